@@ -30,11 +30,11 @@ list *listCreate(void)
 }
 
 /*
- * listRelease 释放整个链表，以及链表中所有节点, 这个函数不可能会失败.
+ * listEmpty 释放链表中所有的节点,但保留链表结构本身,释放之后链表为空.
  *
  * T = O(N)
  */
-void listRelease(list *list)
+void listEmpty(list *list)
 {
 	unsigned long len;
 	listNode *current, *next;
@@ -54,6 +54,18 @@ void listRelease(list *list)
 
 		current = next;
 	}
+	list->head = list->tail = NULL;
+	list->len = 0;
+}
+
+/*
+ * listRelease 释放整个链表，以及链表中所有节点, 这个函数不可能会失败.
+ *
+ * T = O(N)
+ */
+void listRelease(list *list)
+{
+	listEmpty(list);
 
 	// 释放链表结构
 	zfree(list);
@@ -13,13 +13,21 @@
 #include <errno.h>
 #include "ae.h"
 #include "zmalloc.h"
+#include "dict.h"
 #include "aeepoll.h"
+#include "aeiouring.h"
 
 /*
  * 删除事件处理器
  */
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
-	aeApiFree(eventLoop);
+	int j;
+
+	eventLoop->api->free(eventLoop);
+	for (j = 0; j < eventLoop->timeEventCount; j++)
+		zfree(eventLoop->timeEventHeap[j]);
+	zfree(eventLoop->timeEventHeap);
+	dictRelease(eventLoop->timeEventIds);
 	zfree(eventLoop->events);
 	zfree(eventLoop->fired);
 	zfree(eventLoop);
@@ -32,6 +40,27 @@ void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep
 	eventLoop->beforesleep = beforesleep;
 }
 
+/*
+ * 设置多路复用库返回之后需要被执行的函数
+ */
+void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep) {
+	eventLoop->aftersleep = aftersleep;
+}
+
+/*
+ * 设置下一次等待事件时是否不阻塞, 用于还有工作留到下一轮事件循环的时候
+ */
+void aeSetDontWait(aeEventLoop *eventLoop, int noWait) {
+	eventLoop->dontwait = noWait;
+}
+
+/*
+ * 返回事件处理器正在使用的多路复用库的名字
+ */
+char *aeGetApiName(aeEventLoop *eventLoop) {
+	return eventLoop->api->name;
+}
+
 /*
  * 取出当前时间的秒和毫秒，
  * 并分别将它们保存到 seconds 和 milliseconds 参数中
@@ -45,10 +74,34 @@ static void aeGetTime(long *seconds, long *milliseconds)
 	*milliseconds = tv.tv_usec / 1000;
 }
 
+/*
+ * 时间事件 id 字典的类型, 键指向 aeTimeEvent 中的 id 字段
+ */
+static unsigned int aeTimeEventIdHash(const void *key) {
+	return dictGenHashFunction(key, sizeof(long long));
+}
+
+static int aeTimeEventIdCompare(void *privdata, const void *key1, const void *key2) {
+	AE_NOTUSED(privdata);
+	return *(const long long *)key1 == *(const long long *)key2;
+}
+
+static dictType aeTimeEventIdDictType = {
+	aeTimeEventIdHash,      /* hash function */
+	NULL,                   /* key dup */
+	NULL,                   /* val dup */
+	aeTimeEventIdCompare,   /* key compare */
+	NULL,                   /* key destructor */
+	NULL                    /* val destructor */
+};
+
 /*
  * 初始化事件处理器状态
+ *
+ * api 指定优先使用的多路复用库, 如果是 AE_API_IOURING 但内核不支持
+ * (或者被 seccomp 之类的机制禁用), 那么回退到 epoll
  */
-aeEventLoop *aeCreateEventLoop(int setsize) { // 创建一个EventLoop,我只是稍微有那么点好奇,究竟这些个玩意到底是怎么实现的.
+aeEventLoop *aeCreateEventLoop(int setsize, int api) { // 创建一个EventLoop,我只是稍微有那么点好奇,究竟这些个玩意到底是怎么实现的.
 	aeEventLoop *eventLoop;
 	int i;
 
@@ -65,13 +118,24 @@ aeEventLoop *aeCreateEventLoop(int setsize) { // 创建一个EventLoop,我只是
 	eventLoop->lastTime = time(NULL); // 获得当前的时间
 
 	// 初始化时间事件结构
-	eventLoop->timeEventHead = NULL;
+	eventLoop->timeEventHeap = NULL;
+	eventLoop->timeEventCount = 0;
+	eventLoop->timeEventSize = 0;
 	eventLoop->timeEventNextId = 0; // 这个量随着时间事件的增加而增加
 
 	eventLoop->stop = 0;
+	eventLoop->dontwait = 0;
 	eventLoop->maxfd = -1;
 	eventLoop->beforesleep = NULL;
-	if (aeApiCreate(eventLoop) == -1) goto err;
+	eventLoop->aftersleep = NULL;
+	eventLoop->api = NULL;
+	if (api == AE_API_IOURING && aeUringOps.create(eventLoop) == 0)
+		eventLoop->api = &aeUringOps;
+	if (eventLoop->api == NULL) {
+		if (aeEpollOps.create(eventLoop) == -1) goto err;
+		eventLoop->api = &aeEpollOps;
+	}
+	eventLoop->timeEventIds = dictCreate(&aeTimeEventIdDictType, NULL);
 
 	// Events with mask == AE_NONE are not set. So let's initialize the
 	// vector with it.
@@ -117,6 +181,77 @@ static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms)
 
 
 
+/*
+ * 时间事件 a 是否早于 b 到达, 同一毫秒到达的先创建的在前
+ */
+static int aeTimeEventBefore(aeTimeEvent *a, aeTimeEvent *b) {
+	if (a->when_sec != b->when_sec) return a->when_sec < b->when_sec;
+	if (a->when_ms != b->when_ms) return a->when_ms < b->when_ms;
+	return a->id < b->id;
+}
+
+/*
+ * 把时间事件 te 放到堆的位置 j, 同时更新它记录的下标
+ */
+static void aeTimeHeapSet(aeEventLoop *eventLoop, int j, aeTimeEvent *te) {
+	eventLoop->timeEventHeap[j] = te;
+	te->heapIndex = j;
+}
+
+/*
+ * 上浮: 事件到达时间变早(或者刚插入)之后恢复堆的性质
+ */
+static void aeTimeHeapUp(aeEventLoop *eventLoop, int j) {
+	aeTimeEvent **heap = eventLoop->timeEventHeap;
+	aeTimeEvent *te = heap[j];
+
+	while (j > 0) {
+		int parent = (j - 1) / 2;
+		if (!aeTimeEventBefore(te, heap[parent])) break;
+		aeTimeHeapSet(eventLoop, j, heap[parent]);
+		j = parent;
+	}
+	aeTimeHeapSet(eventLoop, j, te);
+}
+
+/*
+ * 下沉: 事件到达时间变晚(或者被堆尾元素替换)之后恢复堆的性质
+ */
+static void aeTimeHeapDown(aeEventLoop *eventLoop, int j) {
+	aeTimeEvent **heap = eventLoop->timeEventHeap;
+	aeTimeEvent *te = heap[j];
+	int count = eventLoop->timeEventCount;
+
+	while (1) {
+		int child = j * 2 + 1;
+		if (child >= count) break;
+		if (child + 1 < count && aeTimeEventBefore(heap[child + 1], heap[child]))
+			child++;
+		if (!aeTimeEventBefore(heap[child], te)) break;
+		aeTimeHeapSet(eventLoop, j, heap[child]);
+		j = child;
+	}
+	aeTimeHeapSet(eventLoop, j, te);
+}
+
+/*
+ * 从堆中移除时间事件 te, O(log N)
+ */
+static void aeTimeHeapRemove(aeEventLoop *eventLoop, aeTimeEvent *te) {
+	int j = te->heapIndex;
+	aeTimeEvent *last = eventLoop->timeEventHeap[--eventLoop->timeEventCount];
+
+	te->heapIndex = -1;
+	if (last == te) return;
+
+	// 用堆尾的事件填补空位, 它可能需要上浮也可能需要下沉
+	aeTimeHeapSet(eventLoop, j, last);
+	if (j > 0 && aeTimeEventBefore(last, eventLoop->timeEventHeap[(j - 1) / 2]))
+		aeTimeHeapUp(eventLoop, j);
+	else
+		aeTimeHeapDown(eventLoop, j);
+}
+
 /*
  * 创建时间事件
  */
@@ -128,6 +263,15 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
 
 	aeTimeEvent *te; // 创建时间事件结构
 
+	// 堆数组已满, 扩大一倍
+	if (eventLoop->timeEventCount == eventLoop->timeEventSize) {
+		int size = eventLoop->timeEventSize ? eventLoop->timeEventSize * 2 : 16;
+		aeTimeEvent **heap = zrealloc(eventLoop->timeEventHeap, sizeof(aeTimeEvent *) * size);
+		if (heap == NULL) return AE_ERR;
+		eventLoop->timeEventHeap = heap;
+		eventLoop->timeEventSize = size;
+	}
+
 	te = zmalloc(sizeof(*te));
 	if (te == NULL) return AE_ERR;
 
@@ -141,30 +285,26 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
 	
 	te->clientData = clientData; // 设置私有数据
 
-	
-	te->next = eventLoop->timeEventHead; // 将新事件放入表头
-	eventLoop->timeEventHead = te;
+	if (dictAdd(eventLoop->timeEventIds, &te->id, te) != DICT_OK) {
+		zfree(te);
+		return AE_ERR;
+	}
+
+	// 放入堆尾, 然后上浮
+	aeTimeHeapSet(eventLoop, eventLoop->timeEventCount++, te);
+	aeTimeHeapUp(eventLoop, te->heapIndex);
 
 	return id;
 }
 
 /* 
  * 寻找里目前时间最近的时间事件
- * 因为链表是乱序的，所以查找复杂度为 O（N）
+ * 时间事件组成最小堆，堆顶就是最近的事件，复杂度为 O（1）
  */
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-	aeTimeEvent *te = eventLoop->timeEventHead;
-	aeTimeEvent *nearest = NULL;
-
-	while (te) {
-		if (!nearest || te->when_sec < nearest->when_sec ||
-			(te->when_sec == nearest->when_sec &&
-				te->when_ms < nearest->when_ms))
-			nearest = te;
-		te = te->next;
-	}
-	return nearest;
+	if (eventLoop->timeEventCount == 0) return NULL;
+	return eventLoop->timeEventHeap[0];
 }
 
 /*
@@ -185,7 +325,7 @@ int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask,
 	aeFileEvent *fe = &eventLoop->events[fd];
 
 	// 监听指定 fd 的指定事件
-	if (aeApiAddEvent(eventLoop, fd, mask) == -1)
+	if (eventLoop->api->addEvent(eventLoop, fd, mask) == -1)
 		return AE_ERR;
 
 	// 设置文件事件类型，以及事件的处理器
@@ -208,34 +348,21 @@ int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask,
  */
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-	aeTimeEvent *te, *prev = NULL;
-
-	// 遍历链表
-	te = eventLoop->timeEventHead;
-	while (te) {
+	aeTimeEvent *te = dictFetchValue(eventLoop->timeEventIds, &id);
 
-		// 发现目标事件，删除
-		if (te->id == id) {
+	if (te == NULL) return AE_ERR; // NO event with the specified ID found
 
-			if (prev == NULL)
-				eventLoop->timeEventHead = te->next;
-			else
-				prev->next = te->next;
+	dictDelete(eventLoop->timeEventIds, &id);
+	aeTimeHeapRemove(eventLoop, te);
 
-			// 执行清理处理器
-			if (te->finalizerProc)
-				te->finalizerProc(eventLoop, te->clientData);
+	// 执行清理处理器
+	if (te->finalizerProc)
+		te->finalizerProc(eventLoop, te->clientData);
 
-			// 释放时间事件
-			zfree(te);
+	// 释放时间事件
+	zfree(te);
 
-			return AE_OK;
-		}
-		prev = te;
-		te = te->next;
-	}
-
-	return AE_ERR; // NO event with the specified ID found
+	return AE_OK;
 }
 
 /* Process time events
@@ -245,58 +372,67 @@ int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 static int processTimeEvents(aeEventLoop *eventLoop) {
 	int processed = 0;
 	aeTimeEvent *te;
-	long long maxId;
 	time_t now = time(NULL); // 获得当前的时间
+	long long maxId;
+	int j;
 
 	// 通过重置事件的运行时间,防止因时间穿插（skew）而造成的事件处理混乱
+	// 所有事件都提前到现在执行, 堆中的相对顺序不再成立, 需要重建
 	if (now < eventLoop->lastTime) {
-		te = eventLoop->timeEventHead;
-		while (te) {
-			te->when_sec = 0;
-			te = te->next;
-		}
+		for (j = 0; j < eventLoop->timeEventCount; j++)
+			eventLoop->timeEventHeap[j]->when_sec = 0;
+		for (j = eventLoop->timeEventCount / 2 - 1; j >= 0; j--)
+			aeTimeHeapDown(eventLoop, j);
 	}
 	eventLoop->lastTime = now; // 更新最后一次处理时间事件的时间
 
-	// 遍历链表, 执行那些已经到达的事件
-	te = eventLoop->timeEventHead;
-	maxId = eventLoop->timeEventNextId - 1; // 最大的时间事件的编号
-	while (te) {
+	// 本轮只处理在这之前创建的事件, 事件处理器新创建的事件留到下一轮
+	maxId = eventLoop->timeEventNextId - 1;
+
+	// 反复取出堆顶, 执行那些已经到达的事件, 堆顶还没到达说明其余的也都没有到达
+	while ((te = aeSearchNearestTimer(eventLoop)) != NULL) {
 		long now_sec, now_ms;
 		long long id;
+		int retval;
 
 		// 获取当前时间
 		aeGetTime(&now_sec, &now_ms);
 
-		// 如果当前时间等于或等于事件的执行时间，那么说明事件已到达，执行这个事件
-		if (now_sec > te->when_sec ||
-			(now_sec == te->when_sec && now_ms >= te->when_ms))
-		{
-			int retval;
-
-			id = te->id;
-			// 执行事件处理器，并获取返回值,只要该返回值不是-1,代表它下次还要执行
-			// 比较典型的redis.c中serverCron函数,它每次都返回一个固定的量,表示
-			// 它会定期运行
-			retval = te->timeProc(eventLoop, id, te->clientData);
-			processed++;
-			
-			// 记录是否有需要循环执行这个事件时间
-			if (retval != AE_NOMORE) {
-				// retval 毫秒之后继续执行这个时间事件
-				aeAddMillisecondsToNow(retval, &te->when_sec, &te->when_ms);
-			}
-			else {
-				// 将这个事件删除
-				aeDeleteTimeEvent(eventLoop, id);
-			}
-
-			// 因为执行事件之后，事件列表可能已经被改变了 
-			// 因此需要将 te 放回表头，继续开始执行事件
-			te = eventLoop->timeEventHead;
+		if (now_sec < te->when_sec ||
+			(now_sec == te->when_sec && now_ms < te->when_ms))
+			break;
+
+		// 堆顶是本轮新创建的事件: 同一毫秒到达的事件按 id 排序,
+		// 堆中剩下的旧事件都是在本轮执行期间才到达的, 一起留到下一轮
+		if (te->id > maxId) break;
+
+		id = te->id;
+		// 执行事件处理器，并获取返回值,只要该返回值不是-1,代表它下次还要执行
+		// 比较典型的redis.c中serverCron函数,它每次都返回一个固定的量,表示
+		// 它会定期运行
+		retval = te->timeProc(eventLoop, id, te->clientData);
+		processed++;
+
+		// 事件处理器可能已经删除了这个事件, 重新按 id 查找
+		te = dictFetchValue(eventLoop->timeEventIds, &id);
+		if (te == NULL) continue;
+
+		// 记录是否有需要循环执行这个事件时间
+		if (retval != AE_NOMORE) {
+			// retval 毫秒之后继续执行这个时间事件, 到达时间只会变晚, 下沉即可
+			aeAddMillisecondsToNow(retval, &te->when_sec, &te->when_ms);
+			aeTimeHeapDown(eventLoop, te->heapIndex);
+
+			// 重新安排之后仍然已经到达(比如返回 0), 结束本轮,
+			// 否则它会一直在堆顶反复执行, 文件事件就得不到处理
+			aeGetTime(&now_sec, &now_ms);
+			if (now_sec > te->when_sec ||
+				(now_sec == te->when_sec && now_ms >= te->when_ms))
+				break;
 		}
 		else {
-			te = te->next;
+			// 将这个事件删除
+			aeDeleteTimeEvent(eventLoop, id);
 		}
 	}
 	return processed;
@@ -371,8 +507,18 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
 			}
 		}
 
+		// 还有工作要做, 只收集已经就绪的事件, 不阻塞
+		if (eventLoop->dontwait) {
+			tv.tv_sec = tv.tv_usec = 0;
+			tvp = &tv;
+		}
+
 		// 处理文件事件，阻塞时间由 tvp 决定, 总之,如果有事件的话,一定要等到有事件发生才返回
-		numevents = aeApiPoll(eventLoop , tvp);
+		numevents = eventLoop->api->poll(eventLoop , tvp);
+
+		// 如果有需要在多路复用库返回之后执行的函数，那么运行它
+		if (eventLoop->aftersleep != NULL && flags & AE_CALL_AFTER_SLEEP)
+			eventLoop->aftersleep(eventLoop);
 		for (j = 0; j < numevents; j++) {
 			// 从已就绪数组中 fired 获取已发生事件的信息,包括文件描述符fd,发生的事情mask
 			aeFileEvent *fe = &eventLoop->events[eventLoop->fired[j].fd];
@@ -419,7 +565,7 @@ void aeMain(aeEventLoop *eventLoop) {
 			eventLoop->beforesleep(eventLoop);
 
 		// 开始处理事件
-		aeProcessEvents(eventLoop, AE_ALL_EVENTS);
+		aeProcessEvents(eventLoop, AE_ALL_EVENTS|AE_CALL_AFTER_SLEEP);
 	}
 }
 
@@ -446,5 +592,286 @@ void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask) {
 		eventLoop->maxfd = j;
 	}
 	// 取消对给定fd的给定事件的监听
-	aeApiDelEvent(eventLoop, fd, mask);
-}
\ No newline at end of file
+	eventLoop->api->delEvent(eventLoop, fd, mask);
+}
+#ifdef AE_TEST_MAIN
+/*
+ * 测试: make ae-test && ./ae-test
+ * 时间事件的性能: ./ae-test benchmark
+ */
+#include <strings.h>
+
+static int failed = 0;
+
+#define test_assert(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static long long testUstime(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((long long)tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+/* 时间事件的到达时间(毫秒), 按执行的顺序记录下来 */
+static long long fired[1024];
+static int firedCount = 0;
+static int finalized = 0;
+
+static int recordProc(aeEventLoop *eventLoop, long long id, void *clientData) {
+	AE_NOTUSED(eventLoop);
+	AE_NOTUSED(id);
+	if (firedCount < 1024) fired[firedCount++] = (long)clientData;
+	return AE_NOMORE;
+}
+
+static void countFinalizer(aeEventLoop *eventLoop, void *clientData) {
+	AE_NOTUSED(eventLoop);
+	AE_NOTUSED(clientData);
+	finalized++;
+}
+
+static void runUntilNoTimers(aeEventLoop *el) {
+	while (el->timeEventCount > 0) aeProcessEvents(el, AE_TIME_EVENTS);
+}
+
+/*
+ * 乱序添加的时间事件按到达时间执行, 删除的事件不会执行, 两者都会调用 finalizer
+ */
+static void testOrderAndDelete(void) {
+	aeEventLoop *el = aeCreateEventLoop(64, AE_API_EPOLL);
+	long long ids[300];
+	int j;
+
+	srandom(1);
+	firedCount = finalized = 0;
+	for (j = 0; j < 300; j++) {
+		long ms = random() % 40;
+
+		ids[j] = aeCreateTimeEvent(el, ms, recordProc, (void *)(j % 3 == 0 ? -1 : ms), countFinalizer);
+	}
+	for (j = 0; j < 300; j += 3) test_assert(aeDeleteTimeEvent(el, ids[j]) == AE_OK);
+	test_assert(aeDeleteTimeEvent(el, ids[0]) == AE_ERR);
+	test_assert(el->timeEventCount == 200);
+
+	runUntilNoTimers(el);
+	test_assert(firedCount == 200);
+	test_assert(finalized == 300);
+	for (j = 0; j < firedCount; j++) {
+		test_assert(fired[j] >= 0);
+		// 到达时间按毫秒取整, 同一毫秒之内的先后不确定
+		if (j > 0) test_assert(fired[j] + 1 >= fired[j - 1]);
+	}
+	aeDeleteEventLoop(el);
+}
+
+static int periodicCount = 0;
+static long long victimId = -1;
+
+static int periodicProc(aeEventLoop *eventLoop, long long id, void *clientData) {
+	AE_NOTUSED(clientData);
+	if (++periodicCount == 5) {
+		aeDeleteTimeEvent(eventLoop, id);
+		return 1;
+	}
+	return 1;
+}
+
+static int killerProc(aeEventLoop *eventLoop, long long id, void *clientData) {
+	AE_NOTUSED(id);
+	AE_NOTUSED(clientData);
+	test_assert(aeDeleteTimeEvent(eventLoop, victimId) == AE_OK);
+	return AE_NOMORE;
+}
+
+/*
+ * 周期事件按返回值重新排进堆中; 事件处理器可以删除自己, 也可以删除别的事件
+ */
+static void testPeriodicAndSelfDelete(void) {
+	aeEventLoop *el = aeCreateEventLoop(64, AE_API_EPOLL);
+
+	firedCount = finalized = 0;
+	periodicCount = 0;
+	// 处理器在第 5 次执行时删除自己, 虽然返回了 1 也不会再执行
+	aeCreateTimeEvent(el, 0, periodicProc, NULL, countFinalizer);
+	// 两个事件同时到达, 先执行的那个删除了另一个
+	aeCreateTimeEvent(el, 10, killerProc, NULL, NULL);
+	victimId = aeCreateTimeEvent(el, 30, recordProc, (void *)30, countFinalizer);
+	runUntilNoTimers(el);
+	test_assert(periodicCount == 5);
+	test_assert(firedCount == 0);
+	test_assert(finalized == 2);
+	aeDeleteEventLoop(el);
+}
+
+static int readCount = 0;
+
+static void readProc(aeEventLoop *eventLoop, int fd, void *clientData, int mask) {
+	char buf[16];
+
+	AE_NOTUSED(eventLoop);
+	AE_NOTUSED(clientData);
+	AE_NOTUSED(mask);
+	if (read(fd, buf, sizeof(buf)) > 0) readCount++;
+}
+
+/*
+ * 文件事件在两种后端上的行为相同, 要求 io_uring 但不可用时回退到 epoll
+ */
+static void testFileEvents(int api) {
+	aeEventLoop *el = aeCreateEventLoop(64, api);
+	int fds[2], j;
+
+	test_assert(el != NULL);
+	if (api == AE_API_EPOLL) test_assert(!strcmp(aeGetApiName(el), "epoll"));
+	test_assert(pipe(fds) == 0);
+	readCount = 0;
+	test_assert(aeCreateFileEvent(el, fds[0], AE_READABLE, readProc, NULL) == AE_OK);
+
+	// 没有数据时不触发
+	aeProcessEvents(el, AE_FILE_EVENTS | AE_DONT_WAIT);
+	test_assert(readCount == 0);
+
+	// 水平触发: 每次有数据都会触发
+	for (j = 0; j < 3; j++) {
+		test_assert(write(fds[1], "x", 1) == 1);
+		aeProcessEvents(el, AE_FILE_EVENTS);
+	}
+	test_assert(readCount == 3);
+
+	// 删除之后不再触发
+	aeDeleteFileEvent(el, fds[0], AE_READABLE);
+	test_assert(write(fds[1], "x", 1) == 1);
+	aeProcessEvents(el, AE_FILE_EVENTS | AE_DONT_WAIT);
+	aeProcessEvents(el, AE_FILE_EVENTS | AE_DONT_WAIT);
+	test_assert(readCount == 3);
+
+	close(fds[0]);
+	close(fds[1]);
+	aeDeleteEventLoop(el);
+}
+
+static int chainCount = 0;
+
+/* 每次执行都创建一个马上到达的新事件, 执行 100 次之后停止, 以免测试失败时死循环 */
+static int chainProc(aeEventLoop *eventLoop, long long id, void *clientData) {
+	AE_NOTUSED(id);
+	AE_NOTUSED(clientData);
+	if (++chainCount < 100) aeCreateTimeEvent(eventLoop, 0, chainProc, NULL, NULL);
+	return AE_NOMORE;
+}
+
+/* 每次执行都要求马上再次执行, 100 次之后停止 */
+static int rearmProc(aeEventLoop *eventLoop, long long id, void *clientData) {
+	AE_NOTUSED(eventLoop);
+	AE_NOTUSED(id);
+	AE_NOTUSED(clientData);
+	return ++chainCount < 100 ? 0 : AE_NOMORE;
+}
+
+/*
+ * 处理器新创建的事件, 以及重新安排之后仍然已经到达的事件, 都留到下一轮执行,
+ * 一轮时间事件不会无限地执行下去, 文件事件也能得到处理
+ */
+static void testTimerStarvation(void) {
+	aeEventLoop *el = aeCreateEventLoop(64, AE_API_EPOLL);
+	int fds[2];
+
+	test_assert(pipe(fds) == 0);
+	test_assert(aeCreateFileEvent(el, fds[0], AE_READABLE, readProc, NULL) == AE_OK);
+
+	chainCount = 0;
+	aeCreateTimeEvent(el, 0, chainProc, NULL, NULL);
+	test_assert(aeProcessEvents(el, AE_TIME_EVENTS | AE_DONT_WAIT) == 1);
+	test_assert(chainCount == 1);
+	test_assert(aeProcessEvents(el, AE_TIME_EVENTS | AE_DONT_WAIT) == 1);
+	test_assert(chainCount == 2);
+	runUntilNoTimers(el);
+	test_assert(chainCount == 100);
+
+	chainCount = readCount = 0;
+	aeCreateTimeEvent(el, 0, rearmProc, NULL, NULL);
+	test_assert(write(fds[1], "x", 1) == 1);
+	aeProcessEvents(el, AE_ALL_EVENTS | AE_DONT_WAIT);
+	test_assert(chainCount == 1);
+	test_assert(readCount == 1);
+	test_assert(write(fds[1], "x", 1) == 1);
+	aeProcessEvents(el, AE_ALL_EVENTS | AE_DONT_WAIT);
+	test_assert(chainCount == 2);
+	test_assert(readCount == 2);
+	runUntilNoTimers(el);
+	test_assert(chainCount == 100);
+
+	close(fds[0]);
+	close(fds[1]);
+	aeDeleteEventLoop(el);
+}
+
+static int nopProc(aeEventLoop *eventLoop, long long id, void *clientData) {
+	AE_NOTUSED(eventLoop);
+	AE_NOTUSED(id);
+	AE_NOTUSED(clientData);
+	return 1000;
+}
+
+/*
+ * 有 count 个还没到达的时间事件时, 每次处理时间事件的平均耗时,
+ * 以及添加和删除一个时间事件的平均耗时
+ */
+static void benchmarkTimers(int count) {
+	aeEventLoop *el = aeCreateEventLoop(64, AE_API_EPOLL);
+	long long *ids = zmalloc(sizeof(long long) * (count + 1));
+	long long start, create, tick, del;
+	int j, ticks = 100000;
+
+	start = testUstime();
+	for (j = 0; j < count; j++)
+		ids[j] = aeCreateTimeEvent(el, 3600 * 1000 + j % 1000, nopProc, NULL, NULL);
+	create = testUstime() - start;
+
+	// 删除三分之一, 让堆里的事件不再按添加的顺序排列
+	for (j = 0; j < count; j += 3) aeDeleteTimeEvent(el, ids[j]);
+
+	start = testUstime();
+	for (j = 0; j < ticks; j++) aeProcessEvents(el, AE_TIME_EVENTS | AE_DONT_WAIT);
+	tick = testUstime() - start;
+
+	start = testUstime();
+	for (j = 1; j < count; j += 3) aeDeleteTimeEvent(el, ids[j]);
+	del = testUstime() - start;
+
+	printf("%7d timers: tick %.3f us, create %.3f us, delete %.3f us\n", count,
+		(double)tick / ticks,
+		count ? (double)create / count : 0,
+		count ? (double)del / ((count + 1) / 3) : 0);
+	zfree(ids);
+	aeDeleteEventLoop(el);
+}
+
+int main(int argc, char **argv) {
+	if (argc >= 2 && !strcasecmp(argv[1], "benchmark")) {
+		benchmarkTimers(0);
+		benchmarkTimers(1000);
+		benchmarkTimers(10000);
+		benchmarkTimers(100000);
+		return 0;
+	}
+
+	testOrderAndDelete();
+	testPeriodicAndSelfDelete();
+	testTimerStarvation();
+	testFileEvents(AE_API_EPOLL);
+	testFileEvents(AE_API_IOURING);
+
+	if (failed) {
+		printf("%d assertions failed\n", failed);
+		return 1;
+	}
+	printf("all tests passed\n");
+	return 0;
+}
+#endif
@@ -7,6 +7,7 @@
 #define __AE_H__
 
 #include <time.h>
+#include <sys/time.h>
 
 /* 事件执行状态 */
 // 成功
@@ -31,11 +32,19 @@
 #define AE_ALL_EVENTS (AE_FILE_EVENTS|AE_TIME_EVENTS)
 // 不阻塞，也不进行等待
 #define AE_DONT_WAIT 4
+// 多路复用库返回之后调用 aftersleep
+#define AE_CALL_AFTER_SLEEP 8
 
 /* 决定时间事件是否要持续执行的 flag */
 
 #define AE_NOMORE -1
 
+/* 多路复用后端 */
+// epoll(2)
+#define AE_API_EPOLL 0
+// io_uring(7), 不可用时回退到 epoll
+#define AE_API_IOURING 1
+
 /* Macros */
 #define AE_NOTUSED(V) ((void) V)
 
@@ -48,6 +57,17 @@ typedef int aeTimeProc(struct aeEventLoop *eventLoop, long long id, void *client
 typedef void aeEventFinalizerProc(struct aeEventLoop *eventLoop, void *clientData);
 typedef void aeBeforeSleepProc(struct aeEventLoop *eventLoop);
 
+/* 多路复用库接口 -- 每个后端(aeepoll.c, aeiouring.c)提供一份 */
+typedef struct aeApiOps {
+	char *name;
+	int (*create)(struct aeEventLoop *eventLoop);
+	int (*resize)(struct aeEventLoop *eventLoop, int setsize);
+	void (*free)(struct aeEventLoop *eventLoop);
+	int (*addEvent)(struct aeEventLoop *eventLoop, int fd, int mask);
+	void (*delEvent)(struct aeEventLoop *eventLoop, int fd, int delmask);
+	int (*poll)(struct aeEventLoop *eventLoop, struct timeval *tvp);
+} aeApiOps;
+
 /* File event structure -- 文件事件结构 */
 
 typedef struct aeFileEvent {
@@ -80,7 +100,7 @@ typedef struct aeTimeEvent {
 
 	void *clientData; // 多路复用库的私有数据
 
-	struct aeTimeEvent *next; // 指向下个时间事件结构，形成链表
+	int heapIndex; // 在 eventLoop->timeEventHeap 中的下标
 
 } aeTimeEvent;
 
@@ -113,19 +133,30 @@ typedef struct aeEventLoop { // 全局只需要一份EventLoop
 
 	aeFiredEvent *fired; // 已就绪的文件事件
 
-	aeTimeEvent *timeEventHead; // 时间事件
+	// 时间事件, 按到达时间组成一个最小堆, 堆顶就是最近的时间事件
+	aeTimeEvent **timeEventHeap;
+	int timeEventCount; // 堆中时间事件的数量
+	int timeEventSize;  // 堆数组的容量
+
+	struct dict *timeEventIds; // id -> aeTimeEvent, 用于按 id 删除
 
 	int stop; // 事件处理器的开关
 
+	int dontwait; // 为真时多路复用库不阻塞等待, 还有没做完的工作
+
 	void *apidata; // 多路复用库的私有数据, 一般用于存放aeApiState对象的指针,
 	// 而aeApiState有着epoll_events结构的一个数组
 
+	const aeApiOps *api; // 当前使用的多路复用库
+
 	aeBeforeSleepProc *beforesleep; // 在处理事件前要执行的函数
 
+	aeBeforeSleepProc *aftersleep; // 多路复用库返回之后, 处理就绪事件之前要执行的函数
+
 } aeEventLoop;
 
 /* Prototypes */
-aeEventLoop *aeCreateEventLoop(int setsize);
+aeEventLoop *aeCreateEventLoop(int setsize, int api);
 int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask, aeFileProc *proc, void *clientData);
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds, aeTimeProc *proc, void *clientData,
 	aeEventFinalizerProc *finalizerProc);
@@ -135,4 +166,7 @@ void aeMain(aeEventLoop *eventLoop);
 void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask);
 void aeDeleteEventLoop(aeEventLoop *eventLoop);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
+void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep);
+void aeSetDontWait(aeEventLoop *eventLoop, int noWait);
+char *aeGetApiName(aeEventLoop *eventLoop);
 #endif
@@ -5,7 +5,7 @@
 /*
  * 创建一个新的 epoll 实例，并将它赋值给 eventLoop
  */
-int aeApiCreate(aeEventLoop *eventLoop) {
+static int aeApiCreate(aeEventLoop *eventLoop) {
 
     aeApiState *state = zmalloc(sizeof(aeApiState));
 
@@ -35,7 +35,7 @@ int aeApiCreate(aeEventLoop *eventLoop) {
 /*
  * 调整事件槽大小
  */
-int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
     aeApiState *state = eventLoop->apidata;
     state->events = zrealloc(state->events, sizeof(struct epoll_event)*setsize); // 重新分配槽的大小
     return 0;
@@ -44,7 +44,7 @@ int aeApiResize(aeEventLoop *eventLoop, int setsize) {
 /*
  * 释放 epoll 实例和事件槽
  */
-void aeApiFree(aeEventLoop *eventLoop) {
+static void aeApiFree(aeEventLoop *eventLoop) {
     aeApiState *state = eventLoop->apidata;
     close(state->epfd); // 关闭 epoll 的描述符
     zfree(state->events);
@@ -54,7 +54,7 @@ void aeApiFree(aeEventLoop *eventLoop) {
 /*
  * 关联给定事件到 fd
  */
-int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) { // 添加到某个事件之上,好吧,主要是看封装,道理我们都懂是吧.
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) { // 添加到某个事件之上,好吧,主要是看封装,道理我们都懂是吧.
     aeApiState *state = eventLoop->apidata;
     struct epoll_event ee;
 
@@ -79,7 +79,7 @@ int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) { // 添加到某个
 /*
  * 从 fd 中删除给定事件
  */
-void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
     aeApiState *state = eventLoop->apidata; 
     struct epoll_event ee;
 
@@ -102,7 +102,7 @@ void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
 /*
  * 获取可执行事件
  */
-int aeApiPoll(aeEventLoop *eventLoop , struct timeval *tvp) {
+static int aeApiPoll(aeEventLoop *eventLoop , struct timeval *tvp) {
     aeApiState *state = eventLoop->apidata;
     int retval, numevents = 0;
 
@@ -137,8 +137,14 @@ int aeApiPoll(aeEventLoop *eventLoop , struct timeval *tvp) {
 }
 
 /*
- * 返回当前正在使用的 poll 库的名字
+ * epoll 后端的接口表
  */
-char *aeApiName(void) {
-    return "epoll";
-}
+const aeApiOps aeEpollOps = {
+    "epoll",
+    aeApiCreate,
+    aeApiResize,
+    aeApiFree,
+    aeApiAddEvent,
+    aeApiDelEvent,
+    aeApiPoll
+};
@@ -16,11 +16,5 @@ typedef struct aeApiState {
 
 } aeApiState;
 
-int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp);
-int aeApiCreate(aeEventLoop *eventLoop);
-int aeApiResize(aeEventLoop *eventLoop, int setsize);
-void aeApiFree(aeEventLoop *eventLoop);
-int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask);
-void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask);
-char *aeApiName(void);
+extern const aeApiOps aeEpollOps;
 #endif
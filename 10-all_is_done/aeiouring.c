@@ -0,0 +1,373 @@
+/* Linux io_uring(7) based ae.c module */
+#include "aeiouring.h"
+#include "zmalloc.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// 提交队列的长度, 队列满了会先提交一次, 所以这个值只影响批量的大小
+#define AE_URING_ENTRIES 1024
+
+// POLL_REMOVE 请求自己的完成事件不需要处理
+#define AE_URING_IGNORE ((__u64)-1)
+
+/*
+ * user_data 的编码: 低 32 位是 fd, 第 32 位是方向(0 读, 1 写),
+ * 剩下的 31 位是代数. 每次撤销某个方向的 poll 时代数加一,
+ * 这样撤销之前已经产生(或者正在路上)的完成事件就会被丢弃,
+ * 即使 fd 在此期间被关闭又被复用.
+ */
+#define AE_URING_GEN_MASK 0x7fffffff
+
+static __u64 aeUringData(int fd, int dir, unsigned gen) {
+    return ((__u64)(gen & AE_URING_GEN_MASK) << 33) | ((__u64)dir << 32) | (unsigned)fd;
+}
+
+static int aeUringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int aeUringEnter(aeUringState *state, unsigned to_submit,
+        unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, state->ringfd, to_submit,
+        min_complete, flags, arg, argsz);
+}
+
+/*
+ * 把已经填好的 SQE 提交给内核, 不等待完成事件
+ */
+static int aeUringSubmit(aeUringState *state) {
+    unsigned pending = *state->sq_tail - __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+
+    while (pending) {
+        if (aeUringEnter(state, pending, 0, 0, NULL, 0) == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        pending = *state->sq_tail - __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+    }
+    return 0;
+}
+
+/*
+ * 填写一个 SQE 并把它发布到提交队列的尾部, 真正的提交推迟到下一次
+ * aeApiPoll (或者队列满的时候)
+ */
+static int aeUringQueue(aeUringState *state, int op, int fd,
+        unsigned events, __u64 addr, __u64 data) {
+    unsigned tail = *state->sq_tail;
+    unsigned head = __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    if (tail - head == state->sq_entries) {
+        // 提交队列已满, 先提交掉
+        if (aeUringSubmit(state) == -1) return -1;
+    }
+
+    idx = tail & *state->sq_mask;
+    sqe = &state->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->addr = addr;
+    sqe->user_data = data;
+    state->sq_array[idx] = idx;
+    __atomic_store_n(state->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * 为 fd 的某个方向挂上一个 one-shot poll
+ */
+static int aeUringArm(aeUringState *state, int fd, int mask) {
+    int dir = (mask == AE_WRITABLE);
+    __u64 data = aeUringData(fd, dir, state->gen[fd * 2 + dir]);
+
+    if (aeUringQueue(state, IORING_OP_POLL_ADD, fd,
+            dir ? POLLOUT : POLLIN, 0, data) == -1) return -1;
+    state->armed[fd] |= mask;
+    return 0;
+}
+
+/*
+ * 撤销 fd 某个方向上已经挂着的 poll
+ */
+static void aeUringDisarm(aeUringState *state, int fd, int mask) {
+    int dir = (mask == AE_WRITABLE);
+    __u64 data = aeUringData(fd, dir, state->gen[fd * 2 + dir]);
+
+    // 即使 POLL_REMOVE 没能入队, 代数也已经变了, 旧的完成事件会被丢弃
+    aeUringQueue(state, IORING_OP_POLL_REMOVE, -1, 0, data, AE_URING_IGNORE);
+    state->gen[fd * 2 + dir] = (state->gen[fd * 2 + dir] + 1) & AE_URING_GEN_MASK;
+    state->armed[fd] &= ~mask;
+}
+
+/*
+ * 分配以 fd 为下标的数组, 并初始化 [from, setsize) 这一段
+ */
+static void aeUringResizeSlots(aeUringState *state, int from, int setsize) {
+    int j;
+
+    state->want = zrealloc(state->want, setsize);
+    state->armed = zrealloc(state->armed, setsize);
+    state->gen = zrealloc(state->gen, sizeof(unsigned) * setsize * 2);
+    state->firedpos = zrealloc(state->firedpos, sizeof(int) * setsize);
+    state->rearm = zrealloc(state->rearm, sizeof(int) * setsize);
+    for (j = from; j < setsize; j++) {
+        state->want[j] = AE_NONE;
+        state->armed[j] = AE_NONE;
+        state->gen[j * 2] = state->gen[j * 2 + 1] = 0;
+        state->firedpos[j] = -1;
+    }
+    if (state->rearmlen > setsize) state->rearmlen = setsize;
+}
+
+static void aeUringUnmap(aeUringState *state) {
+    if (state->sqes) munmap(state->sqes, state->sqes_sz);
+    if (state->cqring && state->cqring != state->sqring)
+        munmap(state->cqring, state->cqring_sz);
+    if (state->sqring) munmap(state->sqring, state->sqring_sz);
+}
+
+/*
+ * 创建一个新的 io_uring 实例，并将它赋值给 eventLoop
+ *
+ * 内核不支持 io_uring, 缺少 NODROP / EXT_ARG 特性, 或者 io_uring_enter
+ * 被禁用时返回 -1, 由 aeCreateEventLoop 回退到 epoll
+ */
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    struct io_uring_params p;
+    struct io_uring_getevents_arg arg;
+    aeUringState *state = zcalloc(sizeof(aeUringState));
+    char *sq, *cq;
+
+    if (!state) return -1;
+
+    memset(&p, 0, sizeof(p));
+    state->ringfd = aeUringSetup(AE_URING_ENTRIES, &p);
+    if (state->ringfd == -1) {
+        zfree(state);
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_EXT_ARG))
+        goto err;
+
+    state->sqring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    state->cqring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (state->cqring_sz > state->sqring_sz) state->sqring_sz = state->cqring_sz;
+        state->cqring_sz = state->sqring_sz;
+    }
+
+    state->sqring = mmap(NULL, state->sqring_sz, PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_SQ_RING);
+    if (state->sqring == MAP_FAILED) {
+        state->sqring = NULL;
+        goto err;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        state->cqring = state->sqring;
+    } else {
+        state->cqring = mmap(NULL, state->cqring_sz, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_CQ_RING);
+        if (state->cqring == MAP_FAILED) {
+            state->cqring = NULL;
+            goto err;
+        }
+    }
+    state->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL, state->sqes_sz, PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED) {
+        state->sqes = NULL;
+        goto err;
+    }
+
+    sq = state->sqring;
+    state->sq_head = (unsigned *)(sq + p.sq_off.head);
+    state->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    state->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    state->sq_array = (unsigned *)(sq + p.sq_off.array);
+    state->sq_entries = p.sq_entries;
+
+    cq = state->cqring;
+    state->cq_head = (unsigned *)(cq + p.cq_off.head);
+    state->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    state->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    /* seccomp 之类的机制可能只禁用了 io_uring_enter, 先空转一次,
+     * 失败的话现在就回退到 epoll, 而不是在 aeApiPoll 中一直拿不到事件 */
+    memset(&arg, 0, sizeof(arg));
+    if (aeUringEnter(state, 0, 0, IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+            &arg, sizeof(arg)) == -1 && errno != EINTR)
+        goto err;
+
+    aeUringResizeSlots(state, 0, eventLoop->setsize);
+    eventLoop->apidata = state;
+    return 0;
+
+err:
+    aeUringUnmap(state);
+    close(state->ringfd);
+    zfree(state);
+    return -1;
+}
+
+/*
+ * 调整 fd 数组大小
+ */
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeUringState *state = eventLoop->apidata;
+    int from = eventLoop->setsize < setsize ? eventLoop->setsize : setsize;
+
+    aeUringResizeSlots(state, from, setsize);
+    return 0;
+}
+
+/*
+ * 释放 io_uring 实例, 关闭描述符时内核会撤销所有还挂着的 poll
+ */
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeUringState *state = eventLoop->apidata;
+
+    aeUringUnmap(state);
+    close(state->ringfd);
+    zfree(state->want);
+    zfree(state->armed);
+    zfree(state->gen);
+    zfree(state->firedpos);
+    zfree(state->rearm);
+    zfree(state);
+}
+
+/*
+ * 关联给定事件到 fd, 只是把 POLL_ADD 放进提交队列,
+ * 真正的提交和下一次等待合并在一起
+ */
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeUringState *state = eventLoop->apidata;
+    int old = state->want[fd];
+    int need = mask & ~state->armed[fd];
+
+    state->want[fd] |= mask;
+    if ((need & AE_READABLE) && aeUringArm(state, fd, AE_READABLE) == -1) goto err;
+    if ((need & AE_WRITABLE) && aeUringArm(state, fd, AE_WRITABLE) == -1) goto err;
+    return 0;
+
+err:
+    state->want[fd] = old;
+    return -1;
+}
+
+/*
+ * 从 fd 中删除给定事件
+ *
+ * 必须马上撤销已经挂着的 poll: fd 随后可能被关闭并在同一轮循环里被复用,
+ * 那时旧的 poll 仍然指向旧的文件
+ */
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeUringState *state = eventLoop->apidata;
+
+    state->want[fd] &= ~delmask;
+    if (delmask & state->armed[fd] & AE_READABLE) aeUringDisarm(state, fd, AE_READABLE);
+    if (delmask & state->armed[fd] & AE_WRITABLE) aeUringDisarm(state, fd, AE_WRITABLE);
+}
+
+/*
+ * 获取可执行事件
+ *
+ * 一次 io_uring_enter 完成三件事: 提交 Add/DelEvent 积累下来的请求,
+ * 提交上一轮就绪 fd 的重挂请求, 以及等待新的完成事件
+ */
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeUringState *state = eventLoop->apidata;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned head, tail, submit, wait = 1;
+    int j, numevents = 0;
+
+    // one-shot poll 触发之后就失效了, 还需要监听的话重新挂上
+    for (j = 0; j < state->rearmlen; j++) {
+        int fd = state->rearm[j];
+        int need = state->want[fd] & ~state->armed[fd];
+
+        if (need & AE_READABLE) aeUringArm(state, fd, AE_READABLE);
+        if (need & AE_WRITABLE) aeUringArm(state, fd, AE_WRITABLE);
+    }
+    state->rearmlen = 0;
+
+    memset(&arg, 0, sizeof(arg));
+    if (tvp) {
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec * 1000;
+        arg.ts = (__u64)(uintptr_t)&ts;
+        if (tvp->tv_sec == 0 && tvp->tv_usec == 0) wait = 0;
+    }
+    // 完成队列里已经有事件的话不要阻塞
+    if (*state->cq_head != __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE)) wait = 0;
+
+    submit = *state->sq_tail - __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+    // 超时(ETIME)和被信号打断(EINTR)都只是意味着没有更多的事件,
+    // 下面照常收割完成队列
+    aeUringEnter(state, submit, wait,
+        IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+    head = *state->cq_head;
+    tail = __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cq_mask];
+        __u64 data = cqe->user_data;
+        int res = cqe->res;
+        int fd, dir, mask, pos;
+
+        head++;
+        if (data == AE_URING_IGNORE) continue;
+        fd = (int)(data & 0xffffffff);
+        dir = (int)((data >> 32) & 1);
+        if (fd >= eventLoop->setsize ||
+            (unsigned)(data >> 33) != state->gen[fd * 2 + dir]) continue; // 过期的事件
+
+        mask = dir ? AE_WRITABLE : AE_READABLE;
+        state->armed[fd] &= ~mask;
+        // 和 aeepoll.c 一样, 出错和挂断也当作可写事件
+        if (res > 0 && (res & (POLLERR|POLLHUP))) mask |= AE_WRITABLE;
+
+        // 同一个 fd 的读写两个完成事件合并成一个已就绪事件
+        pos = state->firedpos[fd];
+        if (pos == -1) {
+            pos = numevents++;
+            state->firedpos[fd] = pos;
+            eventLoop->fired[pos].fd = fd;
+            eventLoop->fired[pos].mask = 0;
+            state->rearm[state->rearmlen++] = fd;
+        }
+        eventLoop->fired[pos].mask |= mask;
+    }
+    __atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+
+    for (j = 0; j < numevents; j++)
+        state->firedpos[eventLoop->fired[j].fd] = -1;
+
+    // 返回已就绪事件个数
+    return numevents;
+}
+
+/*
+ * io_uring 后端的接口表
+ */
+const aeApiOps aeUringOps = {
+    "io_uring",
+    aeApiCreate,
+    aeApiResize,
+    aeApiFree,
+    aeApiAddEvent,
+    aeApiDelEvent,
+    aeApiPoll
+};
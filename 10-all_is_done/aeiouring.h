@@ -0,0 +1,48 @@
+#ifndef __AE_IOURING_H_
+#define __AE_IOURING_H_
+#include "ae.h"
+#include <linux/io_uring.h>
+
+//
+// aeUringState io_uring 后端的状态
+//
+// 每个 fd 的每个方向(读/写)各挂一个 one-shot 的 POLL_ADD,
+// 完成之后在下一次 poll 之前重新挂上, 这样语义上和 epoll 的水平触发一致,
+// 而注册/注销/重挂和等待都合并在同一次 io_uring_enter 里面提交.
+//
+typedef struct aeUringState {
+	// io_uring 实例描述符
+	int ringfd;
+
+	// 提交队列(SQ), 和内核共享的内存
+	void *sqring;
+	size_t sqring_sz;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+	size_t sqes_sz;
+
+	// 完成队列(CQ)
+	void *cqring;
+	size_t cqring_sz;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	// 以下数组都以 fd 为下标, 长度为 setsize
+	unsigned char *want;  // 需要监听的事件 AE_READABLE|AE_WRITABLE
+	unsigned char *armed; // 已经挂在内核里的 poll
+	unsigned *gen;        // 每个 fd 每个方向的代数, 用来丢弃过期的完成事件
+	int *firedpos;        // fd 在 fired 数组中的位置, -1 表示还没有就绪
+
+	// 上一次 poll 返回的 fd, 下一次 poll 之前需要为它们重挂 one-shot poll
+	int *rearm;
+	int rearmlen;
+} aeUringState;
+
+extern const aeApiOps aeUringOps;
+#endif
@@ -39,19 +39,29 @@ static int anetSetReuseAddr(char *err, int fd) {
 	return ANET_OK;
 }
 
+/*
+ * 允许多个套接字绑定到同一个端口, 由内核在它们之间分发新连接
+ */
+static int anetSetReusePort(char *err, int fd) {
+	int yes = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+		anetSetError(err, "setsocketopt SO_REUSEPORT: %s", strerror(errno));
+		return ANET_ERR;
+	}
+	return ANET_OK;
+}
+
 /*
  * anetListen 绑定并创建监听套接字
  */
 static int anetListen(char *err, int fd, struct sockaddr *sa, socklen_t len, int backlog) {
 	if (bind(fd, sa, len) == -1) {
 		anetSetError(err, "bind: %s", strerror(errno));
-		close(fd);
 		return ANET_ERR;
 	}
 
 	if (listen(fd, backlog) == -1) {
 		anetSetError(err, "listen: %s", strerror(errno));
-		close(fd);
 		return ANET_ERR;
 	}
 
@@ -98,8 +108,20 @@ int anetTcpAccept(char *err, int s, char *ip, size_t ip_len, int *port) {
 	return fd;
 }
 
-static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog) {
-	int s, rv;
+/*
+ * 本地套接字的 accept 函数, 返回连接的描述符
+ */
+int anetUnixAccept(char *err, int s) {
+	int fd;
+	struct sockaddr_un sa;
+	socklen_t salen = sizeof(sa);
+	if ((fd = anetGenericAccept(err, s, (struct sockaddr*)&sa, &salen)) == -1)
+		return ANET_ERR;
+	return fd;
+}
+
+static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog, int reuseport) {
+	int s = -1, rv;
 	char _port[6];
 	struct addrinfo hints;
 	struct addrinfo *servinfo, *p;
@@ -119,6 +141,7 @@ static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backl
 		if ((s = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
 			continue; // 创建套接字失败的话,继续
 		if (anetSetReuseAddr(err, s) == ANET_ERR) goto error;
+		if (reuseport && anetSetReusePort(err, s) == ANET_ERR) goto error;
 		if (anetListen(err, s, p->ai_addr, p->ai_addrlen, backlog) == ANET_ERR) goto error;
 
 		goto end;
@@ -128,6 +151,7 @@ static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backl
 		goto error;
 	}
 error:
+	if (s != -1) close(s);
 	s = ANET_ERR;
 end:
 	freeaddrinfo(servinfo);
@@ -135,7 +159,42 @@ end:
 }
 
 int anetTcpServer(char *err, int port, char *bindaddr, int backlog) {
-	return _anetTcpServer(err, port, bindaddr, AF_INET, backlog);
+	return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, 0);
+}
+
+/*
+ * 和 anetTcpServer 一样, 不过打开了 SO_REUSEPORT,
+ * 多个事件循环可以各自监听同一个端口
+ */
+int anetTcpReusePortServer(char *err, int port, char *bindaddr, int backlog) {
+	return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, 1);
+}
+
+/*
+ * 在本地套接字 path 上监听, perm 不为 0 时用它设置套接字文件的权限
+ */
+int anetUnixServer(char *err, char *path, mode_t perm, int backlog) {
+	int s;
+	struct sockaddr_un sa;
+
+	if ((s = socket(AF_LOCAL, SOCK_STREAM, 0)) == -1) {
+		anetSetError(err, "creating socket: %s", strerror(errno));
+		return ANET_ERR;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_LOCAL;
+	strncpy(sa.sun_path, path, sizeof(sa.sun_path) - 1);
+	if (anetListen(err, s, (struct sockaddr*)&sa, sizeof(sa), backlog) == ANET_ERR)
+		goto error;
+	if (perm && chmod(sa.sun_path, perm) == -1) {
+		anetSetError(err, "chmod %s: %s", sa.sun_path, strerror(errno));
+		goto error;
+	}
+	return s;
+
+error:
+	close(s);
+	return ANET_ERR;
 }
 
 /*
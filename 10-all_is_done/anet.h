@@ -3,6 +3,7 @@
 #ifndef ANET_H
 #define ANET_H
 
+#include <sys/types.h>
 
 #define ANET_OK 0
 #define ANET_ERR -1
@@ -13,7 +14,10 @@
 #define ANET_IP_ONLY (1<<0)
 
 int anetTcpServer(char *err, int port, char *bindaddr, int backlog);
+int anetTcpReusePortServer(char *err, int port, char *bindaddr, int backlog);
+int anetUnixServer(char *err, char *path, mode_t perm, int backlog);
 int anetTcpAccept(char *err, int serversock, char *ip, size_t ip_len, int *port);
+int anetUnixAccept(char *err, int serversock);
 int anetNonBlock(char *err, int fd);
 int anetEnableTcpNoDelay(char *err, int fd);
 int anetKeepAlive(char *err, int fd, int interval);
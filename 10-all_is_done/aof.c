@@ -8,7 +8,7 @@
 #include "t_hash.h"
 #include "t_set.h"
 #include "redis.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "intset.h"
 #include "networking.h"
 #include <fcntl.h>
@@ -19,9 +19,10 @@
 #include <sys/wait.h>
 #include "aof.h"
 #include "rdb.h"
+#include "latency.h"
 
 /*============================ Variable and Function Declaration ======================== */
-extern struct redisServer server;
+extern struct sharedObjectsStruct shared;
 void expireCommand(redisClient *c);
 void pexpireCommand(redisClient *c);
 void setexCommand(redisClient *c);
@@ -55,66 +56,43 @@ int rioWriteBulkObject(rio *r, robj *obj) {
 int rewriteListObject(rio *r, robj *key, robj *o) {
 	long long count = 0, items = listTypeLength(o);
 
-	if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-		unsigned char *zl = o->ptr;
-		unsigned char *p = ziplistIndex(zl, 0);
-		unsigned char *vstr;
-		unsigned int vlen;
-		long long vlong;
+	if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+		quicklist *list = o->ptr;
+		quicklistIter *li = quicklistGetIterator(list, AL_START_HEAD);
+		quicklistEntry entry;
 
 		/* 先构建一个 RPUSH key 
-		 * 然后从 ZIPLIST 中取出最多 REDIS_AOF_REWRITE_ITEMS_PER_CMD 个元素
-		 * 之后重复第一步，直到 ZIPLIST 为空 */
-		while (ziplistGet(p, &vstr, &vlen, &vlong)) {
+		 * 然后从 quicklist 中取出最多 REDIS_AOF_REWRITE_ITEMS_PER_CMD 个元素
+		 * 之后重复第一步，直到取完所有元素 */
+		while (quicklistNext(li, &entry)) {
 			if (count == 0) {
 				int cmd_items = (items > REDIS_AOF_REWRITE_ITEMS_PER_CMD) ?
 					REDIS_AOF_REWRITE_ITEMS_PER_CMD : items;
 
-				if (rioWriteBulkCount(r, '*', 2 + cmd_items) == 0) return 0;
-				if (rioWriteBulkString(r, "RPUSH", 5) == 0) return 0;
-				if (rioWriteBulkObject(r, key) == 0) return 0;
+				if (rioWriteBulkCount(r, '*', 2 + cmd_items) == 0 ||
+					rioWriteBulkString(r, "RPUSH", 5) == 0 ||
+					rioWriteBulkObject(r, key) == 0) {
+					quicklistReleaseIterator(li);
+					return 0;
+				}
 			}
-			if (vstr) { /* 取出值 */
-				if (rioWriteBulkString(r, (char*)vstr, vlen) == 0) return 0;
+			if (entry.value) { /* 取出值 */
+				if (rioWriteBulkString(r, (char*)entry.value, entry.sz) == 0) {
+					quicklistReleaseIterator(li);
+					return 0;
+				}
 			}
 			else {
-				if (rioWriteBulkLongLong(r, vlong) == 0) return 0;
-			}
-			/* 移动指针，并计算被取出元素的数量 */
-			p = ziplistNext(zl, p);
-			if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) count = 0;
-			items--;
-		}
-	}
-	else if (o->encoding == REDIS_ENCODING_LINKEDLIST) { /* 双向链表 */
-		list *list = o->ptr;
-		listNode *ln;
-		listIter li;
-
-		/* 先构建一个 RPUSH key 
-		 * 然后从双端链表中取出最多 REDIS_AOF_REWRITE_ITEMS_PER_CMD 个元素
-		 * 之后重复第一步，直到链表为空 */
-		listRewind(list, &li);
-		while ((ln = listNext(&li))) {
-			robj *eleobj = listNodeValue(ln);
-
-			if (count == 0) {
-				int cmd_items = (items > REDIS_AOF_REWRITE_ITEMS_PER_CMD) ?
-					REDIS_AOF_REWRITE_ITEMS_PER_CMD : items;
-
-				if (rioWriteBulkCount(r, '*', 2 + cmd_items) == 0) return 0;
-				if (rioWriteBulkString(r, "RPUSH", 5) == 0) return 0;
-				if (rioWriteBulkObject(r, key) == 0) return 0;
+				if (rioWriteBulkLongLong(r, entry.longval) == 0) {
+					quicklistReleaseIterator(li);
+					return 0;
+				}
 			}
-
-			/* 取出值 */
-			if (rioWriteBulkObject(r, eleobj) == 0) return 0;
-
-			/* 元素计数 */
+			/* 计算被取出元素的数量 */
 			if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) count = 0;
-
 			items--;
 		}
+		quicklistReleaseIterator(li);
 	}
 	else {
 		mylog("%s", "Unknown list encoding");
@@ -186,7 +164,7 @@ int rewriteSetObject(rio *r, robj *key, robj *o) {
 int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
 	long long count = 0, items = zsetLength(o);
 
-	if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+	if (o->encoding == REDIS_ENCODING_LISTPACK) {
 		unsigned char *zl = o->ptr;
 		unsigned char *eptr, *sptr;
 		unsigned char *vstr;
@@ -194,13 +172,13 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
 		long long vll;
 		double score;
 
-		eptr = ziplistIndex(zl, 0);
+		eptr = lpSeek(zl, 0);
 		assert(eptr != NULL);
-		sptr = ziplistNext(zl, eptr);
+		sptr = lpNext(zl, eptr);
 		assert(sptr != NULL);
 
 		while (eptr != NULL) {
-			assert(ziplistGet(eptr, &vstr, &vlen, &vll));
+			assert(lpGet(eptr, &vstr, &vlen, &vll));
 			score = zzlGetScore(sptr);
 
 			if (count == 0) {
@@ -265,12 +243,12 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
 */
 static int rioWriteHashIteratorCursor(rio *r, hashTypeIterator *hi, int what) {
 
-	if (hi->encoding == REDIS_ENCODING_ZIPLIST) { /* 压缩链表 */
+	if (hi->encoding == REDIS_ENCODING_LISTPACK) { /* listpack */
 		unsigned char *vstr = NULL;
 		unsigned int vlen = UINT_MAX;
 		long long vll = LLONG_MAX;
 
-		hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+		hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
 		if (vstr) {
 			return rioWriteBulkString(r, (char*)vstr, vlen);
 		}
@@ -335,10 +313,55 @@ int rewriteHashObject(rio *r, robj *key, robj *o) {
 *
 * 不过单个命令每次处理的元素数量不能超过 REDIS_AOF_REWRITE_ITEMS_PER_CMD 。
 */
+/*
+ * 根据值的类型，选择适当的命令来保存键值对 key 和 o ，
+ * 如果 expiretime 不为 -1 ，那么再写入一条 PEXPIREAT 命令保存键的过期时间。
+ *
+ * 写入失败时返回 0 。
+ */
+static int rewriteKeyObject(rio *r, robj *key, robj *o, long long expiretime) {
+	if (o->type == REDIS_STRING) {
+		/* Emit a SET command */
+		char cmd[] = "*3\r\n$3\r\nSET\r\n";
+		if (rioWrite(r, cmd, sizeof(cmd) - 1) == 0) return 0;
+		/* Key and value */
+		if (rioWriteBulkObject(r, key) == 0) return 0;
+		if (rioWriteBulkObject(r, o) == 0) return 0;
+	}
+	else if (o->type == REDIS_LIST) {
+		if (rewriteListObject(r, key, o) == 0) return 0;
+	}
+	else if (o->type == REDIS_SET) {
+		if (rewriteSetObject(r, key, o) == 0) return 0;
+	}
+	else if (o->type == REDIS_ZSET) {
+		if (rewriteSortedSetObject(r, key, o) == 0) return 0;
+	}
+	else if (o->type == REDIS_HASH) {
+		if (rewriteHashObject(r, key, o) == 0) return 0;
+	}
+	else {
+		mylog("%s", "Unknown object type");
+	}
+
+	/* 
+	* 保存键的过期时间
+	*/
+	if (expiretime != -1) {
+		char cmd[] = "*3\r\n$9\r\nPEXPIREAT\r\n";
+
+		/* 写入 PEXPIREAT expiretime 命令 */
+		if (rioWrite(r, cmd, sizeof(cmd) - 1) == 0) return 0;
+		if (rioWriteBulkObject(r, key) == 0) return 0;
+		if (rioWriteBulkLongLong(r, expiretime) == 0) return 0;
+	}
+	return 1;
+}
+
 int rewriteAppendOnlyFile(char *filename) { 
 	/* 这里指的是一切,也就是要将数据库里的东西全部写一遍 */
-	dictIterator *di = NULL;
-	dictEntry *de;
+	htIterator *di = NULL;
+	htEntry *de;
 	rio aof;
 	FILE *fp;
 	char tmpfile[256];
@@ -371,11 +394,11 @@ int rewriteAppendOnlyFile(char *filename) {
 		char selectcmd[] = "*2\r\n$6\r\nSELECT\r\n";
 		redisDb *db = server.db + j;
 		/* 指向键空间 */
-		dict *d = db->dict;
-		if (dictSize(d) == 0) continue;
+		hashtab *d = db->dict;
+		if (htSize(d) == 0) continue;
 
 		/* 创建键空间迭代器 */
-		di = dictGetSafeIterator(d);
+		di = htGetSafeIterator(d);
 		if (!di) {
 			fclose(fp);
 			return REDIS_ERR;
@@ -390,7 +413,7 @@ int rewriteAppendOnlyFile(char *filename) {
 		/* 
 		* 遍历数据库所有键，并通过命令将它们的当前状态（值）记录到新 AOF 文件中
 		*/
-		while ((de = dictNext(di)) != NULL) {
+		while ((de = htNext(di)) != NULL) {
 			sds keystr;
 			robj key, *o;
 			long long expiretime;
@@ -407,47 +430,11 @@ int rewriteAppendOnlyFile(char *filename) {
 			*/
 			if (expiretime != -1 && expiretime < now) continue;
 
-			/* 
-			* 根据值的类型，选择适当的命令来保存值
-			*/
-			if (o->type == REDIS_STRING) {
-				/* Emit a SET command */
-				char cmd[] = "*3\r\n$3\r\nSET\r\n";
-				if (rioWrite(&aof, cmd, sizeof(cmd) - 1) == 0) goto werr;
-				/* Key and value */
-				if (rioWriteBulkObject(&aof, &key) == 0) goto werr;
-				if (rioWriteBulkObject(&aof, o) == 0) goto werr;
-			}
-			else if (o->type == REDIS_LIST) {
-				if (rewriteListObject(&aof, &key, o) == 0) goto werr;
-			}
-			else if (o->type == REDIS_SET) {
-				if (rewriteSetObject(&aof, &key, o) == 0) goto werr;
-			}
-			else if (o->type == REDIS_ZSET) {
-				if (rewriteSortedSetObject(&aof, &key, o) == 0) goto werr;
-			}
-			else if (o->type == REDIS_HASH) {
-				if (rewriteHashObject(&aof, &key, o) == 0) goto werr;
-			}
-			else {
-				mylog("%s", "Unknown object type");
-			}
-
-			/* 
-			* 保存键的过期时间
-			*/
-			if (expiretime != -1) {
-				char cmd[] = "*3\r\n$9\r\nPEXPIREAT\r\n";
-
-				/* 写入 PEXPIREAT expiretime 命令 */
-				if (rioWrite(&aof, cmd, sizeof(cmd) - 1) == 0) goto werr;
-				if (rioWriteBulkObject(&aof, &key) == 0) goto werr;
-				if (rioWriteBulkLongLong(&aof, expiretime) == 0) goto werr;
-			}
+			/* 写入重建键值对以及过期时间的命令 */
+			if (rewriteKeyObject(&aof, &key, o, expiretime) == 0) goto werr;
 		}
 		/* 释放迭代器 */
-		dictReleaseIterator(di);
+		htReleaseIterator(di);
 	}
 
 	/* 冲洗并关闭新 AOF 文件 */
@@ -470,7 +457,7 @@ werr:
 	fclose(fp);
 	unlink(tmpfile);
 	mylog("Write error writing append only file on disk: %s", strerror(errno));
-	if (di) dictReleaseIterator(di);
+	if (di) htReleaseIterator(di);
 	return REDIS_ERR;
 }
 
@@ -495,6 +482,47 @@ werr:
 *    至此，后台 AOF 重写完成。
 */
 
+/*
+ * 打开用来从重写子进程接收信息的管道, 父进程一端设为非阻塞的,
+ * 管道打不开也不影响重写, 只是拿不到写时复制的内存量
+ */
+static void aofOpenChildInfoPipe(void) {
+	if (pipe(server.aof_child_info_pipe) == -1) {
+		server.aof_child_info_pipe[0] = -1;
+		server.aof_child_info_pipe[1] = -1;
+		return;
+	}
+	fcntl(server.aof_child_info_pipe[0], F_SETFL, O_NONBLOCK);
+}
+
+static void aofCloseChildInfoPipe(void) {
+	if (server.aof_child_info_pipe[0] != -1) close(server.aof_child_info_pipe[0]);
+	if (server.aof_child_info_pipe[1] != -1) close(server.aof_child_info_pipe[1]);
+	server.aof_child_info_pipe[0] = -1;
+	server.aof_child_info_pipe[1] = -1;
+}
+
+/*
+ * 子进程把自己写时复制的字节数发送给父进程
+ */
+static void aofSendChildInfo(size_t cow_size) {
+	if (server.aof_child_info_pipe[1] == -1) return;
+	if (write(server.aof_child_info_pipe[1], &cow_size, sizeof(cow_size)) != sizeof(cow_size)) {
+		/* 父进程只是拿不到统计信息而已 */
+	}
+}
+
+/*
+ * 父进程在子进程退出之后读取它发来的信息
+ */
+static void aofReceiveChildInfo(void) {
+	size_t cow_size;
+
+	if (server.aof_child_info_pipe[0] == -1) return;
+	if (read(server.aof_child_info_pipe[0], &cow_size, sizeof(cow_size)) == sizeof(cow_size))
+		server.aof_last_cow_size = cow_size;
+}
+
 int rewriteAppendOnlyFileBackground(void) {
 	pid_t childpid;
 	long long start;
@@ -502,6 +530,8 @@ int rewriteAppendOnlyFileBackground(void) {
 	/* 已经有进程在进行 AOF 重写了 */
 	if (server.aof_child_pid != -1) return REDIS_ERR;
 
+	aofOpenChildInfoPipe();
+
 	/* 记录 fork 开始前的时间，计算 fork 耗时用 */
 	start = ustime();
 
@@ -529,6 +559,7 @@ int rewriteAppendOnlyFileBackground(void) {
 				mylog("AOF rewrite: %zu MB of memory used by copy-on-write",
 					private_dirty / (1024 * 1024));
 			}
+			aofSendChildInfo(private_dirty);
 			/* 发送重写成功信号 */
 			exitFromChild(0);
 		}
@@ -542,9 +573,17 @@ int rewriteAppendOnlyFileBackground(void) {
 		if (childpid == -1) {
 			mylog("Can't rewrite append only file in background: fork: %s",
 				strerror(errno));
+			aofCloseChildInfoPipe();
 			return REDIS_ERR;
 		}
 
+		/* 写端只留给子进程 */
+		if (server.aof_child_info_pipe[1] != -1) {
+			close(server.aof_child_info_pipe[1]);
+			server.aof_child_info_pipe[1] = -1;
+		}
+
+		latencyAddSampleIfNeeded("fork", (ustime() - start) / 1000);
 		mylog("Background append only file rewriting started by pid %d", childpid);
 
 		/* 记录 AOF 重写的信息 */
@@ -843,6 +882,7 @@ void aof_background_fsync(int fd) {
 void flushAppendOnlyFile(int force) { 
 	ssize_t nwritten;
 	int sync_in_progress = 0;
+	mstime_t latency;
 
 	/* 缓冲区中没有任何内容，直接返回 */
 	if (sdslen(server.aof_buf) == 0) return;
@@ -894,7 +934,10 @@ void flushAppendOnlyFile(int force) {
 	* 当然，如果出现像电源中断这样的不可抗现象，那么 AOF 文件也是可能会出现问题的
 	* 这时就要用 redis-check-aof 程序来进行修复。
 	*/
+	latencyStartMonitor(latency);
 	nwritten = write(server.aof_fd, server.aof_buf, sdslen(server.aof_buf));
+	latencyEndMonitor(latency);
+	latencyAddSampleIfNeeded("aof-write", latency);
 	if (nwritten != (signed)sdslen(server.aof_buf)) {
 
 		static time_t last_write_error_log = 0;
@@ -1001,7 +1044,10 @@ void flushAppendOnlyFile(int force) {
 	if (server.aof_fsync_strategy == AOF_FSYNC_ALWAYS) {
 		/* aof_fsync is defined as fdatasync() for Linux in order to avoid
 		* flushing metadata. */
+		latencyStartMonitor(latency);
 		aof_fsync(server.aof_fd); /* Let's try to get this data on the disk */
+		latencyEndMonitor(latency);
+		latencyAddSampleIfNeeded("aof-fsync-always", latency);
 	}
 	else if ((server.aof_fsync_strategy == AOF_FSYNC_EVERYSEC &&
 		server.unixtime > server.aof_last_fsync)) {
@@ -1156,17 +1202,30 @@ void aofRewriteBufferAppend(unsigned char *s, unsigned long len) {
 }
 
 
+/*
+* 返回 AOF 重写缓存中内容的总长度
+*/
+unsigned long aofRewriteBufferSize(void) {
+	listNode *ln;
+	listIter li;
+	unsigned long size = 0;
+
+	listRewind(server.aof_rewrite_buf_blocks, &li);
+	while ((ln = listNext(&li))) {
+		aofrwblock *block = listNodeValue(ln);
+		size += block->used;
+	}
+	return size;
+}
+
 /*
 * 将命令追加到 AOF 文件中，
 * 如果 AOF 重写正在进行，那么也将命令追加到 AOF 重写缓存中。
 */
-void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc) {
-	sds buf = sdsempty();
-	robj *tmpargv[3];
-
-	/* 
-	* 使用 SELECT 命令，显式设置数据库，确保之后的命令被设置到正确的数据库
-	*/
+/* 
+* 使用 SELECT 命令，显式设置数据库，确保之后的命令被设置到正确的数据库
+*/
+static sds catAppendOnlySelectCommand(sds buf, int dictid) {
 	if (dictid != server.aof_selected_db) {
 		char seldb[64];
 
@@ -1176,6 +1235,44 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
 
 		server.aof_selected_db = dictid;
 	}
+	return buf;
+}
+
+/* 
+* 将命令追加到 AOF 缓存中，
+* 如果 BGREWRITEAOF 正在进行，那么也追加到 AOF 重写缓存中。
+*/
+static void feedAppendOnlyFileBuffer(sds buf) {
+	/* 
+	* 在重新进入事件循环之前，这些命令会被冲洗到磁盘上，
+	* 并向客户端返回一个回复。
+	*/
+	if (server.aof_state == REDIS_AOF_ON)
+		server.aof_buf = sdscatlen(server.aof_buf, buf, sdslen(buf));
+
+	/* 
+	* 如果 BGREWRITEAOF 正在进行，
+	* 那么我们还需要将命令追加到重写缓存中，
+	* 从而记录当前正在重写的 AOF 文件和数据库当前状态的差异。
+	* 注意,这里不是将命令添加到server.aof_buf中,而是添加到server.aof_rewrite_buf_blocks中,这难道就是所谓的重写缓存?
+	*/
+	if (server.aof_child_pid != -1)
+		aofRewriteBufferAppend((unsigned char*)buf, sdslen(buf));
+
+	/*
+	* 这里有一个有意思的点,我在这里记录一下,那就是如果有子进程在重写aof文件的话,那么这里的命令会被添加两次
+	* 一次是添加到aof_buf中去,另外一次是添加到aof_rewrite_buf_blocks中去,其实,如果有子进程在重写aof的话
+	* 只需要将命令添加到aof_rewrite_buf_blocks里面即可,不用添加到aof_buf,因为重写完成后,父进程会调用函数
+	* backgroundRewriteDoneHandler,在那个函数里,添加到aof_rewrite_buf_blocks的命令会被写入到aof文件中
+	* 而aof_buf会被清空,这里之所以这么干,是作者偷懒而已.
+	*/
+}
+
+void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc) {
+	sds buf = sdsempty();
+	robj *tmpargv[3];
+
+	buf = catAppendOnlySelectCommand(buf, dictid);
 
 	/* EXPIRE 、 PEXPIRE 和 EXPIREAT 命令 */
 	if (cmd->proc == expireCommand || cmd->proc == pexpireCommand) {
@@ -1203,35 +1300,36 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
 		buf = catAppendOnlyGenericCommand(buf, argc, argv);
 	}
 
-	/* 
-	* 将命令追加到 AOF 缓存中，
-	* 在重新进入事件循环之前，这些命令会被冲洗到磁盘上，
-	* 并向客户端返回一个回复。
-	*/
-	if (server.aof_state == REDIS_AOF_ON)
-		server.aof_buf = sdscatlen(server.aof_buf, buf, sdslen(buf));
-
-	/* 
-	* 如果 BGREWRITEAOF 正在进行，
-	* 那么我们还需要将命令追加到重写缓存中，
-	* 从而记录当前正在重写的 AOF 文件和数据库当前状态的差异。
-	* 注意,这里不是将命令添加到server.aof_buf中,而是添加到server.aof_rewrite_buf_blocks中,这难道就是所谓的重写缓存?
-	*/
-	if (server.aof_child_pid != -1)
-		aofRewriteBufferAppend((unsigned char*)buf, sdslen(buf));
-
-	/*
-	* 这里有一个有意思的点,我在这里记录一下,那就是如果有子进程在重写aof文件的话,那么这里的命令会被添加两次
-	* 一次是添加到aof_buf中去,另外一次是添加到aof_rewrite_buf_blocks中去,其实,如果有子进程在重写aof的话
-	* 只需要将命令添加到aof_rewrite_buf_blocks里面即可,不用添加到aof_buf,因为重写完成后,父进程会调用函数
-	* backgroundRewriteDoneHandler,在那个函数里,添加到aof_rewrite_buf_blocks的命令会被写入到aof文件中
-	* 而aof_buf会被清空,这里之所以这么干,是作者偷懒而已.
-	*/
+	feedAppendOnlyFileBuffer(buf);
 
 	/* 释放 */
 	sdsfree(buf);
 }
 
+/*
+* 将数据库 dictid 中键 key 的当前状态追加到 AOF 文件中：
+* 先删除这个键，如果键存在，再写入重建它的命令以及它的过期时间。
+*
+* 多 reactor 模式下，跨分区执行的写命令通过这个函数传播，见 reactor.c 。
+*/
+void feedAppendOnlyFileKey(int dictid, robj *key) {
+	redisDb *db = server.db + dictid;
+	robj *argv[2], *o;
+	rio r;
+
+	rioInitWithBuffer(&r, catAppendOnlySelectCommand(sdsempty(), dictid));
+
+	argv[0] = shared.del;
+	argv[1] = key;
+	r.io.buffer.ptr = catAppendOnlyGenericCommand(r.io.buffer.ptr, 2, argv);
+
+	if ((o = lookupKey(db, key)) != NULL)
+		rewriteKeyObject(&r, key, o, getExpire(db, key));
+
+	feedAppendOnlyFileBuffer(r.io.buffer.ptr);
+	sdsfree(r.io.buffer.ptr);
+}
+
 /*
 * 删除 AOF 重写所产生的临时文件
 */
@@ -1419,6 +1517,10 @@ cleanup:
 	/* 移除临时文件 */
 	aofRemoveTempFile(server.aof_child_pid);
 
+	/* 子进程已经退出了, 它发送的信息都已经在管道里 */
+	aofReceiveChildInfo();
+	aofCloseChildInfoPipe();
+
 	/* 重置默认属性 */
 	server.aof_child_pid = -1;
 	/* Schedule a new rewrite if we are waiting for it to switch the AOF ON. */
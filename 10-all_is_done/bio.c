@@ -92,6 +92,9 @@ void bioInit(void) {
 		bio_pending[j] = 0;
 	}
 
+	/* 后台线程会释放 job, 内存统计需要原子地更新 */
+	zmalloc_enable_thread_safeness();
+
 	/* 
 	* 设置栈大小
 	*/
@@ -2,15 +2,25 @@
 #include "db.h"
 #include "object.h"
 #include "intset.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "util.h"
 #include "multi.h"
+#include "reactor.h"
+#include "evict.h"
 #include <signal.h>
 #include <ctype.h>
 
 /*============================== Variable and Function Declaration =========================*/
 extern struct sharedObjectsStruct shared;
 
+/*
+ * 多 reactor 模式下每个 reactor 只拥有键空间的一个分区,
+ * 返回键 key 实际所在的那个分区中, 和 db 编号相同的数据库.
+ */
+static inline redisDb *keyDb(redisDb *db, robj *key) {
+	if (server.reactors_num == 1) return db;
+	return &servers[keyReactor(key)].db[db->id];
+}
 
 /*
  * 从数据库db中取出键key的值(对象)
@@ -18,11 +28,21 @@ extern struct sharedObjectsStruct shared;
  */
 robj *lookupKey(redisDb *db, robj *key) {
 	// 查找键空间
-	char *str = key->ptr;
-	dictEntry *de = dictFind(db->dict, key->ptr);
+	htEntry *de = htFind(keyDb(db, key)->dict, key->ptr);
 
 	if (de) {
 		robj *val = dictGetVal(de);
+
+		/* 更新值的访问时间或访问频率.
+		 * 有子进程时不更新, 避免没有必要的写时复制;
+		 * 共享对象不更新, 它同时属于很多个键, 多 reactor 模式下还会被其他线程读取 */
+		if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+			val->refcount != REDIS_SHARED_REFCOUNT) {
+			if (server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LFU)
+				updateLFU(val);
+			else
+				val->lru = LRU_CLOCK();
+		}
 		return val;
 	}
 	else
@@ -39,7 +59,11 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
 	// 从数据库中取出键的值
 	val = lookupKey(db, key);
 
-	// todo
+	// 更新命中/不命中信息
+	if (val == NULL)
+		server.stat_keyspace_misses++;
+	else
+		server.stat_keyspace_hits++;
 	return val;
 }
 
@@ -73,7 +97,7 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
 	// 复制键名
 	sds copy = sdsdup(key->ptr);
 	// 尝试添加键值对
-	int retval = dictAdd(db->dict, copy, val);
+	int retval = htAdd(keyDb(db, key)->dict, copy, val);
 
 	// 如果键已经存在,那么停止
 	// todo
@@ -83,8 +107,15 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
  * 调用者负责对新值 val 的引用计数进行增加。
  */
 void dbOverwrite(redisDb *db, robj *key, robj *val) {
-	dictEntry *de = dictFind(db->dict, key->ptr);
-	dictReplace(db->dict, key->ptr, val);
+	htEntry *de;
+
+	db = keyDb(db, key);
+	/* LFU 策略下新值继承旧值的访问频率 */
+	if ((server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LFU) &&
+		val->refcount != REDIS_SHARED_REFCOUNT &&
+		(de = htFind(db->dict, key->ptr)) != NULL)
+		val->lru = ((robj *)dictGetVal(de))->lru;
+	htReplace(db->dict, key->ptr, val);
 }
 
 /* 高层次的 SET 操作函数。
@@ -117,7 +148,6 @@ void setKey(redisDb *db, robj *key, robj *val) {
 /*
  * 将客户端的目标数据库切换成id所指定的数据库
  */
-extern struct redisServer server;
 int selectDb(redisClient *c, int id) {
 	/* 确保id在正确范围内 */
 	if (id < 0 || id >= server.dbnum)
@@ -142,7 +172,7 @@ robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o) {
  * 检查键key是否存在于数据库中,存在返回1,不存在返回0
  */
 int dbExists(redisDb *db, robj *key) {
-	return dictFind(db->dict, key->ptr) != NULL;
+	return htFind(keyDb(db, key)->dict, key->ptr) != NULL;
 }
 
 void existsCommand(redisClient *c) {
@@ -154,6 +184,26 @@ void existsCommand(redisClient *c) {
 	}
 }
 
+/*
+ * DEL key [key ...]
+ * 删除给定的键, 回复被删除键的数量.
+ * 跨分区写命令写入 AOF 的 DEL 也由这个命令载入.
+ */
+void delCommand(redisClient *c) {
+	int deleted = 0, j;
+
+	for (j = 1; j < c->argc; j++) {
+		/* 先删除过期的键 */
+		expireIfNeeded(c->db, c->argv[j]);
+		if (dbDelete(c->db, c->argv[j])) {
+			signalModifiedKey(c->db, c->argv[j]);
+			server.dirty++;
+			deleted++;
+		}
+	}
+	addReplyLongLong(c, deleted);
+}
+
 /*
  * 为执行写入操作而从数据库中查找返回key的值.
  * 如果key存在,那么返回key的值对象.
@@ -170,8 +220,11 @@ robj* lookupKeyWriteOrReply(redisClient *c, robj *key, robj* reply) {
  * 删除成功返回1,因为键不存在而导致删除失败时,返回0.
  */
 int dbDelete(redisDb *db, robj *key) {
+	db = keyDb(db, key);
+	/* 先删除过期时间, 过期字典和键空间共用同一个键名 */
+	if (htSize(db->expires) > 0) htDelete(db->expires, key->ptr);
 	// 删除键值对
-	if (dictDelete(db->dict, key->ptr) == DICT_OK) {
+	if (htDelete(db->dict, key->ptr) == DICT_OK) {
 		// todo
 		return 1;
 	}
@@ -213,14 +266,15 @@ int *zunionInterGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *nu
  */
 void setExpire(redisDb *db, robj *key, long long when) {
 
-	dictEntry *kde, *de;
+	htEntry *kde, *de;
 	/* 取出键 */
-	kde = dictFind(db->dict, key->ptr);
+	db = keyDb(db, key);
+	kde = htFind(db->dict, key->ptr);
 
 	assert(kde != NULL);
 
 	/* 根据键取出键的过期时间 */
-	de = dictReplaceRaw(db->expires, dictGetKey(kde));
+	de = htReplaceRaw(db->expires, dictGetKey(kde));
 
 	/* 设置键的过期时间
 	 * 这里是直接使用整数值来保存过期时间，不是用 INT 编码的 String 对象 */
@@ -273,13 +327,14 @@ void expireCommand(redisClient *c) { /* 设置某个键过期 */
  * 如果键没有设置过期时间，那么返回 -1 。
  */
 long long getExpire(redisDb *db, robj *key) {
-	dictEntry *de;
+	htEntry *de;
 
 	/* 获取键的过期时间
 	 * 如果过期时间不存在，那么直接返回 */
-	if (dictSize(db->expires) == 0 ||
-		(de = dictFind(db->expires, key->ptr)) == NULL) return -1;
-	assert(dictFind(db->dict, key->ptr) != NULL);
+	db = keyDb(db, key);
+	if (htSize(db->expires) == 0 ||
+		(de = htFind(db->expires, key->ptr)) == NULL) return -1;
+	assert(htFind(db->dict, key->ptr) != NULL);
 
 	/* 返回过期时间 */
 	return dictGetSignedIntegerVal(de);
@@ -333,17 +388,18 @@ void ttlCommand(redisClient *c) { /* 计算还有多少时间键到期 */
  */
 int removeExpire(redisDb *db, robj *key) {
 	/* 确保键带有过期时间 */
-	assert(dictFind(db->dict, key->ptr) != NULL);
+	db = keyDb(db, key);
+	assert(htFind(db->dict, key->ptr) != NULL);
 
 	/* 删除过期时间 */
-	return dictDelete(db->expires, key->ptr) == DICT_OK;
+	return htDelete(db->expires, key->ptr) == DICT_OK;
 }
 
 void persistCommand(redisClient *c) {
-	dictEntry *de;
+	htEntry *de;
 
 	/* 取出键 */
-	de = dictFind(c->db->dict, c->argv[1]->ptr);
+	de = htFind(keyDb(c->db, c->argv[1])->dict, c->argv[1]->ptr);
 
 	if (de == NULL) {
 		/* 键没有过期时间 */
@@ -399,6 +455,7 @@ int expireIfNeeded(redisDb *db, robj *key) {
 	if (now <= when) return 0;
 
 	/* 将过期键从数据库中删除 */
+	server.stat_expiredkeys++;
 	return dbDelete(db, key);
 }
 
@@ -410,11 +467,7 @@ void scanCallback(void *privdata, const dictEntry *de) {
 	robj *o = pd[1];
 	robj *key, *val = NULL;
 
-	if (o == NULL) {
-		sds sdskey = dictGetKey(de);
-		key = createStringObject(sdskey, sdslen(sdskey));
-	}
-	else if (o->type == REDIS_SET) {
+	if (o->type == REDIS_SET) {
 		key = dictGetKey(de);
 		incrRefCount(key);
 	}
@@ -436,6 +489,16 @@ void scanCallback(void *privdata, const dictEntry *de) {
 	if (val) listAddNodeTail(keys, val);
 }
 
+/*
+ * 迭代数据库键空间时使用的回调函数, privdata 是保存键的列表
+ */
+void keyspaceScanCallback(void *privdata, const htEntry *de) {
+	list *keys = privdata;
+	sds sdskey = dictGetKey(de);
+
+	listAddNodeTail(keys, createStringObject(sdskey, sdslen(sdskey)));
+}
+
 
 /* 
  * 这是 SCAN 、 HSCAN 、 SSCAN 命令的实现函数。
@@ -510,17 +573,16 @@ void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
 	}
 
 	/* Step 2: 对容器进行迭代.
-	 * 如果对象的底层实现为 ziplist 、intset 而不是哈希表，
+	 * 如果对象的底层实现为 listpack 、intset 而不是哈希表，
 	 * 那么这些对象应该只包含了少量元素，
 	 * 为了保持不让服务器记录迭代状态的设计
-	 * 我们将 ziplist 或者 intset 里面的所有元素都一次返回给调用者
+	 * 我们将 listpack 或者 intset 里面的所有元素都一次返回给调用者
 	 * 并向调用者返回游标（cursor） 0 */
 
 	/* Handle the case of a hash table. */
 	ht = NULL;
 	if (o == NULL) {
-		/* 迭代目标为当前数据库 */
-		ht = c->db->dict;
+		/* 迭代目标为当前数据库, 键空间是 hashtab, 在下面单独处理 */
 	}
 	else if (o->type == REDIS_SET && o->encoding == REDIS_ENCODING_HT) {
 		/* 迭代目标为 HT 编码的集合 */
@@ -538,7 +600,31 @@ void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
 		count *= 2; /* We return key / value for this type. */
 	}
 
-	if (ht) {
+	if (o == NULL && server.reactors_num > 1) {
+		/* 多 reactor 模式下(SCAN 在所有 reactor 都停下来的时候执行)依次迭代每个分区,
+		 * 游标除以分区数得到字典的游标, 余数是正在迭代的分区 */
+		int part = cursor % server.reactors_num;
+
+		cursor /= server.reactors_num;
+		while (part < server.reactors_num) {
+			hashtab *keyspace = servers[part].db[c->db->id].dict;
+
+			do {
+				cursor = htScan(keyspace, cursor, keyspaceScanCallback, keys);
+			} while (cursor && listLength(keys) < count);
+			if (cursor) break;
+			part++;
+			if (listLength(keys) >= count) break;
+		}
+		cursor = (part < server.reactors_num) ?
+			cursor * server.reactors_num + part : 0;
+	}
+	else if (o == NULL) {
+		do {
+			cursor = htScan(c->db->dict, cursor, keyspaceScanCallback, keys);
+		} while (cursor && listLength(keys) < count);
+	}
+	else if (ht) {
 		void *privdata[2];
 
 		/* 我们向回调函数传入两个指针：
@@ -548,7 +634,7 @@ void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
 		privdata[0] = keys;
 		privdata[1] = o;
 		do {
-			cursor = dictScan(ht, cursor, scanCallback, privdata); /* 最终将数据放入了keys中 */
+			cursor = dictScan(ht, cursor, scanCallback, NULL, privdata); /* 最终将数据放入了keys中 */
 		} while (cursor && listLength(keys) < count); /* 要提取到足够的元素个数才行 */
 	}
 	else if (o->type == REDIS_SET) {
@@ -560,17 +646,17 @@ void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
 		cursor = 0;
 	}
 	else if (o->type == REDIS_HASH || o->type == REDIS_ZSET) {
-		unsigned char *p = ziplistIndex(o->ptr, 0);
+		unsigned char *p = lpSeek(o->ptr, 0);
 		unsigned char *vstr;
 		unsigned int vlen;
 		long long vll;
 
 		while (p) {
-			ziplistGet(p, &vstr, &vlen, &vll);
+			lpGet(p, &vstr, &vlen, &vll);
 			listAddNodeTail(keys,
 				(vstr != NULL) ? createStringObject((char*)vstr, vlen) :
 				createStringObjectFromLongLong(vll));
-			p = ziplistNext(o->ptr, p);
+			p = lpNext(o->ptr, p);
 		}
 		cursor = 0;
 	}
@@ -686,4 +772,61 @@ void signalModifiedKey(redisDb *db, robj *key) {
 	touchWatchedKey(db, key);
 }
 
+/*-----------------------------------------------------------------------------
+ *
+ * 值的主动 rehash
+ *
+ * 哈希表编码的哈希, 集合和有序集合只在被访问时执行渐进式 rehash,
+ * 之后不再被访问的值会一直同时占用新旧两个表.
+ * 修改这些值的命令调用 dbTrackRehashing() 记录它们的键,
+ * 由 databasesCron 调用 dbRehashValues() 在空闲时完成 rehash.
+ *----------------------------------------------------------------------------*/
 
+/*
+ * 返回对象 o 使用的字典, 如果 o 不是用字典编码的, 返回 NULL
+ */
+static dict *valueDict(robj *o) {
+	if (o->encoding == REDIS_ENCODING_HT)
+		return o->ptr;
+	if (o->encoding == REDIS_ENCODING_SKIPLIST)
+		return ((zset*)o->ptr)->dict;
+	return NULL;
+}
+
+/*
+ * 如果键 key 的值 val 正在 rehash, 就记录这个键
+ */
+void dbTrackRehashing(redisDb *db, robj *key, robj *val) {
+	dict *d = valueDict(val);
+
+	if (d == NULL || !dictIsRehashing(d)) return;
+	if (dictAdd(keyDb(db, key)->rehashing_values, key, NULL) == DICT_OK)
+		incrRefCount(key);
+}
+
+/*
+ * 对数据库 db 中记录下来的值执行 rehash, 最多执行 ms 毫秒.
+ * 已经完成 rehash, 或者已经被删除和覆盖的键会从记录中移除.
+ *
+ * 执行了 rehash 时返回 1, 没有需要 rehash 的值时返回 0.
+ */
+int dbRehashValues(redisDb *db, int ms) {
+	long long start;
+
+	if (dictSize(db->rehashing_values) == 0) return 0;
+
+	start = timeInMilliseconds();
+	do {
+		dictEntry *de = dictGetRandomKey(db->rehashing_values);
+		robj *key = dictGetKey(de);
+		htEntry *he = htFind(db->dict, key->ptr);
+		dict *d = he ? valueDict(dictGetVal(he)) : NULL;
+
+		while (d && dictRehash(d, 100)) {
+			if (timeInMilliseconds() - start > ms) return 1;
+		}
+		dictDelete(db->rehashing_values, key);
+	} while (dictSize(db->rehashing_values) &&
+		timeInMilliseconds() - start <= ms);
+	return 1;
+}
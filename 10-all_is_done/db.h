@@ -16,6 +16,7 @@ int dbDelete(redisDb *db, robj *key);
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
 int dbExists(redisDb *db, robj *key);
 void existsCommand(redisClient *c);
+void delCommand(redisClient *c);
 int *zunionInterGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 
 void setExpire(redisDb *db, robj *key, long long when);
@@ -29,9 +30,12 @@ void persistCommand(redisClient *c);
 int parseScanCursorOrReply(redisClient *c, robj *o, unsigned long *cursor);
 int expireIfNeeded(redisDb *db, robj *key);
 void scanCallback(void *privdata, const dictEntry *de);
+void keyspaceScanCallback(void *privdata, const htEntry *de);
 void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor);
 void scanCommand(redisClient *c);
 void selectCommand(redisClient *c);
 void pexpireCommand(redisClient *c);
 void signalModifiedKey(redisDb *db, robj *key);
+void dbTrackRehashing(redisDb *db, robj *key, robj *val);
+int dbRehashValues(redisDb *db, int ms);
 #endif
\ No newline at end of file
@@ -0,0 +1,423 @@
+/*
+ * 主动的内存碎片整理.
+ *
+ * 大量删除数据之后, 存活下来的 robj, sds, dictEntry 之类的小对象零散地分布在
+ * 许多 slab 中, 这些 slab 既不能被清空还给操作系统, 也不会被新数据填满.
+ * serverCron 在碎片率超过阈值时用 htScan 逐步遍历键空间, 把稀疏的 slab 中的
+ * 对象搬到更满的 slab 中(由 zmalloc_defrag 决定哪些对象值得搬动),
+ * 然后修正所有指向它们的指针, 被搬空的 slab 就还给了操作系统.
+ *
+ * 每次只运行 active_defrag_running 指定的 CPU 百分比的时间.
+ * 一轮下来碎片没有减少时暂停整理, 见 activeDefragBackingOff.
+ * 有子进程时不整理, 搬动对象会让写时复制复制出大量的内存页.
+ *
+ * 多 reactor 模式下每个 reactor 整理自己的分区, 碎片率则是整个进程的.
+ *
+ * 只有引用计数符合预期的对象才会被搬动, 其他地方(比如客户端的回复链表)
+ * 还引用着的对象保持不动.
+ */
+#include "redis.h"
+#include "defrag.h"
+#include "object.h"
+#include "util.h"
+
+/*
+ * 尝试搬动一块内存, 搬动了就返回新的地址, 旧的地址随即失效
+ */
+static void *activeDefragAlloc(void *ptr) {
+	void *newptr = zmalloc_defrag(ptr);
+
+	if (newptr) server.stat_active_defrag_hits++;
+	else server.stat_active_defrag_misses++;
+	return newptr;
+}
+
+static sds activeDefragSds(sds s) {
+	size_t offset = s - (char*)sdsAllocPtr(s);
+	char *newsh = activeDefragAlloc(sdsAllocPtr(s));
+
+	return newsh ? newsh + offset : NULL;
+}
+
+/*
+ * 搬动字符串对象和它的 sds, 对象只有 refs 个预期的引用时才搬动.
+ * 对象本身被搬动时返回新的地址, 搬动的内存块数累加到 defragged 中.
+ */
+static robj *activeDefragStringOb(robj *ob, int refs, long *defragged) {
+	robj *ret;
+
+	if (ob->refcount != refs) return NULL;
+
+	/* embstr 的 sds 和对象在同一块内存中, 一起搬动 */
+	if (ob->encoding == REDIS_ENCODING_EMBSTR) {
+		size_t offset = (char*)ob->ptr - (char*)ob;
+
+		if ((ret = activeDefragAlloc(ob)) == NULL) return NULL;
+		ret->ptr = (char*)ret + offset;
+		(*defragged)++;
+		return ret;
+	}
+
+	if (ob->encoding == REDIS_ENCODING_RAW) {
+		sds newsds = activeDefragSds(ob->ptr);
+
+		if (newsds) {
+			ob->ptr = newsds;
+			(*defragged)++;
+		}
+	}
+	if ((ret = activeDefragAlloc(ob))) (*defragged)++;
+	return ret;
+}
+
+/*
+ * 整理字典: 哈希表数组, 节点, 以及作为键和值的字符串对象(由 flags 决定)
+ */
+#define DEFRAG_DICT_KEYS (1<<0)
+#define DEFRAG_DICT_VALS (1<<1)
+static long activeDefragDict(dict *d, int flags) {
+	long defragged = 0;
+	unsigned long i;
+	int t;
+
+	for (t = 0; t < 2; t++) {
+		dictht *ht = &d->ht[t];
+		dictEntry **newtable;
+
+		if (ht->size == 0) continue;
+		if ((newtable = activeDefragAlloc(ht->table))) {
+			ht->table = newtable;
+			defragged++;
+		}
+		for (i = 0; i < ht->size; i++) {
+			dictEntry **deref = &ht->table[i];
+
+			while (*deref) {
+				dictEntry *de = *deref, *newde;
+				robj *newob;
+
+				if ((newde = activeDefragAlloc(de))) {
+					*deref = de = newde;
+					defragged++;
+				}
+				if ((flags & DEFRAG_DICT_KEYS) &&
+					(newob = activeDefragStringOb(dictGetKey(de), 1, &defragged)))
+					de->key = newob;
+				if ((flags & DEFRAG_DICT_VALS) &&
+					(newob = activeDefragStringOb(dictGetVal(de), 1, &defragged)))
+					dictGetVal(de) = newob;
+				deref = &de->next;
+			}
+		}
+	}
+	return defragged;
+}
+
+/*
+ * 整理 quicklist 的节点和节点中的 listpack(或者压缩后的数据)
+ */
+static long activeDefragQuicklist(quicklist *ql) {
+	long defragged = 0;
+	quicklistNode *node, *newnode;
+	unsigned char *newlp;
+
+	for (node = ql->head; node; node = node->next) {
+		if ((newnode = activeDefragAlloc(node))) {
+			if (newnode->prev) newnode->prev->next = newnode;
+			else ql->head = newnode;
+			if (newnode->next) newnode->next->prev = newnode;
+			else ql->tail = newnode;
+			node = newnode;
+			defragged++;
+		}
+		if ((newlp = activeDefragAlloc(node->lp))) {
+			node->lp = newlp;
+			defragged++;
+		}
+	}
+	return defragged;
+}
+
+/*
+ * 整理有序集合的跳跃表.
+ *
+ * 成员对象同时被字典和跳跃表引用(引用计数为 2), 字典的值指向节点中的分值,
+ * 所以搬动成员和节点之后都要修正字典中的节点.
+ * 沿着第 0 层遍历, update[i] 始终是当前节点在第 i 层的前驱,
+ * 它在第 i 层指向当前节点, 当且仅当当前节点的层数大于 i.
+ */
+static long activeDefragZsetSkiplist(zset *zs) {
+	zskiplist *zsl = zs->zsl;
+	zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x, *newx;
+	long defragged = 0;
+	int i;
+
+	for (i = 0; i < zsl->level; i++) update[i] = zsl->header;
+
+	while ((x = update[0]->level[0].forward) != NULL) {
+		dictEntry *de = dictFind(zs->dict, x->obj);
+		robj *newele;
+
+		if ((newele = activeDefragStringOb(x->obj, 2, &defragged))) {
+			x->obj = newele;
+			de->key = newele;
+		}
+
+		if ((newx = activeDefragAlloc(x))) {
+			for (i = 0; i < zsl->level && update[i]->level[i].forward == x; i++)
+				update[i]->level[i].forward = newx;
+			if (newx->level[0].forward) newx->level[0].forward->backward = newx;
+			else zsl->tail = newx;
+			dictGetVal(de) = &newx->score;
+			x = newx;
+			defragged++;
+		}
+
+		for (i = 0; i < zsl->level && update[i]->level[i].forward == x; i++)
+			update[i] = x;
+	}
+	return defragged;
+}
+
+/*
+ * 整理一个值对象内部的内存, 返回搬动的内存块数
+ */
+static long activeDefragValue(robj *ob) {
+	long defragged = 0;
+	void *newptr;
+
+	switch (ob->type) {
+	case REDIS_STRING:
+		/* 在 activeDefragStringOb 中处理 */
+		break;
+
+	case REDIS_LIST:
+		if (ob->encoding == REDIS_ENCODING_QUICKLIST)
+			defragged += activeDefragQuicklist(ob->ptr);
+		if ((newptr = activeDefragAlloc(ob->ptr))) {
+			ob->ptr = newptr;
+			defragged++;
+		}
+		break;
+
+	case REDIS_SET:
+		if (ob->encoding == REDIS_ENCODING_HT)
+			defragged += activeDefragDict(ob->ptr, DEFRAG_DICT_KEYS);
+		if ((newptr = activeDefragAlloc(ob->ptr))) {
+			ob->ptr = newptr;
+			defragged++;
+		}
+		break;
+
+	case REDIS_HASH:
+		if (ob->encoding == REDIS_ENCODING_HT)
+			defragged += activeDefragDict(ob->ptr, DEFRAG_DICT_KEYS | DEFRAG_DICT_VALS);
+		if ((newptr = activeDefragAlloc(ob->ptr))) {
+			ob->ptr = newptr;
+			defragged++;
+		}
+		break;
+
+	case REDIS_ZSET:
+		if (ob->encoding == REDIS_ENCODING_SKIPLIST) {
+			zset *zs = ob->ptr;
+
+			defragged += activeDefragZsetSkiplist(zs);
+			defragged += activeDefragDict(zs->dict, 0);
+			if ((newptr = activeDefragAlloc(zs->dict))) {
+				zs->dict = newptr;
+				defragged++;
+			}
+			if ((newptr = activeDefragAlloc(zs->zsl))) {
+				zs->zsl = newptr;
+				defragged++;
+			}
+		}
+		if ((newptr = activeDefragAlloc(ob->ptr))) {
+			ob->ptr = newptr;
+			defragged++;
+		}
+		break;
+	}
+	return defragged;
+}
+
+/*
+ * 整理一个键: 键名, 值对象以及值对象内部的内存.
+ * 过期字典和主字典共用同一个键名 sds, 搬动键名之后也要修正过期字典.
+ * 键空间的键值对直接存放在 hashtab 的槽中, 没有单独分配的节点需要搬动.
+ */
+static long defragKey(redisDb *db, htEntry *de) {
+	sds keysds = dictGetKey(de), newsds;
+	robj *ob = dictGetVal(de), *newob;
+	htEntry *exde = NULL;
+	long defragged = 0;
+
+	/* 要在旧的键名被释放之前查找 */
+	if (htSize(db->expires))
+		exde = htFindEntryByPtrAndHash(db->expires, keysds,
+			dictHashKey(db->expires, keysds));
+	if ((newsds = activeDefragSds(keysds))) {
+		de->key = newsds;
+		if (exde) exde->key = newsds;
+		defragged++;
+	}
+
+	if (ob->type == REDIS_STRING) {
+		newob = activeDefragStringOb(ob, 1, &defragged);
+	} else if (ob->refcount == 1) {
+		defragged += activeDefragValue(ob);
+		if ((newob = activeDefragAlloc(ob))) defragged++;
+	} else {
+		newob = NULL;
+	}
+	if (newob) dictGetVal(de) = newob;
+
+	return defragged;
+}
+
+static void defragScanCallback(void *privdata, const htEntry *de) {
+	if (defragKey(privdata, (htEntry*)de))
+		server.stat_active_defrag_key_hits++;
+	else
+		server.stat_active_defrag_key_misses++;
+}
+
+/*
+ * 根据 slab 的碎片率决定整理时占用的 CPU 百分比, 不需要整理时返回 0
+ */
+static int computeDefragCycles(void) {
+	size_t allocated, active;
+	float frag_pct;
+	int cpu_pct;
+
+	if (!zmalloc_get_slab_info(&allocated, &active) || allocated == 0) return 0;
+	frag_pct = ((float)active / allocated - 1) * 100;
+	if (frag_pct < server.active_defrag_threshold_lower ||
+		active - allocated < server.active_defrag_ignore_bytes)
+		return 0;
+
+	/* 在两个阈值之间按碎片率线性地增加力度 */
+	cpu_pct = server.active_defrag_cycle_min +
+		(int)((frag_pct - server.active_defrag_threshold_lower) *
+		(server.active_defrag_cycle_max - server.active_defrag_cycle_min) /
+		(server.active_defrag_threshold_upper - server.active_defrag_threshold_lower));
+	if (cpu_pct > server.active_defrag_cycle_max) cpu_pct = server.active_defrag_cycle_max;
+	if (cpu_pct < server.active_defrag_cycle_min) cpu_pct = server.active_defrag_cycle_min;
+	return cpu_pct;
+}
+
+/*
+ * 返回 slab 中的碎片字节数
+ */
+static size_t defragFragBytes(void) {
+	size_t allocated, active;
+
+	zmalloc_get_slab_info(&allocated, &active);
+	return active - allocated;
+}
+
+/*
+ * a 是否比 b 多出 b 的 ACTIVE_DEFRAG_BACKOFF_CHANGE_PCT% 以上
+ */
+static int defragGrewMeaningfully(size_t a, size_t b) {
+	return a > b && (a - b) * 100 > b * ACTIVE_DEFRAG_BACKOFF_CHANGE_PCT;
+}
+
+/*
+ * 上一轮没有让碎片减少时(剩下的碎片由搬不动的对象造成),
+ * 马上开始新的一轮只会再白白扫描一遍键空间.
+ * 退避到期, 或者碎片, 使用的内存有了明显的变化之后才允许开始新的一轮.
+ */
+static int activeDefragBackingOff(void) {
+	size_t used = zmalloc_used_memory();
+
+	if (server.active_defrag_backoff_until == 0) return 0;
+
+	if (mstime() < server.active_defrag_backoff_until &&
+		!defragGrewMeaningfully(defragFragBytes(), server.active_defrag_backoff_frag) &&
+		!defragGrewMeaningfully(used, server.active_defrag_backoff_used) &&
+		!defragGrewMeaningfully(server.active_defrag_backoff_used, used))
+		return 1;
+
+	server.active_defrag_backoff_until = 0;
+	return 0;
+}
+
+/*
+ * 一轮整理结束, 搬动的内存块可以忽略不计, 或者碎片没有减少时开始退避
+ */
+static void activeDefragPassDone(void) {
+	long long hits = server.stat_active_defrag_hits - server.active_defrag_pass_hits;
+	long long misses = server.stat_active_defrag_misses - server.active_defrag_pass_misses;
+	size_t frag = defragFragBytes();
+
+	mylog("Active defrag done, hits %lld, misses %lld", hits, misses);
+	server.active_defrag_db = 0;
+	server.active_defrag_running = 0;
+
+	if (hits > 0 && hits * 100 >= (hits + misses) * ACTIVE_DEFRAG_MIN_HITS_PCT &&
+		frag < server.active_defrag_pass_frag)
+		return;
+
+	server.active_defrag_backoff_until = mstime() + ACTIVE_DEFRAG_BACKOFF_MS;
+	server.active_defrag_backoff_frag = frag;
+	server.active_defrag_backoff_used = zmalloc_used_memory();
+	mylog("%s", "Active defrag is not reducing fragmentation, backing off");
+}
+
+/*
+ * 由 databasesCron 调用, 每次最多运行 active_defrag_running% 的 CPU 时间,
+ * 下次从上次停下的数据库和游标处继续.
+ */
+void activeDefragCycle(void) {
+	long long start, timelimit, prev_hits;
+	int iterations = 0;
+	redisDb *db;
+
+	if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return;
+
+	/* 每秒重新计算一次碎片率 */
+	run_with_period(1000) {
+		int cpu_pct = computeDefragCycles();
+
+		if (!server.active_defrag_running) {
+			if (cpu_pct && !activeDefragBackingOff()) {
+				server.active_defrag_running = cpu_pct;
+				server.active_defrag_pass_hits = server.stat_active_defrag_hits;
+				server.active_defrag_pass_misses = server.stat_active_defrag_misses;
+				server.active_defrag_pass_frag = defragFragBytes();
+				mylog("Starting active defrag, cpu %d%%", cpu_pct);
+			}
+		}
+		else if (cpu_pct > server.active_defrag_running) {
+			server.active_defrag_running = cpu_pct;
+		}
+	}
+	if (!server.active_defrag_running) return;
+
+	start = ustime();
+	timelimit = 1000000LL * server.active_defrag_running / server.hz / 100;
+	if (timelimit <= 0) timelimit = 1;
+	prev_hits = server.stat_active_defrag_hits;
+
+	while (1) {
+		db = server.db + server.active_defrag_db;
+		server.active_defrag_cursor = htScan(db->dict, server.active_defrag_cursor,
+			defragScanCallback, db);
+
+		/* 这个数据库整理完了, 所有的数据库都整理完之后本轮结束 */
+		if (server.active_defrag_cursor == 0 &&
+			++server.active_defrag_db == server.dbnum) {
+			activeDefragPassDone();
+			return;
+		}
+
+		if (++iterations > ACTIVE_DEFRAG_SCAN_STEPS ||
+			server.stat_active_defrag_hits - prev_hits > ACTIVE_DEFRAG_HITS_CHECK) {
+			if (ustime() - start > timelimit) return;
+			iterations = 0;
+			prev_hits = server.stat_active_defrag_hits;
+		}
+	}
+}
@@ -0,0 +1,14 @@
+#ifndef __DEFRAG_H
+#define __DEFRAG_H
+
+#include "redis.h"
+
+#define ACTIVE_DEFRAG_SCAN_STEPS 16   /* 每扫描这么多个桶检查一次时间 */
+#define ACTIVE_DEFRAG_HITS_CHECK 512  /* 或者每搬动这么多个内存块检查一次时间 */
+#define ACTIVE_DEFRAG_MIN_HITS_PCT 1  /* 一轮搬动的内存块少于检查过的这个百分比时, 认为整理没有效果 */
+#define ACTIVE_DEFRAG_BACKOFF_MS 60000 /* 整理没有效果之后最长等待这么久再开始新的一轮 */
+#define ACTIVE_DEFRAG_BACKOFF_CHANGE_PCT 10 /* 或者碎片增加, 使用的内存变化超过这个百分比之后 */
+
+void activeDefragCycle(void);
+
+#endif /* __DEFRAG_H */
@@ -753,6 +753,33 @@ dictEntry *dictFind(dict *d, const void *key)
 	return NULL;
 }
 
+/*
+ * 查找键指针等于 oldptr 的节点, 返回指向这个节点的指针(桶或者前一个节点的 next)的地址,
+ * 调用者可以通过它替换整个节点. 只比较指针, 并且不会进行单步 rehash.
+ * hash 是键的哈希值, 要在 oldptr 指向的内存被释放之前计算.
+ *
+ * 找不到返回 NULL
+ */
+dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, unsigned int hash)
+{
+	dictEntry **heref;
+	unsigned int idx, table;
+
+	if (d->ht[0].size == 0) return NULL;
+
+	for (table = 0; table <= 1; table++) {
+		idx = hash & d->ht[table].sizemask;
+		heref = &d->ht[table].table[idx];
+		while (*heref) {
+			if ((*heref)->key == oldptr)
+				return heref;
+			heref = &(*heref)->next;
+		}
+		if (!dictIsRehashing(d)) return NULL;
+	}
+	return NULL;
+}
+
 /*
  * 获取包含给定键的节点的值
  *
@@ -1187,10 +1214,14 @@ static unsigned long rev(unsigned long v) {
 *    comment is supposed to help.
 *    对游标进行翻转（reverse）的原因初看上去比较难以理解，
 *    不过阅读这份注释应该会有所帮助。
+*
+* bucketfn 不为 NULL 时, 在访问每个桶中的节点之前, 先以桶的地址调用它,
+* 碎片整理借此搬动桶中的节点.
 */
 unsigned long dictScan(dict *d,
 	unsigned long v,
 	dictScanFunction *fn,
+	dictScanBucketFunction *bucketfn,
 	void *privdata)
 {
 	dictht *t0, *t1;
@@ -1211,6 +1242,7 @@ unsigned long dictScan(dict *d,
 
 		/* Emit entries at cursor */
 		// 指向哈希桶
+		if (bucketfn) bucketfn(privdata, &t0->table[v & m0]);
 		de = t0->table[v & m0];
 		// 遍历桶中的所有节点
 		while (de) {
@@ -1239,6 +1271,7 @@ unsigned long dictScan(dict *d,
 
 		/* Emit entries at cursor */
 		// 指向桶，并迭代桶中的所有节点
+		if (bucketfn) bucketfn(privdata, &t0->table[v & m0]);
 		de = t0->table[v & m0];
 		while (de) {
 			fn(privdata, de);
@@ -1253,6 +1286,7 @@ unsigned long dictScan(dict *d,
 		do {
 			/* Emit entries at cursor */
 			// 指向桶，并迭代桶中的所有节点
+			if (bucketfn) bucketfn(privdata, &t1->table[v & m1]);
 			de = t1->table[v & m1];
 			while (de) {
 				fn(privdata, de);
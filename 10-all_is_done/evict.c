@@ -0,0 +1,381 @@
+/*
+ * maxmemory: 内存用量超过 server.maxmemory 之后,
+ * 按照 server.maxmemory_policy 淘汰一些键来腾出空间.
+ *
+ * LRU 和 LFU 都是近似的: 每个对象的 lru 字段保存最近一次访问的时间
+ * (或者 LFU 的访问频率), 淘汰时只对少量的键进行抽样.
+ *
+ * 多 reactor 模式下每个 reactor 只从自己的分区中淘汰键,
+ * 内存用量则是整个进程的.
+ */
+#include "redis.h"
+#include "evict.h"
+#include "db.h"
+#include "object.h"
+#include "latency.h"
+#include "aof.h"
+#include "multi.h"
+#include "networking.h"
+
+extern struct sharedObjectsStruct shared;
+
+/* ============================== LRU 时钟 ================================== */
+
+/*
+ * 返回当前的 LRU 时钟, 精度为 REDIS_LRU_CLOCK_RESOLUTION 毫秒,
+ * 超过 REDIS_LRU_BITS 位之后会回绕.
+ */
+unsigned int getLRUClock(void) {
+	return (mstime() / REDIS_LRU_CLOCK_RESOLUTION) & REDIS_LRU_CLOCK_MAX;
+}
+
+/*
+ * 估算对象已经多少毫秒没有被访问过了
+ */
+unsigned long long estimateObjectIdleTime(robj *o) {
+	unsigned long long lruclock = LRU_CLOCK();
+
+	if (lruclock >= o->lru)
+		return (lruclock - o->lru) * REDIS_LRU_CLOCK_RESOLUTION;
+	// 时钟已经回绕了一次
+	return (lruclock + (REDIS_LRU_CLOCK_MAX - o->lru)) * REDIS_LRU_CLOCK_RESOLUTION;
+}
+
+/* ================================ LFU ===================================== */
+
+/*
+ * LFU 策略下对象的 lru 字段分为两部分:
+ *
+ *          16 bits      8 bits
+ *     +----------------+--------+
+ *     + 最近一次衰减时间 | 计数器  |
+ *     +----------------+--------+
+ *
+ * 时间的单位是分钟, 只保留低 16 位.
+ * 计数器是一个对数计数器(Morris counter), 8 位就可以表示上百万次的访问,
+ * 同时每过 server.lfu_decay_time 分钟减一, 所以很久以前频繁访问的键也会变冷.
+ */
+
+/*
+ * 返回当前时间的分钟数, 只保留低 16 位
+ */
+unsigned long LFUGetTimeInMinutes(void) {
+	return (server.unixtime / 60) & 65535;
+}
+
+/*
+ * 返回从 ldt 到现在经过的分钟数, 考虑了回绕
+ */
+static unsigned long LFUTimeElapsed(unsigned long ldt) {
+	unsigned long now = LFUGetTimeInMinutes();
+
+	if (now >= ldt) return now - ldt;
+	return 65535 - ldt + now;
+}
+
+/*
+ * 对数地增加计数器: 计数器越大, 增加的概率越小
+ */
+static uint8_t LFULogIncr(uint8_t counter) {
+	double r, baseval, p;
+
+	if (counter == 255) return 255;
+	r = (double)rand() / RAND_MAX;
+	baseval = counter - LFU_INIT_VAL;
+	if (baseval < 0) baseval = 0;
+	p = 1.0 / (baseval * server.lfu_log_factor + 1);
+	if (r < p) counter++;
+	return counter;
+}
+
+/*
+ * 按照距离上次衰减经过的时间衰减计数器, 返回衰减后的值.
+ * 这个函数不修改对象.
+ */
+unsigned long LFUDecrAndReturn(robj *o) {
+	unsigned long ldt = o->lru >> 8;
+	unsigned long counter = o->lru & 255;
+	unsigned long num_periods = server.lfu_decay_time ?
+		LFUTimeElapsed(ldt) / server.lfu_decay_time : 0;
+
+	if (num_periods)
+		counter = (num_periods > counter) ? 0 : counter - num_periods;
+	return counter;
+}
+
+/*
+ * 对象被访问时更新它的 LFU 数据: 先衰减, 再增加
+ */
+void updateLFU(robj *o) {
+	unsigned long counter = LFUDecrAndReturn(o);
+
+	counter = LFULogIncr(counter);
+	o->lru = (LFUGetTimeInMinutes() << 8) | counter;
+}
+
+/* ============================== 淘汰池 ==================================== */
+
+/*
+ * 为当前 reactor 创建淘汰池
+ */
+void evictionPoolAlloc(void) {
+	struct evictionPoolEntry *ep;
+	int j;
+
+	ep = zmalloc(sizeof(*ep) * EVPOOL_SIZE);
+	for (j = 0; j < EVPOOL_SIZE; j++) {
+		ep[j].idle = 0;
+		ep[j].key = NULL;
+		ep[j].cached = sdsMakeRoomFor(sdsempty(), EVPOOL_CACHED_SDS_SIZE);
+		ep[j].dbid = 0;
+	}
+	server.eviction_pool = ep;
+}
+
+/*
+ * 从 sampledict 中抽样 server.maxmemory_samples 个键, 把比池中的键更适合淘汰的放进池子.
+ *
+ * sampledict 是 db->dict (allkeys 策略) 或者 db->expires (volatile 策略),
+ * 值对象总是从 keydict 也就是 db->dict 中取得.
+ */
+static void evictionPoolPopulate(int dbid, hashtab *sampledict, hashtab *keydict,
+	struct evictionPoolEntry *pool)
+{
+	htEntry *samples[server.maxmemory_samples];
+	int j, k, count;
+
+	count = htGetRandomKeys(sampledict, samples, server.maxmemory_samples);
+	for (j = 0; j < count; j++) {
+		unsigned long long idle;
+		sds key;
+		robj *o;
+		htEntry *de = samples[j];
+
+		key = dictGetKey(de);
+		if (server.maxmemory_policy != REDIS_MAXMEMORY_VOLATILE_TTL) {
+			if (sampledict != keydict) de = htFind(keydict, key);
+			o = dictGetVal(de);
+		}
+
+		// 计算淘汰的优先级, 越大越先被淘汰
+		if (server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LRU) {
+			idle = estimateObjectIdleTime(o);
+		}
+		else if (server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LFU) {
+			idle = 255 - LFUDecrAndReturn(o);
+		}
+		else {
+			// VOLATILE_TTL: 越早过期越先被淘汰
+			idle = ULLONG_MAX - dictGetSignedIntegerVal(de);
+		}
+
+		// 找到第一个比它大的位置
+		k = 0;
+		while (k < EVPOOL_SIZE && pool[k].key && pool[k].idle < idle) k++;
+		if (k == 0 && pool[EVPOOL_SIZE - 1].key != NULL) {
+			// 池子已经满了, 而且这个键比池中所有的键都不适合淘汰
+			continue;
+		}
+		else if (k < EVPOOL_SIZE && pool[k].key == NULL) {
+			// 插入到一个空位, 不需要移动
+		}
+		else {
+			if (pool[EVPOOL_SIZE - 1].key == NULL) {
+				// 右边还有空位, 把 k 及之后的项右移一位
+				sds cached = pool[EVPOOL_SIZE - 1].cached;
+				memmove(pool + k + 1, pool + k,
+					sizeof(pool[0]) * (EVPOOL_SIZE - k - 1));
+				pool[k].cached = cached;
+			}
+			else {
+				// 没有空位了, 丢掉最左边(最不适合淘汰)的项, 把 k 之前的项左移一位
+				sds cached = pool[0].cached;
+
+				k--;
+				if (pool[0].key != pool[0].cached) sdsfree(pool[0].key);
+				memmove(pool, pool + 1, sizeof(pool[0]) * k);
+				pool[k].cached = cached;
+			}
+		}
+
+		// 键名不太长时复用预先分配的空间
+		if (sdslen(key) > EVPOOL_CACHED_SDS_SIZE) {
+			pool[k].key = sdsdup(key);
+		}
+		else {
+			pool[k].cached = sdscpylen(pool[k].cached, key, sdslen(key));
+			pool[k].key = pool[k].cached;
+		}
+		pool[k].idle = idle;
+		pool[k].dbid = dbid;
+	}
+}
+
+/* ================================ 淘汰 ==================================== */
+
+/*
+ * 把被淘汰的键作为 DEL 传播到 AOF
+ */
+static void propagateEvictedKey(redisDb *db, robj *key) {
+	robj *argv[2];
+
+	argv[0] = shared.del;
+	argv[1] = key;
+	propagate(server.delCommand, db->id, argv, 2, REDIS_PROPAGATE_AOF);
+}
+
+/*
+ * 返回计入 maxmemory 的内存用量.
+ * AOF 缓冲区会在写入文件之后释放, 不计算在内.
+ * 各个事件循环的回复缓冲区池只是缓存, 也不计算在内,
+ * 其他 reactor 的池长度是不加锁读取的, 只是一个近似值.
+ */
+static size_t evictionMemoryUsed(void) {
+	size_t mem_used = zmalloc_used_memory();
+	size_t overhead = 0;
+	int j;
+
+	if (server.aof_state != REDIS_AOF_OFF)
+		overhead = sdslen(server.aof_buf) + aofRewriteBufferSize();
+	for (j = 0; j < server.reactors_num; j++)
+		overhead += (size_t)__atomic_load_n(&servers[j].reply_buf_pool_len,
+			__ATOMIC_RELAXED) * REDIS_REPLY_CHUNK_BYTES;
+	return mem_used > overhead ? mem_used - overhead : 0;
+}
+
+/*
+ * 如果内存用量超过了 server.maxmemory, 按照淘汰策略删除一些键.
+ *
+ * 内存用量降到限制以下, 或者本来就没有超过时返回 REDIS_OK,
+ * 没有可以淘汰的键时返回 REDIS_ERR, 这时候不能再执行会增加内存用量的命令.
+ */
+int freeMemoryIfNeeded(void) {
+	size_t mem_used, mem_tofree, mem_freed;
+	int keys_freed = 0;
+	mstime_t latency;
+	static __thread unsigned int next_db = 0;
+
+	mem_used = evictionMemoryUsed();
+	if (mem_used <= server.maxmemory) return REDIS_OK;
+	if (server.maxmemory_policy == REDIS_MAXMEMORY_NO_EVICTION)
+		return REDIS_ERR;
+
+	mem_tofree = mem_used - server.maxmemory;
+	mem_freed = 0;
+	latencyStartMonitor(latency);
+	while (mem_freed < mem_tofree) {
+		int j, k;
+		sds bestkey = NULL;
+		int bestdbid = 0;
+		redisDb *db;
+		hashtab *dict;
+		htEntry *de;
+
+		if (server.maxmemory_policy & (REDIS_MAXMEMORY_FLAG_LRU | REDIS_MAXMEMORY_FLAG_LFU) ||
+			server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_TTL)
+		{
+			struct evictionPoolEntry *pool = server.eviction_pool;
+
+			while (bestkey == NULL) {
+				unsigned long total_keys = 0, keys;
+
+				// 从每个数据库中抽样, 填充淘汰池
+				for (j = 0; j < server.dbnum; j++) {
+					db = server.db + j;
+					dict = (server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_ALLKEYS) ?
+						db->dict : db->expires;
+					if ((keys = htSize(dict)) != 0) {
+						evictionPoolPopulate(j, dict, db->dict, pool);
+						total_keys += keys;
+					}
+				}
+				if (!total_keys) break; // 没有可以淘汰的键
+
+				// 从池子的右边开始, 取出第一个仍然存在的键
+				for (k = EVPOOL_SIZE - 1; k >= 0; k--) {
+					if (pool[k].key == NULL) continue;
+					bestdbid = pool[k].dbid;
+
+					if (server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_ALLKEYS)
+						de = htFind(server.db[pool[k].dbid].dict, pool[k].key);
+					else
+						de = htFind(server.db[pool[k].dbid].expires, pool[k].key);
+
+					if (pool[k].key != pool[k].cached) sdsfree(pool[k].key);
+					pool[k].key = NULL;
+					pool[k].idle = 0;
+
+					if (de) {
+						bestkey = dictGetKey(de);
+						break;
+					}
+					// 键已经不存在了, 试下一个
+				}
+			}
+		}
+		else {
+			// 随机淘汰, 轮流从每个数据库中选一个
+			for (j = 0; j < server.dbnum; j++) {
+				k = (++next_db) % server.dbnum;
+				db = server.db + k;
+				dict = (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_RANDOM) ?
+					db->dict : db->expires;
+				if (htSize(dict) != 0) {
+					de = htGetRandomKey(dict);
+					bestkey = dictGetKey(de);
+					bestdbid = k;
+					break;
+				}
+			}
+		}
+
+		// 删除选中的键
+		if (bestkey) {
+			robj *keyobj;
+			long long delta;
+
+			db = server.db + bestdbid;
+			keyobj = createStringObject(bestkey, sdslen(bestkey));
+
+			delta = (long long)zmalloc_used_memory();
+			dbDelete(db, keyobj);
+			delta -= (long long)zmalloc_used_memory();
+			if (delta > 0) mem_freed += delta;
+
+			// 删除之后再传播, 在屏障中执行时传播的是键删除之后的状态
+			propagateEvictedKey(db, keyobj);
+			server.stat_evictedkeys++;
+			decrRefCount(keyobj);
+			keys_freed++;
+
+			/*
+			 * 多 reactor 模式下其他 reactor 也在分配和释放内存, delta 并不准确,
+			 * 所以每淘汰 16 个键就重新检查一次实际的内存用量
+			 */
+			if ((keys_freed & 15) == 0 && evictionMemoryUsed() <= server.maxmemory)
+				mem_freed = mem_tofree;
+		}
+		else {
+			break; // 没有可以淘汰的键了
+		}
+	}
+	latencyEndMonitor(latency);
+	latencyAddSampleIfNeeded("eviction-cycle", latency);
+
+	return mem_freed >= mem_tofree ? REDIS_OK : REDIS_ERR;
+}
+
+/*
+ * 执行命令之前调用: 设置了 maxmemory 时先淘汰一些键.
+ * 腾不出空间, 而且命令可能增加内存用量时, 回复 OOM 错误并返回 REDIS_ERR.
+ */
+int evictBeforeCommand(redisClient *c) {
+	if (server.maxmemory == 0) return REDIS_OK;
+
+	if (freeMemoryIfNeeded() == REDIS_ERR && (c->cmd->flags & REDIS_CMD_DENYOOM)) {
+		flagTransaction(c);
+		addReply(c, shared.oomerr);
+		return REDIS_ERR;
+	}
+	return REDIS_OK;
+}
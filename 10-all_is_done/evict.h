@@ -0,0 +1,37 @@
+#ifndef __EVICT_H
+#define __EVICT_H
+
+#include "redis.h"
+
+#define EVPOOL_SIZE 16             /* 淘汰池的大小 */
+#define EVPOOL_CACHED_SDS_SIZE 255 /* 淘汰池中预先分配的键名空间, 更长的键名才需要另外分配 */
+
+/*
+ * 淘汰池中的一项.
+ *
+ * 每次淘汰时从数据库中抽样几个键, 把它们中最适合淘汰的放进池子,
+ * 池子中的键按 idle 从小到大排列, 淘汰时取最后一个.
+ * 这样多次抽样的结果可以累积起来, 比每次只看样本本身更接近真正的 LRU.
+ */
+struct evictionPoolEntry {
+
+	unsigned long long idle; // 越大越应该被淘汰: LRU 是空闲时间, LFU 是 255 减去访问频率, TTL 是过期时间取反
+
+	sds key; // 键名
+
+	sds cached; // 预先分配的键名空间, 键名不太长时 key 就指向这里
+
+	int dbid; // 键所在的数据库
+
+};
+
+unsigned int getLRUClock(void);
+unsigned long long estimateObjectIdleTime(robj *o);
+unsigned long LFUGetTimeInMinutes(void);
+unsigned long LFUDecrAndReturn(robj *o);
+void updateLFU(robj *o);
+void evictionPoolAlloc(void);
+int freeMemoryIfNeeded(void);
+int evictBeforeCommand(redisClient *c);
+
+#endif /* __EVICT_H */
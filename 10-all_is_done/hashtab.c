@@ -0,0 +1,1299 @@
+/* Open addressing hash tables, see hashtab.h */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "hashtab.h"
+#include "endianconv.h"
+#include "zmalloc.h"
+
+/*
+ * 控制字节:
+ *
+ * 1xxxxxxx 已用槽, 低 7 位是键的哈希值的高 7 位
+ * 00000000 空槽
+ * 00000001 墓碑, 被删除的槽
+ *
+ * 空槽编码为 0, 新表可以直接用 zcalloc 分配, 大表的页由内核按需清零,
+ * 不需要在分配时逐组写一遍控制字节.
+ *
+ * 键的起始组由哈希值的低位决定, 从起始组开始按三角数探测 (0, 1, 3, 6, ...),
+ * 组数是 2 的次方, 所以探测序列会经过每一个组. 插入时使用序列中第一个空槽或墓碑,
+ * 查找时遇到含有空槽的组就可以停下: 如果键在更后面的组中,
+ * 插入它的时候这个组一定是满的.
+ *
+ * 删除时如果所在的组里还有空槽, 说明从来没有探测序列越过这个组,
+ * 可以直接标记为空槽, 否则只能标记为墓碑.
+ */
+#define HT_CTRL_EMPTY ((unsigned char)0x00)
+#define HT_CTRL_DELETED ((unsigned char)0x01)
+#define HT_CTRL_IS_FULL(c) (((c) & 0x80) != 0)
+#define HT_H2(hash) ((unsigned char)(0x80 | (((hash) >> 25) & 0x7f)))
+
+/*
+ * 装载率上限: 已用槽和墓碑不超过 7/8.
+ * 禁止 resize 时(有子进程在保存数据)放宽到 15/16, 尽量不分配新表.
+ */
+#define HT_MAX_FILL(size) ((size) - (size) / 8)
+#define HT_FORCE_FILL(size) ((size) - (size) / 16)
+
+/*
+ * 一次处理一组的 8 个控制字节 (SWAR), 不依赖 SSE2 等指令集.
+ * 返回的掩码中每个匹配的字节的最高位为 1.
+ */
+#define HT_LSB 0x0101010101010101ULL
+#define HT_MSB 0x8080808080808080ULL
+
+static inline uint64_t htLoadCtrl(const htGroup *grp) {
+	uint64_t ctrl;
+
+	memcpy(&ctrl, grp->ctrl, sizeof(ctrl));
+	return intrev64ifbe(ctrl);
+}
+
+/* 控制字节等于 h2 的已用槽: 异或之后值为 0 的字节 */
+static inline uint64_t htMatchH2(uint64_t ctrl, unsigned char h2) {
+	uint64_t x = ctrl ^ (HT_LSB * h2);
+
+	return ~(((x & ~HT_MSB) + ~HT_MSB) | x | ~HT_MSB);
+}
+
+/* 空槽的最高位和最低位都是 0, 左移 7 位把每个字节的最低位移到最高位 */
+static inline uint64_t htMatchEmpty(uint64_t ctrl) {
+	return ~(ctrl | (ctrl << 7)) & HT_MSB;
+}
+
+static inline uint64_t htMatchEmptyOrDeleted(uint64_t ctrl) {
+	return ~ctrl & HT_MSB;
+}
+
+static inline uint64_t htMatchFull(uint64_t ctrl) {
+	return ctrl & HT_MSB;
+}
+
+/* 掩码中第一个匹配的槽, 以及去掉它之后的掩码 */
+#define htMaskFirst(m) (__builtin_ctzll(m) >> 3)
+#define htMaskNext(m) ((m) & ((m) - 1))
+
+/*
+ * 和 dict_can_resize 的作用相同, 见 dict.c
+ */
+static int ht_can_resize = 1;
+
+/* -------------------------- private prototypes ---------------------------- */
+
+static int _htExpandIfNeeded(hashtab *d);
+static unsigned long _htNextPower(unsigned long size);
+
+/* ----------------------------- API implementation ------------------------- */
+
+/*
+ * 重置（或初始化）给定哈希表的各项属性值
+ */
+static void _htReset(htTable *t) {
+	t->groups = NULL;
+	t->size = 0;
+	t->groupmask = 0;
+	t->used = 0;
+	t->deleted = 0;
+}
+
+/*
+ * 创建一个新的哈希表
+ *
+ * T = O(1)
+ */
+hashtab *htCreate(dictType *type, void *privDataPtr) {
+	hashtab *d = zmalloc(sizeof(*d));
+
+	_htReset(&d->ht[0]);
+	_htReset(&d->ht[1]);
+	d->type = type;
+	d->privdata = privDataPtr;
+	d->rehashidx = -1;
+	d->iterators = 0;
+	return d;
+}
+
+/*
+ * 在表 t 中查找键, 找不到返回 NULL
+ */
+static htEntry *_htFindInTable(hashtab *d, htTable *t, const void *key, unsigned int h) {
+	unsigned long g = h & t->groupmask, i;
+	unsigned char h2 = HT_H2(h);
+
+	if (t->size == 0) return NULL;
+
+	for (i = 0; i <= t->groupmask; i++) {
+		htGroup *grp = &t->groups[g];
+		uint64_t ctrl = htLoadCtrl(grp), m;
+
+		for (m = htMatchH2(ctrl, h2); m; m = htMaskNext(m)) {
+			htEntry *he = &grp->slots[htMaskFirst(m)];
+
+			if (dictCompareKeys(d, key, he->key)) return he;
+		}
+		// 这个组从来没有满过, 键不可能在更后面
+		if (htMatchEmpty(ctrl)) return NULL;
+		g = (g + i + 1) & t->groupmask;
+	}
+	return NULL;
+}
+
+/*
+ * 在两个表中查找键, rehash 时 0 号表中还没有迁移的键仍然在 0 号表中
+ */
+static htEntry *_htFind(hashtab *d, const void *key, unsigned int h) {
+	htEntry *he = _htFindInTable(d, &d->ht[0], key, h);
+
+	if (he == NULL && htIsRehashing(d))
+		he = _htFindInTable(d, &d->ht[1], key, h);
+	return he;
+}
+
+/*
+ * 在表 t 中为哈希值为 h 的键占用一个槽并返回它.
+ * 调用者要保证键不在表中, 并且表中还有空位.
+ */
+static htEntry *_htInsertSlot(htTable *t, unsigned int h) {
+	unsigned long g = h & t->groupmask, i;
+
+	for (i = 0; i <= t->groupmask; i++) {
+		htGroup *grp = &t->groups[g];
+		uint64_t m = htMatchEmptyOrDeleted(htLoadCtrl(grp));
+
+		if (m) {
+			int idx = htMaskFirst(m);
+
+			if (grp->ctrl[idx] == HT_CTRL_DELETED) t->deleted--;
+			grp->ctrl[idx] = HT_H2(h);
+			t->used++;
+			return &grp->slots[idx];
+		}
+		g = (g + i + 1) & t->groupmask;
+	}
+	assert(0);
+	return NULL;
+}
+
+/*
+ * 释放表 t 中组 grp 的第 idx 个槽
+ */
+static void _htClearSlot(htTable *t, htGroup *grp, int idx) {
+	if (htMatchEmpty(htLoadCtrl(grp))) {
+		grp->ctrl[idx] = HT_CTRL_EMPTY;
+	}
+	else {
+		grp->ctrl[idx] = HT_CTRL_DELETED;
+		t->deleted++;
+	}
+	t->used--;
+}
+
+/*
+ * 缩小给定哈希表, 让装载率接近上限.
+ * 墓碑很多时, 即使大小不变也会重建一次, 清除所有的墓碑.
+ *
+ * 返回 DICT_ERR 表示正在 rehash, 禁止 resize, 或者不需要调整.
+ *
+ * T = O(N)
+ */
+int htResize(hashtab *d) {
+	unsigned long minimal;
+
+	if (!ht_can_resize || htIsRehashing(d)) return DICT_ERR;
+
+	minimal = d->ht[0].used + d->ht[0].used / 7 + 1;
+	if (minimal < HT_INITIAL_SIZE)
+		minimal = HT_INITIAL_SIZE;
+	return htExpand(d, minimal);
+}
+
+/*
+ * 分配一个能容纳 size 个槽的新表, 所有的槽都是空槽
+ */
+static void _htAlloc(htTable *t, unsigned long size) {
+	unsigned long groups = size / HT_GROUP_SLOTS;
+
+	t->groups = zcalloc(groups * sizeof(htGroup));
+	t->size = size;
+	t->groupmask = groups - 1;
+	t->used = 0;
+	t->deleted = 0;
+}
+
+/*
+ * 创建一个新的哈希表:
+ *
+ * 1) 如果 0 号表为空，那么新表就是 0 号表
+ * 2) 否则新表作为 1 号表, 并开始渐进式 rehash
+ *
+ * 正在 rehash, size 容纳不下现有的键, 或者大小不变并且没有墓碑要清除时返回 DICT_ERR.
+ *
+ * T = O(N)
+ */
+int htExpand(hashtab *d, unsigned long size) {
+	htTable n;
+	unsigned long realsize = _htNextPower(size);
+
+	if (htIsRehashing(d) || d->ht[0].used >= HT_MAX_FILL(realsize))
+		return DICT_ERR;
+	if (realsize == d->ht[0].size && d->ht[0].deleted == 0)
+		return DICT_ERR;
+
+	_htAlloc(&n, realsize);
+
+	if (d->ht[0].groups == NULL) {
+		d->ht[0] = n;
+		return DICT_OK;
+	}
+
+	d->ht[1] = n;
+	d->rehashidx = 0;
+	return DICT_OK;
+}
+
+/*
+ * 执行 N 步渐进式 rehash, 每一步迁移 0 号表的一个组.
+ * 最多跳过 N*10 个没有键的组, 避免一次调用阻塞太久.
+ *
+ * 迁移走的槽和删除一样变成空槽或者墓碑,
+ * 这样 0 号表中其他还没有迁移的键仍然能被找到.
+ *
+ * 返回 1 表示仍有键需要从 0 号哈希表移动到 1 号哈希表，
+ * 返回 0 则表示所有键都已经迁移完毕。
+ *
+ * T = O(N)
+ */
+int htRehash(hashtab *d, int n) {
+	int empty_visits = n * 10;
+	htTable *t0 = &d->ht[0], *t1 = &d->ht[1];
+
+	if (!htIsRehashing(d)) return 0;
+
+	while (n-- && t0->used != 0) {
+		htGroup *grp;
+		uint64_t m;
+
+		// 0 号表中还有键, 所以 rehashidx 不会越界
+		assert(t0->groupmask >= (unsigned long)d->rehashidx);
+
+		// 略过没有键的组
+		grp = &t0->groups[d->rehashidx];
+		while ((m = htMatchFull(htLoadCtrl(grp))) == 0) {
+			d->rehashidx++;
+			if (--empty_visits == 0) return 1;
+			grp = &t0->groups[d->rehashidx];
+		}
+
+		// 把组中所有的键迁移到 1 号表
+		for (; m; m = htMaskNext(m)) {
+			int idx = htMaskFirst(m);
+			htEntry *he = &grp->slots[idx];
+
+			*_htInsertSlot(t1, dictHashKey(d, he->key)) = *he;
+			_htClearSlot(t0, grp, idx);
+		}
+		d->rehashidx++;
+	}
+
+	// 0 号表已经空了, 用 1 号表代替它
+	if (t0->used == 0) {
+		zfree(t0->groups);
+		*t0 = *t1;
+		_htReset(t1);
+		d->rehashidx = -1;
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * 在给定毫秒数内，以 100 步为单位, 对哈希表进行 rehash.
+ *
+ * T = O(N)
+ */
+int htRehashMilliseconds(hashtab *d, int ms) {
+	long long start = timeInMilliseconds();
+	int rehashes = 0;
+
+	while (htRehash(d, 100)) {
+		rehashes += 100;
+		if (timeInMilliseconds() - start > ms) break;
+	}
+	return rehashes;
+}
+
+/*
+ * 在没有安全迭代器的情况下，对哈希表进行单步 rehash
+ *
+ * T = O(1)
+ */
+static void _htRehashStep(hashtab *d) {
+	if (d->iterators == 0) htRehash(d, 1);
+}
+
+/*
+ * 尝试将给定键值对添加到哈希表中, 只有给定键 key 不存在时添加操作才会成功
+ *
+ * 添加成功返回 DICT_OK , 失败返回 DICT_ERR
+ */
+int htAdd(hashtab *d, void *key, void *val) {
+	htEntry *entry = htAddRaw(d, key);
+
+	if (!entry) return DICT_ERR;
+	dictSetVal(d, entry, val);
+	return DICT_OK;
+}
+
+/*
+ * 尝试将键插入到哈希表中
+ *
+ * 如果键已经存在，那么返回 NULL, 否则返回保存这个键的槽,
+ * 由调用者设置值.
+ *
+ * 最坏 T = O(N),平摊 O(1)
+ */
+htEntry *htAddRaw(hashtab *d, void *key) {
+	unsigned int h;
+	htEntry *entry;
+	htTable *t;
+
+	if (htIsRehashing(d)) _htRehashStep(d);
+
+	h = dictHashKey(d, key);
+	if (_htFind(d, key, h)) return NULL;
+
+	if (_htExpandIfNeeded(d) == DICT_ERR) return NULL;
+
+	// 如果正在 rehash, 新键总是添加到 1 号表
+	t = htIsRehashing(d) ? &d->ht[1] : &d->ht[0];
+	entry = _htInsertSlot(t, h);
+	dictSetKey(d, entry, key);
+	return entry;
+}
+
+/*
+ * 将给定的键值对添加到哈希表中，如果键已经存在，那么替换它的值
+ *
+ * 如果键值对为全新添加，那么返回 1,
+ * 如果键值对是通过对原有的键值对更新得来的，那么返回 0.
+ */
+int htReplace(hashtab *d, void *key, void *val) {
+	htEntry *entry, auxentry;
+
+	if (htAdd(d, key, val) == DICT_OK)
+		return 1;
+
+	// 先设置新值, 再释放旧值, 新值和旧值可能是同一个对象
+	entry = htFind(d, key);
+	auxentry = *entry;
+	dictSetVal(d, entry, val);
+	dictFreeVal(d, &auxentry);
+	return 0;
+}
+
+/*
+ * 返回保存给定键的槽, 键不存在时先添加它
+ */
+htEntry *htReplaceRaw(hashtab *d, void *key) {
+	htEntry *entry = htFind(d, key);
+
+	return entry ? entry : htAddRaw(d, key);
+}
+
+/*
+ * 查找并删除包含给定键的槽, 参数 nofree 决定是否调用键和值的释放函数
+ *
+ * 找到并成功删除返回 DICT_OK ，没找到则返回 DICT_ERR
+ */
+static int htGenericDelete(hashtab *d, const void *key, int nofree) {
+	unsigned int h;
+	int table;
+
+	if (d->ht[0].size == 0) return DICT_ERR;
+
+	if (htIsRehashing(d)) _htRehashStep(d);
+
+	h = dictHashKey(d, key);
+	for (table = 0; table <= 1; table++) {
+		htTable *t = &d->ht[table];
+		htEntry *he = _htFindInTable(d, t, key, h);
+
+		if (he) {
+			// 槽所在的组和槽在组中的位置
+			htGroup *grp = &t->groups[((char*)he - (char*)t->groups) / sizeof(htGroup)];
+
+			if (!nofree) {
+				dictFreeKey(d, he);
+				dictFreeVal(d, he);
+			}
+			_htClearSlot(t, grp, he - grp->slots);
+			return DICT_OK;
+		}
+		if (!htIsRehashing(d)) break;
+	}
+	return DICT_ERR;
+}
+
+int htDelete(hashtab *d, const void *key) {
+	return htGenericDelete(d, key, 0);
+}
+
+int htDeleteNoFree(hashtab *d, const void *key) {
+	return htGenericDelete(d, key, 1);
+}
+
+/*
+ * 删除哈希表上的所有键值对，并重置哈希表的各项属性
+ *
+ * T = O(N)
+ */
+static void _htClear(hashtab *d, htTable *t, void(callback)(void *)) {
+	unsigned long g;
+
+	for (g = 0; g < t->size / HT_GROUP_SLOTS && t->used > 0; g++) {
+		htGroup *grp = &t->groups[g];
+		uint64_t m;
+
+		if (callback && (g & 8191) == 0) callback(d->privdata);
+
+		for (m = htMatchFull(htLoadCtrl(grp)); m; m = htMaskNext(m)) {
+			htEntry *he = &grp->slots[htMaskFirst(m)];
+
+			dictFreeKey(d, he);
+			dictFreeVal(d, he);
+			t->used--;
+		}
+	}
+	zfree(t->groups);
+	_htReset(t);
+}
+
+/*
+ * 删除并释放整个哈希表
+ */
+void htRelease(hashtab *d) {
+	_htClear(d, &d->ht[0], NULL);
+	_htClear(d, &d->ht[1], NULL);
+	zfree(d);
+}
+
+/*
+ * 清空哈希表上的所有键值对，并重置哈希表属性
+ */
+void htEmpty(hashtab *d, void(callback)(void*)) {
+	_htClear(d, &d->ht[0], callback);
+	_htClear(d, &d->ht[1], callback);
+	d->rehashidx = -1;
+	d->iterators = 0;
+}
+
+/*
+ * 返回哈希表中包含键 key 的槽, 找不到返回 NULL
+ *
+ * T = O(1)
+ */
+htEntry *htFind(hashtab *d, const void *key) {
+	if (d->ht[0].size == 0) return NULL;
+
+	if (htIsRehashing(d)) _htRehashStep(d);
+
+	return _htFind(d, key, dictHashKey(d, key));
+}
+
+/*
+ * 查找键指针等于 oldptr 的槽, 只比较指针, 并且不会进行单步 rehash.
+ * hash 是键的哈希值, 要在 oldptr 指向的内存被释放之前计算.
+ *
+ * 找不到返回 NULL
+ */
+htEntry *htFindEntryByPtrAndHash(hashtab *d, const void *oldptr, unsigned int hash) {
+	int table;
+
+	for (table = 0; table <= 1; table++) {
+		htTable *t = &d->ht[table];
+		unsigned long g = hash & t->groupmask, i;
+
+		if (t->size == 0) return NULL;
+
+		for (i = 0; i <= t->groupmask; i++) {
+			htGroup *grp = &t->groups[g];
+			uint64_t ctrl = htLoadCtrl(grp), m;
+
+			for (m = htMatchH2(ctrl, HT_H2(hash)); m; m = htMaskNext(m)) {
+				htEntry *he = &grp->slots[htMaskFirst(m)];
+
+				if (he->key == oldptr) return he;
+			}
+			if (htMatchEmpty(ctrl)) break;
+			g = (g + i + 1) & t->groupmask;
+		}
+		if (!htIsRehashing(d)) break;
+	}
+	return NULL;
+}
+
+/*
+ * 获取给定键的值, 键不存在时返回 NULL
+ */
+void *htFetchValue(hashtab *d, const void *key) {
+	htEntry *he = htFind(d, key);
+
+	return he ? dictGetVal(he) : NULL;
+}
+
+/*
+ * 哈希表状态的指纹, 用于检查不安全迭代器运行期间哈希表是否被修改, 见 dictFingerprint
+ */
+static long long htFingerprint(hashtab *d) {
+	long long integers[6], hash = 0;
+	int j;
+
+	integers[0] = (long)d->ht[0].groups;
+	integers[1] = d->ht[0].size;
+	integers[2] = d->ht[0].used;
+	integers[3] = (long)d->ht[1].groups;
+	integers[4] = d->ht[1].size;
+	integers[5] = d->ht[1].used;
+
+	for (j = 0; j < 6; j++) {
+		hash += integers[j];
+		/* For the hashing step we use Tomas Wang's 64 bit integer hash. */
+		hash = (~hash) + (hash << 21); // hash = (hash << 21) - hash - 1;
+		hash = hash ^ (hash >> 24);
+		hash = (hash + (hash << 3)) + (hash << 8); // hash * 265
+		hash = hash ^ (hash >> 14);
+		hash = (hash + (hash << 2)) + (hash << 4); // hash * 21
+		hash = hash ^ (hash >> 28);
+		hash = hash + (hash << 31);
+	}
+	return hash;
+}
+
+/*
+ * 创建并返回给定哈希表的不安全迭代器
+ */
+htIterator *htGetIterator(hashtab *d) {
+	htIterator *iter = zmalloc(sizeof(*iter));
+
+	iter->d = d;
+	iter->table = 0;
+	iter->index = -1;
+	iter->safe = 0;
+	return iter;
+}
+
+/*
+ * 创建并返回给定哈希表的安全迭代器,
+ * 迭代期间可以删除迭代器刚刚返回的键
+ */
+htIterator *htGetSafeIterator(hashtab *d) {
+	htIterator *i = htGetIterator(d);
+
+	i->safe = 1;
+	return i;
+}
+
+/*
+ * 返回迭代器指向的下一个槽, 迭代完毕时返回 NULL
+ *
+ * 槽不会因为删除而移动, 所以不需要像 dictIterator 那样提前记录下一个节点.
+ */
+htEntry *htNext(htIterator *iter) {
+	while (1) {
+		htTable *t = &iter->d->ht[iter->table];
+		htGroup *grp;
+		int idx;
+
+		if (iter->index == -1 && iter->table == 0) {
+			if (iter->safe)
+				iter->d->iterators++;
+			else
+				iter->fingerprint = htFingerprint(iter->d);
+		}
+		iter->index++;
+
+		if (iter->index >= (long)t->size) {
+			if (htIsRehashing(iter->d) && iter->table == 0) {
+				iter->table++;
+				iter->index = 0;
+				t = &iter->d->ht[1];
+			}
+			else {
+				break;
+			}
+		}
+
+		grp = &t->groups[iter->index / HT_GROUP_SLOTS];
+		idx = iter->index % HT_GROUP_SLOTS;
+		if (HT_CTRL_IS_FULL(grp->ctrl[idx])) return &grp->slots[idx];
+
+		// 整组都没有键时跳过这一组
+		if (idx == 0 && htMatchFull(htLoadCtrl(grp)) == 0)
+			iter->index += HT_GROUP_SLOTS - 1;
+	}
+	return NULL;
+}
+
+/*
+ * 释放给定迭代器
+ */
+void htReleaseIterator(htIterator *iter) {
+	if (!(iter->index == -1 && iter->table == 0)) {
+		if (iter->safe)
+			iter->d->iterators--;
+		else
+			assert(iter->fingerprint == htFingerprint(iter->d));
+	}
+	zfree(iter);
+}
+
+/*
+ * 随机返回哈希表中的一个键值对, 哈希表为空时返回 NULL.
+ *
+ * 先随机选一个有键的组, 再从组中随机选一个键.
+ */
+htEntry *htGetRandomKey(hashtab *d) {
+	htTable *t;
+	unsigned long g;
+	uint64_t m;
+	int n;
+
+	if (htSize(d) == 0) return NULL;
+
+	if (htIsRehashing(d)) _htRehashStep(d);
+
+	do {
+		if (htIsRehashing(d)) {
+			// 0 号表中 rehashidx 之前的组已经迁移完了, 不用考虑
+			unsigned long groups0 = d->ht[0].groupmask + 1 - d->rehashidx;
+
+			g = random() % (groups0 + d->ht[1].groupmask + 1);
+			if (g < groups0) {
+				t = &d->ht[0];
+				g += d->rehashidx;
+			}
+			else {
+				t = &d->ht[1];
+				g -= groups0;
+			}
+		}
+		else {
+			t = &d->ht[0];
+			g = random() & t->groupmask;
+		}
+		m = htMatchFull(htLoadCtrl(&t->groups[g]));
+	} while (m == 0);
+
+	n = random() % __builtin_popcountll(m);
+	while (n--) m = htMaskNext(m);
+	return &t->groups[g].slots[htMaskFirst(m)];
+}
+
+/*
+ * 从随机的位置开始顺序地取出最多 count 个不重复的键值对, 存放到 des 中,
+ * 返回取出的数量. 用于抽样, 见 dictGetRandomKeys.
+ */
+int htGetRandomKeys(hashtab *d, htEntry **des, int count) {
+	int j; /* internal hash table id, 0 or 1. */
+	int stored = 0;
+
+	if (htSize(d) < (unsigned long)count) count = htSize(d);
+	while (stored < count) {
+		for (j = 0; j < 2; j++) {
+			htTable *t = &d->ht[j];
+			unsigned long g, groups = t->groupmask + 1;
+
+			if (t->size == 0) continue;
+
+			// 从随机的组开始, 最多访问每个组一次
+			g = random() & t->groupmask;
+			while (groups--) {
+				htGroup *grp = &t->groups[g];
+				uint64_t m;
+
+				for (m = htMatchFull(htLoadCtrl(grp)); m; m = htMaskNext(m)) {
+					*des++ = &grp->slots[htMaskFirst(m)];
+					if (++stored == count) return stored;
+				}
+				g = (g + 1) & t->groupmask;
+			}
+			/* If there is only one table and we iterated it all, we should
+			* already have 'count' elements. Assert this condition. */
+			assert(htIsRehashing(d) != 0);
+		}
+	}
+	return stored; /* Never reached. */
+}
+
+/* Function to reverse bits, see dict.c */
+static unsigned long rev(unsigned long v) {
+	unsigned long s = 8 * sizeof(v); // bit size; must be power of 2
+	unsigned long mask = ~0;
+	while ((s >>= 1) > 0) {
+		mask ^= (mask << s);
+		v = ((v >> s) & mask) | ((v << s) & ~mask);
+	}
+	return v;
+}
+
+/*
+ * 返回表 t 中起始组为 home 的所有键.
+ *
+ * 这些键都在从 home 开始的探测序列上, 并且在第一个含有空槽的组之前(含),
+ * 序列经过的组中起始组不是 home 的键不返回, 它们会在自己的起始组被返回.
+ */
+static void _htScanHome(hashtab *d, htTable *t, unsigned long home,
+	htScanFunction *fn, void *privdata)
+{
+	unsigned long g = home, i;
+
+	for (i = 0; i <= t->groupmask; i++) {
+		htGroup *grp = &t->groups[g];
+		uint64_t ctrl = htLoadCtrl(grp), m;
+
+		for (m = htMatchFull(ctrl); m; m = htMaskNext(m)) {
+			htEntry *he = &grp->slots[htMaskFirst(m)];
+
+			if ((dictHashKey(d, he->key) & t->groupmask) == home)
+				fn(privdata, he);
+		}
+		if (htMatchEmpty(ctrl)) break;
+		g = (g + i + 1) & t->groupmask;
+	}
+}
+
+/*
+ * 迭代哈希表中的键值对, 用法和保证与 dictScan 相同:
+ * 从游标 0 开始, 每次调用返回下一次使用的游标, 返回 0 时迭代完成,
+ * 迭代期间一直存在的键至少被返回一次.
+ *
+ * 游标的每一位对应起始组, 而不是槽的位置: 键的起始组总是哈希值和 groupmask 的与,
+ * 这和 dict 中键所在的桶一样, 所以 dictScan 的反向二进制游标在表的大小变化时
+ * 仍然成立. 键不一定在它的起始组中, 但一定在从起始组开始的探测序列上.
+ *
+ * 插入和删除都不会移动已有的键, 只有 rehash 会, 而 rehash 和 dictScan 中一样处理.
+ */
+unsigned long htScan(hashtab *d, unsigned long v, htScanFunction *fn, void *privdata) {
+	htTable *t0, *t1;
+	unsigned long m0, m1;
+
+	if (htSize(d) == 0) return 0;
+
+	if (!htIsRehashing(d)) {
+		t0 = &(d->ht[0]);
+		m0 = t0->groupmask;
+
+		_htScanHome(d, t0, v & m0, fn, privdata);
+	}
+	else {
+		t0 = &d->ht[0];
+		t1 = &d->ht[1];
+
+		/* Make sure t0 is the smaller and t1 is the bigger table */
+		if (t0->size > t1->size) {
+			t0 = &d->ht[1];
+			t1 = &d->ht[0];
+		}
+
+		m0 = t0->groupmask;
+		m1 = t1->groupmask;
+
+		_htScanHome(d, t0, v & m0, fn, privdata);
+
+		/* Iterate over indices in larger table that are the expansion
+		* of the index pointed to by the cursor in the smaller table */
+		do {
+			_htScanHome(d, t1, v & m1, fn, privdata);
+
+			/* Increment bits not covered by the smaller mask */
+			v = (((v | m0) + 1) & ~m0) | (v & m0);
+
+			/* Continue while bits covered by mask difference is non-zero */
+		} while (v & (m0 ^ m1));
+	}
+
+	/* Set unmasked bits so incrementing the reversed cursor
+	* operates on the masked bits of the smaller table */
+	v |= ~m0;
+
+	/* Increment the reverse cursor */
+	v = rev(v);
+	v++;
+	v = rev(v);
+
+	return v;
+}
+
+/* ------------------------- private functions ------------------------------ */
+
+/*
+ * 根据需要，初始化哈希表，或者开始一次 rehash, 保证插入时有空位
+ *
+ * T = O(N)
+ */
+static int _htExpandIfNeeded(hashtab *d) {
+	htTable *t;
+
+	if (d->ht[0].size == 0) return htExpand(d, HT_INITIAL_SIZE);
+
+	if (htIsRehashing(d)) {
+		htTable n;
+		unsigned long g;
+
+		t = &d->ht[1];
+		// 0 号表里还没迁移的键最终都要搬进 1 号表, 所以也要算在内,
+		// 否则缩容时按当前键数分配的 1 号表会在 rehash 途中被插满
+		if (d->ht[0].used + t->used + t->deleted < HT_MAX_FILL(t->size))
+			return DICT_OK;
+
+		// 空间不够时把 1 号表换成一个更大的表, 0 号表的 rehash 继续进行.
+		// (正在迭代 1 号表的安全迭代器可能会重复或者漏掉一些键)
+		_htAlloc(&n, _htNextPower((d->ht[0].used + t->used) * 2));
+		for (g = 0; g <= t->groupmask; g++) {
+			htGroup *grp = &t->groups[g];
+			uint64_t m;
+
+			for (m = htMatchFull(htLoadCtrl(grp)); m; m = htMaskNext(m)) {
+				htEntry *he = &grp->slots[htMaskFirst(m)];
+
+				*_htInsertSlot(&n, dictHashKey(d, he->key)) = *he;
+			}
+		}
+		zfree(t->groups);
+		*t = n;
+		return DICT_OK;
+	}
+
+	t = &d->ht[0];
+	if (t->used + t->deleted < HT_MAX_FILL(t->size) ||
+		(!ht_can_resize && t->used + t->deleted < HT_FORCE_FILL(t->size)))
+		return DICT_OK;
+
+	// 新表的大小至少是已用槽数的两倍, 墓碑很多时新表可能不比现在的大
+	return htExpand(d, t->used * 2);
+}
+
+/*
+ * 计算第一个大于等于 size 的 2 的 N 次方(不小于初始大小)，用作哈希表的大小
+ */
+static unsigned long _htNextPower(unsigned long size) {
+	unsigned long i = HT_INITIAL_SIZE;
+
+	if (size >= LONG_MAX) return LONG_MAX + 1LU;
+	while (1) {
+		if (i >= size)
+			return i;
+		i *= 2;
+	}
+}
+
+/*
+ * 开启自动 rehash
+ */
+void htEnableResize(void) {
+	ht_can_resize = 1;
+}
+
+/*
+ * 关闭自动 rehash
+ */
+void htDisableResize(void) {
+	ht_can_resize = 0;
+}
+
+#ifdef HASHTAB_TEST_MAIN
+/*
+ * 测试: make hashtab-test && ./hashtab-test
+ * 性能对比: ./hashtab-test benchmark [count]
+ *
+ * 键直接用整数强转成的指针, 不需要分配内存
+ */
+#include <stdint.h>
+#include <strings.h>
+#include <sys/time.h>
+#include "sds.h"
+
+static unsigned int testHash(const void *key) {
+	uint64_t x = (uintptr_t)key;
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return (unsigned int)x;
+}
+
+static int testCompare(void *privdata, const void *key1, const void *key2) {
+	DICT_NOTUSED(privdata);
+	return key1 == key2;
+}
+
+static dictType testType = {
+	testHash, NULL, NULL, testCompare, NULL, NULL
+};
+
+#define K(i) ((void *)(uintptr_t)(i))
+
+static int failed = 0;
+
+#define test_assert(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static void htRehashAll(hashtab *d) {
+	while (htIsRehashing(d)) htRehash(d, 100);
+}
+
+/*
+ * 一边插入一边检查: 每次扩容期间, 已经插入的键在两个表中都能找到
+ */
+static void testRehash(void) {
+	hashtab *d = htCreate(&testType, NULL);
+	long i, j, n = 100000, checks = 0;
+
+	for (i = 0; i < n; i++) {
+		test_assert(htAdd(d, K(i), K(i + 1)) == DICT_OK);
+		if (htIsRehashing(d) && d->rehashidx > 0 && checks < 20) {
+			checks++;
+			for (j = 0; j <= i; j++) test_assert(htFind(d, K(j)) != NULL);
+		}
+	}
+	test_assert(checks > 0);
+	test_assert(htAdd(d, K(0), NULL) == DICT_ERR);
+	test_assert(htReplace(d, K(0), K(42)) == 0);
+	test_assert(htFetchValue(d, K(0)) == K(42));
+	htRehashAll(d);
+	test_assert(htSize(d) == (unsigned long)n);
+	test_assert(d->ht[0].used <= HT_MAX_FILL(d->ht[0].size));
+	test_assert(d->ht[1].groups == NULL);
+	for (i = 1; i < n; i++) test_assert(htFetchValue(d, K(i)) == K(i + 1));
+	for (i = n; i < 2 * n; i++) test_assert(htFind(d, K(i)) == NULL);
+
+	for (i = 0; i < n; i += 2) test_assert(htDelete(d, K(i)) == DICT_OK);
+	test_assert(htDelete(d, K(0)) == DICT_ERR);
+	test_assert(htSize(d) == (unsigned long)n / 2);
+	for (i = 0; i < n; i++) test_assert((htFind(d, K(i)) != NULL) == (i % 2 == 1));
+	htRelease(d);
+}
+
+/*
+ * 安全迭代器: 每个键正好返回一次, 迭代期间暂停 rehash, 可以删除返回的键.
+ * 不安全迭代器: 迭代期间没有修改时指纹不变
+ */
+static void testIterators(void) {
+	hashtab *d = htCreate(&testType, NULL);
+	htIterator *iter;
+	htEntry *he;
+	long n, count = 0, rehashidx;
+	unsigned char *seen;
+
+	// 停在 rehash 的中途, 迭代器要同时遍历两个表
+	for (n = 0; n < 10000 || !htIsRehashing(d); n++) htAdd(d, K(n), NULL);
+	seen = zcalloc(n);
+
+	iter = htGetSafeIterator(d);
+	rehashidx = d->rehashidx;
+	while ((he = htNext(iter)) != NULL) {
+		long k = (long)(uintptr_t)dictGetKey(he);
+
+		test_assert(k >= 0 && k < n && seen[k] == 0);
+		seen[k]++;
+		count++;
+		// 有安全迭代器时查找不会执行 rehash
+		htFind(d, K(k));
+		test_assert(d->rehashidx == rehashidx);
+	}
+	htReleaseIterator(iter);
+	test_assert(count == n);
+
+	iter = htGetIterator(d);
+	count = 0;
+	while (htNext(iter) != NULL) count++;
+	htReleaseIterator(iter);
+	test_assert(count == n);
+
+	memset(seen, 0, n);
+	iter = htGetSafeIterator(d);
+	count = 0;
+	while ((he = htNext(iter)) != NULL) {
+		long k = (long)(uintptr_t)dictGetKey(he);
+
+		test_assert(seen[k] == 0);
+		seen[k]++;
+		count++;
+		test_assert(htDelete(d, K(k)) == DICT_OK);
+	}
+	htReleaseIterator(iter);
+	test_assert(count == n);
+	test_assert(htSize(d) == 0);
+
+	zfree(seen);
+	htRelease(d);
+}
+
+/*
+ * 墓碑: 满组中删除的槽变成墓碑, 不能截断经过它的探测序列,
+ * 之后的插入会重用墓碑, 扩容或者同样大小的重建会清掉墓碑
+ */
+static void testTombstones(void) {
+	hashtab *d = htCreate(&testType, NULL);
+	unsigned long deleted;
+	long i, j;
+
+	test_assert(htExpand(d, 1024) == DICT_OK);
+	for (i = 0; i < 800; i++) htAdd(d, K(i), NULL);
+	test_assert(!htIsRehashing(d) && d->ht[0].size == 1024);
+
+	for (i = 0; i < 800; i += 2) htDelete(d, K(i));
+	deleted = d->ht[0].deleted;
+	test_assert(deleted > 0);
+	for (i = 0; i < 800; i++) test_assert((htFind(d, K(i)) != NULL) == (i % 2 == 1));
+
+	// 没有键也没有墓碑的组不会再出现墓碑, 总数只会因为重用而减少
+	for (i = 0; i < 200; i++) htAdd(d, K(10000 + i), NULL);
+	test_assert(!htIsRehashing(d));
+	test_assert(d->ht[0].deleted < deleted);
+	for (i = 0; i < 200; i++) test_assert(htFind(d, K(10000 + i)) != NULL);
+
+	// 墓碑和已用槽一起达到上限时扩容, 而不是把表插满
+	for (i = 0; i < 400; i++) htAdd(d, K(20000 + i), NULL);
+	htRehashAll(d);
+	test_assert(d->ht[0].deleted == 0);
+	test_assert(htSize(d) == 1000);
+	for (i = 1; i < 800; i += 2) test_assert(htFind(d, K(i)) != NULL);
+	htRelease(d);
+
+	// 反复插入再删除, 键一直不多但墓碑越来越多, 达到上限时以同样的大小重建
+	d = htCreate(&testType, NULL);
+	test_assert(htExpand(d, 1024) == DICT_OK);
+	for (i = 0; i < 20000; i++) {
+		htAdd(d, K(i), NULL);
+		if (htIsRehashing(d)) {
+			test_assert(d->ht[1].size == 1024);
+			break;
+		}
+		if (i >= 400) htDelete(d, K(i - 400));
+	}
+	test_assert(htIsRehashing(d));
+	htRehashAll(d);
+	test_assert(d->ht[0].size == 1024 && d->ht[0].deleted == 0);
+	test_assert(htSize(d) == 401);
+	for (j = i - 400; j <= i; j++) test_assert(htDelete(d, K(j)) == DICT_OK);
+	test_assert(htSize(d) == 0);
+	htRelease(d);
+}
+
+static void scanCallback(void *privdata, const htEntry *he) {
+	unsigned char *seen = privdata;
+	long k = (long)(uintptr_t)dictGetKey(he);
+
+	if (k < 100000) seen[k] = 1;
+}
+
+/*
+ * SCAN 的保证: 迭代期间一直存在的键至少被返回一次,
+ * 即使哈希表在两次调用之间扩容, 缩容, 或者正在 rehash
+ */
+static void testScan(void) {
+	unsigned char *seen = zcalloc(100000);
+	hashtab *d;
+	unsigned long cursor;
+	long i, next, steps;
+
+	// 迭代期间不断插入, 表会扩容好几次
+	d = htCreate(&testType, NULL);
+	for (i = 0; i < 1000; i++) htAdd(d, K(i), NULL);
+	htRehashAll(d);
+	cursor = 0;
+	next = 100000;
+	do {
+		cursor = htScan(d, cursor, scanCallback, seen);
+		for (i = 0; i < 200 && next < 150000; i++) htAdd(d, K(next++), NULL);
+	} while (cursor != 0);
+	test_assert(next == 150000);
+	for (i = 0; i < 1000; i++) test_assert(seen[i]);
+	htRelease(d);
+
+	// 迭代到一半时删除大部分键并缩容, 之后的调用有时正好在 rehash 中途
+	memset(seen, 0, 100000);
+	d = htCreate(&testType, NULL);
+	for (i = 0; i < 100000; i++) htAdd(d, K(i), NULL);
+	htRehashAll(d);
+	cursor = 0;
+	steps = 0;
+	do {
+		cursor = htScan(d, cursor, scanCallback, seen);
+		if (++steps == 100) {
+			for (i = 0; i < 100000; i++)
+				if (i % 50) htDelete(d, K(i));
+			test_assert(htResize(d) == DICT_OK);
+		}
+		htRehash(d, 1);
+	} while (cursor != 0);
+	test_assert(steps > 100);
+	for (i = 0; i < 100000; i += 50) test_assert(seen[i]);
+	htRelease(d);
+
+	zfree(seen);
+}
+
+/*
+ * 缩容后 1 号表只按当前键数分配, rehash 途中插入的键不能把它插满
+ */
+static void testShrinkThenInsert(void) {
+	hashtab *d = htCreate(&testType, NULL);
+	long i;
+
+	for (i = 1; i <= 900; i++) htAdd(d, K(i), NULL);
+	htRehashAll(d);
+	for (i = 101; i <= 900; i++) htDelete(d, K(i));
+	test_assert(htResize(d) == DICT_OK);
+	test_assert(htIsRehashing(d));
+	for (i = 0; i < 30; i++) test_assert(htAdd(d, K(100000 + i), NULL) == DICT_OK);
+	htRehashAll(d);
+	test_assert(htSize(d) == 130);
+	for (i = 1; i <= 100; i++) test_assert(htFind(d, K(i)) != NULL);
+	for (i = 0; i < 30; i++) test_assert(htFind(d, K(100000 + i)) != NULL);
+	htRelease(d);
+}
+
+/*
+ * 模拟 databasesCron: 键空间缩小到装载率低于 10% 后缩容,
+ * 之后每一轮插入和删除一些键, 再主动 rehash 1 毫秒, rehash 必须能够完成.
+ * 剩下的 7167 个键缩容到 8192 个槽, 装载率上限正好是 7168, 几乎没有余量.
+ */
+static void testCronShrink(void) {
+	hashtab *d = htCreate(&testType, NULL);
+	long i, next = 1000000, rounds = 0;
+
+	for (i = 0; i < 100000; i++) htAdd(d, K(i), NULL);
+	htRehashAll(d);
+	for (i = 7167; i < 100000; i++) htDelete(d, K(i));
+	test_assert(htSize(d) * 100 / htSlots(d) < 10);
+	test_assert(htResize(d) == DICT_OK);
+	test_assert(htIsRehashing(d) && d->ht[1].size == 8192);
+	while (htIsRehashing(d) && rounds++ < 100000) {
+		for (i = 0; i < 2000; i++) htAdd(d, K(next++), NULL);
+		for (i = 0; i < 400; i++) test_assert(htDelete(d, K(next - 1 - i * 5)) == DICT_OK);
+		htRehashMilliseconds(d, 1);
+	}
+	test_assert(!htIsRehashing(d));
+	test_assert(htSize(d) == 7167 + (next - 1000000) / 5 * 4);
+	for (i = 0; i < 7167; i++) test_assert(htFind(d, K(i)) != NULL);
+	// 每一轮删除了本轮插入的第 4, 9, 14, ... 个键
+	for (i = 1000000; i < next; i++)
+		test_assert((htFind(d, K(i)) != NULL) == ((i - 1000000) % 5 != 4));
+	htRelease(d);
+}
+
+/*
+ * 性能对比: ./hashtab-test benchmark [count]
+ *
+ * 键是 "key:N" 形式的 sds, 和键空间一样.
+ * 命中测试按预先打乱的顺序查找, 只计算哈希表本身的开销.
+ */
+static unsigned int benchHash(const void *key) {
+	return dictGenHashFunction(key, sdslen((sds)key));
+}
+
+static int benchCompare(void *privdata, const void *key1, const void *key2) {
+	DICT_NOTUSED(privdata);
+	return sdslen((sds)key1) == sdslen((sds)key2) &&
+		memcmp(key1, key2, sdslen((sds)key1)) == 0;
+}
+
+static dictType benchType = {
+	benchHash, NULL, NULL, benchCompare, NULL, NULL
+};
+
+static long long benchUstime(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void benchmark(long count, int useht) {
+	long queries = count < 2000000 ? count : 2000000, i, found = 0;
+	sds *keys = zmalloc(sizeof(sds) * count);
+	sds *hits = zmalloc(sizeof(sds) * queries);
+	sds *misses = zmalloc(sizeof(sds) * queries);
+	long long start, insert, hit, miss;
+	size_t base;
+	void *t;
+
+	for (i = 0; i < count; i++) keys[i] = sdscatprintf(sdsempty(), "key:%ld", i);
+	srandom(1);
+	for (i = 0; i < queries; i++) {
+		hits[i] = keys[random() % count];
+		misses[i] = sdscatprintf(sdsempty(), "nokey:%ld", i);
+	}
+
+	base = zmalloc_used_memory();
+	t = useht ? (void *)htCreate(&benchType, NULL) : (void *)dictCreate(&benchType, NULL);
+	start = benchUstime();
+	for (i = 0; i < count; i++) {
+		if (useht) htAdd(t, keys[i], NULL);
+		else dictAdd(t, keys[i], NULL);
+	}
+	insert = benchUstime() - start;
+	if (useht) htRehashAll(t);
+	else while (dictIsRehashing((dict *)t)) dictRehash(t, 100);
+
+	start = benchUstime();
+	for (i = 0; i < queries; i++)
+		found += useht ? htFind(t, hits[i]) != NULL : dictFind(t, hits[i]) != NULL;
+	hit = benchUstime() - start;
+
+	start = benchUstime();
+	for (i = 0; i < queries; i++)
+		found += useht ? htFind(t, misses[i]) != NULL : dictFind(t, misses[i]) != NULL;
+	miss = benchUstime() - start;
+
+	printf("%-8s %ld keys: %.1f bytes/key, insert %.2f Mops, hit %.2f Mops, miss %.2f Mops\n",
+		useht ? "hashtab" : "dict", count,
+		(double)(zmalloc_used_memory() - base) / count,
+		(double)count / insert, (double)queries / hit, (double)queries / miss);
+	test_assert(found == queries);
+
+	if (useht) htRelease(t);
+	else dictRelease(t);
+	for (i = 0; i < count; i++) sdsfree(keys[i]);
+	for (i = 0; i < queries; i++) sdsfree(misses[i]);
+	zfree(keys);
+	zfree(hits);
+	zfree(misses);
+}
+
+int main(int argc, char **argv) {
+	if (argc >= 2 && !strcasecmp(argv[1], "benchmark")) {
+		long count = argc >= 3 ? atol(argv[2]) : 1000000;
+
+		benchmark(count, 0);
+		benchmark(count, 1);
+		return failed != 0;
+	}
+
+	testRehash();
+	testIterators();
+	testTombstones();
+	testScan();
+	testShrinkThenInsert();
+	testCronShrink();
+
+	if (failed) {
+		printf("%d assertions failed\n", failed);
+		return 1;
+	}
+	printf("all tests passed\n");
+	return 0;
+}
+#endif
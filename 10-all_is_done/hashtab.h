@@ -0,0 +1,152 @@
+/* Open addressing hash tables, used for the keyspace.
+ *
+ * dict.c 用链表解决冲突, 查找一个键要依次访问桶数组, 节点和键本身,
+ * 每一步都可能是一次 cache miss, 每个节点还要单独分配 24 字节.
+ *
+ * hashtab 把键值对直接存放在槽里, 每 8 个槽组成一组, 组的开头是 8 个控制字节,
+ * 记录每个槽是空槽, 墓碑, 还是保存着哈希值高 7 位的已用槽.
+ * 查找时一次比较整组的 8 个控制字节 (SwissTable 的做法), 只有高 7 位相同的槽
+ * 才需要比较键, 找不到的键通常只需要读一次控制字节.
+ *
+ * 它使用和 dict 相同的 dictType, dictGetKey, dictGetVal, dictSetVal 等宏
+ * 也可以直接用于 htEntry. 和 dict 一样支持渐进式 rehash, 安全迭代器,
+ * 以及 SCAN 的反向二进制游标.
+ *
+ * 注意 htEntry 就在槽数组里面, 插入, 查找(会执行单步 rehash)等操作都可能移动它,
+ * 所以 htFind 等函数返回的指针只在对同一个哈希表进行下一次操作之前有效.
+ */
+
+#ifndef __HASHTAB_H
+#define __HASHTAB_H
+
+#include "dict.h"
+
+/* 每组的槽数, 一组的控制字节正好是一个 uint64_t */
+#define HT_GROUP_SLOTS 8
+
+/* 哈希表的初始大小(槽数) */
+#define HT_INITIAL_SIZE HT_GROUP_SLOTS
+
+//
+// htEntry 哈希表的槽, 和 dictEntry 相比没有 next 指针
+//
+typedef struct htEntry {
+	// 键
+	void *key;
+
+	// 值
+	union {
+		void *val;
+		uint64_t u64;
+		int64_t s64;
+	} v;
+} htEntry;
+
+//
+// htGroup 一组槽以及它们的控制字节
+//
+typedef struct htGroup {
+	unsigned char ctrl[HT_GROUP_SLOTS];
+	htEntry slots[HT_GROUP_SLOTS];
+} htGroup;
+
+//
+// htTable 哈希表
+//
+typedef struct htTable {
+
+	// 组数组
+	htGroup *groups;
+
+	// 槽的数量, 总是 HT_GROUP_SLOTS 乘以 2 的某个次方
+	unsigned long size;
+
+	// 组的数量减一, 用于计算键的起始组
+	unsigned long groupmask;
+
+	// 已用槽的数量
+	unsigned long used;
+
+	// 墓碑的数量, 墓碑和已用槽一样会拉长探测序列
+	unsigned long deleted;
+
+} htTable;
+
+//
+// hashtab 开放寻址的字典
+//
+typedef struct hashtab {
+
+	// 类型特定函数, 和 dict 共用
+	dictType *type;
+
+	// 私有数据
+	void *privdata;
+
+	// 哈希表, rehash 时把 0 号表的键迁移到 1 号表
+	htTable ht[2];
+
+	// 下一个要迁移的 0 号表的组, 没有 rehash 时为 -1
+	long rehashidx;
+
+	// 目前正在运行的安全迭代器的数量
+	int iterators;
+
+} hashtab;
+
+//
+// htIterator 迭代器, safe 的含义和 dictIterator 相同
+//
+typedef struct htIterator {
+
+	// 被迭代的哈希表
+	hashtab *d;
+
+	// table ：正在被迭代的哈希表号码
+	// safe ：标识这个迭代器是否安全
+	int table, safe;
+
+	// 当前槽的位置
+	long index;
+
+	long long fingerprint; // unsafe iterator fingerprint for misuse detection
+} htIterator;
+
+typedef void (htScanFunction)(void *privdata, const htEntry *de);
+
+/* ------------------------------- Macros ------------------------------------*/
+// 返回给定哈希表的槽数
+#define htSlots(d) ((d)->ht[0].size+(d)->ht[1].size)
+// 返回哈希表的已有键值对数量
+#define htSize(d) ((d)->ht[0].used+(d)->ht[1].used)
+// 查看哈希表是否正在 rehash
+#define htIsRehashing(d) ((d)->rehashidx != -1)
+
+/* API */
+hashtab *htCreate(dictType *type, void *privDataPtr);
+int htExpand(hashtab *d, unsigned long size);
+int htAdd(hashtab *d, void *key, void *val);
+htEntry *htAddRaw(hashtab *d, void *key);
+int htReplace(hashtab *d, void *key, void *val);
+htEntry *htReplaceRaw(hashtab *d, void *key);
+int htDelete(hashtab *d, const void *key);
+int htDeleteNoFree(hashtab *d, const void *key);
+void htRelease(hashtab *d);
+htEntry *htFind(hashtab *d, const void *key);
+htEntry *htFindEntryByPtrAndHash(hashtab *d, const void *oldptr, unsigned int hash);
+void *htFetchValue(hashtab *d, const void *key);
+int htResize(hashtab *d);
+htIterator *htGetIterator(hashtab *d);
+htIterator *htGetSafeIterator(hashtab *d);
+htEntry *htNext(htIterator *iter);
+void htReleaseIterator(htIterator *iter);
+htEntry *htGetRandomKey(hashtab *d);
+int htGetRandomKeys(hashtab *d, htEntry **des, int count);
+void htEmpty(hashtab *d, void(callback)(void*));
+void htEnableResize(void);
+void htDisableResize(void);
+int htRehash(hashtab *d, int n);
+int htRehashMilliseconds(hashtab *d, int ms);
+unsigned long htScan(hashtab *d, unsigned long v, htScanFunction *fn, void *privdata);
+
+#endif /* __HASHTAB_H */
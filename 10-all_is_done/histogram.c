@@ -0,0 +1,103 @@
+#include <string.h>
+#include "histogram.h"
+#include "zmalloc.h"
+
+/*
+ * 计算 value 所在的桶
+ */
+static int histogramBucketIndex(uint64_t value) {
+	int bits;
+
+	if (value < HIST_SUB_BUCKETS) return (int)value;
+
+	// 最高位的位置, value >= 16 时 bits >= 4
+	bits = 63 - __builtin_clzll(value);
+	if (bits > HIST_MAX_BITS) return HIST_BUCKETS - 1;
+
+	// 最高位之后的 HIST_SUB_BUCKET_BITS 位决定了在这个区间中的哪一个桶
+	return HIST_SUB_BUCKETS * (bits - HIST_SUB_BUCKET_BITS + 1) +
+		(int)((value >> (bits - HIST_SUB_BUCKET_BITS)) & (HIST_SUB_BUCKETS - 1));
+}
+
+/*
+ * 返回第 index 个桶能容纳的最大值
+ */
+uint64_t histogramBucketMax(int index) {
+	int bits;
+	uint64_t sub;
+
+	if (index < HIST_SUB_BUCKETS) return index;
+
+	bits = index / HIST_SUB_BUCKETS + HIST_SUB_BUCKET_BITS - 1;
+	sub = index % HIST_SUB_BUCKETS;
+	return ((HIST_SUB_BUCKETS + sub + 1) << (bits - HIST_SUB_BUCKET_BITS)) - 1;
+}
+
+/*
+ * 创建一个空的直方图
+ */
+histogram *histogramCreate(void) {
+	histogram *h = zmalloc(sizeof(*h));
+	histogramReset(h);
+	return h;
+}
+
+void histogramFree(histogram *h) {
+	zfree(h);
+}
+
+/*
+ * 清空直方图
+ */
+void histogramReset(histogram *h) {
+	memset(h, 0, sizeof(*h));
+}
+
+/*
+ * 记录一个值
+ */
+void histogramRecord(histogram *h, uint64_t value) {
+	h->buckets[histogramBucketIndex(value)]++;
+	h->count++;
+	if (value > h->max) h->max = value;
+}
+
+/*
+ * 和 histogramRecord 一样, 不过可以被几个线程同时调用
+ */
+void histogramRecordAtomic(histogram *h, uint64_t value) {
+	uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+	__atomic_add_fetch(&h->buckets[histogramBucketIndex(value)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+	while (value > max &&
+		!__atomic_compare_exchange_n(&h->max, &max, value, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+ * 返回第 percentile (0 到 100) 百分位的值.
+ * 返回的是值所在的桶能容纳的最大值, 不会超过记录过的最大值.
+ */
+uint64_t histogramValueAtPercentile(histogram *h, double percentile) {
+	uint64_t target, seen = 0;
+	int j;
+
+	if (h->count == 0) return 0;
+	if (percentile > 100) percentile = 100;
+
+	// 至少要数到第一个值
+	target = (uint64_t)(percentile / 100 * h->count + 0.5);
+	if (target == 0) target = 1;
+
+	for (j = 0; j < HIST_BUCKETS; j++) {
+		seen += h->buckets[j];
+		if (seen >= target) {
+			uint64_t v = histogramBucketMax(j);
+			// 最后一个桶没有上限
+			if (j == HIST_BUCKETS - 1) return h->max;
+			return v < h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
@@ -0,0 +1,35 @@
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * 对数-线性分桶的直方图(和 HdrHistogram 的思路一样):
+ * 小于 HIST_SUB_BUCKETS 的值每个值一个桶,
+ * 之后每个 2 的幂次区间再均分为 HIST_SUB_BUCKETS 个桶,
+ * 所以任何一个值的误差都不超过 1/HIST_SUB_BUCKETS (6.25%).
+ */
+#define HIST_SUB_BUCKET_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BUCKET_BITS)
+#define HIST_MAX_BITS 30 /* 最高位不超过第 30 位的值才能区分, 不小于 2^31 的值都记到最后一个桶里 */
+#define HIST_BUCKETS (HIST_SUB_BUCKETS * (HIST_MAX_BITS - HIST_SUB_BUCKET_BITS + 2))
+
+typedef struct histogram {
+
+	uint64_t count; // 记录的值的总数
+
+	uint64_t max; // 记录过的最大值
+
+	uint64_t buckets[HIST_BUCKETS]; // 每个桶中值的数量
+
+} histogram;
+
+histogram *histogramCreate(void);
+void histogramFree(histogram *h);
+void histogramReset(histogram *h);
+void histogramRecord(histogram *h, uint64_t value);
+void histogramRecordAtomic(histogram *h, uint64_t value);
+uint64_t histogramBucketMax(int index);
+uint64_t histogramValueAtPercentile(histogram *h, double percentile);
+
+#endif // __HISTOGRAM_H
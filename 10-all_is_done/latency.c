@@ -0,0 +1,469 @@
+/*
+ * 这个文件实现了 LATENCY 命令:
+ *
+ * 1) LATENCY HISTOGRAM 查看每个命令的耗时分布.
+ * 2) 延迟监视器: 代码中的采样点在某个操作(fork, AOF 写入, 过期键清理...)
+ *    耗时超过 server.latency_monitor_threshold 毫秒时记录一个样本,
+ *    LATENCY LATEST/HISTORY/DOCTOR/RESET 查看和清理这些样本.
+ *
+ * 多 reactor 模式下每个 reactor 记录自己的样本, LATENCY 命令执行时其他
+ * reactor 都停了下来, 同名事件的样本会被合并到一起.
+ */
+#include "redis.h"
+#include "latency.h"
+#include "histogram.h"
+#include "networking.h"
+
+extern struct sharedObjectsStruct shared;
+
+/* ============================ 延迟监视器 ================================== */
+
+static unsigned int dictStringHash(const void *key) {
+	return dictGenHashFunction(key, strlen(key));
+}
+
+static int dictStringKeyCompare(void *privdata, const void *key1, const void *key2) {
+	REDIS_NOTUSED(privdata);
+	return strcmp(key1, key2) == 0;
+}
+
+static void dictVanillaFree(void *privdata, void *val) {
+	REDIS_NOTUSED(privdata);
+	zfree(val);
+}
+
+/* 事件名(C 字符串) -> struct latencyTimeSeries */
+static dictType latencyTimeSeriesDictType = {
+	dictStringHash,             /* hash function */
+	NULL,                       /* key dup */
+	NULL,                       /* val dup */
+	dictStringKeyCompare,       /* key compare */
+	dictVanillaFree,            /* key destructor */
+	dictVanillaFree             /* val destructor */
+};
+
+/*
+ * 初始化当前 reactor 的延迟监视器
+ */
+void latencyMonitorInit(void) {
+	server.latency_events = dictCreate(&latencyTimeSeriesDictType, NULL);
+}
+
+/*
+ * 为事件 event 记录一个延迟样本, 单位为毫秒.
+ * 一般不直接调用, 而是通过 latencyAddSampleIfNeeded 调用.
+ */
+void latencyAddSample(char *event, mstime_t latency) {
+	struct latencyTimeSeries *ts = dictFetchValue(server.latency_events, event);
+	time_t now = server.unixtime;
+	int prev;
+
+	// 第一次出现的事件
+	if (ts == NULL) {
+		ts = zcalloc(sizeof(*ts));
+		dictAdd(server.latency_events, zstrdup(event), ts);
+	}
+	if (latency > ts->max) ts->max = latency;
+
+	// 同一秒内的样本只保留最大的那个
+	prev = (ts->idx + LATENCY_TS_LEN - 1) % LATENCY_TS_LEN;
+	if (ts->samples[prev].time == now) {
+		if (latency > ts->samples[prev].latency)
+			ts->samples[prev].latency = latency;
+		return;
+	}
+
+	ts->samples[ts->idx].time = now;
+	ts->samples[ts->idx].latency = latency;
+	ts->idx = (ts->idx + 1) % LATENCY_TS_LEN;
+}
+
+/*
+ * 检查事件 event 是否已经在第 0 到 reactor - 1 个 reactor 中出现过,
+ * 用于在遍历所有 reactor 的事件时去掉重复的事件名.
+ */
+static int latencyEventSeenBefore(char *event, int reactor) {
+	int r;
+
+	for (r = 0; r < reactor; r++)
+		if (dictFetchValue(servers[r].latency_events, event)) return 1;
+	return 0;
+}
+
+static int latencySampleCompare(const void *a, const void *b) {
+	const struct latencySample *sa = a, *sb = b;
+
+	return (sa->time > sb->time) - (sa->time < sb->time);
+}
+
+/*
+ * 把所有 reactor 中事件 event 的样本合并到 ts 中.
+ * 同一秒内的样本只保留最大的, 只保留最近的 LATENCY_TS_LEN 个样本.
+ * 事件在所有 reactor 中都不存在时返回 REDIS_ERR.
+ */
+static int latencyMergeTimeSeries(char *event, struct latencyTimeSeries *ts) {
+	struct latencySample *samples;
+	int r, j, n = 0, merged = 0, found = 0;
+
+	memset(ts, 0, sizeof(*ts));
+	samples = zmalloc(sizeof(*samples) * LATENCY_TS_LEN * server.reactors_num);
+	for (r = 0; r < server.reactors_num; r++) {
+		struct latencyTimeSeries *rts = dictFetchValue(servers[r].latency_events, event);
+
+		if (rts == NULL) continue;
+		found = 1;
+		if (rts->max > ts->max) ts->max = rts->max;
+		for (j = 0; j < LATENCY_TS_LEN; j++)
+			if (rts->samples[j].time) samples[n++] = rts->samples[j];
+	}
+
+	qsort(samples, n, sizeof(*samples), latencySampleCompare);
+	for (j = 0; j < n; j++) {
+		if (merged && samples[merged - 1].time == samples[j].time) {
+			if (samples[j].latency > samples[merged - 1].latency)
+				samples[merged - 1].latency = samples[j].latency;
+		}
+		else {
+			samples[merged++] = samples[j];
+		}
+	}
+
+	// 按时间顺序写入, idx 最后指向最旧的样本
+	for (j = merged > LATENCY_TS_LEN ? merged - LATENCY_TS_LEN : 0; j < merged; j++) {
+		ts->samples[ts->idx] = samples[j];
+		ts->idx = (ts->idx + 1) % LATENCY_TS_LEN;
+	}
+	zfree(samples);
+	return found ? REDIS_OK : REDIS_ERR;
+}
+
+/* 事件样本的统计数据, 供 LATENCY DOCTOR 使用 */
+struct latencyStats {
+	uint32_t all_time_high; /* 出现过的最大延迟 */
+	uint32_t avg;           /* 现存样本的平均延迟 */
+	uint32_t min;           /* 现存样本的最小延迟 */
+	uint32_t max;           /* 现存样本的最大延迟 */
+	uint32_t mad;           /* 平均绝对偏差 */
+	uint32_t samples;       /* 现存样本的数量 */
+	time_t period;          /* 第一个样本到现在的秒数除以样本数 */
+};
+
+static void analyzeLatencyForEvent(struct latencyTimeSeries *ts, struct latencyStats *ls) {
+	uint64_t sum = 0;
+	int j;
+
+	memset(ls, 0, sizeof(*ls));
+	ls->all_time_high = ts->max;
+	ls->min = UINT32_MAX;
+	for (j = 0; j < LATENCY_TS_LEN; j++) {
+		if (ts->samples[j].time == 0) continue;
+		ls->samples++;
+		sum += ts->samples[j].latency;
+		if (ts->samples[j].latency > ls->max) ls->max = ts->samples[j].latency;
+		if (ts->samples[j].latency < ls->min) ls->min = ts->samples[j].latency;
+		if (ls->period == 0 || ts->samples[j].time < ls->period)
+			ls->period = ts->samples[j].time;
+	}
+	if (ls->samples == 0) {
+		ls->min = 0;
+		return;
+	}
+
+	ls->avg = sum / ls->samples;
+	ls->period = (server.unixtime - ls->period) / ls->samples;
+	if (ls->period == 0) ls->period = 1;
+
+	sum = 0;
+	for (j = 0; j < LATENCY_TS_LEN; j++) {
+		int64_t delta;
+
+		if (ts->samples[j].time == 0) continue;
+		delta = (int64_t)ls->avg - ts->samples[j].latency;
+		sum += delta < 0 ? -delta : delta;
+	}
+	ls->mad = sum / ls->samples;
+}
+
+/*
+ * 根据事件名给出可能的原因和建议
+ */
+static char *latencyEventAdvice(char *event) {
+	if (!strcmp(event, "command"))
+		return "Slow commands are blocking the event loop. Check SLOWLOG GET and "
+			"LATENCY HISTOGRAM, and avoid O(N) commands on big collections.";
+	if (!strcmp(event, "fork"))
+		return "Forking the AOF rewrite child is slow. The fork time grows with the "
+			"dataset size; make sure transparent huge pages are disabled and the "
+			"instance is not running in a VM with slow fork.";
+	if (!strncmp(event, "aof-", 4))
+		return "Writing or fsyncing the AOF is blocking the event loop. The disk is "
+			"probably slow or busy: prefer the everysec fsync policy, enable "
+			"no-appendfsync-on-rewrite, or move the AOF to a faster disk.";
+	if (!strcmp(event, "rdb-save"))
+		return "SAVE blocks the server while the whole dataset is written to disk. "
+			"Avoid calling it on a serving instance.";
+	if (!strcmp(event, "eviction-cycle"))
+		return "Keys are being evicted because maxmemory was reached. Each command "
+			"may have to evict several keys first: raise maxmemory, or lower "
+			"maxmemory_samples to make every eviction cheaper.";
+	if (!strcmp(event, "expire-cycle"))
+		return "The active expire cycle is taking too long, usually because many "
+			"keys are set to expire at the same time. Add some randomness to the "
+			"expire times.";
+	if (!strcmp(event, "server-cron") || !strcmp(event, "before-sleep") ||
+		!strcmp(event, "eventloop-handlers"))
+		return "The event loop itself is stalling. Look at the other events for "
+			"the subsystem that caused it; if none is reported the host may be "
+			"overloaded or swapping.";
+	return "No advice available for this event.";
+}
+
+/*
+ * 生成 LATENCY DOCTOR 的报告
+ */
+static sds createLatencyReport(void) {
+	sds report = sdsempty();
+	int r, eventnum = 0;
+
+	if (server.latency_monitor_threshold == 0)
+		return sdscat(report, "The latency monitor is disabled: "
+			"latency_monitor_threshold is set to 0.\n");
+
+	for (r = 0; r < server.reactors_num; r++) {
+		dictIterator *di = dictGetIterator(servers[r].latency_events);
+		dictEntry *de;
+
+		while ((de = dictNext(di)) != NULL) {
+			char *event = dictGetKey(de);
+			struct latencyTimeSeries ts;
+			struct latencyStats ls;
+
+			if (latencyEventSeenBefore(event, r)) continue;
+			latencyMergeTimeSeries(event, &ts);
+			analyzeLatencyForEvent(&ts, &ls);
+			if (ls.samples == 0) continue;
+
+			eventnum++;
+			report = sdscatprintf(report,
+				"%d. %s: %u latency spikes (average %ums, mean deviation %ums, "
+				"period %ld sec). Worst all time event %ums.\n"
+				"   %s\n\n",
+				eventnum, event, ls.samples, ls.avg, ls.mad,
+				(long)ls.period, ls.all_time_high,
+				latencyEventAdvice(event));
+		}
+		dictReleaseIterator(di);
+	}
+
+	if (eventnum == 0) {
+		report = sdscatprintf(report,
+			"No latency spikes above %lldms were observed. The server is "
+			"behaving well.\n", server.latency_monitor_threshold);
+	}
+	else {
+		report = sdscatprintf(sdscatprintf(sdsempty(),
+			"%d event(s) exceeded the latency monitor threshold of %lldms:\n\n",
+			eventnum, server.latency_monitor_threshold), "%s", report);
+	}
+	return report;
+}
+
+/*
+ * LATENCY LATEST
+ *
+ * 每个事件回复: 事件名, 最近一个样本的时间, 最近一个样本的延迟, 出现过的最大延迟
+ */
+static void latencyLatestCommand(redisClient *c) {
+	void *replylen = addDeferredMultiBulkLength(c);
+	long count = 0;
+	int r;
+
+	for (r = 0; r < server.reactors_num; r++) {
+		dictIterator *di = dictGetIterator(servers[r].latency_events);
+		dictEntry *de;
+
+		while ((de = dictNext(di)) != NULL) {
+			char *event = dictGetKey(de);
+			struct latencyTimeSeries ts;
+			int last;
+
+			if (latencyEventSeenBefore(event, r)) continue;
+			latencyMergeTimeSeries(event, &ts);
+			last = (ts.idx + LATENCY_TS_LEN - 1) % LATENCY_TS_LEN;
+
+			addReplyMultiBulkLen(c, 4);
+			addReplyBulkCString(c, event);
+			addReplyLongLong(c, ts.samples[last].time);
+			addReplyLongLong(c, ts.samples[last].latency);
+			addReplyLongLong(c, ts.max);
+			count++;
+		}
+		dictReleaseIterator(di);
+	}
+	setDeferredMultiBulkLength(c, replylen, count);
+}
+
+/*
+ * LATENCY HISTORY event
+ *
+ * 按时间顺序回复事件的所有样本: [时间, 延迟]
+ */
+static void latencyHistoryCommand(redisClient *c) {
+	struct latencyTimeSeries ts;
+	int j, samples = 0;
+
+	if (latencyMergeTimeSeries(c->argv[2]->ptr, &ts) == REDIS_ERR) {
+		addReplyMultiBulkLen(c, 0);
+		return;
+	}
+
+	for (j = 0; j < LATENCY_TS_LEN; j++)
+		if (ts.samples[j].time) samples++;
+
+	addReplyMultiBulkLen(c, samples);
+	for (j = 0; j < LATENCY_TS_LEN; j++) {
+		int i = (ts.idx + j) % LATENCY_TS_LEN;
+
+		if (ts.samples[i].time == 0) continue;
+		addReplyMultiBulkLen(c, 2);
+		addReplyLongLong(c, ts.samples[i].time);
+		addReplyLongLong(c, ts.samples[i].latency);
+	}
+}
+
+/*
+ * LATENCY RESET [event ...]
+ *
+ * 不带参数时清空所有事件, 回复被清空的事件数量.
+ */
+static void latencyResetCommand(redisClient *c) {
+	long long resets = 0;
+	int r, j;
+
+	// 先数出有多少个不同的事件, 再清空
+	if (c->argc == 2) {
+		for (r = 0; r < server.reactors_num; r++) {
+			dictIterator *di = dictGetIterator(servers[r].latency_events);
+			dictEntry *de;
+
+			while ((de = dictNext(di)) != NULL)
+				if (!latencyEventSeenBefore(dictGetKey(de), r)) resets++;
+			dictReleaseIterator(di);
+		}
+		for (r = 0; r < server.reactors_num; r++)
+			dictEmpty(servers[r].latency_events, NULL);
+	}
+	else {
+		for (j = 2; j < c->argc; j++) {
+			int found = 0;
+
+			for (r = 0; r < server.reactors_num; r++)
+				if (dictDelete(servers[r].latency_events, c->argv[j]->ptr) == DICT_OK)
+					found = 1;
+			resets += found;
+		}
+	}
+	addReplyLongLong(c, resets);
+}
+
+/* ============================ LATENCY HISTOGRAM =========================== */
+
+/*
+ * 回复一个命令的耗时直方图, 格式为:
+ *
+ * 1) 命令名
+ * 2) 1) "calls"
+ *    2) 调用次数
+ *    3) "histogram_usec"
+ *    4) 1) 桶的上限(微秒)
+ *       2) 耗时不超过这个上限的调用次数
+ *       ...
+ *
+ * 只输出非空的桶, 次数是累计的.
+ */
+static void latencyReplyHistogram(redisClient *c, struct redisCommand *cmd) {
+	histogram *h = cmd->latency_histogram;
+	uint64_t seen = 0;
+	int j, buckets = 0;
+
+	for (j = 0; j < HIST_BUCKETS; j++)
+		if (h->buckets[j]) buckets++;
+
+	addReplyBulkCString(c, cmd->name);
+	addReplyMultiBulkLen(c, 4);
+	addReplyBulkCString(c, "calls");
+	addReplyLongLong(c, h->count);
+	addReplyBulkCString(c, "histogram_usec");
+	addReplyMultiBulkLen(c, buckets * 2);
+	for (j = 0; j < HIST_BUCKETS; j++) {
+		if (!h->buckets[j]) continue;
+		seen += h->buckets[j];
+		// 最后一个桶没有上限, 用记录过的最大值代替
+		addReplyLongLong(c, j == HIST_BUCKETS - 1 ? h->max : histogramBucketMax(j));
+		addReplyLongLong(c, seen);
+	}
+}
+
+/*
+ * LATENCY HISTOGRAM [command ...]
+ *
+ * 不带参数时输出所有被调用过的命令.
+ */
+static void latencyHistogramCommand(redisClient *c) {
+	void *replylen = addDeferredMultiBulkLength(c);
+	long count = 0;
+	int j;
+
+	if (c->argc == 2) {
+		dictIterator *di = dictGetIterator(server.commands);
+		dictEntry *de;
+
+		while ((de = dictNext(di)) != NULL) {
+			struct redisCommand *cmd = dictGetVal(de);
+
+			if (!cmd->latency_histogram->count) continue;
+			latencyReplyHistogram(c, cmd);
+			count++;
+		}
+		dictReleaseIterator(di);
+	}
+	else {
+		for (j = 2; j < c->argc; j++) {
+			struct redisCommand *cmd = lookupCommand(c->argv[j]->ptr);
+
+			// 不存在或者没有被调用过的命令直接跳过
+			if (cmd == NULL || !cmd->latency_histogram->count) continue;
+			latencyReplyHistogram(c, cmd);
+			count++;
+		}
+	}
+	setDeferredMultiBulkLength(c, replylen, count * 2);
+}
+
+/*
+ * LATENCY <subcommand> [arg ...]
+ */
+void latencyCommand(redisClient *c) {
+	if (!strcasecmp(c->argv[1]->ptr, "histogram")) {
+		latencyHistogramCommand(c);
+	}
+	else if (!strcasecmp(c->argv[1]->ptr, "latest") && c->argc == 2) {
+		latencyLatestCommand(c);
+	}
+	else if (!strcasecmp(c->argv[1]->ptr, "history") && c->argc == 3) {
+		latencyHistoryCommand(c);
+	}
+	else if (!strcasecmp(c->argv[1]->ptr, "doctor") && c->argc == 2) {
+		sds report = createLatencyReport();
+
+		addReplyBulkCBuffer(c, report, sdslen(report));
+		sdsfree(report);
+	}
+	else if (!strcasecmp(c->argv[1]->ptr, "reset")) {
+		latencyResetCommand(c);
+	}
+	else {
+		addReplyErrorFormat(c, "Unknown LATENCY subcommand or wrong number of arguments for '%s'",
+			(char *)c->argv[1]->ptr);
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef __LATENCY_H
+#define __LATENCY_H
+
+#include "redis.h"
+
+#define LATENCY_TS_LEN 160 /* 每个事件最多保存的样本数 */
+
+/* 一个延迟样本, 同一秒内的多个样本只保留最大的那个 */
+struct latencySample {
+	int32_t time; /* 样本的 unix 时间, 单位为秒 */
+	uint32_t latency; /* 延迟, 单位为毫秒 */
+};
+
+/* 一个事件的样本序列, 是一个环形缓冲区 */
+struct latencyTimeSeries {
+	int idx; /* 下一个样本写入的位置 */
+	uint32_t max; /* 出现过的最大延迟 */
+	struct latencySample samples[LATENCY_TS_LEN]; /* 最近的样本 */
+};
+
+void latencyMonitorInit(void);
+void latencyAddSample(char *event, mstime_t latency);
+void latencyCommand(redisClient *c);
+
+/*
+ * 延迟采样点的用法:
+ *
+ *   mstime_t latency;
+ *   latencyStartMonitor(latency);
+ *   ... 可能很慢的操作 ...
+ *   latencyEndMonitor(latency);
+ *   latencyAddSampleIfNeeded("event-name", latency);
+ *
+ * server.latency_monitor_threshold 为 0 时不做任何事情.
+ */
+#define latencyStartMonitor(var) if (server.latency_monitor_threshold) { \
+	var = mstime(); \
+} else { \
+	var = 0; \
+}
+
+#define latencyEndMonitor(var) if (server.latency_monitor_threshold) { \
+	var = mstime() - var; \
+}
+
+#define latencyAddSampleIfNeeded(event, var) \
+	if (server.latency_monitor_threshold && \
+		(var) >= server.latency_monitor_threshold) \
+		latencyAddSample((event), (var));
+
+#endif /* __LATENCY_H */
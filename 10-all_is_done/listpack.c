@@ -0,0 +1,800 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <assert.h>
+#include "zmalloc.h"
+#include "util.h"
+#include "listpack.h"
+
+/*
+ * listpack 的内存布局:
+ *
+ * <total-bytes> <num-elements> <element-1> ... <element-N> <end>
+ *
+ * total-bytes 是 4 字节的小端整数, 记录整个 listpack 的字节数.
+ * num-elements 是 2 字节的小端整数, 等于 LP_HDR_NUMELE_UNKNOWN 时
+ * 表示元素太多, 需要遍历才能知道个数.
+ * end 是一个值为 0xFF 的字节.
+ *
+ * 每个元素的布局:
+ *
+ * <encoding-type + element-data> <element-backlen>
+ *
+ * backlen 是前半部分的字节数, 从右往左读, 每个字节保存 7 位,
+ * 最高位为 1 表示左边还有字节, 所以从任意元素的起点都能找到前一个元素.
+ */
+
+#define LP_HDR_SIZE 6
+#define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
+#define LP_EOF 0xFF
+
+/* 整数编码最多 9 个字节, backlen 最多 5 个字节 */
+#define LP_MAX_INT_ENCODING_LEN 9
+#define LP_MAX_BACKLEN_SIZE 5
+
+/*
+ * 编码类型
+ *
+ * 0xxxxxxx                     7 位无符号整数
+ * 10xxxxxx                     长度在 6 位以内的字符串
+ * 110xxxxx yyyyyyyy            13 位有符号整数
+ * 1110xxxx yyyyyyyy            长度在 12 位以内的字符串
+ * 11110000 + 4 字节长度          长度在 32 位以内的字符串
+ * 11110001 / 0010 / 0011 / 0100 16 / 24 / 32 / 64 位有符号整数
+ */
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_IS_7BIT_UINT(byte) (((byte) & LP_ENCODING_7BIT_UINT_MASK) == LP_ENCODING_7BIT_UINT)
+
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_IS_6BIT_STR(byte) (((byte) & LP_ENCODING_6BIT_STR_MASK) == LP_ENCODING_6BIT_STR)
+
+#define LP_ENCODING_13BIT_INT 0xC0
+#define LP_ENCODING_13BIT_INT_MASK 0xE0
+#define LP_ENCODING_IS_13BIT_INT(byte) (((byte) & LP_ENCODING_13BIT_INT_MASK) == LP_ENCODING_13BIT_INT)
+
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_IS_12BIT_STR(byte) (((byte) & LP_ENCODING_12BIT_STR_MASK) == LP_ENCODING_12BIT_STR)
+
+#define LP_ENCODING_32BIT_STR 0xF0
+#define LP_ENCODING_16BIT_INT 0xF1
+#define LP_ENCODING_24BIT_INT 0xF2
+#define LP_ENCODING_32BIT_INT 0xF3
+#define LP_ENCODING_64BIT_INT 0xF4
+
+#define LP_ENCODING_6BIT_STR_LEN(p) ((p)[0] & 0x3F)
+#define LP_ENCODING_12BIT_STR_LEN(p) ((((p)[0] & 0xF) << 8) | (p)[1])
+#define LP_ENCODING_32BIT_STR_LEN(p) (((uint32_t)(p)[1] << 0) | \
+	((uint32_t)(p)[2] << 8) | \
+	((uint32_t)(p)[3] << 16) | \
+	((uint32_t)(p)[4] << 24))
+
+/* 元素的插入位置 */
+#define LP_BEFORE 0
+#define LP_AFTER 1
+#define LP_REPLACE 2
+
+#define LP_ENCODING_INT 0
+#define LP_ENCODING_STRING 1
+
+/*
+ * 读写表头
+ */
+#define lpGetTotalBytes(p) (((uint32_t)(p)[0] << 0) | \
+	((uint32_t)(p)[1] << 8) | \
+	((uint32_t)(p)[2] << 16) | \
+	((uint32_t)(p)[3] << 24))
+
+#define lpGetNumElements(p) (((uint32_t)(p)[4] << 0) | \
+	((uint32_t)(p)[5] << 8))
+
+#define lpSetTotalBytes(p, v) do { \
+	(p)[0] = (v) & 0xff; \
+	(p)[1] = ((v) >> 8) & 0xff; \
+	(p)[2] = ((v) >> 16) & 0xff; \
+	(p)[3] = ((v) >> 24) & 0xff; \
+} while (0)
+
+#define lpSetNumElements(p, v) do { \
+	(p)[4] = (v) & 0xff; \
+	(p)[5] = ((v) >> 8) & 0xff; \
+} while (0)
+
+/*
+ * 创建一个空的 listpack
+ */
+unsigned char *lpNew(void) {
+	unsigned char *lp = zmalloc(LP_HDR_SIZE + 1);
+	lpSetTotalBytes(lp, LP_HDR_SIZE + 1);
+	lpSetNumElements(lp, 0);
+	lp[LP_HDR_SIZE] = LP_EOF;
+	return lp;
+}
+
+/*
+ * 检查字符串 ele 能否编码成整数, 可以的话把编码写入 intenc,
+ * 编码的字节数写入 *enclen, 并返回 LP_ENCODING_INT.
+ *
+ * 否则返回 LP_ENCODING_STRING, *enclen 是字符串编码之后的字节数.
+ */
+static int lpEncodeGetType(unsigned char *ele, uint32_t size, unsigned char *intenc, uint64_t *enclen) {
+	long long v;
+
+	if (size > 0 && size <= 20 && string2ll((char*)ele, size, &v)) {
+		if (v >= 0 && v <= 127) {
+			intenc[0] = v;
+			*enclen = 1;
+		}
+		else if (v >= -4096 && v <= 4095) {
+			/* 负数用补码保存 */
+			if (v < 0) v = ((int64_t)1 << 13) + v;
+			intenc[0] = (v >> 8) | LP_ENCODING_13BIT_INT;
+			intenc[1] = v & 0xff;
+			*enclen = 2;
+		}
+		else if (v >= INT16_MIN && v <= INT16_MAX) {
+			if (v < 0) v = ((int64_t)1 << 16) + v;
+			intenc[0] = LP_ENCODING_16BIT_INT;
+			intenc[1] = v & 0xff;
+			intenc[2] = v >> 8;
+			*enclen = 3;
+		}
+		else if (v >= -8388608 && v <= 8388607) {
+			if (v < 0) v = ((int64_t)1 << 24) + v;
+			intenc[0] = LP_ENCODING_24BIT_INT;
+			intenc[1] = v & 0xff;
+			intenc[2] = (v >> 8) & 0xff;
+			intenc[3] = v >> 16;
+			*enclen = 4;
+		}
+		else if (v >= INT32_MIN && v <= INT32_MAX) {
+			if (v < 0) v = ((int64_t)1 << 32) + v;
+			intenc[0] = LP_ENCODING_32BIT_INT;
+			intenc[1] = v & 0xff;
+			intenc[2] = (v >> 8) & 0xff;
+			intenc[3] = (v >> 16) & 0xff;
+			intenc[4] = v >> 24;
+			*enclen = 5;
+		}
+		else {
+			uint64_t uv = v;
+			int i;
+			intenc[0] = LP_ENCODING_64BIT_INT;
+			for (i = 1; i <= 8; i++) {
+				intenc[i] = uv & 0xff;
+				uv >>= 8;
+			}
+			*enclen = 9;
+		}
+		return LP_ENCODING_INT;
+	}
+
+	if (size < 64) *enclen = 1 + size;
+	else if (size < 4096) *enclen = 2 + size;
+	else *enclen = 5 + (uint64_t)size;
+	return LP_ENCODING_STRING;
+}
+
+/*
+ * 把字符串 s 按照 len 对应的编码写入 buf
+ */
+static void lpEncodeString(unsigned char *buf, unsigned char *s, uint32_t len) {
+	if (len < 64) {
+		buf[0] = len | LP_ENCODING_6BIT_STR;
+		memcpy(buf + 1, s, len);
+	}
+	else if (len < 4096) {
+		buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+		buf[1] = len & 0xff;
+		memcpy(buf + 2, s, len);
+	}
+	else {
+		buf[0] = LP_ENCODING_32BIT_STR;
+		buf[1] = len & 0xff;
+		buf[2] = (len >> 8) & 0xff;
+		buf[3] = (len >> 16) & 0xff;
+		buf[4] = (len >> 24) & 0xff;
+		memcpy(buf + 5, s, len);
+	}
+}
+
+/*
+ * 把长度 l 编码成 backlen 写入 buf, 返回 backlen 的字节数.
+ *
+ * buf 为 NULL 时只计算字节数.
+ */
+static unsigned long lpEncodeBacklen(unsigned char *buf, uint64_t l) {
+	if (l <= 127) {
+		if (buf) buf[0] = l;
+		return 1;
+	}
+	else if (l < 16383) {
+		if (buf) {
+			buf[0] = l >> 7;
+			buf[1] = (l & 127) | 128;
+		}
+		return 2;
+	}
+	else if (l < 2097151) {
+		if (buf) {
+			buf[0] = l >> 14;
+			buf[1] = ((l >> 7) & 127) | 128;
+			buf[2] = (l & 127) | 128;
+		}
+		return 3;
+	}
+	else if (l < 268435455) {
+		if (buf) {
+			buf[0] = l >> 21;
+			buf[1] = ((l >> 14) & 127) | 128;
+			buf[2] = ((l >> 7) & 127) | 128;
+			buf[3] = (l & 127) | 128;
+		}
+		return 4;
+	}
+	else {
+		if (buf) {
+			buf[0] = l >> 28;
+			buf[1] = ((l >> 21) & 127) | 128;
+			buf[2] = ((l >> 14) & 127) | 128;
+			buf[3] = ((l >> 7) & 127) | 128;
+			buf[4] = (l & 127) | 128;
+		}
+		return 5;
+	}
+}
+
+/*
+ * 从 backlen 的最后一个字节 p 开始往左解码出前一个元素的长度,
+ * 和 lpEncodeBacklen 对应, backlen 最多 5 个字节
+ */
+static uint64_t lpDecodeBacklen(unsigned char *p) {
+	uint64_t val = 0;
+	uint64_t shift = 0;
+	do {
+		val |= (uint64_t)(p[0] & 127) << shift;
+		if (!(p[0] & 128)) break;
+		shift += 7;
+		p--;
+	} while (shift <= 28);
+	return val;
+}
+
+/*
+ * 返回 p 所指向的元素的 编码 + 数据 部分的字节数, 不包括 backlen
+ */
+static uint32_t lpCurrentEncodedSize(unsigned char *p) {
+	if (LP_ENCODING_IS_7BIT_UINT(p[0])) return 1;
+	if (LP_ENCODING_IS_6BIT_STR(p[0])) return 1 + LP_ENCODING_6BIT_STR_LEN(p);
+	if (LP_ENCODING_IS_13BIT_INT(p[0])) return 2;
+	if (LP_ENCODING_IS_12BIT_STR(p[0])) return 2 + LP_ENCODING_12BIT_STR_LEN(p);
+	switch (p[0]) {
+	case LP_ENCODING_16BIT_INT: return 3;
+	case LP_ENCODING_24BIT_INT: return 4;
+	case LP_ENCODING_32BIT_INT: return 5;
+	case LP_ENCODING_64BIT_INT: return 9;
+	case LP_ENCODING_32BIT_STR: return 5 + LP_ENCODING_32BIT_STR_LEN(p);
+	case LP_EOF: return 1;
+	}
+	/* 损坏的 listpack */
+	assert(0);
+	return 0;
+}
+
+/*
+ * 跳过 p 所指向的元素, 返回下一个元素 (或者 end) 的位置
+ */
+static unsigned char *lpSkip(unsigned char *p) {
+	unsigned long entrylen = lpCurrentEncodedSize(p);
+	entrylen += lpEncodeBacklen(NULL, entrylen);
+	return p + entrylen;
+}
+
+/*
+ * 返回 p 所指向的元素的值.
+ *
+ * 元素是字符串时返回字符串的指针, 长度保存到 *count;
+ * 元素是整数时返回 NULL, 值保存到 *ival.
+ */
+static unsigned char *lpGetValue(unsigned char *p, uint32_t *count, int64_t *ival) {
+	uint64_t uval, negstart, negmax;
+
+	if (LP_ENCODING_IS_7BIT_UINT(p[0])) {
+		*ival = p[0] & 0x7f;
+		return NULL;
+	}
+	else if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+		*count = LP_ENCODING_6BIT_STR_LEN(p);
+		return p + 1;
+	}
+	else if (LP_ENCODING_IS_13BIT_INT(p[0])) {
+		uval = ((uint64_t)(p[0] & 0x1f) << 8) | p[1];
+		negstart = (uint64_t)1 << 12;
+		negmax = 8191;
+	}
+	else if (LP_ENCODING_IS_12BIT_STR(p[0])) {
+		*count = LP_ENCODING_12BIT_STR_LEN(p);
+		return p + 2;
+	}
+	else if (p[0] == LP_ENCODING_16BIT_INT) {
+		uval = (uint64_t)p[1] | (uint64_t)p[2] << 8;
+		negstart = (uint64_t)1 << 15;
+		negmax = UINT16_MAX;
+	}
+	else if (p[0] == LP_ENCODING_24BIT_INT) {
+		uval = (uint64_t)p[1] | (uint64_t)p[2] << 8 | (uint64_t)p[3] << 16;
+		negstart = (uint64_t)1 << 23;
+		negmax = UINT32_MAX >> 8;
+	}
+	else if (p[0] == LP_ENCODING_32BIT_INT) {
+		uval = (uint64_t)p[1] | (uint64_t)p[2] << 8 |
+			(uint64_t)p[3] << 16 | (uint64_t)p[4] << 24;
+		negstart = (uint64_t)1 << 31;
+		negmax = UINT32_MAX;
+	}
+	else if (p[0] == LP_ENCODING_64BIT_INT) {
+		int i;
+		uval = 0;
+		for (i = 8; i >= 1; i--) uval = (uval << 8) | p[i];
+		negstart = (uint64_t)1 << 63;
+		negmax = UINT64_MAX;
+	}
+	else {
+		*count = LP_ENCODING_32BIT_STR_LEN(p);
+		return p + 5;
+	}
+
+	/* 补码转换回有符号整数 */
+	if (uval >= negstart) {
+		uval = negmax - uval;
+		*ival = uval;
+		*ival = -*ival - 1;
+	}
+	else {
+		*ival = uval;
+	}
+	return NULL;
+}
+
+/*
+ * 取出 p 所指向的元素的值.
+ *
+ * 字符串保存到 *sval 和 *slen, 整数保存到 *lval 并把 *sval 设为 NULL.
+ *
+ * p 为 NULL 或者指向 end 时返回 0 , 否则返回 1 .
+ */
+unsigned int lpGet(unsigned char *p, unsigned char **sval, unsigned int *slen, long long *lval) {
+	unsigned char *s;
+	uint32_t count;
+	int64_t ival;
+
+	if (p == NULL || p[0] == LP_EOF) return 0;
+	if (sval) *sval = NULL;
+
+	s = lpGetValue(p, &count, &ival);
+	if (s) {
+		if (sval) {
+			*sval = s;
+			*slen = count;
+		}
+	}
+	else {
+		if (lval) *lval = ival;
+	}
+	return 1;
+}
+
+/*
+ * 所有插入, 删除和替换操作的实现.
+ *
+ * ele 为 NULL 时删除 p 所指向的元素, 否则按 where 把 ele 插入到
+ * p 的前面, 后面, 或者替换掉 p.
+ *
+ * newp 不为 NULL 时, *newp 指向新插入的元素, 删除时指向被删除元素
+ * 原来的位置 (可能是 end).
+ *
+ * 只需要移动 p 之后的内存, 不会像 ziplist 那样引起连锁更新.
+ */
+static unsigned char *lpInsertElement(unsigned char *lp, unsigned char *ele, uint32_t size,
+	unsigned char *p, int where, unsigned char **newp) {
+
+	unsigned char intenc[LP_MAX_INT_ENCODING_LEN];
+	unsigned char backlen[LP_MAX_BACKLEN_SIZE];
+	uint64_t enclen = 0;
+	unsigned long backlen_size = 0;
+	int enctype = LP_ENCODING_STRING;
+	int delete = (ele == NULL);
+	uint64_t old_bytes, new_bytes;
+	uint32_t replaced_len = 0;
+	unsigned long poff;
+	unsigned char *dst;
+
+	if (delete) where = LP_REPLACE;
+
+	/* 插入到 p 的后面等于插入到下一个元素的前面 */
+	if (where == LP_AFTER) {
+		p = lpSkip(p);
+		where = LP_BEFORE;
+	}
+
+	poff = p - lp;
+
+	if (!delete) {
+		enctype = lpEncodeGetType(ele, size, intenc, &enclen);
+		backlen_size = lpEncodeBacklen(backlen, enclen);
+	}
+
+	old_bytes = lpGetTotalBytes(lp);
+	if (where == LP_REPLACE) {
+		replaced_len = lpCurrentEncodedSize(p);
+		replaced_len += lpEncodeBacklen(NULL, replaced_len);
+	}
+
+	new_bytes = old_bytes + enclen + backlen_size - replaced_len;
+	if (new_bytes > UINT32_MAX) return NULL;
+
+	/* 变大时先扩展内存再移动, 变小时先移动再收缩内存 */
+	dst = lp + poff;
+	if (new_bytes > old_bytes) {
+		lp = zrealloc(lp, new_bytes);
+		dst = lp + poff;
+	}
+
+	if (where == LP_BEFORE) {
+		memmove(dst + enclen + backlen_size, dst, old_bytes - poff);
+	}
+	else {
+		memmove(dst + enclen + backlen_size, dst + replaced_len, old_bytes - poff - replaced_len);
+	}
+
+	if (new_bytes < old_bytes) {
+		lp = zrealloc(lp, new_bytes);
+		dst = lp + poff;
+	}
+
+	if (newp) *newp = dst;
+
+	if (!delete) {
+		if (enctype == LP_ENCODING_INT) {
+			memcpy(dst, intenc, enclen);
+		}
+		else {
+			lpEncodeString(dst, ele, size);
+		}
+		dst += enclen;
+		memcpy(dst, backlen, backlen_size);
+	}
+
+	/* 更新元素个数, 个数未知时保持未知 */
+	if (where != LP_REPLACE || delete) {
+		uint32_t num = lpGetNumElements(lp);
+		if (num != LP_HDR_NUMELE_UNKNOWN) {
+			if (!delete) lpSetNumElements(lp, num + 1);
+			else lpSetNumElements(lp, num - 1);
+		}
+	}
+	lpSetTotalBytes(lp, new_bytes);
+
+	return lp;
+}
+
+/*
+ * 把 s 添加到 listpack 的表头或者表尾
+ */
+unsigned char *lpPush(unsigned char *lp, unsigned char *s, unsigned int slen, int where) {
+	unsigned char *p;
+	if (where == LP_HEAD) {
+		p = lp + LP_HDR_SIZE;
+	}
+	else {
+		p = lp + lpGetTotalBytes(lp) - 1;
+	}
+	return lpInsertElement(lp, s, slen, p, LP_BEFORE, NULL);
+}
+
+/*
+ * 把 s 插入到 p 的前面, p 指向 end 时添加到表尾.
+ *
+ * T = O(N)
+ */
+unsigned char *lpInsert(unsigned char *lp, unsigned char *p, unsigned char *s, unsigned int slen) {
+	return lpInsertElement(lp, s, slen, p, LP_BEFORE, NULL);
+}
+
+/*
+ * 用 s 替换 *p 所指向的元素, *p 被更新为替换之后的元素
+ */
+unsigned char *lpReplace(unsigned char *lp, unsigned char **p, unsigned char *s, unsigned int slen) {
+	return lpInsertElement(lp, s, slen, *p, LP_REPLACE, p);
+}
+
+/*
+ * 删除 *p 所指向的元素, 并原地更新 *p,
+ * 使得可以在迭代的过程中删除元素.
+ */
+unsigned char *lpDelete(unsigned char *lp, unsigned char **p) {
+	return lpInsertElement(lp, NULL, 0, *p, LP_REPLACE, p);
+}
+
+/*
+ * 从索引 index 开始删除 num 个元素
+ */
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num) {
+	unsigned char *first, *tail;
+	unsigned long deleted = 0;
+	uint32_t bytes, numele;
+
+	if (num == 0) return lp;
+	first = lpSeek(lp, index);
+	if (first == NULL) return lp;
+
+	tail = first;
+	while (deleted < num && tail[0] != LP_EOF) {
+		tail = lpSkip(tail);
+		deleted++;
+	}
+
+	bytes = lpGetTotalBytes(lp);
+	memmove(first, tail, lp + bytes - tail);
+	bytes -= tail - first;
+	lp = zrealloc(lp, bytes);
+	lpSetTotalBytes(lp, bytes);
+
+	numele = lpGetNumElements(lp);
+	if (numele != LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp, numele - deleted);
+	return lp;
+}
+
+/*
+ * 返回第一个元素, listpack 为空时返回 NULL
+ */
+unsigned char *lpFirst(unsigned char *lp) {
+	unsigned char *p = lp + LP_HDR_SIZE;
+	if (p[0] == LP_EOF) return NULL;
+	return p;
+}
+
+/*
+ * 返回 p 的后一个元素, 没有的话返回 NULL
+ */
+unsigned char *lpNext(unsigned char *lp, unsigned char *p) {
+	(void)lp;
+	if (p[0] == LP_EOF) return NULL;
+	p = lpSkip(p);
+	if (p[0] == LP_EOF) return NULL;
+	return p;
+}
+
+/*
+ * 返回 p 的前一个元素, p 是第一个元素时返回 NULL.
+ *
+ * p 指向 end 时返回最后一个元素.
+ */
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p) {
+	uint64_t prevlen;
+
+	if (p - lp == LP_HDR_SIZE) return NULL;
+
+	/* 读出前一个元素尾部的 backlen */
+	p--;
+	prevlen = lpDecodeBacklen(p);
+	prevlen += lpEncodeBacklen(NULL, prevlen);
+	return p - prevlen + 1;
+}
+
+/*
+ * 返回最后一个元素, listpack 为空时返回 NULL
+ */
+unsigned char *lpLast(unsigned char *lp) {
+	unsigned char *p = lp + lpGetTotalBytes(lp) - 1;
+	return lpPrev(lp, p);
+}
+
+/*
+ * 返回元素个数
+ */
+unsigned long lpLength(unsigned char *lp) {
+	uint32_t numele = lpGetNumElements(lp);
+	unsigned long count = 0;
+	unsigned char *p;
+
+	if (numele != LP_HDR_NUMELE_UNKNOWN) return numele;
+
+	/* 元素太多, 只能遍历计算 */
+	p = lp + LP_HDR_SIZE;
+	while (p[0] != LP_EOF) {
+		p = lpSkip(p);
+		count++;
+	}
+
+	/* 个数又能放进表头时, 写回去 */
+	if (count < LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp, count);
+	return count;
+}
+
+/*
+ * 返回 listpack 占用的字节数
+ */
+size_t lpBytes(unsigned char *lp) {
+	return lpGetTotalBytes(lp);
+}
+
+/*
+ * 返回索引 index 上的元素, 负数从表尾开始计算.
+ *
+ * 从离 index 更近的一端开始遍历, 索引越界时返回 NULL.
+ */
+unsigned char *lpSeek(unsigned char *lp, long index) {
+	long numele = lpLength(lp);
+	unsigned char *p;
+	int forward = 1;
+
+	if (index < 0) index = numele + index;
+	if (index < 0 || index >= numele) return NULL;
+
+	if (index > numele / 2) {
+		forward = 0;
+		index -= numele;
+	}
+
+	if (forward) {
+		p = lpFirst(lp);
+		while (index > 0 && p) {
+			p = lpNext(lp, p);
+			index--;
+		}
+	}
+	else {
+		p = lpLast(lp);
+		while (index < -1 && p) {
+			p = lpPrev(lp, p);
+			index++;
+		}
+	}
+	return p;
+}
+
+/*
+ * 对比 p 所指向的元素和字符串 s, 相等返回 1 , 不相等返回 0 .
+ */
+unsigned int lpCompare(unsigned char *p, unsigned char *s, unsigned int slen) {
+	unsigned char *value;
+	uint32_t count;
+	int64_t ival;
+	long long sval;
+
+	if (p[0] == LP_EOF) return 0;
+
+	value = lpGetValue(p, &count, &ival);
+	if (value) {
+		return count == slen && memcmp(value, s, slen) == 0;
+	}
+
+	/* 元素是整数, s 也要能转换成同一个整数 */
+	if (slen > 0 && slen <= 20 && string2ll((char*)s, slen, &sval)) {
+		return ival == sval;
+	}
+	return 0;
+}
+
+/*
+ * 从 p 开始寻找值等于 s 的元素, 每次对比之后跳过 skip 个元素.
+ *
+ * 找不到时返回 NULL.
+ */
+unsigned char *lpFind(unsigned char *p, unsigned char *s, unsigned int slen, unsigned int skip) {
+	int skipcnt = 0;
+	/* 0 表示还没有尝试把 s 转换成整数, 1 表示可以转换, -1 表示不能 */
+	int sintenc = 0;
+	long long sval = 0;
+
+	while (p[0] != LP_EOF) {
+		if (skipcnt == 0) {
+			unsigned char *value;
+			uint32_t count;
+			int64_t ival;
+
+			value = lpGetValue(p, &count, &ival);
+			if (value) {
+				if (count == slen && memcmp(value, s, slen) == 0) return p;
+			}
+			else {
+				/* s 只在第一次遇到整数元素时转换一次 */
+				if (sintenc == 0) {
+					sintenc = (slen > 0 && slen <= 20 &&
+						string2ll((char*)s, slen, &sval)) ? 1 : -1;
+				}
+				if (sintenc == 1 && ival == sval) return p;
+			}
+			skipcnt = skip;
+		}
+		else {
+			skipcnt--;
+		}
+		p = lpSkip(p);
+	}
+	return NULL;
+}
+
+#ifdef LISTPACK_TEST_MAIN
+/*
+ * 测试: make listpack-test && ./listpack-test
+ */
+
+static int failed = 0;
+
+#define test_assert(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+/*
+ * backlen 在每种长度的边界上编码之后都能解码回来, 包括 5 个字节的
+ */
+static void testBacklen(void) {
+	static const uint64_t lens[] = {
+		0, 1, 127, 128, 16382, 16383, 16384, 2097150, 2097151, 2097152,
+		268435454, 268435455, 268435456, 4294967295ULL
+	};
+	unsigned char buf[5];
+	unsigned int j;
+
+	for (j = 0; j < sizeof(lens) / sizeof(*lens); j++) {
+		unsigned long n = lpEncodeBacklen(buf, lens[j]);
+
+		test_assert(n >= 1 && n <= 5);
+		test_assert(lpDecodeBacklen(buf + n - 1) == lens[j]);
+	}
+	test_assert(lpEncodeBacklen(NULL, 4294967295ULL) == 5);
+}
+
+/*
+ * 长度不同的元素从两个方向遍历的结果一致
+ */
+static void testTraverse(void) {
+	static const unsigned int sizes[] = { 0, 1, 63, 64, 127, 200, 4095, 4096, 16380, 20000, 70000 };
+	unsigned int nsizes = sizeof(sizes) / sizeof(*sizes);
+	unsigned char *lp = lpNew(), *p, *s = zmalloc(70000), *vstr;
+	unsigned int vlen, j;
+	long long vlong;
+
+	for (j = 0; j < nsizes; j++) {
+		memset(s, 'a' + j, sizes[j]);
+		lp = lpPush(lp, s, sizes[j], LP_TAIL);
+	}
+	test_assert(lpLength(lp) == nsizes);
+
+	for (p = lpFirst(lp), j = 0; p; p = lpNext(lp, p), j++)
+		test_assert(lpGet(p, &vstr, &vlen, &vlong) && vlen == sizes[j]);
+	test_assert(j == nsizes);
+
+	for (p = lpLast(lp), j = nsizes; p; p = lpPrev(lp, p), j--)
+		test_assert(lpGet(p, &vstr, &vlen, &vlong) && vlen == sizes[j - 1] &&
+			(vlen == 0 || vstr[vlen - 1] == 'a' + j - 1));
+	test_assert(j == 0);
+
+	zfree(s);
+	zfree(lp);
+}
+
+int main(int argc, char **argv) {
+	((void) argc);
+	((void) argv);
+
+	testBacklen();
+	testTraverse();
+
+	if (failed) {
+		printf("%d assertions failed\n", failed);
+		return 1;
+	}
+	printf("all tests passed\n");
+	return 0;
+}
+#endif
@@ -0,0 +1,33 @@
+#ifndef __LISTPACK_H
+#define __LISTPACK_H
+
+#include <stddef.h>
+
+/*
+ * listpack 是 ziplist 的替代品.
+ *
+ * 每个元素只记录自己的长度 (写在元素的尾部, 用来反向遍历),
+ * 不再记录前一个元素的长度, 所以插入和删除不会引起连锁更新.
+ */
+
+#define LP_HEAD 0
+#define LP_TAIL 1
+
+unsigned char *lpNew(void);
+unsigned char *lpPush(unsigned char *lp, unsigned char *s, unsigned int slen, int where);
+unsigned char *lpInsert(unsigned char *lp, unsigned char *p, unsigned char *s, unsigned int slen);
+unsigned char *lpReplace(unsigned char *lp, unsigned char **p, unsigned char *s, unsigned int slen);
+unsigned char *lpDelete(unsigned char *lp, unsigned char **p);
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num);
+unsigned char *lpSeek(unsigned char *lp, long index);
+unsigned char *lpFirst(unsigned char *lp);
+unsigned char *lpLast(unsigned char *lp);
+unsigned char *lpNext(unsigned char *lp, unsigned char *p);
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p);
+unsigned int lpGet(unsigned char *p, unsigned char **sval, unsigned int *slen, long long *lval);
+unsigned int lpCompare(unsigned char *p, unsigned char *s, unsigned int slen);
+unsigned char *lpFind(unsigned char *p, unsigned char *s, unsigned int slen, unsigned int skip);
+unsigned long lpLength(unsigned char *lp);
+size_t lpBytes(unsigned char *lp);
+
+#endif /* __LISTPACK_H */
@@ -13,7 +13,6 @@
 #include "util.h"
 
 extern struct sharedObjectsStruct shared;
-extern struct redisServer server;
 /* ================================ MULTI/EXEC ============================== */
 
 /* 
@@ -365,6 +364,12 @@ void watchCommand(redisClient *c) {
 		return;
 	}
 
+	/* 多 reactor 模式下修改键的 reactor 不能安全地修改其他 reactor 中客户端的状态 */
+	if (server.reactors_num > 1) {
+		addReplyError(c, "WATCH is not supported in multi-reactor mode");
+		return;
+	}
+
 	/* 监视输入的任意个键 */
 	for (j = 1; j < c->argc; j++)
 		watchForKey(c, c->argv[j]);
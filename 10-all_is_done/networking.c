@@ -1,23 +1,30 @@
+#include "fmacros.h"
 #include "util.h"
 #include "zmalloc.h"
 #include "object.h"
 #include "db.h"
 #include <sys/uio.h>
 #include <math.h>
+#include <pthread.h>
+#include <limits.h>
 #include "networking.h"
 
 /*============================== Variable and Function Declaration =========================*/
-extern struct redisServer server;
 extern struct sharedObjectsStruct shared;
 
 int _addReplyToBuffer(redisClient *c, char *s, size_t len);
+static int replyObjectIsAppendable(robj *tail, size_t len);
+static void clientAllocReplyBuffer(redisClient *c);
+
+/* I/O 线程可能同时向 clients_to_close 中添加客户端 */
+static pthread_mutex_t async_free_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /*==================================== 基础函数 ==========================================*/
 /*
  * 计算出输出缓冲区的大小
  */
 size_t zmalloc_size_sds(sds s) {
-	return zmalloc_size(s - sizeof(struct sdshdr));
+	return zmalloc_size(sdsAllocPtr(s));
 }
 
 /*
@@ -45,11 +52,8 @@ void _addReplyStringToList(redisClient *c, char *s, size_t len) {
 		tail = listNodeValue(listLast(c->reply));
 
 		// Append to this object when possible.
-		if (tail->ptr != NULL && tail->encoding == REDIS_ENCODING_RAW &&
-			sdslen(tail->ptr) + len <= REDIS_REPLY_CHUNK_BYTES)
-		{
+		if (replyObjectIsAppendable(tail, len)) {
 			c->reply_bytes -= zmalloc_size_sds(tail->ptr);
-			tail = dupLastObjectIfNeeded(c->reply);
 			// 将字符串拼接到一个 SDS 之后
 			tail->ptr = sdscatlen(tail->ptr, s, len);
 			c->reply_bytes += zmalloc_size_sds(tail->ptr);
@@ -62,7 +66,7 @@ void _addReplyStringToList(redisClient *c, char *s, size_t len) {
 			c->reply_bytes += getStringObjectSdsUsedMemory(o);
 		}
 	}
-	/* 防止因为加的内容太多,导致出错,但是实际上,在这个版本的代码里,下面的函数调用没有什么用处 */
+	/* 检查输出缓冲区的大小,超过限制的话异步关闭客户端 */
 	asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
@@ -161,42 +165,107 @@ void *dupClientReplyValue(void *o) {
 }
 
 /*
- * 当回复列表中的最后一个对象并非属于回复的一部分时,创建该对象的一个复制品.
+ * 回复链表表尾的对象能否再拼接 len 字节的内容.
+ *
+ * 只有回复自己创建的块(引用计数为 1)才能拼接,
+ * 引用着键空间中的值对象或者共享对象的节点不能被修改,
+ * 后面的内容放到新的节点里,这样值对象就不会因为拼接而被复制一遍.
  */
-robj *dupLastObjectIfNeeded(list *reply) {
-	robj *new, *cur;
-	listNode *ln;
-	ln = listLast(reply);
-	cur = listNodeValue(ln);
-	if (cur->refcount > 1) {
-		new = dupStringObject(cur);
-		decrRefCount(cur);
-		listNodeValue(ln) = new;
-	}
-	return listNodeValue(ln);
+static int replyObjectIsAppendable(robj *tail, size_t len) {
+	return tail->ptr != NULL &&
+		tail->encoding == REDIS_ENCODING_RAW &&
+		tail->refcount == 1 &&
+		sdslen(tail->ptr) + len <= REDIS_REPLY_CHUNK_BYTES;
 }
 
-static void setProtocolError(redisClient *c, int pos) { /* 如果在读入协议内容是,发现内容不符合协议,那么异步地关闭这个客户端 */
-	// todo
+/*
+ * 如果在读入协议内容时,发现内容不符合协议,
+ * 那么在发送完错误回复之后关闭这个客户端,并丢弃 pos 之前的内容
+ */
+static void setProtocolError(redisClient *c, size_t pos) {
+	mylog("%s", "Protocol error from client");
+	c->flags |= REDIS_CLOSE_AFTER_REPLY;
+	sdsrange(c->querybuf, pos, -1);
+	c->qb_pos = 0;
 }
 
 /*
  * 尝试将回复添加到 c->buf 中
  */
 int _addReplyToBuffer(redisClient *c, char *s, size_t len) {
-	size_t available = sizeof(c->buf) - c->bufpos; // 可用的空间数
+	size_t available = REDIS_REPLY_CHUNK_BYTES - c->bufpos; // 可用的空间数
 
 	// 回复链表中已经有内容了,再添加内容到c->buf中就是错误了.
 	if (listLength(c->reply) > 0) return REDIS_ERR;
 
 	if (len > available) return REDIS_ERR; // 必须要有充足的空间
 
+	if (c->buf == NULL) clientAllocReplyBuffer(c);
 	memcpy(c->buf + c->bufpos, s, len);
 	c->bufpos += len;
 	return REDIS_OK;
 	
 }
 
+/*
+ * 为客户端取得一个回复缓冲区,优先使用池中空闲的缓冲区.
+ *
+ * I/O 线程解析查询时也可能产生回复,这时不能访问缓冲区池,直接分配.
+ */
+static void clientAllocReplyBuffer(redisClient *c) {
+	if (!(c->flags & REDIS_PENDING_READ) && server.reply_buf_pool_len > 0) {
+		c->buf = server.reply_buf_pool[--server.reply_buf_pool_len];
+		if (server.reply_buf_pool_len < server.reply_buf_pool_min)
+			server.reply_buf_pool_min = server.reply_buf_pool_len;
+	}
+	else {
+		c->buf = zmalloc(REDIS_REPLY_CHUNK_BYTES);
+	}
+}
+
+/*
+ * 将客户端已经写空的回复缓冲区放回池中,池已满的话就释放掉.
+ * 下次有回复时再重新取得.
+ */
+void clientReleaseReplyBuffer(redisClient *c) {
+	if (c->buf == NULL || c->bufpos) return;
+	if (server.reply_buf_pool_len < REDIS_REPLY_BUF_POOL_MAX)
+		server.reply_buf_pool[server.reply_buf_pool_len++] = c->buf;
+	else
+		zfree(c->buf);
+	c->buf = NULL;
+}
+
+/*
+ * 由 serverCron 定期调用, 释放缓冲区池中上一个周期里一直没有被取出过的缓冲区的一半.
+ * 连接数的峰值过去之后池会逐渐缩小, 而不是一直占着 REDIS_REPLY_BUF_POOL_MAX 个缓冲区.
+ * 池底部的缓冲区最久没有被用过, 从底部开始释放.
+ */
+void replyBufferPoolTrim(void) {
+	int idle = (server.reply_buf_pool_min + 1) / 2;
+	int j;
+
+	if (idle > 0) {
+		for (j = 0; j < idle; j++) zfree(server.reply_buf_pool[j]);
+		server.reply_buf_pool_len -= idle;
+		memmove(server.reply_buf_pool, server.reply_buf_pool + idle,
+			sizeof(char*) * server.reply_buf_pool_len);
+	}
+	server.reply_buf_pool_min = server.reply_buf_pool_len;
+}
+
+/*
+ * 返回一个可以放入回复链表的对象.
+ *
+ * 放入链表的是对象本身而不是复制品, writeToClient 直接从对象的 sds 中写出,
+ * 写完之后释放这个引用.
+ * 开启 I/O 线程之后节点会在 I/O 线程中被释放,这时引用计数是原子地增减的.
+ */
+static robj *getReplyObject(robj *o) {
+	incrRefCount(o);
+	return o;
+}
+
 /*
  * 将回复对象(一个SDS)添加到c->reply回复链表中
  */
@@ -205,7 +274,7 @@ void _addReplyObjectToList(redisClient *c, robj *o) {
 
 	// 链表中无缓存块,直接将对象追加到链表中
 	if (listLength(c->reply) == 0) {
-		incrRefCount(o); // 增加引用计数
+		o = getReplyObject(o); // 增加引用计数
 		listAddNodeTail(c->reply, o);
 		c->reply_bytes += getStringObjectSdsUsedMemory(o);
 	}
@@ -213,80 +282,134 @@ void _addReplyObjectToList(redisClient *c, robj *o) {
 		tail = listNodeValue(listLast(c->reply)); // 取出表尾的sds
 		// 如果表尾sds的已用空间加上对象的长度,小于REDIS_REPLY_CHUNK_BYTES
 		// 那么将新对象的内容拼接到sds的末尾.
-		if (tail->ptr != NULL &&
-			tail->encoding == REDIS_ENCODING_RAW &&
-			sdslen(tail->ptr) + sdslen(o->ptr) <= REDIS_REPLY_CHUNK_BYTES) {
+		if (sdslen(o->ptr) < REDIS_REPLY_REF_MIN_BYTES &&
+			replyObjectIsAppendable(tail, sdslen(o->ptr))) {
 			c->reply_bytes -= zmalloc_size_sds(tail->ptr);
-			tail = dupLastObjectIfNeeded(c->reply);
 			// 将内容拼接起来
 			tail->ptr = sdscatlen(tail->ptr, o->ptr, sdslen(o->ptr));
 			c->reply_bytes += zmalloc_size_sds(tail->ptr);
 		}
 		else { /* 直接将对象追加到末尾 */
-			incrRefCount(o);
+			o = getReplyObject(o);
 			listAddNodeTail(c->reply, o);
 			c->reply_bytes += getStringObjectSdsUsedMemory(o);
 		}
 	}
-	/* 检查回复缓冲区的大小，如果超过系统限制的话，那么关闭客户端
-	* 不过在这个版本的代码里,起不到作用.
-	*/
+	/* 检查回复缓冲区的大小，如果超过系统限制的话，那么关闭客户端 */
 	asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
 /*
- * 负责传送命令回复的写处理器
+ * 客户端的输出缓冲区或者回复链表中是否还有内容等待发送
  */
-void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-	redisClient *c = privdata;
-	int nwritten = 0, totwritten = 0;
-	int objlen;
-	size_t objmem;
-	robj *o;
+int clientHasPendingReplies(redisClient *c) {
+	return c->bufpos || listLength(c->reply);
+}
 
-	// 一直循环,直到回复缓冲区为空
-	while (c->bufpos > 0 || listLength(c->reply)) 
-	{
-		if (c->bufpos > 0) 
-		{
-			nwritten = write(fd, c->buf + c->sentlen, c->bufpos - c->sentlen);
-			if (nwritten <= 0) break; // 有可能是真的出错,也有可能是系统的缓冲区已满
-			// 成功写入则更新写入计数器变量 
+/*
+ * 将一次写入的 nwritten 个字节从输出缓冲区中扣除:
+ * 先扣除 c->buf 中的内容,再依次扣除回复链表中的对象,
+ * 完全写出的对象会被删除,只写出一部分的对象由 c->sentlen 记录写到了哪里.
+ */
+static void clientConsumeWrittenBytes(redisClient *c, size_t nwritten) {
+	if (c->bufpos > 0) {
+		size_t remaining = c->bufpos - c->sentlen;
+
+		if (nwritten < remaining) {
 			c->sentlen += nwritten;
-			totwritten += nwritten;
-			// 如果缓冲区的内容已经全部写入完毕,那么清空客户端的两个计数器变量
-			if (c->sentlen == c->bufpos) 
-			{
-				c->bufpos = 0;
-				c->sentlen = 0;
-			}
+			return;
 		}
-		else {
-			// 取出位于链表最前面的对象
-			o = listNodeValue(listFirst(c->reply));
-			objlen = sdslen(o->ptr);
-			objmem = getStringObjectSdsUsedMemory(o);
+		nwritten -= remaining;
+		c->bufpos = 0;
+		c->sentlen = 0;
+	}
 
-			if (objlen == 0) { /* 略过空对象 */
-				listDelNode(c->reply, listFirst(c->reply));
-				c->reply_bytes -= objmem;
-				continue;
-			}
+	while (listLength(c->reply)) {
+		listNode *ln = listFirst(c->reply);
+		robj *o = listNodeValue(ln);
+		size_t remaining;
 
-			nwritten = write(fd, ((char *)o->ptr) + c->sentlen, objlen - c->sentlen);
-			if (nwritten <= 0) break;
+		if (o->ptr == NULL) return; /* 长度还没有确定的 multi bulk 回复 */
+		remaining = sdslen(o->ptr) - c->sentlen;
+		if (nwritten < remaining) {
 			c->sentlen += nwritten;
-			totwritten += nwritten;
+			return;
+		}
+		// 这个对象已经全部写入完毕(空对象也在这里被略过)
+		nwritten -= remaining;
+		c->sentlen = 0;
+		c->reply_bytes -= getStringObjectSdsUsedMemory(o);
+		listDelNode(c->reply, ln);
+	}
+}
 
-			// 如果缓冲区的内容全部写入完毕,那么删除已经写入完毕的节点
-			if (c->sentlen == objlen) {
-				listDelNode(c->reply, listFirst(c->reply));
-				c->sentlen = 0;
-				c->reply_bytes -= objmem;
+/*
+ * 将客户端输出缓冲区中的内容写入到套接字.
+ *
+ * c->buf 和回复链表中的对象会被收集到一个 iovec 数组中,用一次 writev 写出,
+ * 每次收集的块数不超过 IOV_MAX ,字节数不超过 REDIS_MAX_WRITEV_BYTES .
+ *
+ * handler_installed 为真时,说明是由写处理器调用的,写完之后需要删除写处理器,
+ * 出错的客户端也会被立即释放.
+ * 由 I/O 线程调用时 handler_installed 为 0 ,这时出错的客户端只会被标记为异步关闭.
+ *
+ * 客户端仍然可用时返回 REDIS_OK ,否则返回 REDIS_ERR .
+ */
+int writeToClient(int fd, redisClient *c, int handler_installed) {
+	struct iovec iov[IOV_MAX];
+	ssize_t nwritten = 0, totwritten = 0;
+
+	// 一直循环,直到回复缓冲区为空,或者套接字的缓冲区已满
+	while (clientHasPendingReplies(c)) {
+		int iovcnt = 0;
+		size_t iovbytes = 0, offset = c->sentlen;
+		listIter li;
+		listNode *ln;
+
+		if (c->bufpos > 0) {
+			iov[iovcnt].iov_base = c->buf + c->sentlen;
+			iov[iovcnt].iov_len = c->bufpos - c->sentlen;
+			iovbytes += iov[iovcnt].iov_len;
+			iovcnt++;
+			offset = 0; // c->sentlen 记录的是 c->buf 的进度
+		}
+
+		listRewind(c->reply, &li);
+		while ((ln = listNext(&li)) != NULL &&
+			iovcnt < IOV_MAX && iovbytes < REDIS_MAX_WRITEV_BYTES)
+		{
+			robj *o = listNodeValue(ln);
+			size_t objlen;
+
+			if (o->ptr == NULL) break;
+			objlen = sdslen(o->ptr);
+			if (objlen > offset) { /* 略过空对象 */
+				iov[iovcnt].iov_base = (char*)o->ptr + offset;
+				iov[iovcnt].iov_len = objlen - offset;
+				iovbytes += iov[iovcnt].iov_len;
+				iovcnt++;
 			}
+			offset = 0;
 		}
 
+		// 开头只有空对象的话,直接将它们删除
+		if (iovbytes == 0) {
+			unsigned long len = listLength(c->reply);
+
+			clientConsumeWrittenBytes(c, 0);
+			if (listLength(c->reply) == len) break; /* 遇到了长度还没有确定的回复 */
+			continue;
+		}
+
+		nwritten = writev(fd, iov, iovcnt);
+		if (nwritten <= 0) break; // 有可能是真的出错,也有可能是系统的缓冲区已满
+		totwritten += nwritten;
+		clientConsumeWrittenBytes(c, nwritten);
+
+		// 没有全部写出,说明套接字的缓冲区已满,不必再尝试了
+		if ((size_t)nwritten < iovbytes) break;
 	}
+
 	/* 写入出错检查 */
 	if (nwritten == -1) {
 		if (errno == EAGAIN) {
@@ -294,27 +417,50 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
 		}
 		else {
 			mylog("Error writing to client: %s", strerror(errno));
-			freeClient(c);
-			return;
+			if (handler_installed) freeClient(c); else freeClientAsync(c);
+			return REDIS_ERR;
 		}
 	}
+	if (totwritten > 0) c->lastinteraction = server.unixtime;
 
-	if (c->bufpos == 0 && listLength(c->reply) == 0) {
+	if (!clientHasPendingReplies(c)) {
 		c->sentlen = 0;
-		mylog("%s", "close write  handler");
 		/* 删除 write handler */
-		aeDeleteFileEvent(server.el, c->fd, AE_WRITABLE); /* 这里很重要,如果不关闭的话,下次还会通知,尽管你没有什么数据要发送 */
+		if (handler_installed) {
+			mylog("%s", "close write  handler");
+			aeDeleteFileEvent(server.el, c->fd, AE_WRITABLE); /* 这里很重要,如果不关闭的话,下次还会通知,尽管你没有什么数据要发送 */
+		}
 		/* 如果指定了写入之后关闭客户端 FLAG ，那么关闭客户端 */
-		if (c->flags & REDIS_CLOSE_AFTER_REPLY) freeClient(c);
+		if (c->flags & REDIS_CLOSE_AFTER_REPLY) {
+			if (handler_installed) freeClient(c); else freeClientAsync(c);
+			return REDIS_ERR;
+		}
 	}
+	return REDIS_OK;
+}
+
+/*
+ * 负责传送命令回复的写处理器
+ */
+void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+	redisClient *c = privdata;
+	REDIS_NOTUSED(el);
+	REDIS_NOTUSED(mask);
+	if (writeToClient(fd, c, 1) == REDIS_OK && !clientHasPendingReplies(c))
+		clientReleaseReplyBuffer(c);
 }
 
 int prepareClientToWrite(redisClient *c) {
 	if (c->fd <= 0) return REDIS_ERR; /* 伪客户端总是不可以写的 */
-	/* 一般情况下,为客户端套接字安装写处理器到事件循环 */
-	if (c->bufpos == 0 && listLength(c->reply) == 0 &&
-		aeCreateFileEvent(server.el, c->fd, AE_WRITABLE, sendReplyToClient, c) == AE_ERR)
-		return REDIS_ERR;
+	/* I/O 线程在解析查询时产生的回复(比如协议错误)先留在缓冲区里,
+	 * 等主线程处理完这一批读取之后再统一安排写出 */
+	if (c->flags & REDIS_PENDING_READ) return REDIS_OK;
+	/* 命令在其他 reactor 中执行,客户端回到自己的 reactor 之后再安排写出 */
+	if (c->flags & REDIS_FORWARDED) return REDIS_OK;
+	/* 不直接安装写处理器,而是先放入待写链表,在 beforeSleep 中直接写出,
+	 * 只有一次没能写完的客户端才会安装写处理器.
+	 * 这样大部分请求都省掉了 epoll_ctl 的 add/del 和一轮多余的事件循环 */
+	if (!clientHasPendingReplies(c)) clientInstallWriteHandler(c);
 	return REDIS_OK;
 }
 
@@ -349,21 +495,28 @@ redisClient *createClient(int fd) {
 
 	/* 初始化各个属性 */
 	c->fd = fd;
+	c->id = __atomic_fetch_add(&servers[0].next_client_id, 1, __ATOMIC_RELAXED);
 	c->name = NULL;
+	c->buf = NULL; // 回复缓冲区,有回复时才分配
 	c->bufpos = 0; // 回复缓冲区的偏移量
 	c->sentlen = 0;
 	c->querybuf = sdsempty();
+	c->querybuf_peak = 0;
+	c->qb_pos = 0;
 	c->reqtype = 0; // 命令请求的类型
 	c->argc = 0; // 命令参数的数量
 	c->argv = NULL; // 命令参数
 	c->cmd = c->lastcmd = NULL; // 当前执行的命令和最近一次执行的命令
 	c->lastinteraction = server.unixtime; // 最后一次互动时间
+	c->obuf_soft_limit_reached_time = 0;
 	c->bulklen = -1; // 读入的参数的长度
 	c->multibulklen = 0; // 查询缓冲区中未读入的命令内容数量
 
 	c->reply = listCreate(); // 回复链表 
 	c->reply_bytes = 0; //  回复链表的字节量
 	c->flags = 0; /* 设置参数 */
+	c->reactor = server.reactor_id; /* 客户端由接受连接的 reactor 负责 */
+	c->mailbox_next = NULL;
 
 	listSetFreeMethod(c->reply, decrRefCountVoid);
 	listSetDupMethod(c->reply, dupClientReplyValue);
@@ -385,15 +538,18 @@ void addReply(redisClient *c, robj *obj) {
 
 	// 如果对象的编码为RAW,并且静态缓冲区有空间,那么就可以在不弄乱内存页的情况下,将对象发送给客户端
 	if (sdsEncodedObject(obj)) {
+		// 大的对象不复制,直接在回复链表中引用它
+		if (sdslen(obj->ptr) >= REDIS_REPLY_REF_MIN_BYTES) {
+			_addReplyObjectToList(c, obj);
+		}
 		// 首先尝试复制内容得到 c->buf 中,这样可以避免内存分配
-		char *str = obj->ptr;
-		if (_addReplyToBuffer(c, obj->ptr, sdslen(obj->ptr)) != REDIS_OK) {
+		else if (_addReplyToBuffer(c, obj->ptr, sdslen(obj->ptr)) != REDIS_OK) {
 			// 如果c->buf中的空间不够,就复制到c->reply链表中
 			_addReplyObjectToList(c, obj);
 		}
 	}
 	else if (obj->encoding == REDIS_ENCODING_INT) {
-		if (listLength(c->reply) == 0 && (sizeof(c->buf) - c->bufpos) >= 32) {
+		if (listLength(c->reply) == 0 && (REDIS_REPLY_CHUNK_BYTES - c->bufpos) >= 32) {
 			char buf[32];
 			int len;
 			len = ll2string(buf, sizeof(buf), (long)obj->ptr);
@@ -438,21 +594,27 @@ void addReply(redisClient *c, robj *obj) {
  * 这个函数相当于parse,处理命令
  */
 int processInlineBuffer(redisClient *c) {
-	char *newline;
-	int argc, j;
+	char *newline, *query = c->querybuf + c->qb_pos;
+	int argc, j, linefeed_chars = 1;
 	sds *argv, aux;
 	size_t querylen;
 
-	newline = strchr(c->querybuf, '\n'); // 寻找一行的结尾
+	newline = memchr(query, '\n', sdslen(c->querybuf) - c->qb_pos); // 寻找一行的结尾
 
-	// 如果接收到了错误的内容,出错
+	// 还没有收到完整的一行,等待更多的数据;行太长的话,就是协议出错了
 	if (newline == NULL) {
+		if (sdslen(c->querybuf) - c->qb_pos > REDIS_INLINE_MAX_SIZE) {
+			addReplyError(c, "Protocol error: too big inline request");
+			setProtocolError(c, c->qb_pos);
+		}
 		return REDIS_ERR;
 	}
 
 	// 处理\r\n 
-	if (newline && newline != c->querybuf && *(newline - 1) == '\r')
+	if (newline != query && *(newline - 1) == '\r') {
 		newline--;
+		linefeed_chars++;
+	}
 
 	/* 然后根据空格,来分割命令的参数
 	 * 比如说 SET msg hello \r\n将被分割成
@@ -461,15 +623,15 @@ int processInlineBuffer(redisClient *c) {
 	 * argv[2] = hello
 	 * argc = 3
 	 */
-	querylen = newline - (c->querybuf);
-	aux = sdsnewlen(c->querybuf, querylen);
+	querylen = newline - query;
+	aux = sdsnewlen(query, querylen);
 	argv = sdssplitargs(aux, &argc);
 	sdsfree(aux);
 
-	// 从缓冲区中删除已经读取了的内容,剩下的内容是未被读取的
-	sdsrange(c->querybuf, querylen + 2, -1);
+	// 跳过已经读取了的内容,剩下的内容是未被读取的
+	c->qb_pos += querylen + linefeed_chars;
 
-	if (c->argv) free(c->argv);
+	if (c->argv) zfree(c->argv);
 	c->argv = zmalloc(sizeof(robj*)*argc);
 
 	// 为每个参数创建一个字符串对象
@@ -490,6 +652,43 @@ int processInlineBuffer(redisClient *c) {
 
 
 
+/*
+ * 读取查询缓冲区中 pos 处的 '*' 或 '$' 之后,以 \r\n 结尾的长度值.
+ *
+ * 常见的长度都是不带前导 0 的短整数,这种情况下一边扫描数字一边计算,
+ * 一趟就能同时找到 \r\n 并得到长度,不必先查找 \r 再调用 string2ll .
+ * 其他情况(负数,数据还没有完全到达,格式错误)交给 memchr 和 string2ll 处理.
+ *
+ * 返回 1 表示读取成功,长度保存在 *ll 中, *newline 指向 \r ;
+ * 返回 0 表示 \r\n 还没有到达;
+ * 返回 -1 表示长度的格式不正确.
+ */
+static int readProtocolLength(redisClient *c, size_t pos, long long *ll, char **newline) {
+	char *p = c->querybuf + pos + 1;
+	char *end = c->querybuf + sdslen(c->querybuf);
+	char *s = p;
+	long long v = 0;
+
+	while (s < end && s - p < 18 && *s >= '0' && *s <= '9') {
+		v = v * 10 + (*s - '0');
+		s++;
+	}
+	if (s > p && end - s >= 2 && s[0] == '\r' && s[1] == '\n' &&
+		(*p != '0' || s - p == 1))
+	{
+		*ll = v;
+		*newline = s;
+		return 1;
+	}
+
+	if (p >= end) return 0;
+	s = memchr(p, '\r', end - p);
+	// 缓冲区中还没有 \r\n ,等待更多的数据
+	if (s == NULL || end - s < 2) return 0;
+	*newline = s;
+	return string2ll(p, s - p, ll) ? 1 : -1;
+}
+
 /*
  * 将 c->querybuf 中的协议内容转换成 c->argv 中的参数对象
  *
@@ -498,21 +697,36 @@ int processInlineBuffer(redisClient *c) {
  * argv[0] = SET
  * argv[1] = MSG
  * argv[2] = HELLO
+ *
+ * 解析从 c->qb_pos 开始,解析完的内容并不马上从缓冲区中删除,只是向前移动 c->qb_pos ,
+ * 这样流水线中的每条命令就不必各自移动一次缓冲区中剩下的内容.
  */
 int processMultibulkBuffer(redisClient *c) {
 	char *newline = NULL;
-	int pos = 0, ok;
+	size_t pos = c->qb_pos;
+	int ok;
 	long long ll;
 
-	assert(c->argc == 0); // 每一次读取命令的时候都要保证client被reset过
-
 	/* 读入命令的参数个数 */
 	// 比如 *3\r\n$3\r\nSET\r\n... 将令 c->multibulklen = 3
 	if (c->multibulklen == 0) {
-		newline = strchr(c->querybuf, '\r');
-		// 将参数个数，也即是 * 之后， \r\n 之前的数字取出并保存到 ll 中 
-		// 比如对于 *3\r\n ，那么 ll 将等于 3
-		ok = string2ll(c->querybuf + 1, newline - (c->querybuf + 1), &ll);
+		assert(c->argc == 0); // 每一次读取命令的时候都要保证client被reset过
+
+		ok = readProtocolLength(c, pos, &ll, &newline);
+		if (ok == 0) {
+			if (sdslen(c->querybuf) - pos > REDIS_INLINE_MAX_SIZE) {
+				addReplyError(c, "Protocol error: too big mbulk count string");
+				setProtocolError(c, pos);
+			}
+			return REDIS_ERR;
+		}
+
+		// 参数个数,也即是 * 之后, \r\n 之前的数字,比如对于 *3\r\n ,那么 ll 将等于 3
+		if (ok < 0 || ll > 1024 * 1024) {
+			addReplyError(c, "Protocol error: invalid multibulk length");
+			setProtocolError(c, pos);
+			return REDIS_ERR;
+		}
 
 		// 参数数量之后的位置 
 		// 比如对于 *3\r\n$3\r\n$SET\r\n... 来说,
@@ -522,6 +736,12 @@ int processMultibulkBuffer(redisClient *c) {
 		//               pos
 		pos = (newline - c->querybuf) + 2;
 
+		// 空的 multibulk 请求,直接丢弃
+		if (ll <= 0) {
+			c->qb_pos = pos;
+			return REDIS_OK;
+		}
+
 		// 设置参数数量
 		c->multibulklen = ll;
 
@@ -534,11 +754,30 @@ int processMultibulkBuffer(redisClient *c) {
 	while (c->multibulklen) {
 		// 读入参数长度
 		if (c->bulklen == -1) { // 这里指的是命令的长度
-			// 确保"\r\n"存在 
-			newline = strchr(c->querybuf + pos, '\r');
+			if (pos >= sdslen(c->querybuf)) break;
+
+			if (c->querybuf[pos] != '$') {
+				addReplyErrorFormat(c, "Protocol error: expected '$', got '%c'",
+					c->querybuf[pos]);
+				setProtocolError(c, pos);
+				return REDIS_ERR;
+			}
 
 			// 读取长度,比如说 $3\r\nSET\r\n 会让 ll 的值变成3
-			ok = string2ll(c->querybuf + pos + 1, newline - (c->querybuf + pos + 1), &ll);
+			ok = readProtocolLength(c, pos, &ll, &newline);
+			if (ok == 0) {
+				if (sdslen(c->querybuf) - pos > REDIS_INLINE_MAX_SIZE) {
+					addReplyError(c, "Protocol error: too big bulk count string");
+					setProtocolError(c, pos);
+					return REDIS_ERR;
+				}
+				break;
+			}
+			if (ok < 0 || ll < 0 || ll > 512 * 1024 * 1024) {
+				addReplyError(c, "Protocol error: invalid bulk length");
+				setProtocolError(c, pos);
+				return REDIS_ERR;
+			}
 
 			// 定位到参数的开头
 			// 比如 
@@ -546,10 +785,26 @@ int processMultibulkBuffer(redisClient *c) {
 			//       ^
 			//       |
 			//      pos
-			pos += newline - (c->querybuf + pos) + 2;
+			pos = (newline - c->querybuf) + 2;
+
+			// 对于很大的参数,把它移动到查询缓冲区的开头,
+			// 并预先为它分配好空间,这样之后就可以直接把查询缓冲区当作参数对象使用
+			if (ll >= REDIS_MBULK_BIG_ARG) {
+				size_t qblen;
+
+				sdsrange(c->querybuf, pos, -1);
+				pos = 0;
+				qblen = sdslen(c->querybuf);
+				if (qblen < (size_t)ll + 2)
+					c->querybuf = sdsMakeRoomFor(c->querybuf, ll + 2 - qblen);
+			}
 			c->bulklen = ll;
 		}
-		
+
+		// 参数的内容还没有完全到达
+		if (sdslen(c->querybuf) - pos < (size_t)(c->bulklen + 2))
+			break;
+
 		// 为参数创建字符串对象
 		if (pos == 0 &&
 			c->bulklen >= REDIS_MBULK_BIG_ARG &&
@@ -573,13 +828,14 @@ int processMultibulkBuffer(redisClient *c) {
 		// 减少还需读入的参数个数
 		c->multibulklen--;
 	}
-	
-	if (pos) sdsrange(c->querybuf, pos, -1); // 从querybuf中删除已被读取的内容
+
+	// 记录解析到的位置,已被读取的内容由 processInputBuffer 统一删除
+	c->qb_pos = pos;
 
 	// 如果本条命令的所有参数都已经读取完,那么返回
 	if (c->multibulklen == 0) return REDIS_OK;
 
-	// 如果还有参数未读取完,那么就是协议出错了!
+	// 还有参数未读取完,等待更多的数据
 	return REDIS_ERR;
 }
 
@@ -606,12 +862,29 @@ void resetClient(redisClient *c) {
 }
 
 void processInputBuffer(redisClient *c) {
+	int budget = REDIS_MAX_COMMANDS_PER_EVENT;
+
 	// 尽可能地处理查询缓存区中的内容.如果读取出现short read, 那么可能会有内容滞留在读取缓冲区里面
 	// 这些滞留的内容也许不能完整构成一个符合协议的命令,需要等待下次读事件的就绪.
-	while (sdslen(c->querybuf)) {
+	while (c->qb_pos < sdslen(c->querybuf)) {
+
+		/* 
+		 * 用完了这一轮的命令配额,剩下的命令排队到下一轮再执行,
+		 * 免得一个发来大量流水线命令的客户端让其他客户端一直等待
+		 */
+		if (budget == 0) {
+			if (!(c->flags & REDIS_PENDING_INPUT)) {
+				c->flags |= REDIS_PENDING_INPUT;
+				listAddNodeTail(server.clients_pending_input, c);
+			}
+			break;
+		}
+
+		/* 客户端将在发送完回复之后关闭,不再处理后面的内容 */
+		if (c->flags & REDIS_CLOSE_AFTER_REPLY) break;
 
 		if (!c->reqtype) {
-			if (c->querybuf[0] == '*') {
+			if (c->querybuf[c->qb_pos] == '*') {
 				c->reqtype = REDIS_REQ_MULTIBULK; // 多条查询 
 			}
 			else {
@@ -632,25 +905,93 @@ void processInputBuffer(redisClient *c) {
 		if (c->argc == 0) {
 			resetClient(c); // 重置客户端
 		}
+		else if (c->flags & REDIS_PENDING_READ) {
+			/* 当前运行在 I/O 线程中,只负责解析,命令交给主线程去执行 */
+			c->flags |= REDIS_PENDING_COMMAND;
+			break;
+		}
 		else {
-			if (processCommand(c) == REDIS_OK)
+			budget--;
+			if (processCommand(c) == REDIS_OK) {
+				/* 命令被转交给了其他 reactor,等客户端回来之后再继续 */
+				if (c->flags & REDIS_FORWARDED) break;
 				resetClient(c);
+			}
 		}
 	}
+
+	/* 一次删除所有已经解析过的内容 */
+	if (c->qb_pos) {
+		sdsrange(c->querybuf, c->qb_pos, -1);
+		c->qb_pos = 0;
+	}
+}
+
+/*
+ * 轮流执行 clients_pending_input 中的客户端排队的命令,
+ * 每个客户端这一轮仍然最多执行 REDIS_MAX_COMMANDS_PER_EVENT 条,没执行完的重新排到队尾.
+ *
+ * 返回处理的客户端数目.
+ */
+int handleClientsWithPendingInput(void) {
+	int processed = 0;
+	int n = listLength(server.clients_pending_input);
+
+	while (n-- && listLength(server.clients_pending_input)) {
+		listNode *ln = listFirst(server.clients_pending_input);
+		redisClient *c = listNodeValue(ln);
+
+		c->flags &= ~REDIS_PENDING_INPUT;
+		listDelNode(server.clients_pending_input, ln);
+		if (c->flags & REDIS_CLOSE_ASAP) continue;
+
+		server.current_client = c;
+		processInputBuffer(c);
+		server.current_client = NULL;
+		processed++;
+	}
+
+	/* 还有客户端在排队,下一轮事件循环不要阻塞 */
+	aeSetDontWait(server.el, listLength(server.clients_pending_input) != 0);
+	return processed;
 }
 
 
+/*
+ * 如果 I/O 线程处于工作状态,那么不在这里读取,而是将客户端放入 clients_pending_read,
+ * 稍后在 beforeSleep 中交给 I/O 线程去读取和解析.
+ */
+static int postponeClientRead(redisClient *c) {
+	if (server.io_threads_active && server.io_threads_do_reads &&
+		!(c->flags & (REDIS_PENDING_READ | REDIS_CLOSE_ASAP)))
+	{
+		c->flags |= REDIS_PENDING_READ;
+		listAddNodeHead(server.clients_pending_read, c);
+		return 1;
+	}
+	return 0;
+}
+
 /*
  * 读取客户端的查询缓冲区内容
+ *
+ * 这个函数既是读事件处理器,也会被 I/O 线程直接调用(此时客户端带有 REDIS_PENDING_READ 标志),
+ * 在 I/O 线程中只能异步地关闭客户端.
  */
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
 	redisClient *c = (redisClient *)privdata;
 	int nread, readlen;
 	size_t qblen;
+	int threaded = c->flags & REDIS_PENDING_READ;
 
-	server.current_client = c; // 设置服务器的当前客户端
+	if (c->flags & REDIS_CLOSE_ASAP) return;
+	/* 还有排队的命令没有执行,先不读,让 TCP 的流量控制挡住发送方 */
+	if (c->flags & REDIS_PENDING_INPUT) return;
+	if (postponeClientRead(c)) return;
+
+	if (!threaded) server.current_client = c; // 设置服务器的当前客户端
 
-	readlen = REDIS_IOBUF_LEN; // 读入长度,默认为16MB
+	readlen = REDIS_IOBUF_LEN; // 读入长度,默认为16KB
 
 	// 获取查询缓冲区当前内容的长度 
 	qblen = sdslen(c->querybuf); 
@@ -666,29 +1007,32 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
 		} 
 		else {
 			mylog("Reading from client: %s", strerror(errno));
+			if (threaded) freeClientAsync(c); else freeClient(c);
 			return;
 		}
 	}
 	else if (nread == 0) { // 对方关闭了连接
 		mylog("%s", "Client closed connection");
-		freeClient(c);
+		if (threaded) freeClientAsync(c); else freeClient(c);
 		return;
 	}
 
 	if (nread) {
 		sdsIncrLen(c->querybuf, nread);
 		c->lastinteraction = server.unixtime; // 更新最后一次互动的时间
+		// 记录查询缓冲区的峰值, clientsCron 根据它回收空闲的空间
+		if (sdslen(c->querybuf) > c->querybuf_peak) c->querybuf_peak = sdslen(c->querybuf);
 	} 
 	else {
 		// 在 nread == -1 且 errno == EAGAIN 时运行
-		server.current_client = NULL;
+		if (!threaded) server.current_client = NULL;
 		return;
 	}
 	//
 	// 从查询缓存中读取内容,创建参数,并执行命令,函数会执行到缓存中的所有内容都被处理完为止
 	//
 	processInputBuffer(c);
-	server.current_client = NULL;
+	if (!threaded) server.current_client = NULL;
 }
 
 
@@ -708,6 +1052,8 @@ static void acceptCommonHandler(int fd, int flags) {
 		close(fd);
 		return;
 	}
+	server.stat_numconnections++;
+	c->flags |= flags;
 }
 
 
@@ -731,6 +1077,24 @@ void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
 	}
 }
 
+/*
+ * 本地套接字连接的 accept 处理器.
+ * 多 reactor 模式下所有 reactor 都监听同一个本地套接字, 没有抢到连接的 reactor 会得到 EAGAIN
+ */
+void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+	int cfd;
+
+	for (; ; ) {
+		cfd = anetUnixAccept(server.neterr, fd);
+		if (cfd == ANET_ERR) {
+			if (errno != EWOULDBLOCK)
+				mylog("Accepting client connection: %s", server.neterr);
+			return;
+		}
+		acceptCommonHandler(cfd, REDIS_UNIX_SOCKET);
+	}
+}
+
 
 void addReplyErrorLength(redisClient *c, char *s, size_t len) {
 	addReplyString(c, "-ERR ", 5);
@@ -823,7 +1187,8 @@ void setDeferredMultiBulkLength(redisClient *c, void *node, long length) {
 	c->reply_bytes += zmalloc_size_sds(len->ptr);
 	if (ln->next != NULL) {
 		next = listNodeValue(ln->next);
-		if (next->ptr != NULL) {
+		/* 把后面的小块拼接过来,引用着大对象的节点则保持原样 */
+		if (next->ptr != NULL && sdslen(next->ptr) < REDIS_REPLY_REF_MIN_BYTES) {
 			c->reply_bytes -= zmalloc_size_sds(len->ptr);
 			c->reply_bytes -= getStringObjectSdsUsedMemory(next);
 			len->ptr = sdscatlen(len->ptr, next->ptr, sdslen(next->ptr));
@@ -872,7 +1237,16 @@ void addReplyDouble(redisClient *c, double d) {
 void freeClientAsync(redisClient *c) {
 	if (c->flags & REDIS_CLOSE_ASAP) return;
 	c->flags |= REDIS_CLOSE_ASAP;
+	/* 命令正在其他 reactor 中执行,客户端回到自己的 reactor 之后再关闭 */
+	if (c->flags & REDIS_FORWARDED) return;
+	if (server.io_threads_num == 1) {
+		listAddNodeTail(server.clients_to_close, c);
+		return;
+	}
+	/* 这个函数可能在 I/O 线程中被调用 */
+	pthread_mutex_lock(&async_free_queue_mutex);
 	listAddNodeTail(server.clients_to_close, c);
+	pthread_mutex_unlock(&async_free_queue_mutex);
 }
 
 /* 关闭需要异步关闭的客户端 */
@@ -889,6 +1263,28 @@ void freeClientsInAsyncFreeQueue(void) {
 	}
 }
 
+/*
+ * 返回客户端输出缓冲区实际使用的内存,包括回复链表节点本身的开销
+ */
+unsigned long getClientOutputBufferMemoryUsage(redisClient *c) {
+	unsigned long list_item_size = sizeof(listNode) + sizeof(robj);
+
+	return c->reply_bytes + (list_item_size * listLength(c->reply));
+}
+
+/*
+ * 返回客户端所属的类别,不同类别的客户端使用不同的输出缓冲区限制:
+ *
+ * REDIS_CLIENT_LIMIT_CLASS_NORMAL -> 普通客户端
+ * REDIS_CLIENT_LIMIT_CLASS_SLAVE  -> 附属节点(MONITOR 客户端也算作普通客户端)
+ * REDIS_CLIENT_LIMIT_CLASS_PUBSUB -> 订阅了频道或者模式的客户端,目前还没有这一类客户端
+ */
+int getClientLimitClass(redisClient *c) {
+	if ((c->flags & REDIS_SLAVE) && !(c->flags & REDIS_MONITOR))
+		return REDIS_CLIENT_LIMIT_CLASS_SLAVE;
+	return REDIS_CLIENT_LIMIT_CLASS_NORMAL;
+}
+
 /* 
  * 这个函数检查客户端是否达到了输出缓冲区的软性（soft）限制或者硬性（hard）限制，
  * 并在到达软限制时，对客户端进行标记。
@@ -897,8 +1293,35 @@ void freeClientsInAsyncFreeQueue(void) {
  *         否则返回 0 。
  */
 int checkClientOutputBufferLimits(redisClient *c) {
-	// todo
-	return 0;
+	int soft = 0, hard = 0, class;
+	unsigned long used_mem = getClientOutputBufferMemoryUsage(c);
+	clientBufferLimitsConfig *limits;
+
+	class = getClientLimitClass(c);
+	limits = &server.client_obuf_limits[class];
+
+	/* 限制为 0 表示不做限制 */
+	if (limits->hard_limit_bytes && used_mem >= limits->hard_limit_bytes)
+		hard = 1;
+	if (limits->soft_limit_bytes && used_mem >= limits->soft_limit_bytes)
+		soft = 1;
+
+	/* 软性限制需要持续 soft_limit_seconds 秒才算达到 */
+	if (soft) {
+		if (c->obuf_soft_limit_reached_time == 0) {
+			/* 第一次超过软性限制,开始计时 */
+			c->obuf_soft_limit_reached_time = server.unixtime;
+			soft = 0;
+		}
+		else {
+			time_t elapsed = server.unixtime - c->obuf_soft_limit_reached_time;
+			if (elapsed <= limits->soft_limit_seconds) soft = 0;
+		}
+	}
+	else {
+		c->obuf_soft_limit_reached_time = 0;
+	}
+	return soft || hard;
 }
 
 /* 
@@ -917,6 +1340,9 @@ void asyncCloseClientOnOutputBufferLimitReached(redisClient *c) {
 
 	/* 检查限制 */
 	if (checkClientOutputBufferLimits(c)) {
+		mylog("Client scheduled to be closed ASAP for overcoming of output buffer limits (%lu bytes)",
+			getClientOutputBufferMemoryUsage(c));
+		server.stat_client_obuf_limit_disconnections[getClientLimitClass(c)]++;
 		/* 异步关闭 */
 		freeClientAsync(c);
 	}
@@ -948,4 +1374,547 @@ void addReplyErrorFormat(redisClient *c, const char *fmt, ...) {
 	}
 	addReplyErrorLength(c, s, sdslen(s));
 	sdsfree(s);
-}
\ No newline at end of file
+}
+
+/*================================ Threaded I/O ==================================*/
+
+/*
+ * 可选的 I/O 线程池.
+ *
+ * 主线程在 beforeSleep 中把等待读取或者等待写出的客户端轮流分配给各个 I/O 线程
+ * (主线程自己作为 0 号线程也处理一份),然后等待所有线程完成.
+ * 在这期间主线程不会执行任何命令,所以每个 I/O 线程只会访问分配给自己的客户端.
+ * I/O 线程只负责读取,解析查询以及写出回复,命令的执行始终在主线程中进行.
+ */
+#define IO_THREADS_OP_READ 0
+#define IO_THREADS_OP_WRITE 1
+
+static pthread_t io_threads[REDIS_IO_THREADS_MAX_NUM];
+static pthread_mutex_t io_threads_mutex[REDIS_IO_THREADS_MAX_NUM];
+static unsigned long io_threads_pending[REDIS_IO_THREADS_MAX_NUM]; /* 各线程还未处理完的客户端数目 */
+static list *io_threads_list[REDIS_IO_THREADS_MAX_NUM]; /* 分配给各线程的客户端 */
+static int io_threads_op; /* 当前这一批是读还是写 */
+
+static unsigned long getIOPendingCount(int i) {
+	return __atomic_load_n(&io_threads_pending[i], __ATOMIC_ACQUIRE);
+}
+
+static void setIOPendingCount(int i, unsigned long count) {
+	__atomic_store_n(&io_threads_pending[i], count, __ATOMIC_RELEASE);
+}
+
+/*
+ * I/O 线程的主函数
+ */
+static void *IOThreadMain(void *myid) {
+	long id = (long)myid;
+
+	while (1) {
+		listIter li;
+		listNode *ln;
+		int j;
+
+		/* 先忙等一会儿,等不到任务的话再去获取互斥锁.
+		 * 主线程停止 I/O 线程时会持有这个锁,线程就会在这里睡眠 */
+		for (j = 0; j < 1000000; j++) {
+			if (getIOPendingCount(id) != 0) break;
+		}
+		if (getIOPendingCount(id) == 0) {
+			pthread_mutex_lock(&io_threads_mutex[id]);
+			pthread_mutex_unlock(&io_threads_mutex[id]);
+			continue;
+		}
+
+		listRewind(io_threads_list[id], &li);
+		while ((ln = listNext(&li))) {
+			redisClient *c = listNodeValue(ln);
+			if (io_threads_op == IO_THREADS_OP_WRITE)
+				writeToClient(c->fd, c, 0);
+			else
+				readQueryFromClient(server.el, c->fd, c, 0);
+		}
+		listEmpty(io_threads_list[id]);
+		setIOPendingCount(id, 0);
+	}
+	return NULL;
+}
+
+/*
+ * 初始化 I/O 线程,线程创建之后处于停止状态
+ */
+void initThreadedIO(void) {
+	int i;
+
+	server.io_threads_active = 0;
+	/* 只有一个线程的话,所有的 I/O 都由主线程完成 */
+	if (server.io_threads_num == 1) return;
+
+	if (server.io_threads_num < 1 || server.io_threads_num > REDIS_IO_THREADS_MAX_NUM) {
+		mylog("Fatal: the number of I/O threads must be between 1 and %d",
+			REDIS_IO_THREADS_MAX_NUM);
+		exit(1);
+	}
+
+	/* I/O 线程也会分配和释放内存 */
+	zmalloc_enable_thread_safeness();
+
+	for (i = 0; i < server.io_threads_num; i++) {
+		io_threads_list[i] = listCreate();
+		if (i == 0) continue; /* 0 号线程就是主线程 */
+
+		pthread_mutex_init(&io_threads_mutex[i], NULL);
+		setIOPendingCount(i, 0);
+		pthread_mutex_lock(&io_threads_mutex[i]);
+		if (pthread_create(&io_threads[i], NULL, IOThreadMain, (void*)(long)i) != 0) {
+			mylog("%s", "Fatal: Can't initialize IO thread.");
+			exit(1);
+		}
+	}
+}
+
+static void startThreadedIO(void) {
+	int j;
+	for (j = 1; j < server.io_threads_num; j++)
+		pthread_mutex_unlock(&io_threads_mutex[j]);
+	server.io_threads_active = 1;
+}
+
+static void stopThreadedIO(void) {
+	int j;
+	/* 停止之前,先处理掉已经在排队的读取 */
+	handleClientsWithPendingReadsUsingThreads();
+	for (j = 1; j < server.io_threads_num; j++)
+		pthread_mutex_lock(&io_threads_mutex[j]);
+	server.io_threads_active = 0;
+}
+
+/*
+ * 待写的客户端太少时,线程之间的同步开销会超过并行带来的收益,
+ * 这时停止 I/O 线程,由主线程自己完成读写.
+ *
+ * 返回 1 表示 I/O 线程处于停止状态.
+ */
+static int stopThreadedIOIfNeeded(void) {
+	int pending = listLength(server.clients_pending_write);
+
+	if (server.io_threads_num == 1) return 1;
+
+	if (pending < server.io_threads_num * 2) {
+		if (server.io_threads_active) stopThreadedIO();
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * 将客户端放入 clients_pending_write ,稍后在 beforeSleep 中写出
+ */
+void clientInstallWriteHandler(redisClient *c) {
+	if (c->flags & REDIS_PENDING_WRITE) return;
+	c->flags |= REDIS_PENDING_WRITE;
+	listAddNodeHead(server.clients_pending_write, c);
+}
+
+/*
+ * 写出之后的收尾工作:
+ * 已经写完的客户端把回复缓冲区还给池,
+ * 一次没能写完的客户端,安装写处理器,由事件循环继续写出
+ */
+static void handleClientAfterWrite(redisClient *c) {
+	if (c->flags & REDIS_CLOSE_ASAP) return;
+	if (!clientHasPendingReplies(c)) {
+		clientReleaseReplyBuffer(c);
+		return;
+	}
+	if (aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+		sendReplyToClient, c) == AE_ERR)
+		freeClientAsync(c);
+}
+
+/*
+ * 在主线程中写出 clients_pending_write 中所有客户端的回复
+ */
+static int handleClientsWithPendingWrites(void) {
+	listIter li;
+	listNode *ln;
+	int processed = listLength(server.clients_pending_write);
+
+	listRewind(server.clients_pending_write, &li);
+	while ((ln = listNext(&li))) {
+		redisClient *c = listNodeValue(ln);
+		c->flags &= ~REDIS_PENDING_WRITE;
+		listDelNode(server.clients_pending_write, ln);
+
+		if (c->flags & REDIS_CLOSE_ASAP) continue;
+		if (writeToClient(c->fd, c, 0) == REDIS_ERR) continue;
+		handleClientAfterWrite(c);
+	}
+	return processed;
+}
+
+/*
+ * 将 clients_pending_write 中的客户端分给 I/O 线程写出.
+ *
+ * 返回处理的客户端数目.
+ */
+int handleClientsWithPendingWritesUsingThreads(void) {
+	listIter li;
+	listNode *ln;
+	int j, item_id = 0;
+	int processed = listLength(server.clients_pending_write);
+
+	if (processed == 0) return 0;
+
+	/* 客户端不多,或者没有开启 I/O 线程,直接在主线程中写出 */
+	if (stopThreadedIOIfNeeded()) return handleClientsWithPendingWrites();
+
+	if (!server.io_threads_active) startThreadedIO();
+
+	/* 将客户端轮流分配给各个线程 */
+	listRewind(server.clients_pending_write, &li);
+	while ((ln = listNext(&li))) {
+		redisClient *c = listNodeValue(ln);
+		c->flags &= ~REDIS_PENDING_WRITE;
+
+		if (c->flags & REDIS_CLOSE_ASAP) {
+			listDelNode(server.clients_pending_write, ln);
+			continue;
+		}
+		listAddNodeTail(io_threads_list[item_id % server.io_threads_num], c);
+		item_id++;
+	}
+
+	/* 唤醒其他线程,主线程自己处理 0 号链表 */
+	io_threads_op = IO_THREADS_OP_WRITE;
+	for (j = 1; j < server.io_threads_num; j++)
+		setIOPendingCount(j, listLength(io_threads_list[j]));
+
+	listRewind(io_threads_list[0], &li);
+	while ((ln = listNext(&li))) {
+		redisClient *c = listNodeValue(ln);
+		writeToClient(c->fd, c, 0);
+	}
+	listEmpty(io_threads_list[0]);
+
+	/* 等待其他线程完成 */
+	while (1) {
+		unsigned long pending = 0;
+		for (j = 1; j < server.io_threads_num; j++)
+			pending += getIOPendingCount(j);
+		if (pending == 0) break;
+	}
+
+	/* 写完的客户端归还回复缓冲区,没有写完的客户端安装写处理器 */
+	listRewind(server.clients_pending_write, &li);
+	while ((ln = listNext(&li))) {
+		handleClientAfterWrite(listNodeValue(ln));
+	}
+	listEmpty(server.clients_pending_write);
+	return processed;
+}
+
+/*
+ * 将 clients_pending_read 中的客户端分给 I/O 线程读取并解析,
+ * 然后在主线程中执行解析出来的命令.
+ *
+ * 返回处理的客户端数目.
+ */
+int handleClientsWithPendingReadsUsingThreads(void) {
+	listIter li;
+	listNode *ln;
+	int j, item_id = 0;
+	int processed = listLength(server.clients_pending_read);
+
+	if (!server.io_threads_active || !server.io_threads_do_reads) return 0;
+	if (processed == 0) return 0;
+
+	/* 将客户端轮流分配给各个线程 */
+	listRewind(server.clients_pending_read, &li);
+	while ((ln = listNext(&li))) {
+		redisClient *c = listNodeValue(ln);
+		listAddNodeTail(io_threads_list[item_id % server.io_threads_num], c);
+		item_id++;
+	}
+
+	/* 唤醒其他线程,主线程自己处理 0 号链表 */
+	io_threads_op = IO_THREADS_OP_READ;
+	for (j = 1; j < server.io_threads_num; j++)
+		setIOPendingCount(j, listLength(io_threads_list[j]));
+
+	listRewind(io_threads_list[0], &li);
+	while ((ln = listNext(&li))) {
+		redisClient *c = listNodeValue(ln);
+		readQueryFromClient(server.el, c->fd, c, 0);
+	}
+	listEmpty(io_threads_list[0]);
+
+	/* 等待其他线程完成 */
+	while (1) {
+		unsigned long pending = 0;
+		for (j = 1; j < server.io_threads_num; j++)
+			pending += getIOPendingCount(j);
+		if (pending == 0) break;
+	}
+
+	/* 回到主线程,执行已经解析好的命令 */
+	while (listLength(server.clients_pending_read)) {
+		redisClient *c;
+
+		ln = listFirst(server.clients_pending_read);
+		c = listNodeValue(ln);
+		c->flags &= ~REDIS_PENDING_READ;
+		listDelNode(server.clients_pending_read, ln);
+
+		if (c->flags & REDIS_CLOSE_ASAP) continue;
+
+		server.current_client = c;
+		if (c->flags & REDIS_PENDING_COMMAND) {
+			c->flags &= ~REDIS_PENDING_COMMAND;
+			if (processCommand(c) == REDIS_OK)
+				resetClient(c);
+		}
+		/* 处理查询缓冲区中剩下的命令 */
+		processInputBuffer(c);
+		server.current_client = NULL;
+
+		/* 解析时产生的回复还没有被安排写出 */
+		if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+	}
+	return processed;
+}
+
+#ifdef REDIS_TEST
+/*
+ * 命令请求解析和回复缓冲区池的测试: make redis-test && ./redis-test test networking
+ * 解析的性能: ./redis-test test networking benchmark
+ */
+static int failed = 0;
+
+#define test_assert(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+/*
+ * 只用于解析的客户端, 没有网络连接也不属于任何数据库
+ */
+static redisClient *createParseClient(void) {
+	redisClient *c = zcalloc(sizeof(redisClient));
+
+	c->fd = -1;
+	c->querybuf = sdsempty();
+	c->bulklen = -1;
+	c->reply = listCreate();
+	return c;
+}
+
+static void freeParseClient(redisClient *c) {
+	freeClientArgv(c);
+	zfree(c->argv);
+	sdsfree(c->querybuf);
+	listRelease(c->reply);
+	zfree(c);
+}
+
+/*
+ * 和 processInputBuffer 一样解析查询缓冲区, 但不执行命令,
+ * 而是把每条命令的参数用空格连接起来追加到 *out 中, 命令之间用 '|' 分隔
+ * 返回解析出来的命令数
+ */
+static int parseQueryBuffer(redisClient *c, sds *out) {
+	int count = 0;
+
+	while (c->qb_pos < sdslen(c->querybuf)) {
+		int j;
+
+		if (!c->reqtype)
+			c->reqtype = c->querybuf[c->qb_pos] == '*' ? REDIS_REQ_MULTIBULK : REDIS_REQ_INLINE;
+		if (c->reqtype == REDIS_REQ_INLINE) {
+			if (processInlineBuffer(c) != REDIS_OK) break;
+		}
+		else {
+			if (processMultibulkBuffer(c) != REDIS_OK) break;
+		}
+		if (out) {
+			for (j = 0; j < c->argc; j++) {
+				*out = sdscatsds(*out, c->argv[j]->ptr);
+				*out = sdscat(*out, j == c->argc - 1 ? "|" : " ");
+			}
+		}
+		if (c->argc) count++;
+		resetClient(c);
+	}
+	if (c->qb_pos) {
+		sdsrange(c->querybuf, c->qb_pos, -1);
+		c->qb_pos = 0;
+	}
+	return count;
+}
+
+static sds appendMultibulk(sds s, int argc, const char **argv) {
+	int j;
+
+	s = sdscatprintf(s, "*%d\r\n", argc);
+	for (j = 0; j < argc; j++)
+		s = sdscatprintf(s, "$%zu\r\n%s\r\n", strlen(argv[j]), argv[j]);
+	return s;
+}
+
+/*
+ * 同一段输入在任意位置被分成两次读入, 解析的结果都应该相同
+ */
+static void testSplitInput(const char *desc, sds input, const char *expected) {
+	size_t split;
+	int bad = 0;
+
+	for (split = 0; split <= sdslen(input); split++) {
+		redisClient *c = createParseClient();
+		sds out = sdsempty();
+
+		c->querybuf = sdscatlen(c->querybuf, input, split);
+		parseQueryBuffer(c, &out);
+		c->querybuf = sdscatlen(c->querybuf, input + split, sdslen(input) - split);
+		parseQueryBuffer(c, &out);
+		if (strcmp(out, expected) != 0 || sdslen(c->querybuf) != 0) {
+			if (bad++ == 0)
+				printf("%s: split at %zu: got \"%s\"\n", desc, split, out);
+		}
+		sdsfree(out);
+		freeParseClient(c);
+	}
+	test_assert(bad == 0);
+}
+
+static void testParser(void) {
+	const char *set[] = { "SET", "key", "value" };
+	const char *get[] = { "GET", "key" };
+	const char *empty[] = { "SET", "", "10" };
+	sds input, big, expected;
+
+	input = appendMultibulk(sdsempty(), 3, set);
+	input = appendMultibulk(input, 2, get);
+	input = appendMultibulk(input, 3, empty);
+	testSplitInput("multibulk", input, "SET key value|GET key|SET  10|");
+	sdsfree(input);
+
+	// 内联命令既可以用 \r\n 也可以只用 \n 结尾
+	input = sdsnew("SET a b\nGET a\r\n  \r\nDEL a\n");
+	testSplitInput("inline", input, "SET a b|GET a|DEL a|");
+	sdsfree(input);
+
+	input = sdsnew("GET a\r\n");
+	input = appendMultibulk(input, 2, get);
+	input = sdscat(input, "GET b\n");
+	testSplitInput("mixed", input, "GET a|GET key|GET b|");
+	sdsfree(input);
+
+	// 超过 REDIS_MBULK_BIG_ARG 的参数会被直接当作参数对象使用
+	big = sdsgrowzero(sdsempty(), REDIS_MBULK_BIG_ARG * 2);
+	memset(big, 'x', sdslen(big));
+	set[2] = big;
+	input = appendMultibulk(sdsempty(), 3, set);
+	input = appendMultibulk(input, 2, get);
+	expected = sdscatprintf(sdsempty(), "SET key %s|GET key|", big);
+	testSplitInput("big argument", input, expected);
+	sdsfree(input);
+	sdsfree(expected);
+	sdsfree(big);
+}
+
+/*
+ * 每次读入 16KB 的流水线 SET/GET 命令, 计算解析一条命令的平均耗时
+ */
+static void benchmarkParser(void) {
+	redisClient *c = createParseClient();
+	sds input = sdsempty();
+	long long start, elapsed;
+	int commands = 0, rounds = 2000, j;
+
+	while (sdslen(input) < 16 * 1024 - 64) {
+		char key[32], val[32];
+		const char *set[] = { "SET", key, val };
+		const char *get[] = { "GET", key };
+
+		snprintf(key, sizeof(key), "key:%08d", commands);
+		snprintf(val, sizeof(val), "value:%08d", commands);
+		input = commands % 2 ? appendMultibulk(input, 2, get) : appendMultibulk(input, 3, set);
+		commands++;
+	}
+
+	start = ustime();
+	for (j = 0; j < rounds; j++) {
+		c->querybuf = sdscatlen(c->querybuf, input, sdslen(input));
+		test_assert(parseQueryBuffer(c, NULL) == commands);
+	}
+	elapsed = ustime() - start;
+	printf("parse: %d commands per %zu byte read, %.1f ns per command\n",
+		commands, sdslen(input), (double)elapsed * 1000 / ((long long)commands * rounds));
+	sdsfree(input);
+	freeParseClient(c);
+}
+
+/*
+ * 缓冲区池: 写空的缓冲区回到池中, 一直没有被取出过的缓冲区每个周期释放一半,
+ * 每个周期都会被取空的池不缩小
+ */
+static void testReplyBufferPool(void) {
+	redisClient *clients[100];
+	int j, round;
+
+	server.reply_buf_pool = zmalloc(sizeof(char*) * REDIS_REPLY_BUF_POOL_MAX);
+	server.reply_buf_pool_len = server.reply_buf_pool_min = 0;
+	for (j = 0; j < 100; j++) {
+		clients[j] = createParseClient();
+		test_assert(_addReplyToBuffer(clients[j], "+OK\r\n", 5) == REDIS_OK);
+	}
+	for (j = 0; j < 100; j++) {
+		clients[j]->bufpos = 0;
+		clientReleaseReplyBuffer(clients[j]);
+		test_assert(clients[j]->buf == NULL);
+	}
+	test_assert(server.reply_buf_pool_len == 100);
+
+	/* 高峰刚过, 这一个周期还不能算是空闲的 */
+	replyBufferPoolTrim();
+	test_assert(server.reply_buf_pool_len == 100);
+
+	/* 每个周期 30 个客户端取出又放回缓冲区 */
+	for (round = 0; round < 20; round++) {
+		for (j = 0; j < 30; j++)
+			test_assert(_addReplyToBuffer(clients[j], "+OK\r\n", 5) == REDIS_OK);
+		for (j = 0; j < 30; j++) {
+			clients[j]->bufpos = 0;
+			clientReleaseReplyBuffer(clients[j]);
+		}
+		replyBufferPoolTrim();
+		if (round == 0) test_assert(server.reply_buf_pool_len == 65);
+	}
+	test_assert(server.reply_buf_pool_len == 30);
+
+	/* 完全空闲之后全部释放 */
+	for (round = 0; round < 10; round++) replyBufferPoolTrim();
+	test_assert(server.reply_buf_pool_len == 0);
+
+	for (j = 0; j < 100; j++) freeParseClient(clients[j]);
+	zfree(server.reply_buf_pool);
+}
+
+int networkingTest(int argc, char **argv) {
+	initServerConfig();
+	if (argc >= 4 && !strcasecmp(argv[3], "benchmark")) {
+		benchmarkParser();
+		return failed != 0;
+	}
+
+	testParser();
+	testReplyBufferPool();
+	if (failed) {
+		printf("%d assertions failed\n", failed);
+		return 1;
+	}
+	printf("all tests passed\n");
+	return 0;
+}
+#endif
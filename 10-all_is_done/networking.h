@@ -10,9 +10,13 @@ void addReplyLongLongWithPrefix(redisClient *c, long long ll, char prefix);
 void addReplyBulkLen(redisClient *c, robj *obj);
 void addReplyBulk(redisClient *c, robj *obj);
 void *dupClientReplyValue(void *o);
-robj *dupLastObjectIfNeeded(list *reply);
+int clientHasPendingReplies(redisClient *c);
+int writeToClient(int fd, redisClient *c, int handler_installed);
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
 int prepareClientToWrite(redisClient *c);
+void clientInstallWriteHandler(redisClient *c);
+void clientReleaseReplyBuffer(redisClient *c);
+void replyBufferPoolTrim(void);
 redisClient *createClient(int fd);
 void addReply(redisClient *c, robj *obj);
 int processInlineBuffer(redisClient *c);
@@ -23,6 +27,7 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void *dupClientReplyValue(void *o);
 void decrRefCountVoid(void *o);
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void addReplyErrorLength(redisClient *c, char *s, size_t len);
 void addReplyError(redisClient *c, char *err);
 void freeClientArgv(redisClient *c);
@@ -42,8 +47,19 @@ void addReplyDouble(redisClient *c, double d);
 
 void freeClientAsync(redisClient *c);
 void freeClientsInAsyncFreeQueue(void);
+unsigned long getClientOutputBufferMemoryUsage(redisClient *c);
+int getClientLimitClass(redisClient *c);
 int checkClientOutputBufferLimits(redisClient *c);
 void asyncCloseClientOnOutputBufferLimitReached(redisClient *c);
 int processEventsWhileBlocked(void);
 void addReplyErrorFormat(redisClient *c, const char *fmt, ...);
+
+void initThreadedIO(void);
+int handleClientsWithPendingWritesUsingThreads(void);
+int handleClientsWithPendingReadsUsingThreads(void);
+int handleClientsWithPendingInput(void);
+
+#ifdef REDIS_TEST
+int networkingTest(int argc, char **argv);
+#endif
 #endif
\ No newline at end of file
@@ -1,10 +1,11 @@
 /* Redis Object implementation. */
 #include "object.h"
 #include "util.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "networking.h"
 #include "intset.h"
 #include "t_zset.h"
+#include "evict.h"
 
 #include <unistd.h>
 #include <math.h>
@@ -13,22 +14,35 @@
 extern struct sharedObjectsStruct shared;
 extern struct dictType zsetDictType;
 
+/*
+ * 设置新对象的 lru 字段:
+ * LFU 策略下是当前时间和初始的访问频率, 否则是当前的 LRU 时钟
+ */
+static void initObjectLRU(robj *o) {
+	if (server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LFU)
+		o->lru = (LFUGetTimeInMinutes() << 8) | LFU_INIT_VAL;
+	else
+		o->lru = LRU_CLOCK();
+}
+
 /* 
  * 创建一个 REDIS_ENCODING_EMBSTR 编码的字符对象
  * 这个字符串对象中的 sds 会和字符串对象的 redisObject 结构一起分配
  * 因此这个字符也是不可修改的 
  */
 robj *createEmbeddedStringObject(char *ptr, size_t len) {
-	robj *o = zmalloc(sizeof(robj) + sizeof(struct sdshdr) + len + 1);
-	struct sdshdr *sh = (void*)(o + 1);
+	robj *o = zmalloc(sizeof(robj) + sizeof(struct sdshdr8) + len + 1);
+	struct sdshdr8 *sh = (void*)(o + 1);
 
 	o->type = REDIS_STRING;
 	o->encoding = REDIS_ENCODING_EMBSTR;
 	o->ptr = sh + 1;
 	o->refcount = 1;
+	initObjectLRU(o);
 
 	sh->len = len;
-	sh->free = 0;
+	sh->alloc = len;
+	sh->flags = SDS_TYPE_8;
 	if (ptr) {
 		memcpy(sh->buf, ptr, len);
 		sh->buf[len] = '\0';
@@ -51,9 +65,10 @@ robj *createRawStringObject(char *ptr, size_t len) {
 * REIDS_ENCODING_EMBSTR_SIZE_LIMIT, otherwise the RAW encoding is
 * used.
 *
-* The current limit of 39 is chosen so that the biggest string object
-* we allocate as EMBSTR will still fit into the 64 byte arena of jemalloc. */
-#define REDIS_ENCODING_EMBSTR_SIZE_LIMIT 39
+* The current limit of 44 is chosen so that the biggest string object
+* we allocate as EMBSTR will still fit into the 64 byte arena of jemalloc:
+* 16 (robj) + 3 (sdshdr8) + 44 + 1 ('\0') = 64. */
+#define REDIS_ENCODING_EMBSTR_SIZE_LIMIT 44
 robj *createStringObject(char *ptr, size_t len) {
 	if (len <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT)
 		return createEmbeddedStringObject(ptr, len);
@@ -72,9 +87,7 @@ robj *createObject(int type, void *ptr) {
 	o->encoding = REDIS_ENCODING_RAW;
 	o->ptr = ptr;
 	o->refcount = 1;
-
-	/* Set the LRU to the current lruclock (minutes resolution). */
-	//o->lru = LRU_CLOCK();
+	initObjectLRU(o);
 	return o;
 }
 
@@ -96,12 +109,8 @@ void freeListObject(robj *o) {
 
 	switch (o->encoding) {
 
-	case REDIS_ENCODING_LINKEDLIST:
-		listRelease((list*)o->ptr);
-		break;
-
-	case REDIS_ENCODING_ZIPLIST:
-		zfree(o->ptr);
+	case REDIS_ENCODING_QUICKLIST:
+		quicklistRelease(o->ptr);
 		break;
 
 	default:
@@ -145,7 +154,7 @@ void freeZsetObject(robj *o) {
 		zfree(zs);
 		break;
 
-	case REDIS_ENCODING_ZIPLIST:
+	case REDIS_ENCODING_LISTPACK:
 		zfree(o->ptr);
 		break;
 
@@ -165,7 +174,7 @@ void freeHashObject(robj *o) {
 		dictRelease((dict*)o->ptr);
 		break;
 
-	case REDIS_ENCODING_ZIPLIST:
+	case REDIS_ENCODING_LISTPACK:
 		zfree(o->ptr);
 		break;
 
@@ -181,14 +190,24 @@ void freeHashObject(robj *o) {
  * 当对象的引用计数降为 0 时，释放对象。
  */
 void decrRefCount(robj *o) {
+	int last;
 
+	if (o->refcount == REDIS_SHARED_REFCOUNT) return;
 	if (o->refcount <= 0) {
 	   mylog("decrRefCount against refcount <= 0");
 	   assert(0);
 	}
 
+	// 多 reactor 模式下对象可能同时被几个分区引用(比如跨分区执行的 SUNIONSTORE),
+	// 开启 I/O 线程时回复链表引用的对象会在 I/O 线程中释放,
+	// 这两种情况下引用计数需要原子地增减
+	if (server.reactors_num > 1 || server.io_threads_num > 1)
+		last = __atomic_sub_fetch(&o->refcount, 1, __ATOMIC_ACQ_REL) == 0;
+	else
+		last = --o->refcount == 0;
+
 	// 释放对象
-	if (o->refcount == 1) {
+	if (last) {
 		switch (o->type) {
 		case REDIS_STRING: freeStringObject(o); break;
 		case REDIS_LIST: freeListObject(o); break;
@@ -201,11 +220,6 @@ void decrRefCount(robj *o) {
 			break;
 		}
 		zfree(o);
-
-		// 减少计数
-	}
-	else {
-		o->refcount--;
 	}
 }
 
@@ -223,7 +237,22 @@ void decrRefCountVoid(void *o) {
  * 为对象的引用计数增一
  */
 void incrRefCount(robj *o) {
-	o->refcount++;
+	if (o->refcount == REDIS_SHARED_REFCOUNT) return;
+	if (server.reactors_num > 1 || server.io_threads_num > 1)
+		__atomic_add_fetch(&o->refcount, 1, __ATOMIC_RELAXED);
+	else
+		o->refcount++;
+}
+
+/*
+ * 把对象标记为全局共享的, 之后它的引用计数不再变化, 也永远不会被释放.
+ * 多 reactor 模式下共享对象会被几个线程同时读取, 任何线程都不能再写它,
+ * 包括 lru 字段.
+ */
+robj *makeObjectShared(robj *o) {
+	assert(o->refcount == 1);
+	o->refcount = REDIS_SHARED_REFCOUNT;
+	return o;
 }
 
 
@@ -425,7 +454,10 @@ robj *createStringObjectFromLongLong(long long value) {
 	robj *o;
 
 	// 如果value的大小在REDIS共享整数范围之内
-	if (value >= 0 && value < REDIS_SHARED_INTEGERS) {
+	// 按 LRU/LFU 淘汰时每个值都要有自己的 lru 字段, 不能共享
+	if (value >= 0 && value < REDIS_SHARED_INTEGERS &&
+		(server.maxmemory == 0 ||
+		!(server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_NO_SHARED_INTEGERS))) {
 		incrRefCount(shared.integers[value]);
 		o = shared.integers[value];
 	}
@@ -443,22 +475,22 @@ robj *createStringObjectFromLongLong(long long value) {
 }
 
 /*
- * 创建一个ZIPLIST编码的哈希对象
+ * 创建一个LISTPACK编码的哈希对象
  */
 robj* createHashObject(void) {
-	unsigned char *zl = ziplistNew();
+	unsigned char *zl = lpNew();
 	robj *o = createObject(REDIS_HASH, zl);
-	o->encoding = REDIS_ENCODING_ZIPLIST;
+	o->encoding = REDIS_ENCODING_LISTPACK;
 	return o;
 }
 
 /*
- * 创建一个ZIPLIST编码的列表对象
+ * 创建一个QUICKLIST编码的列表对象
  */
-robj *createZiplistObject(void) {
-	unsigned char *zl = ziplistNew();
-	robj *o = createObject(REDIS_LIST, zl);
-	o->encoding = REDIS_ENCODING_ZIPLIST;
+robj *createQuicklistObject(void) {
+	quicklist *l = quicklistCreate();
+	robj *o = createObject(REDIS_LIST, l);
+	o->encoding = REDIS_ENCODING_QUICKLIST;
 	return o;
 }
 
@@ -553,12 +585,12 @@ robj *createZsetObject(void) {
 }
 
 /*
- * 创建一个 ZIPLIST 编码的有序集合
+ * 创建一个 LISTPACK 编码的有序集合
  */
-robj* createZsetZiplistObject(void) {
-	unsigned char *zl = ziplistNew(); /* ziplist貌似是压缩链表 */
+robj* createZsetListpackObject(void) {
+	unsigned char *zl = lpNew();
 	robj *o = createObject(REDIS_ZSET, zl);
-	o->encoding = REDIS_ENCODING_ZIPLIST;
+	o->encoding = REDIS_ENCODING_LISTPACK;
 	return o;
 }
 
@@ -682,19 +714,3 @@ robj *createStringObjectFromLongDouble(long double value) {
 	// 创建对象
 	return createStringObject(buf, len);
 }
-
-/*
- * 创建一个 LINKEDLIST 编码的列表对象
- */
-robj *createListObject(void) {
-
-	list *l = listCreate();
-
-	robj *o = createObject(REDIS_LIST, l);
-
-	listSetFreeMethod(l, decrRefCountVoid);
-
-	o->encoding = REDIS_ENCODING_LINKEDLIST;
-
-	return o;
-}
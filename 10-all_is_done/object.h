@@ -17,6 +17,7 @@ void decrRefCount(robj *o);
 void decrRefCountVoid(void *o);
 robj *dupStringObject(robj *o);
 void incrRefCount(robj *o);
+robj *makeObjectShared(robj *o);
 robj *createEmbeddedStringObject(char *ptr, size_t len);
 int getLongLongFromObject(robj *o, long long *target);
 int getLongLongFromObjectOrReply(redisClient *c, robj *o, long long *target, const char *msg);
@@ -27,7 +28,7 @@ robj *getDecodedObject(robj *o);
 size_t stringObjectLen(robj *o);
 robj *createStringObjectFromLongLong(long long value);
 void freeListObject(robj *o);
-robj *createZiplistObject(void);
+robj *createQuicklistObject(void);
 
 robj* createIntsetObject(void);
 int isObjectRepresentableAsLongLong(robj *o, long long *llval);
@@ -35,9 +36,8 @@ int isObjectRepresentableAsLongLong(robj *o, long long *llval);
 int isObjectRepresentableAsLongLong(robj *o, long long *llval);
 int getDoubleFromObject(robj *o, double *target);
 robj *createZsetObject(void);
-robj* createZsetZiplistObject(void);
+robj* createZsetListpackObject(void);
 int compareStringObjectsWithFlags(robj *a, robj *b, int flags);
 int compareStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
-robj *createListObject(void);
 #endif
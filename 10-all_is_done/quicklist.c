@@ -0,0 +1,1009 @@
+#include <string.h>
+#include "quicklist.h"
+#include "zmalloc.h"
+#include "listpack.h"
+#include "adlist.h"
+#include "lzf.h"
+#include "util.h"
+
+/*
+ * fill 为负数时每个节点的 listpack 的字节数上限, -1 对应 4KB, -5 对应 64KB
+ */
+static const size_t optimization_level[] = { 4096, 8192, 16384, 32768, 65536 };
+
+/* fill 为正数时, 节点的 listpack 也不能超过这么多字节 */
+#define SIZE_SAFETY_LIMIT 8192
+
+/* 小于这么多字节的节点不压缩 */
+#define MIN_COMPRESS_BYTES 48
+
+/* 压缩之后至少要省下这么多字节才保留压缩的结果 */
+#define MIN_COMPRESS_IMPROVE 8
+
+/* fill 和 compress 都只有 16 位 */
+#define FILL_MAX ((1 << 15) - 1)
+#define COMPRESS_MAX ((1 << 16) - 1)
+
+#define quicklistAllowsCompression(_ql) ((_ql)->compress != 0)
+
+#define quicklistNodeUpdateSz(node) \
+	do { (node)->sz = lpBytes((node)->lp); } while (0)
+
+/*
+ * 创建一个空的 quicklist, 每个节点最多 8KB, 不压缩
+ */
+quicklist *quicklistCreate(void) {
+	quicklist *ql = zmalloc(sizeof(*ql));
+
+	ql->head = ql->tail = NULL;
+	ql->len = 0;
+	ql->count = 0;
+	ql->compress = 0;
+	ql->fill = -2;
+	return ql;
+}
+
+static void quicklistSetCompressDepth(quicklist *quicklist, int compress) {
+	if (compress > COMPRESS_MAX) compress = COMPRESS_MAX;
+	else if (compress < 0) compress = 0;
+	quicklist->compress = compress;
+}
+
+static void quicklistSetFill(quicklist *quicklist, int fill) {
+	if (fill > FILL_MAX) fill = FILL_MAX;
+	else if (fill < -5) fill = -5;
+	else if (fill == 0) fill = 1;
+	quicklist->fill = fill;
+}
+
+void quicklistSetOptions(quicklist *quicklist, int fill, int depth) {
+	quicklistSetFill(quicklist, fill);
+	quicklistSetCompressDepth(quicklist, depth);
+}
+
+/*
+ * 创建一个使用给定选项的空 quicklist
+ */
+quicklist *quicklistNew(int fill, int compress) {
+	quicklist *ql = quicklistCreate();
+
+	quicklistSetOptions(ql, fill, compress);
+	return ql;
+}
+
+static quicklistNode *quicklistCreateNode(void) {
+	quicklistNode *node = zmalloc(sizeof(*node));
+
+	node->prev = node->next = NULL;
+	node->lp = NULL;
+	node->sz = 0;
+	node->count = 0;
+	node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+	node->recompress = 0;
+	node->extra = 0;
+	return node;
+}
+
+/*
+ * 返回 quicklist 的元素总数
+ */
+unsigned long quicklistCount(const quicklist *ql) {
+	return ql->count;
+}
+
+/*
+ * 释放整个 quicklist
+ */
+void quicklistRelease(quicklist *quicklist) {
+	quicklistNode *current, *next;
+
+	current = quicklist->head;
+	while (current) {
+		next = current->next;
+		zfree(current->lp);
+		zfree(current);
+		current = next;
+	}
+	zfree(quicklist);
+}
+
+/*
+ * 用 LZF 压缩节点的 listpack.
+ * 节点太小或者压缩不了多少时保持原样并返回 0, 压缩成功返回 1.
+ */
+static int __quicklistCompressNode(quicklistNode *node) {
+	quicklistLZF *lzf;
+
+	node->recompress = 0;
+	if (node->sz < MIN_COMPRESS_BYTES) return 0;
+
+	lzf = zmalloc(sizeof(*lzf) + node->sz);
+	if (((lzf->sz = lzf_compress(node->lp, node->sz, lzf->compressed, node->sz)) == 0) ||
+		lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
+		/* 压缩失败, 或者压缩之后也没小多少 */
+		zfree(lzf);
+		return 0;
+	}
+	lzf = zrealloc(lzf, sizeof(*lzf) + lzf->sz);
+	zfree(node->lp);
+	node->lp = (unsigned char *)lzf;
+	node->encoding = QUICKLIST_NODE_ENCODING_LZF;
+	return 1;
+}
+
+/*
+ * 解压节点的 listpack, 失败返回 0
+ */
+static int __quicklistDecompressNode(quicklistNode *node) {
+	void *decompressed = zmalloc(node->sz);
+	quicklistLZF *lzf = (quicklistLZF *)node->lp;
+
+	if (lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz) == 0) {
+		zfree(decompressed);
+		return 0;
+	}
+	zfree(lzf);
+	node->lp = decompressed;
+	node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+	return 1;
+}
+
+#define quicklistCompressNode(_node) \
+	do { \
+		if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_RAW) \
+			__quicklistCompressNode((_node)); \
+	} while (0)
+
+#define quicklistDecompressNode(_node) \
+	do { \
+		if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) \
+			__quicklistDecompressNode((_node)); \
+	} while (0)
+
+/* 为了读取而临时解压, 用完之后由 quicklistCompress 重新压缩 */
+#define quicklistDecompressNodeForUse(_node) \
+	do { \
+		if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) { \
+			__quicklistDecompressNode((_node)); \
+			(_node)->recompress = 1; \
+		} \
+	} while (0)
+
+/*
+ * 返回被压缩的节点中压缩后的数据和它的字节数, 节点必须是被压缩的.
+ * 保存 RDB 时直接写入压缩后的数据, 不用先解压.
+ */
+size_t quicklistGetLzf(const quicklistNode *node, void **data) {
+	quicklistLZF *lzf = (quicklistLZF *)node->lp;
+
+	*data = lzf->compressed;
+	return lzf->sz;
+}
+
+/*
+ * 保证两端各 compress 个节点是解压的, 其余的节点中只压缩 node 和
+ * 刚好越过深度的两个节点, 更靠里的节点在它们被访问过之后就已经是压缩的了.
+ */
+static void __quicklistCompress(const quicklist *quicklist, quicklistNode *node) {
+	quicklistNode *forward, *reverse;
+	int depth = 0, in_depth = 0;
+
+	/* 节点太少时没有需要压缩的节点 */
+	if (!quicklistAllowsCompression(quicklist) ||
+		quicklist->len < (unsigned int)(quicklist->compress * 2))
+		return;
+
+	forward = quicklist->head;
+	reverse = quicklist->tail;
+	while (depth++ < quicklist->compress) {
+		quicklistDecompressNode(forward);
+		quicklistDecompressNode(reverse);
+
+		if (forward == node || reverse == node)
+			in_depth = 1;
+
+		/* 两端相遇了, 所有的节点都在深度之内 */
+		if (forward == reverse || forward->next == reverse)
+			return;
+
+		forward = forward->next;
+		reverse = reverse->prev;
+	}
+
+	if (!in_depth) quicklistCompressNode(node);
+
+	/* 刚刚越过深度的两个节点 */
+	quicklistCompressNode(forward);
+	quicklistCompressNode(reverse);
+}
+
+#define quicklistCompress(_ql, _node) \
+	do { \
+		if ((_node)->recompress) \
+			quicklistCompressNode((_node)); \
+		else \
+			__quicklistCompress((_ql), (_node)); \
+	} while (0)
+
+/*
+ * 用完 quicklistIndex 返回的元素之后调用, 把被临时解压的节点重新压缩
+ */
+void quicklistRecompress(const quicklist *quicklist, quicklistNode *node) {
+	quicklistCompress(quicklist, node);
+}
+
+/*
+ * 把 new_node 插入到 old_node 之前或者之后, old_node 为 NULL 时 quicklist 必须为空
+ */
+static void __quicklistInsertNode(quicklist *quicklist, quicklistNode *old_node,
+	quicklistNode *new_node, int after) {
+	if (after) {
+		new_node->prev = old_node;
+		if (old_node) {
+			new_node->next = old_node->next;
+			if (old_node->next) old_node->next->prev = new_node;
+			old_node->next = new_node;
+		}
+		if (quicklist->tail == old_node) quicklist->tail = new_node;
+	}
+	else {
+		new_node->next = old_node;
+		if (old_node) {
+			new_node->prev = old_node->prev;
+			if (old_node->prev) old_node->prev->next = new_node;
+			old_node->prev = new_node;
+		}
+		if (quicklist->head == old_node) quicklist->head = new_node;
+	}
+	if (quicklist->len == 0) quicklist->head = quicklist->tail = new_node;
+	quicklist->len++;
+
+	/* 原来的端点现在可能越过了压缩深度 */
+	if (old_node) quicklistCompress(quicklist, old_node);
+}
+
+/*
+ * 节点的 listpack 加上 sz 字节的新元素之后是否还在 fill 的限制之内
+ */
+static int _quicklistNodeAllowInsert(const quicklistNode *node, const int fill, const size_t sz) {
+	int listpack_overhead;
+	size_t new_sz;
+
+	if (node == NULL) return 0;
+
+	/* 元素的编码和长度 */
+	if (sz < 64) listpack_overhead = 1;
+	else if (sz < 4096) listpack_overhead = 2;
+	else listpack_overhead = 5;
+
+	/* 元素尾部的 backlen */
+	if (sz + listpack_overhead <= 127) listpack_overhead += 1;
+	else if (sz + listpack_overhead < 16383) listpack_overhead += 2;
+	else listpack_overhead += 3;
+
+	/* 整数编码的元素实际上更小, 这里按字符串估计 */
+	new_sz = node->sz + sz + listpack_overhead;
+
+	if (fill < 0) {
+		int offset = (-fill) - 1;
+
+		return offset < (int)(sizeof(optimization_level) / sizeof(*optimization_level)) &&
+			new_sz <= optimization_level[offset];
+	}
+	if (new_sz > SIZE_SAFETY_LIMIT) return 0;
+	return (int)node->count < fill;
+}
+
+/*
+ * 把值推入表头, 创建了新的表头节点时返回 1
+ */
+int quicklistPushHead(quicklist *quicklist, void *value, size_t sz) {
+	quicklistNode *orig_head = quicklist->head;
+
+	if (_quicklistNodeAllowInsert(quicklist->head, quicklist->fill, sz)) {
+		quicklist->head->lp = lpPush(quicklist->head->lp, value, sz, LP_HEAD);
+		quicklistNodeUpdateSz(quicklist->head);
+	}
+	else {
+		quicklistNode *node = quicklistCreateNode();
+
+		node->lp = lpPush(lpNew(), value, sz, LP_HEAD);
+		quicklistNodeUpdateSz(node);
+		__quicklistInsertNode(quicklist, quicklist->head, node, 0);
+	}
+	quicklist->count++;
+	quicklist->head->count++;
+	return orig_head != quicklist->head;
+}
+
+/*
+ * 把值推入表尾, 创建了新的表尾节点时返回 1
+ */
+int quicklistPushTail(quicklist *quicklist, void *value, size_t sz) {
+	quicklistNode *orig_tail = quicklist->tail;
+
+	if (_quicklistNodeAllowInsert(quicklist->tail, quicklist->fill, sz)) {
+		quicklist->tail->lp = lpPush(quicklist->tail->lp, value, sz, LP_TAIL);
+		quicklistNodeUpdateSz(quicklist->tail);
+	}
+	else {
+		quicklistNode *node = quicklistCreateNode();
+
+		node->lp = lpPush(lpNew(), value, sz, LP_TAIL);
+		quicklistNodeUpdateSz(node);
+		__quicklistInsertNode(quicklist, quicklist->tail, node, 1);
+	}
+	quicklist->count++;
+	quicklist->tail->count++;
+	return orig_tail != quicklist->tail;
+}
+
+/*
+ * where 为 QUICKLIST_HEAD 或者 QUICKLIST_TAIL
+ */
+void quicklistPush(quicklist *quicklist, void *value, const size_t sz, int where) {
+	if (where == QUICKLIST_HEAD)
+		quicklistPushHead(quicklist, value, sz);
+	else if (where == QUICKLIST_TAIL)
+		quicklistPushTail(quicklist, value, sz);
+}
+
+/*
+ * 把一个完整的 listpack 作为新的表尾节点, listpack 归 quicklist 所有.
+ * 载入 RDB 时使用, 不检查节点的大小限制.
+ */
+void quicklistAppendListpack(quicklist *quicklist, unsigned char *lp) {
+	quicklistNode *node = quicklistCreateNode();
+
+	node->lp = lp;
+	node->count = lpLength(node->lp);
+	node->sz = lpBytes(lp);
+
+	__quicklistInsertNode(quicklist, quicklist->tail, node, 1);
+	quicklist->count += node->count;
+}
+
+/*
+ * 逐个取出 listpack 中的元素来创建一个 quicklist, 然后释放 listpack
+ */
+quicklist *quicklistCreateFromListpack(int fill, int compress, unsigned char *lp) {
+	quicklist *ql = quicklistNew(fill, compress);
+	unsigned char *p = lpFirst(lp);
+	unsigned char *vstr;
+	unsigned int vlen;
+	long long vlong;
+	char longstr[32] = { 0 };
+
+	while (lpGet(p, &vstr, &vlen, &vlong)) {
+		if (!vstr) {
+			vlen = ll2string(longstr, sizeof(longstr), vlong);
+			vstr = (unsigned char *)longstr;
+		}
+		quicklistPushTail(ql, vstr, vlen);
+		p = lpNext(lp, p);
+	}
+	zfree(lp);
+	return ql;
+}
+
+/*
+ * 从链表中删除一个节点
+ */
+static void __quicklistDelNode(quicklist *quicklist, quicklistNode *node) {
+	if (node->next) node->next->prev = node->prev;
+	if (node->prev) node->prev->next = node->next;
+
+	if (node == quicklist->tail) quicklist->tail = node->prev;
+	if (node == quicklist->head) quicklist->head = node->next;
+
+	quicklist->len--;
+	quicklist->count -= node->count;
+
+	/* 原来在深度之外的节点现在可能成了端点, 要解压 */
+	__quicklistCompress(quicklist, NULL);
+
+	zfree(node->lp);
+	zfree(node);
+}
+
+/*
+ * 删除节点中 *p 处的元素, 节点变空时连节点一起删除.
+ * 节点被删除时返回 1.
+ */
+static int quicklistDelIndex(quicklist *quicklist, quicklistNode *node, unsigned char **p) {
+	int gone = 0;
+
+	node->lp = lpDelete(node->lp, p);
+	node->count--;
+	if (node->count == 0) {
+		gone = 1;
+		__quicklistDelNode(quicklist, node);
+	}
+	else {
+		quicklistNodeUpdateSz(node);
+	}
+	quicklist->count--;
+	return gone;
+}
+
+/*
+ * 用 data 替换索引 index 处的元素, 索引超出范围时返回 0
+ */
+int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data, int sz) {
+	quicklistEntry entry;
+
+	if (!quicklistIndex(quicklist, index, &entry)) return 0;
+
+	entry.node->lp = lpReplace(entry.node->lp, &entry.zi, data, sz);
+	quicklistNodeUpdateSz(entry.node);
+	quicklistCompress(quicklist, entry.node);
+	return 1;
+}
+
+/*
+ * 创建一个迭代器, direction 为 AL_START_HEAD 时从表头开始, 为 AL_START_TAIL 时从表尾开始
+ */
+quicklistIter *quicklistGetIterator(const quicklist *quicklist, int direction) {
+	quicklistIter *iter = zmalloc(sizeof(*iter));
+
+	if (direction == AL_START_HEAD) {
+		iter->current = quicklist->head;
+		iter->offset = 0;
+	}
+	else {
+		iter->current = quicklist->tail;
+		iter->offset = -1;
+	}
+	iter->direction = direction;
+	iter->quicklist = quicklist;
+	iter->zi = NULL;
+	return iter;
+}
+
+/*
+ * 创建一个从索引 idx 开始的迭代器, 索引超出范围时返回 NULL
+ */
+quicklistIter *quicklistGetIteratorAtIdx(const quicklist *quicklist,
+	const int direction, const long long idx) {
+	quicklistEntry entry;
+
+	if (quicklistIndex(quicklist, idx, &entry)) {
+		quicklistIter *base = quicklistGetIterator(quicklist, direction);
+
+		base->zi = NULL;
+		base->current = entry.node;
+		base->offset = entry.offset;
+		return base;
+	}
+	return NULL;
+}
+
+/*
+ * 释放迭代器, 重新压缩迭代到一半的节点
+ */
+void quicklistReleaseIterator(quicklistIter *iter) {
+	if (iter->current) quicklistCompress(iter->quicklist, iter->current);
+	zfree(iter);
+}
+
+/*
+ * 取出迭代器的下一个元素保存到 entry 中, 迭代完毕时返回 0.
+ * 迭代期间不能修改 quicklist.
+ */
+int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
+	while (1) {
+		entry->quicklist = iter->quicklist;
+		entry->node = iter->current;
+		entry->value = NULL;
+		entry->longval = -123456789;
+		entry->sz = 0;
+
+		if (!iter->current) return 0;
+
+		if (!iter->zi) {
+			/* 第一次访问这个节点 */
+			quicklistDecompressNodeForUse(iter->current);
+			iter->zi = lpSeek(iter->current->lp, iter->offset);
+		}
+		else if (iter->direction == AL_START_HEAD) {
+			iter->zi = lpNext(iter->current->lp, iter->zi);
+			iter->offset++;
+		}
+		else {
+			iter->zi = lpPrev(iter->current->lp, iter->zi);
+			iter->offset--;
+		}
+
+		entry->zi = iter->zi;
+		entry->offset = iter->offset;
+
+		if (iter->zi) {
+			lpGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+			return 1;
+		}
+
+		/* 这个节点迭代完了, 转到下一个节点 */
+		quicklistCompress(iter->quicklist, iter->current);
+		if (iter->direction == AL_START_HEAD) {
+			iter->current = iter->current->next;
+			iter->offset = 0;
+		}
+		else {
+			iter->current = iter->current->prev;
+			iter->offset = -1;
+		}
+		iter->zi = NULL;
+	}
+}
+
+/*
+ * 查找索引 index 处的元素, 保存到 entry 中, 索引超出范围时返回 0.
+ * 负数的索引从表尾开始计数, -1 是最后一个元素.
+ *
+ * 按节点中的元素个数跳过整个节点, 只在目标节点的 listpack 中逐个查找.
+ * 目标节点可能被临时解压, 用完 entry 之后要调用 quicklistRecompress.
+ */
+int quicklistIndex(const quicklist *quicklist, const long long idx, quicklistEntry *entry) {
+	quicklistNode *n;
+	unsigned long long accum = 0;
+	unsigned long long index;
+	int forward = idx < 0 ? 0 : 1;
+
+	entry->quicklist = quicklist;
+	entry->node = NULL;
+	entry->zi = NULL;
+	entry->value = NULL;
+	entry->sz = 0;
+
+	index = forward ? idx : (-idx) - 1;
+	if (index >= quicklist->count) return 0;
+
+	n = forward ? quicklist->head : quicklist->tail;
+	while (n) {
+		if (accum + n->count > index) break;
+		accum += n->count;
+		n = forward ? n->next : n->prev;
+	}
+	if (!n) return 0;
+
+	entry->node = n;
+	if (forward) entry->offset = index - accum;
+	else entry->offset = (-index) - 1 + accum;
+
+	quicklistDecompressNodeForUse(entry->node);
+	entry->zi = lpSeek(entry->node->lp, entry->offset);
+	lpGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+	return 1;
+}
+
+/*
+ * 从表头或者表尾弹出一个元素.
+ *
+ * 字符串元素由 saver 复制之后保存到 *data 中, 整数元素保存到 *sval 中, 此时 *data 为 NULL.
+ * quicklist 为空时返回 0.
+ */
+int quicklistPopCustom(quicklist *quicklist, int where, unsigned char **data,
+	unsigned int *sz, long long *sval, void *(*saver)(unsigned char *data, unsigned int sz)) {
+	unsigned char *p;
+	unsigned char *vstr;
+	unsigned int vlen;
+	long long vlong;
+	int pos = (where == QUICKLIST_HEAD) ? 0 : -1;
+	quicklistNode *node;
+
+	if (quicklist->count == 0) return 0;
+
+	if (data) *data = NULL;
+	if (sz) *sz = 0;
+	if (sval) *sval = -123456789;
+
+	/* 两端的节点本来就是解压的, 这里只是保险 */
+	node = (where == QUICKLIST_HEAD) ? quicklist->head : quicklist->tail;
+	quicklistDecompressNode(node);
+	p = lpSeek(node->lp, pos);
+	if (!lpGet(p, &vstr, &vlen, &vlong)) return 0;
+
+	if (vstr) {
+		if (data) *data = saver(vstr, vlen);
+		if (sz) *sz = vlen;
+	}
+	else if (sval) {
+		*sval = vlong;
+	}
+	quicklistDelIndex(quicklist, node, &p);
+	return 1;
+}
+
+#ifdef QUICKLIST_TEST_MAIN
+/*
+ * 测试: make quicklist-test && ./quicklist-test
+ * 和 REDIS_ENCODING_LINKEDLIST 的内存及速度对比: ./quicklist-test benchmark [count]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <sys/time.h>
+#include "sds.h"
+
+static int failed = 0;
+
+#define test_assert(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static long long testUstime(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((long long)tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+/*
+ * 元素 v 的值: 3 的倍数是整数, 其余是长短不一, 容易压缩的字符串
+ */
+static unsigned int testValue(long v, char *buf) {
+	int len;
+
+	if (v % 3 == 0) return ll2string(buf, 32, v);
+	len = sprintf(buf, "element-%ld-", v);
+	memset(buf + len, 'a', v % 50);
+	return len + v % 50;
+}
+
+static int testEntryIs(const quicklistEntry *entry, long v) {
+	char buf[128], ibuf[32];
+	unsigned int len = testValue(v, buf);
+
+	if (entry->value)
+		return entry->sz == len && memcmp(entry->value, buf, len) == 0;
+	return ll2string(ibuf, sizeof(ibuf), entry->longval) == (int)len &&
+		memcmp(ibuf, buf, len) == 0;
+}
+
+static void *testSaver(unsigned char *data, unsigned int sz) {
+	unsigned char *copy = zmalloc(sz + 1);
+
+	memcpy(copy, data, sz);
+	copy[sz] = '\0';
+	return copy;
+}
+
+/* 用一个数组模拟的双端队列, 保存每个位置的元素应该是什么 */
+#define MODEL_SIZE 100000
+
+static long model[MODEL_SIZE * 2];
+static long model_head, model_tail;
+
+/*
+ * 对照模型检查整个 quicklist: 节点的计数和大小限制, 压缩深度,
+ * 两个方向的迭代, 正负索引查找.
+ * 替换元素时不拆分节点, 节点可能超过字节数的限制, 这时 strict 为 0.
+ */
+static void testCheck(quicklist *ql, int strict) {
+	quicklistNode *node;
+	quicklistIter *iter;
+	quicklistEntry entry;
+	unsigned long count = 0, len = 0, j, n = model_tail - model_head;
+	int ok, depth;
+
+	test_assert(quicklistCount(ql) == n);
+	for (node = ql->head; node; node = node->next) {
+		test_assert(node->count > 0);
+		test_assert(node->recompress == 0);
+		if (ql->fill > 0) test_assert(node->count <= (unsigned int)ql->fill);
+		else if (strict) test_assert(node->sz <= optimization_level[-ql->fill - 1]);
+		if (node->next) test_assert(node->next->prev == node);
+		count += node->count;
+		len++;
+	}
+	test_assert(count == n);
+	test_assert(len == ql->len);
+
+	/* 两端 compress 个节点一定没有被压缩 */
+	depth = 0;
+	for (node = ql->head; node && depth < (int)ql->compress; node = node->next, depth++)
+		test_assert(!quicklistNodeIsCompressed(node));
+	depth = 0;
+	for (node = ql->tail; node && depth < (int)ql->compress; node = node->prev, depth++)
+		test_assert(!quicklistNodeIsCompressed(node));
+
+	ok = 1;
+	j = 0;
+	iter = quicklistGetIterator(ql, AL_START_HEAD);
+	while (quicklistNext(iter, &entry)) {
+		if (j >= n || !testEntryIs(&entry, model[model_head + j])) ok = 0;
+		j++;
+	}
+	quicklistReleaseIterator(iter);
+	test_assert(ok && j == n);
+
+	ok = 1;
+	j = n;
+	iter = quicklistGetIterator(ql, AL_START_TAIL);
+	while (quicklistNext(iter, &entry)) {
+		if (j == 0 || !testEntryIs(&entry, model[model_head + j - 1])) ok = 0;
+		j--;
+	}
+	quicklistReleaseIterator(iter);
+	test_assert(ok && j == 0);
+
+	ok = 1;
+	for (j = 0; j < n; j += 1 + n / 500) {
+		if (!quicklistIndex(ql, j, &entry) || !testEntryIs(&entry, model[model_head + j])) ok = 0;
+		quicklistRecompress(ql, entry.node);
+		if (!quicklistIndex(ql, -(long long)j - 1, &entry) ||
+			!testEntryIs(&entry, model[model_tail - j - 1])) ok = 0;
+		quicklistRecompress(ql, entry.node);
+	}
+	test_assert(ok);
+	test_assert(!quicklistIndex(ql, n, &entry));
+	test_assert(!quicklistIndex(ql, -(long long)n - 1, &entry));
+}
+
+/*
+ * 随机地从两端推入和弹出, replace 不为 0 时中间穿插替换, 用不同的 fill 和压缩深度对照模型检查
+ */
+static void testPushPop(int fill, int compress, int replace) {
+	quicklist *ql = quicklistNew(fill, compress);
+	char buf[128];
+	long next = 0, step;
+	int ok = 1;
+
+	model_head = model_tail = MODEL_SIZE;
+	srand(fill * 31 + compress);
+	for (step = 0; step < 60000; step++) {
+		int r = rand() % 10;
+
+		if (r < 7 && model_tail - model_head < MODEL_SIZE - 1) {
+			unsigned int len = testValue(next, buf);
+
+			if (r < 3) {
+				quicklistPushHead(ql, buf, len);
+				model[--model_head] = next;
+			}
+			else {
+				quicklistPushTail(ql, buf, len);
+				model[model_tail++] = next;
+			}
+			next++;
+		}
+		else if (r < 9) {
+			unsigned char *data;
+			unsigned int sz;
+			long long sval;
+			long v;
+			quicklistEntry entry;
+
+			if (!quicklistPopCustom(ql, r == 7 ? QUICKLIST_HEAD : QUICKLIST_TAIL,
+				&data, &sz, &sval, testSaver)) {
+				if (model_tail != model_head) ok = 0;
+				continue;
+			}
+			v = (r == 7) ? model[model_head++] : model[--model_tail];
+			entry.value = data;
+			entry.sz = sz;
+			entry.longval = sval;
+			if (!testEntryIs(&entry, v)) ok = 0;
+			zfree(data);
+		}
+		else if (replace && model_tail > model_head) {
+			long idx = rand() % (model_tail - model_head);
+			unsigned int len = testValue(next, buf);
+
+			if (!quicklistReplaceAtIndex(ql, idx, buf, len)) ok = 0;
+			model[model_head + idx] = next++;
+		}
+		if (step % 10000 == 0) testCheck(ql, !replace);
+	}
+	test_assert(ok);
+	testCheck(ql, !replace);
+	test_assert(!quicklistReplaceAtIndex(ql, model_tail - model_head, buf, 1));
+	quicklistRelease(ql);
+}
+
+/*
+ * 从中间开始迭代
+ */
+static void testIteratorAtIdx(void) {
+	quicklist *ql = quicklistNew(16, 1);
+	quicklistIter *iter;
+	quicklistEntry entry;
+	char buf[128];
+	long j, idx;
+	int ok = 1;
+
+	for (j = 0; j < 1000; j++) quicklistPushTail(ql, buf, testValue(j, buf));
+	for (idx = 0; idx < 1000; idx += 37) {
+		iter = quicklistGetIteratorAtIdx(ql, AL_START_HEAD, idx);
+		for (j = idx; quicklistNext(iter, &entry); j++)
+			if (!testEntryIs(&entry, j)) ok = 0;
+		if (j != 1000) ok = 0;
+		quicklistReleaseIterator(iter);
+
+		iter = quicklistGetIteratorAtIdx(ql, AL_START_TAIL, idx);
+		for (j = idx; quicklistNext(iter, &entry); j--)
+			if (!testEntryIs(&entry, j)) ok = 0;
+		if (j != -1) ok = 0;
+		quicklistReleaseIterator(iter);
+	}
+	test_assert(ok);
+	test_assert(quicklistGetIteratorAtIdx(ql, AL_START_HEAD, 1000) == NULL);
+	quicklistRelease(ql);
+}
+
+/*
+ * 中间的节点被压缩, 读取之后恢复压缩, 载入 RDB 用的 quicklistCreateFromListpack
+ * 和 quicklistAppendListpack 保持元素和顺序
+ */
+static void testCompression(void) {
+	quicklist *ql = quicklistNew(-2, 1), *copy;
+	quicklistNode *node;
+	quicklistEntry entry;
+	unsigned char *lp = lpNew();
+	char buf[128];
+	long j;
+	int compressed = 0, ok = 1;
+
+	for (j = 0; j < 20000; j++) {
+		unsigned int len = testValue(j, buf);
+
+		quicklistPushTail(ql, buf, len);
+		lp = lpPush(lp, (unsigned char *)buf, len, LP_TAIL);
+	}
+	for (node = ql->head; node; node = node->next) {
+		if (quicklistNodeIsCompressed(node)) {
+			void *data;
+
+			compressed++;
+			if (quicklistGetLzf(node, &data) >= node->sz) ok = 0;
+		}
+	}
+	test_assert(ok);
+	test_assert(ql->len > 3 && compressed == (int)ql->len - 2);
+
+	/* 按索引读取中间的元素会临时解压, quicklistRecompress 之后重新压缩 */
+	test_assert(quicklistIndex(ql, 10000, &entry) && testEntryIs(&entry, 10000));
+	test_assert(!quicklistNodeIsCompressed(entry.node) && entry.node->recompress);
+	quicklistRecompress(ql, entry.node);
+	test_assert(quicklistNodeIsCompressed(entry.node) && !entry.node->recompress);
+
+	copy = quicklistCreateFromListpack(-2, 1, lp);
+	model_head = MODEL_SIZE;
+	model_tail = MODEL_SIZE + 20000;
+	for (j = 0; j < 20000; j++) model[model_head + j] = j;
+	testCheck(copy, 1);
+	quicklistRelease(copy);
+
+	/* 每个节点保存一个现成的 listpack */
+	copy = quicklistNew(-2, 1);
+	for (node = ql->head; node; node = node->next) {
+		unsigned char *nodelp;
+
+		quicklistDecompressNode(node);
+		nodelp = zmalloc(node->sz);
+		memcpy(nodelp, node->lp, node->sz);
+		quicklistAppendListpack(copy, nodelp);
+	}
+	test_assert(copy->len == ql->len);
+	testCheck(copy, 1);
+	quicklistRelease(copy);
+	quicklistRelease(ql);
+}
+
+/* 和 robj 一样大小的对象, 用来模拟 REDIS_ENCODING_LINKEDLIST 的元素 */
+typedef struct benchObject {
+	unsigned type : 4;
+	unsigned encoding : 4;
+	unsigned lru : 24;
+	int refcount;
+	void *ptr;
+} benchObject;
+
+/*
+ * 同样的 count 个元素, 分别保存为 robj 链表和 quicklist, 比较内存, 推入, 按索引查找和弹出的开销.
+ * 链表中整数元素和 REDIS_ENCODING_INT 一样直接放在 ptr 中.
+ */
+static void benchmark(long count, int encoding) {
+	static const char *names[] = { "linkedlist", "quicklist", "quicklist+lzf" };
+	size_t base = zmalloc_used_memory(), used;
+	long long start, push_time, index_time, pop_time;
+	quicklist *ql = NULL;
+	list *l = NULL;
+	char buf[128];
+	long j;
+
+	start = testUstime();
+	if (encoding == 0) l = listCreate();
+	else ql = quicklistNew(-2, encoding == 2 ? 1 : 0);
+	for (j = 0; j < count; j++) {
+		unsigned int len = testValue(j, buf);
+
+		if (l) {
+			benchObject *o = zmalloc(sizeof(*o));
+
+			o->refcount = 1;
+			o->ptr = (j % 3 == 0) ? (void *)j : sdsnewlen(buf, len);
+			listAddNodeTail(l, o);
+		}
+		else {
+			quicklistPushTail(ql, buf, len);
+		}
+	}
+	push_time = testUstime() - start;
+	used = zmalloc_used_memory() - base;
+
+	/* LINDEX 随机位置 */
+	start = testUstime();
+	srand(1);
+	for (j = 0; j < 1000; j++) {
+		long idx = rand() % count;
+
+		if (l) {
+			listIndex(l, idx);
+		}
+		else {
+			quicklistEntry entry;
+
+			quicklistIndex(ql, idx, &entry);
+			quicklistRecompress(ql, entry.node);
+		}
+	}
+	index_time = testUstime() - start;
+
+	start = testUstime();
+	for (j = 0; j < count; j++) {
+		if (l) {
+			benchObject *o = listNodeValue(listFirst(l));
+
+			if (j % 3) sdsfree(o->ptr);
+			zfree(o);
+			listDelNode(l, listFirst(l));
+		}
+		else {
+			unsigned char *data;
+			unsigned int sz;
+			long long sval;
+
+			quicklistPopCustom(ql, QUICKLIST_HEAD, &data, &sz, &sval, testSaver);
+			zfree(data);
+		}
+	}
+	pop_time = testUstime() - start;
+	if (l) listRelease(l);
+	else quicklistRelease(ql);
+
+	printf("%-14s %6.1f bytes/elem, push %.2f Mops/s, lindex %.1f us, pop %.2f Mops/s\n",
+		names[encoding], (double)used / count, (double)count / push_time,
+		(double)index_time / 1000, (double)count / pop_time);
+}
+
+int main(int argc, char **argv) {
+	if (argc >= 2 && !strcasecmp(argv[1], "benchmark")) {
+		long count = argc >= 3 ? atol(argv[2]) : 1000000;
+
+		benchmark(count, 0);
+		benchmark(count, 1);
+		benchmark(count, 2);
+		return 0;
+	}
+
+	testPushPop(-2, 0, 0);
+	testPushPop(-1, 1, 0);
+	testPushPop(-2, 1, 1);
+	testPushPop(16, 0, 1);
+	testPushPop(16, 2, 1);
+	testPushPop(1, 1, 1);
+	testIteratorAtIdx();
+	testCompression();
+
+	if (failed) {
+		printf("%d assertions failed\n", failed);
+		return 1;
+	}
+	printf("all tests passed\n");
+	return 0;
+}
+#endif
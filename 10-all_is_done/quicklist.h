@@ -0,0 +1,158 @@
+#ifndef __QUICKLIST_H__
+#define __QUICKLIST_H__
+
+/*
+ * quicklist 是由 listpack 组成的双端链表.
+ *
+ * 每个节点保存一个大小有限的 listpack, 既有 listpack 紧凑的内存布局,
+ * 又不会因为整个列表只有一个 listpack 而在插入删除时复制大量的内存.
+ * 两端之外的节点还可以用 LZF 压缩.
+ */
+
+//
+// quicklistNode quicklist 的节点, 32 字节
+//
+typedef struct quicklistNode {
+
+	// 前置节点
+	struct quicklistNode *prev;
+
+	// 后置节点
+	struct quicklistNode *next;
+
+	// listpack, 节点被压缩时指向 quicklistLZF
+	unsigned char *lp;
+
+	// listpack 的字节数, 节点被压缩时也是未压缩的大小
+	unsigned int sz;
+
+	// listpack 中的元素个数
+	unsigned int count : 16;
+
+	// RAW==1 或者 LZF==2
+	unsigned int encoding : 2;
+
+	// 节点为了读取被临时解压了, 用完之后要重新压缩
+	unsigned int recompress : 1;
+
+	unsigned int extra : 13;
+
+} quicklistNode;
+
+//
+// quicklistLZF 被压缩的 listpack
+//
+typedef struct quicklistLZF {
+
+	// 压缩后的字节数
+	unsigned int sz;
+
+	char compressed[];
+
+} quicklistLZF;
+
+//
+// quicklist
+//
+typedef struct quicklist {
+
+	// 表头节点
+	quicklistNode *head;
+
+	// 表尾节点
+	quicklistNode *tail;
+
+	// 所有 listpack 中的元素总数
+	unsigned long count;
+
+	// 节点数量
+	unsigned int len;
+
+	// 每个节点的大小限制, 正数是元素个数, -1 到 -5 是 4KB 到 64KB
+	int fill : 16;
+
+	// 两端各有这么多个节点不压缩, 0 表示不压缩
+	unsigned int compress : 16;
+
+} quicklist;
+
+//
+// quicklistIter quicklist 迭代器
+//
+typedef struct quicklistIter {
+
+	const quicklist *quicklist;
+
+	// 当前迭代到的节点
+	quicklistNode *current;
+
+	// 当前节点中迭代到的 listpack 元素
+	unsigned char *zi;
+
+	// zi 在当前节点中的索引
+	long offset;
+
+	// 迭代的方向, AL_START_HEAD 或者 AL_START_TAIL
+	int direction;
+
+} quicklistIter;
+
+//
+// quicklistEntry 迭代或者按索引查找时返回的元素
+//
+typedef struct quicklistEntry {
+
+	const quicklist *quicklist;
+
+	// 元素所在的节点
+	quicklistNode *node;
+
+	// 元素在 listpack 中的位置
+	unsigned char *zi;
+
+	// 字符串值, 元素是整数时为 NULL
+	unsigned char *value;
+
+	// 整数值
+	long long longval;
+
+	// 字符串值的长度
+	unsigned int sz;
+
+	// 元素在节点中的索引
+	int offset;
+
+} quicklistEntry;
+
+#define QUICKLIST_HEAD 0
+#define QUICKLIST_TAIL -1
+
+#define QUICKLIST_NODE_ENCODING_RAW 1
+#define QUICKLIST_NODE_ENCODING_LZF 2
+
+/* api */
+quicklist *quicklistCreate(void);
+quicklist *quicklistNew(int fill, int compress);
+void quicklistSetOptions(quicklist *quicklist, int fill, int depth);
+void quicklistRelease(quicklist *quicklist);
+int quicklistPushHead(quicklist *quicklist, void *value, const size_t sz);
+int quicklistPushTail(quicklist *quicklist, void *value, const size_t sz);
+void quicklistPush(quicklist *quicklist, void *value, const size_t sz, int where);
+void quicklistAppendListpack(quicklist *quicklist, unsigned char *lp);
+quicklist *quicklistCreateFromListpack(int fill, int compress, unsigned char *lp);
+int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data, int sz);
+quicklistIter *quicklistGetIterator(const quicklist *quicklist, int direction);
+quicklistIter *quicklistGetIteratorAtIdx(const quicklist *quicklist, int direction, const long long idx);
+int quicklistNext(quicklistIter *iter, quicklistEntry *node);
+void quicklistReleaseIterator(quicklistIter *iter);
+int quicklistIndex(const quicklist *quicklist, const long long index, quicklistEntry *entry);
+void quicklistRecompress(const quicklist *quicklist, quicklistNode *node);
+int quicklistPopCustom(quicklist *quicklist, int where, unsigned char **data,
+	unsigned int *sz, long long *sval, void *(*saver)(unsigned char *data, unsigned int sz));
+unsigned long quicklistCount(const quicklist *ql);
+size_t quicklistGetLzf(const quicklistNode *node, void **data);
+
+#define quicklistNodeIsCompressed(node) \
+	((node)->encoding == QUICKLIST_NODE_ENCODING_LZF)
+
+#endif /* __QUICKLIST_H__ */
@@ -14,9 +14,11 @@
 #include "t_hash.h"
 #include "t_set.h"
 #include "redis.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "intset.h"
 #include "rdb.h"
+#include "reactor.h"
+#include "latency.h"
 #include <math.h>
 #include <sys/types.h>
 #include <sys/time.h>
@@ -27,7 +29,6 @@
 
 /*============================ Variable and Function Declaration ======================== */
 extern struct sharedObjectsStruct shared;
-extern struct redisServer server;
 extern struct rio rioFileIO;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 
@@ -110,10 +111,8 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
 		return rdbSaveType(rdb, REDIS_RDB_TYPE_STRING);
 
 	case REDIS_LIST:
-		if (o->encoding == REDIS_ENCODING_ZIPLIST)
-			return rdbSaveType(rdb, REDIS_RDB_TYPE_LIST_ZIPLIST);
-		else if (o->encoding == REDIS_ENCODING_LINKEDLIST)
-			return rdbSaveType(rdb, REDIS_RDB_TYPE_LIST);
+		if (o->encoding == REDIS_ENCODING_QUICKLIST)
+			return rdbSaveType(rdb, REDIS_RDB_TYPE_LIST_QUICKLIST_2);
 		else {
 			mylog("Unknown list encoding");
 			assert(NULL);
@@ -131,8 +130,8 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
 			
 
 	case REDIS_ZSET:
-		if (o->encoding == REDIS_ENCODING_ZIPLIST)
-			return rdbSaveType(rdb, REDIS_RDB_TYPE_ZSET_ZIPLIST);
+		if (o->encoding == REDIS_ENCODING_LISTPACK)
+			return rdbSaveType(rdb, REDIS_RDB_TYPE_ZSET_LISTPACK);
 		else if (o->encoding == REDIS_ENCODING_SKIPLIST)
 			return rdbSaveType(rdb, REDIS_RDB_TYPE_ZSET);
 		else {
@@ -141,8 +140,8 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
 		}
 
 	case REDIS_HASH:
-		if (o->encoding == REDIS_ENCODING_ZIPLIST)
-			return rdbSaveType(rdb, REDIS_RDB_TYPE_HASH_ZIPLIST);
+		if (o->encoding == REDIS_ENCODING_LISTPACK)
+			return rdbSaveType(rdb, REDIS_RDB_TYPE_HASH_LISTPACK);
 		else if (o->encoding == REDIS_ENCODING_HT)
 			return rdbSaveType(rdb, REDIS_RDB_TYPE_HASH);
 		else {
@@ -267,6 +266,35 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
 	return rdbEncodeInteger(value, enc);
 }
 
+/*
+* 将已经用 LZF 压缩过的数据保存到 rdb 中, 载入时得到的是解压后的字符串。
+*
+* 函数在成功时返回写入的字节数，写入失败时返回 -1 。
+*/
+int rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len, size_t original_len) {
+	unsigned char byte;
+	int n, nwritten = 0;
+
+	/* 写入类型，说明这是一个 LZF 压缩字符串 */
+	byte = (REDIS_RDB_ENCVAL << 6) | REDIS_RDB_ENC_LZF;
+	if ((n = rdbWriteRaw(rdb, &byte, 1)) == -1) return -1;
+	nwritten += n;
+
+	/* 写入字符串压缩后的长度 */
+	if ((n = rdbSaveLen(rdb, compress_len)) == -1) return -1;
+	nwritten += n;
+
+	/* 写入字符串未压缩时的长度 */
+	if ((n = rdbSaveLen(rdb, original_len)) == -1) return -1;
+	nwritten += n;
+
+	/* 写入压缩后的字符串 */
+	if ((n = rdbWriteRaw(rdb, data, compress_len)) == -1) return -1;
+	nwritten += n;
+
+	return nwritten;
+}
+
 /*
 * 尝试对输入字符串 s 进行压缩，
 * 如果压缩成功，那么将压缩后的字符串保存到 rdb 中。
@@ -277,8 +305,7 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
 */
 int rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
 	size_t comprlen, outlen;
-	unsigned char byte;
-	int n, nwritten = 0;
+	int nwritten;
 	void *out;
 
 	/* 压缩字符串 */
@@ -291,34 +318,10 @@ int rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
 		return 0;
 	}
 
-	/* 
-	* 保存压缩后的字符串到 rdb 。
-	*/
-
-	/* 写入类型，说明这是一个 LZF 压缩字符串 */
-	byte = (REDIS_RDB_ENCVAL << 6) | REDIS_RDB_ENC_LZF;
-	if ((n = rdbWriteRaw(rdb, &byte, 1)) == -1) goto writeerr;
-	nwritten += n;
-
-	/* 写入字符串压缩后的长度 */
-	if ((n = rdbSaveLen(rdb, comprlen)) == -1) goto writeerr; /* 然后直接写入压缩后的长度,是吧. */
-	nwritten += n;
-
-	/* 写入字符串未压缩时的长度 */
-	if ((n = rdbSaveLen(rdb, len)) == -1) goto writeerr;
-	nwritten += n;
-
-	/* 写入压缩后的字符串 */
-	if ((n = rdbWriteRaw(rdb, out, comprlen)) == -1) goto writeerr;
-	nwritten += n;
-
+	/* 保存压缩后的字符串到 rdb */
+	nwritten = rdbSaveLzfBlob(rdb, out, comprlen, len);
 	zfree(out);
-
 	return nwritten;
-
-writeerr:
-	zfree(out);
-	return -1;
 }
 
 /* Save a double value. Doubles are saved as strings prefixed by an unsigned
@@ -453,27 +456,26 @@ int rdbSaveObject(rio *rdb, robj *o) {
 		nwritten += n;
 	}
 	else if (o->type == REDIS_LIST) { /* 保存列表对象 */
-		if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-			size_t l = ziplistBlobLen((unsigned char*)o->ptr);
-			/* 以字符串对象的形式保存整个 ZIPLIST 列表 */
-			if ((n = rdbSaveRawString(rdb, o->ptr, l)) == -1) return -1;
-			nwritten += n;
-		}
-		else if (o->encoding == REDIS_ENCODING_LINKEDLIST) { /* 底层编码为双向链表 */
-			list *list = o->ptr;
-			listIter li;
-			listNode *ln;
+		if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+			quicklist *ql = o->ptr;
+			quicklistNode *node = ql->head;
 
-			if ((n = rdbSaveLen(rdb, listLength(list))) == -1) return -1;
+			/* 先保存节点数量, 然后以字符串的形式逐个保存节点的 listpack */
+			if ((n = rdbSaveLen(rdb, ql->len)) == -1) return -1;
 			nwritten += n;
 
-			/* 遍历所有列表项 */
-			listRewind(list, &li);
-			while ((ln = listNext(&li))) {
-				robj *eleobj = listNodeValue(ln);
-				/* 以字符串对象的形式保存列表项 */
-				if ((n = rdbSaveStringObject(rdb, eleobj)) == -1) return -1;
+			while (node) {
+				if (quicklistNodeIsCompressed(node)) {
+					/* 已经压缩过的节点直接写入, 不用先解压 */
+					void *data;
+					size_t compress_len = quicklistGetLzf(node, &data);
+					if ((n = rdbSaveLzfBlob(rdb, data, compress_len, node->sz)) == -1) return -1;
+				}
+				else {
+					if ((n = rdbSaveRawString(rdb, node->lp, node->sz)) == -1) return -1;
+				}
 				nwritten += n;
+				node = node->next;
 			}
 		}
 		else {
@@ -513,10 +515,10 @@ int rdbSaveObject(rio *rdb, robj *o) {
 		}
 	}
 	else if (o->type == REDIS_ZSET) { /* 保存有序集对象 */
-		if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-			size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+		if (o->encoding == REDIS_ENCODING_LISTPACK) {
+			size_t l = lpBytes((unsigned char*)o->ptr);
 
-			/* 以字符串对象的形式保存整个 ZIPLIST 有序集 */
+			/* 以字符串对象的形式保存整个 LISTPACK 有序集 */
 			if ((n = rdbSaveRawString(rdb, o->ptr, l)) == -1) return -1;
 			nwritten += n;
 		}
@@ -549,9 +551,9 @@ int rdbSaveObject(rio *rdb, robj *o) {
 		}
 	}
 	else if (o->type == REDIS_HASH) { /* 保存哈希表 */
-		if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-			size_t l = ziplistBlobLen((unsigned char*)o->ptr);
-			/* 以字符串对象的形式保存整个 ZIPLIST 哈希表 */
+		if (o->encoding == REDIS_ENCODING_LISTPACK) {
+			size_t l = lpBytes((unsigned char*)o->ptr);
+			/* 以字符串对象的形式保存整个 LISTPACK 哈希表 */
 			if ((n = rdbSaveRawString(rdb, o->ptr, l)) == -1) return -1;
 			nwritten += n;
 
@@ -631,8 +633,8 @@ int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val,
 * 保存成功返回 REDIS_OK ，出错/失败返回 REDIS_ERR 。
 */
 int rdbSave(char *filename) {
-	dictIterator *di = NULL;
-	dictEntry *de;
+	htIterator *di = NULL;
+	htEntry *de;
 	char tmpfile[256];
 	char magic[10];
 	int j;
@@ -665,12 +667,12 @@ int rdbSave(char *filename) {
 		/* 指向数据库 */
 		redisDb *db = server.db + j;
 		/* 指向数据库键空间 */
-		dict *d = db->dict;
+		hashtab *d = db->dict;
 		/* 跳过空数据库 */
-		if (dictSize(d) == 0) continue;
+		if (htSize(d) == 0) continue;
 
 		/* 创建键空间迭代器 */
-		di = dictGetSafeIterator(d);
+		di = htGetSafeIterator(d);
 		if (!di) {
 			fclose(fp);
 			return REDIS_ERR;
@@ -684,7 +686,7 @@ int rdbSave(char *filename) {
 		/*
 		* 遍历数据库，并写入每个键值对的数据
 		*/
-		while ((de = dictNext(di)) != NULL) {
+		while ((de = htNext(di)) != NULL) {
 			sds keystr = dictGetKey(de);
 			robj key, *o = dictGetVal(de);
 			long long expire;
@@ -696,7 +698,7 @@ int rdbSave(char *filename) {
 			/* 保存键值对数据 */
 			if (rdbSaveKeyValuePair(&rdb, &key, o, expire, now) == -1) goto werr;
 		}
-		dictReleaseIterator(di);
+		htReleaseIterator(di);
 	}
 	di = NULL; /* So that we don't release it again on error. */
 	/* 
@@ -736,11 +738,14 @@ werr:
 	/* 删除文件 */
 	unlink(tmpfile);
 	mylog("Write error saving DB on disk: %s", strerror(errno));
-	if (di) dictReleaseIterator(di);
+	if (di) htReleaseIterator(di);
 	return REDIS_ERR;
 }
 
 void saveCommand(redisClient *c) {
+	mstime_t latency;
+	int retval;
+
 	/*
 	* BGSAVE已经在执行中,不能再执行SAVE
 	* 否则将产生竞争条件
@@ -750,7 +755,12 @@ void saveCommand(redisClient *c) {
 		return;
 	}
 
-	if (rdbSave(server.rdb_filename) == REDIS_OK) {
+	/* 多 reactor 模式下每个分区保存到自己的 RDB 文件中 */
+	latencyStartMonitor(latency);
+	retval = server.reactors_num > 1 ? reactorSave() : rdbSave(server.rdb_filename);
+	latencyEndMonitor(latency);
+	latencyAddSampleIfNeeded("rdb-save", latency);
+	if (retval == REDIS_OK) {
 		addReply(c, shared.ok);
 	}
 	else {
@@ -1017,8 +1027,31 @@ int rdbLoadDoubleValue(rio *rdb, double *val) {
 	}
 }
 
+/*
+* 把旧版本 RDB 中的 ziplist 逐个元素转换成 listpack, 并释放 ziplist
+*/
+static unsigned char *rdbZiplistToListpack(unsigned char *zl) {
+	unsigned char *lp = lpNew();
+	unsigned char *p = ziplistIndex(zl, 0);
+	unsigned char *vstr;
+	unsigned int vlen;
+	long long vlong;
+	char longstr[32];
+
+	while (ziplistGet(p, &vstr, &vlen, &vlong)) {
+		if (!vstr) {
+			vlen = ll2string(longstr, sizeof(longstr), vlong);
+			vstr = (unsigned char *)longstr;
+		}
+		lp = lpPush(lp, vstr, vlen, LP_TAIL);
+		p = ziplistNext(zl, p);
+	}
+	zfree(zl);
+	return lp;
+}
+
 
-/* 
+/*
 * 从 rdb 文件中载入指定类型的对象。
 *
 * 读入成功返回一个新对象，否则返回 NULL 。
@@ -1040,15 +1073,9 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 		*/
 		if ((len = rdbLoadLen(rdb, NULL)) == REDIS_RDB_LENERR) return NULL;
 
-		/*
-		* 根据节点数，创建对象的编码
-		*/
-		if (len > server.list_max_ziplist_entries) {
-			o = createListObject();
-		}
-		else {
-			o = createZiplistObject();
-		}
+		o = createQuicklistObject();
+		quicklistSetOptions(o->ptr, server.list_max_listpack_size,
+			server.list_compress_depth);
 
 		/* 
 		* 载入所有列表项
@@ -1056,27 +1083,41 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 		while (len--) {
 			/* 载入字符串对象 */
 			if ((ele = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;
-			/* 
-			* 根据字符串对象，
-			* 检查是否需要将列表从 ZIPLIST 编码转换为 LINKEDLIST 编码
-			*/
-			if (o->encoding == REDIS_ENCODING_ZIPLIST &&
-				sdsEncodedObject(ele) &&
-				sdslen(ele->ptr) > server.list_max_ziplist_value)
-				listTypeConvert(o, REDIS_ENCODING_LINKEDLIST);
-			if (o->encoding == REDIS_ENCODING_ZIPLIST) { /* ZIPLIST */
-				dec = getDecodedObject(ele);
-				/* 将字符串值推入 ZIPLIST 末尾来重建列表 */
-				o->ptr = ziplistPush(o->ptr, dec->ptr, sdslen(dec->ptr), REDIS_TAIL);
-
-				decrRefCount(dec);
-				decrRefCount(ele);
-			}
-			else {
-				/* 将新列表项推入到链表的末尾 */
-				ele = tryObjectEncoding(ele);
-				listAddNodeTail(o->ptr, ele);
+			dec = getDecodedObject(ele);
+			/* 将字符串值推入 quicklist 末尾来重建列表 */
+			quicklistPushTail(o->ptr, dec->ptr, sdslen(dec->ptr));
+			decrRefCount(dec);
+			decrRefCount(ele);
+		}
+	}
+	else if (rdbtype == REDIS_RDB_TYPE_LIST_QUICKLIST ||
+		rdbtype == REDIS_RDB_TYPE_LIST_QUICKLIST_2) { /* 载入 quicklist 编码的列表 */
+		/* 读入节点数 */
+		if ((len = rdbLoadLen(rdb, NULL)) == REDIS_RDB_LENERR) return NULL;
+
+		o = createQuicklistObject();
+		quicklistSetOptions(o->ptr, server.list_max_listpack_size,
+			server.list_compress_depth);
+
+		/* 每个节点是一个以字符串形式保存的 listpack, 旧版本是 ziplist */
+		while (len--) {
+			robj *aux = rdbLoadStringObject(rdb);
+			unsigned char *lp;
+
+			if (aux == NULL) return NULL;
+			lp = zmalloc(sdslen(aux->ptr));
+			memcpy(lp, aux->ptr, sdslen(aux->ptr));
+			decrRefCount(aux);
+
+			if (rdbtype == REDIS_RDB_TYPE_LIST_QUICKLIST)
+				lp = rdbZiplistToListpack(lp);
+
+			/* 空的节点没有意义, 直接丢弃 */
+			if (lpLength(lp) == 0) {
+				zfree(lp);
+				continue;
 			}
+			quicklistAppendListpack(o->ptr, lp);
 		}
 	}
 	else if (rdbtype == REDIS_RDB_TYPE_SET) { /* 载入集合对象 */
@@ -1161,12 +1202,12 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 		}
 
 		/*
-		* 如果有序集合符合条件的话，将它转换为 ZIPLIST 编码
+		* 如果有序集合符合条件的话，将它转换为 LISTPACK 编码
 		* 节约空间
 		*/
-		if (zsetLength(o) <= server.zset_max_ziplist_entries &&
-			maxelelen <= server.zset_max_ziplist_value)
-			zsetConvert(o, REDIS_ENCODING_ZIPLIST);
+		if (zsetLength(o) <= server.zset_max_listpack_entries &&
+			maxelelen <= server.zset_max_listpack_value)
+			zsetConvert(o, REDIS_ENCODING_LISTPACK);
 	}
 	else if (rdbtype == REDIS_RDB_TYPE_HASH) { /* 载入哈希表对象 */
 		size_t len;
@@ -1180,15 +1221,15 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 		o = createHashObject();
 
 		/*
-		* 根据节点数量，选择使用 ZIPLIST 编码还是 HT 编码
+		* 根据节点数量，选择使用 LISTPACK 编码还是 HT 编码
 		*/
-		if (len > server.hash_max_ziplist_entries)
+		if (len > server.hash_max_listpack_entries)
 			hashTypeConvert(o, REDIS_ENCODING_HT);
 
 		/* 
-		* 载入所有域和值，并将它们推入到 ZIPLIST 中
+		* 载入所有域和值，并将它们推入到 LISTPACK 中
 		*/
-		while (o->encoding == REDIS_ENCODING_ZIPLIST && len > 0) {
+		while (o->encoding == REDIS_ENCODING_LISTPACK && len > 0) {
 			robj *field, *value;
 			len--;
 			/* 载入域（一个字符串） */
@@ -1201,18 +1242,18 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 			assert(sdsEncodedObject(value));
 
 			/* 
-			* 将域和值推入到 ZIPLIST 末尾
+			* 将域和值推入到 LISTPACK 末尾
 			*
 			* 先推入域，再推入值。
 			*/
-			o->ptr = ziplistPush(o->ptr, field->ptr, sdslen(field->ptr), ZIPLIST_TAIL);
-			o->ptr = ziplistPush(o->ptr, value->ptr, sdslen(value->ptr), ZIPLIST_TAIL);
+			o->ptr = lpPush(o->ptr, field->ptr, sdslen(field->ptr), LP_TAIL);
+			o->ptr = lpPush(o->ptr, value->ptr, sdslen(value->ptr), LP_TAIL);
 
 			/* 
 			* 如果元素过多，那么将编码转换为 HT
 			*/
-			if (sdslen(field->ptr) > server.hash_max_ziplist_value ||
-				sdslen(value->ptr) > server.hash_max_ziplist_value)
+			if (sdslen(field->ptr) > server.hash_max_listpack_value ||
+				sdslen(value->ptr) > server.hash_max_listpack_value)
 			{
 				decrRefCount(field);
 				decrRefCount(value);
@@ -1255,7 +1296,9 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 		rdbtype == REDIS_RDB_TYPE_LIST_ZIPLIST ||
 		rdbtype == REDIS_RDB_TYPE_SET_INTSET ||
 		rdbtype == REDIS_RDB_TYPE_ZSET_ZIPLIST ||
-		rdbtype == REDIS_RDB_TYPE_HASH_ZIPLIST)
+		rdbtype == REDIS_RDB_TYPE_HASH_ZIPLIST ||
+		rdbtype == REDIS_RDB_TYPE_ZSET_LISTPACK ||
+		rdbtype == REDIS_RDB_TYPE_HASH_LISTPACK)
 	{
 		/* 载入字符串对象 */
 		robj *aux = rdbLoadStringObject(rdb);
@@ -1267,6 +1310,12 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 		memcpy(o->ptr, aux->ptr, sdslen(aux->ptr));
 		decrRefCount(aux);
 
+		/* 旧版本的 ziplist 先转换成 listpack */
+		if (rdbtype == REDIS_RDB_TYPE_LIST_ZIPLIST ||
+			rdbtype == REDIS_RDB_TYPE_ZSET_ZIPLIST ||
+			rdbtype == REDIS_RDB_TYPE_HASH_ZIPLIST)
+			o->ptr = rdbZiplistToListpack(o->ptr);
+
 		/*
 		* 根据读取的类型，将值恢复成原来的编码对象。
 		*
@@ -1279,10 +1328,9 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 		case REDIS_RDB_TYPE_LIST_ZIPLIST:
 
 			o->type = REDIS_LIST;
-			o->encoding = REDIS_ENCODING_ZIPLIST;
-			/* 检查是否需要转换编码 */
-			if (ziplistLen(o->ptr) > server.list_max_ziplist_entries)
-				listTypeConvert(o, REDIS_ENCODING_LINKEDLIST);
+			o->encoding = REDIS_ENCODING_LISTPACK;
+			/* 列表总是用 quicklist 编码 */
+			listTypeConvert(o, REDIS_ENCODING_QUICKLIST);
 			break;
 
 		/* INTSET 编码的集合 */
@@ -1296,25 +1344,27 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 				setTypeConvert(o, REDIS_ENCODING_HT);
 			break;
 
-		/* ZIPLIST 编码的有序集合 */
+		/* LISTPACK 编码的有序集合 */
 		case REDIS_RDB_TYPE_ZSET_ZIPLIST:
+		case REDIS_RDB_TYPE_ZSET_LISTPACK:
 
 			o->type = REDIS_ZSET;
-			o->encoding = REDIS_ENCODING_ZIPLIST;
+			o->encoding = REDIS_ENCODING_LISTPACK;
 
 			/* 检查是否需要转换编码 */
-			if (zsetLength(o) > server.zset_max_ziplist_entries)
+			if (zsetLength(o) > server.zset_max_listpack_entries)
 				zsetConvert(o, REDIS_ENCODING_SKIPLIST);
 			break;
 
-		/* ZIPLIST 编码的 HASH */
+		/* LISTPACK 编码的 HASH */
 		case REDIS_RDB_TYPE_HASH_ZIPLIST:
+		case REDIS_RDB_TYPE_HASH_LISTPACK:
 
 			o->type = REDIS_HASH;
-			o->encoding = REDIS_ENCODING_ZIPLIST;
+			o->encoding = REDIS_ENCODING_LISTPACK;
 
 			/* 检查是否需要转换编码 */
-			if (hashTypeLength(o) > server.hash_max_ziplist_entries)
+			if (hashTypeLength(o) > server.hash_max_listpack_entries)
 				hashTypeConvert(o, REDIS_ENCODING_HT);
 			break;
 
@@ -1458,6 +1508,7 @@ int rdbLoad(char *filename) {
 		* 将键值对关联到数据库中
 		*/
 		dbAdd(db, key, val);
+		dbTrackRehashing(db, key, val);
 
 		/*
 		* 设置过期时间
@@ -11,7 +11,7 @@
 *
 * RDB 的版本，当新版本不向就版本兼容时，增一
 */
-#define REDIS_RDB_VERSION 6
+#define REDIS_RDB_VERSION 8
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
 * keys requires a lot of space, so we check the most significant 2 bits of
@@ -79,11 +79,16 @@
 #define REDIS_RDB_TYPE_SET_INTSET    11
 #define REDIS_RDB_TYPE_ZSET_ZIPLIST  12
 #define REDIS_RDB_TYPE_HASH_ZIPLIST  13
+#define REDIS_RDB_TYPE_LIST_QUICKLIST 14
+/* 以 listpack 保存的小对象, 15 留空 */
+#define REDIS_RDB_TYPE_HASH_LISTPACK 16
+#define REDIS_RDB_TYPE_ZSET_LISTPACK 17
+#define REDIS_RDB_TYPE_LIST_QUICKLIST_2 18
 
 /*
 * 检查给定类型是否对象
 */
-#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 13))
+#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 14) || (t >= 16 && t <= 18))
 
 /*
 * 数据库特殊操作标识符
@@ -97,18 +102,12 @@
 /* 数据库的结尾（但不是 RDB 文件的结尾）*/
 #define REDIS_RDB_OPCODE_EOF        255
 
-#define initStaticStringObject(_var,_ptr) do { \
-    _var.refcount = 1; \
-    _var.type = REDIS_STRING; \
-    _var.encoding = REDIS_ENCODING_RAW; \
-    _var.ptr = _ptr; \
-} while(0);
-
 int rdbSaveType(rio *rdb, unsigned char type);
 void backgroundSaveDoneHandler(int exitcode, int bysignal);
 void startLoading(FILE *fp);
 void stopLoading(void);
 void loadingProgress(off_t pos);
 int rdbLoad(char *filename);
+int rdbSave(char *filename);
 #endif
 
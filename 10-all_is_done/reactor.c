@@ -0,0 +1,474 @@
+/*
+ * 多 reactor 模式
+ *
+ * 启动 N 个事件循环, 每个运行在自己的线程上, 各自拥有一份 redisServer(servers[i]),
+ * 通过 SO_REUSEPORT 监听同一个端口, 由内核把新连接分给它们.
+ *
+ * 每个数据库的键空间按键的哈希值分成 N 个分区, 第 i 个分区只由第 i 个 reactor 访问,
+ * 所以执行命令的时候不需要加锁:
+ *
+ * 1) 命令没有键, 或者所有的键都在本分区, 直接在本 reactor 执行.
+ *
+ * 2) 所有的键都在另一个分区, 把客户端投递到那个 reactor 的信箱中,
+ *    由它执行命令, 回复写入客户端的缓冲区之后再投递回来,
+ *    客户端所属的 reactor 重新监听读写事件, 并继续处理查询缓冲区中剩下的命令.
+ *    信箱是一个无锁的栈, 栈从空变成非空的时候用 eventfd 唤醒目标 reactor.
+ *
+ * 3) 键分布在多个分区(MGET, SUNION, ZUNIONSTORE ...), 或者命令需要访问所有分区
+ *    (SCAN, SAVE, EXEC), 那么等所有 reactor 都停下来之后再执行.
+ *    reactor 除了阻塞在多路复用库中的时候, 总是持有 reactors_lock 的读锁,
+ *    这样的命令拿到写锁之后就可以访问所有分区.
+ *
+ * 每个分区有自己的 AOF 文件和 RDB 文件, 第 0 个分区使用配置的文件名,
+ * 第 i 个分区在文件名后面加上 "-i". 跨分区执行的写命令不能原样写进某一个 AOF,
+ * 所以传播的是被修改的键在命令执行之后的状态, 写入键所在分区的 AOF.
+ *
+ * reactors_num 为 1 时这个文件中的代码都不会运行.
+ */
+#include "redis.h"
+#include "reactor.h"
+#include "networking.h"
+#include "db.h"
+#include "rdb.h"
+#include "aof.h"
+#include "crc64.h"
+#include "util.h"
+#include "evict.h"
+#include <fcntl.h>
+#include <sys/eventfd.h>
+
+/* commandReactor() 的返回值, 其他的值都是分区号 */
+#define REACTOR_NONE -1 /* 命令没有键 */
+#define REACTOR_MANY -2 /* 命令的键分布在多个分区 */
+
+/* 跨分区的命令拿写锁, 其他时候每个 reactor 都持有读锁 */
+static pthread_rwlock_t reactors_lock;
+
+/*
+ * 返回键 key 所在的分区, 也就是拥有它的 reactor.
+ *
+ * 和 Redis Cluster 一样支持 hash tag: 如果键中有 {...}, 那么只对花括号里面的内容计算哈希值,
+ * 用户可以借此把需要一起操作的键放进同一个分区, 避免跨分区执行.
+ *
+ * 这里没有使用 dictGenHashFunction, 因为分区号和字典的桶下标都取自哈希值的低位,
+ * 两者相关的话, 每个分区的字典只会用到 1/N 的桶.
+ */
+int keyReactor(robj *key) {
+	char buf[REDIS_LONGSTR_SIZE];
+	char *s;
+	size_t len, start, end;
+
+	if (server.reactors_num == 1) return 0;
+
+	if (sdsEncodedObject(key)) {
+		s = key->ptr;
+		len = sdslen(s);
+	}
+	else {
+		len = ll2string(buf, sizeof(buf), (long)key->ptr);
+		s = buf;
+	}
+
+	for (start = 0; start < len; start++)
+		if (s[start] == '{') break;
+	if (start < len) {
+		for (end = start + 1; end < len; end++)
+			if (s[end] == '}') break;
+		/* 找到了非空的 {...} */
+		if (end < len && end != start + 1) {
+			s += start + 1;
+			len = end - start - 1;
+		}
+	}
+	return crc64(0, (unsigned char*)s, len) % server.reactors_num;
+}
+
+/*
+ * 返回命令的键参数在 argv 中的位置, 数目保存在 numkeys 中.
+ * 返回的数组由调用者释放.
+ */
+static int *commandKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+	int j, i = 0, last, *keys;
+
+	if (cmd->getkeys_proc) return cmd->getkeys_proc(cmd, argv, argc, numkeys);
+
+	*numkeys = 0;
+	if (cmd->firstkey == 0) return NULL;
+
+	last = cmd->lastkey < 0 ? argc + cmd->lastkey : cmd->lastkey;
+	keys = zmalloc(sizeof(int) * (last - cmd->firstkey + 1));
+	for (j = cmd->firstkey; j <= last; j += cmd->keystep) keys[i++] = j;
+	*numkeys = i;
+	return keys;
+}
+
+/*
+ * 返回执行命令需要访问的分区: 分区号, REACTOR_NONE 或者 REACTOR_MANY.
+ *
+ * 大多数命令的键位置是固定的, 这里直接遍历, 不用为每条命令分配 keys 数组.
+ */
+static int commandReactor(struct redisCommand *cmd, robj **argv, int argc) {
+	int j, p, last, target = REACTOR_NONE;
+
+	if (cmd->getkeys_proc) {
+		int *keys, numkeys;
+
+		keys = cmd->getkeys_proc(cmd, argv, argc, &numkeys);
+		for (j = 0; j < numkeys; j++) {
+			p = keyReactor(argv[keys[j]]);
+			if (target != REACTOR_NONE && target != p) {
+				target = REACTOR_MANY;
+				break;
+			}
+			target = p;
+		}
+		zfree(keys);
+		return target;
+	}
+
+	if (cmd->firstkey == 0) return REACTOR_NONE;
+
+	last = cmd->lastkey < 0 ? argc + cmd->lastkey : cmd->lastkey;
+	for (j = cmd->firstkey; j <= last; j += cmd->keystep) {
+		p = keyReactor(argv[j]);
+		if (target != REACTOR_NONE && target != p) return REACTOR_MANY;
+		target = p;
+	}
+	return target;
+}
+
+/*================================ Mailbox ===================================*/
+
+/*
+ * 将客户端 c 投递到 reactor r 的信箱中.
+ *
+ * 信箱是一个 Treiber 栈, 只有栈原本为空的时候才需要唤醒 r,
+ * 否则 r 还没有取走之前的客户端, 会一并取走这一个.
+ */
+static void mailboxPush(struct redisServer *r, redisClient *c) {
+	redisClient *head = __atomic_load_n(&r->mailbox, __ATOMIC_RELAXED);
+	uint64_t one = 1;
+
+	do {
+		c->mailbox_next = head;
+	} while (!__atomic_compare_exchange_n(&r->mailbox, &head, c, 1,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	if (head == NULL && write(r->mailbox_fd, &one, sizeof(one)) == -1 &&
+		errno != EAGAIN)
+	{
+		mylog("Can't wake up reactor %d: %s", r->reactor_id, strerror(errno));
+	}
+}
+
+/*
+ * 在本 reactor 中执行命令.
+ *
+ * 设置了 maxmemory 时在这里淘汰键: 写入哪个分区就从哪个分区淘汰,
+ * 这样每个分区都会随着写入淘汰自己的键, 不会只有接受连接的 reactor 在淘汰.
+ */
+static void reactorCallLocal(redisClient *c) {
+	if (server.maxmemory && evictBeforeCommand(c) == REDIS_ERR) return;
+	call(c, REDIS_CALL_FULL);
+}
+
+/*
+ * 在键所在的 reactor 中执行其他 reactor 转交过来的命令, 然后把客户端还回去
+ */
+static void reactorExecuteForwarded(redisClient *c) {
+	reactorCallLocal(c);
+	/* 命令参数可能被改写或者编码过, 在执行命令的线程中释放 */
+	freeClientArgv(c);
+	mailboxPush(&servers[c->reactor], c);
+}
+
+/*
+ * 转交出去的命令执行完毕, 客户端回到了自己的 reactor
+ */
+static void reactorClientReturned(redisClient *c) {
+	c->flags &= ~REDIS_FORWARDED;
+	resetClient(c);
+
+	/* 执行命令期间被要求关闭(比如超过了输出缓冲区限制) */
+	if (c->flags & REDIS_CLOSE_ASAP) {
+		c->flags &= ~REDIS_CLOSE_ASAP;
+		freeClient(c);
+		return;
+	}
+
+	if (aeCreateFileEvent(server.el, c->fd, AE_READABLE,
+		readQueryFromClient, c) == AE_ERR)
+	{
+		freeClient(c);
+		return;
+	}
+	/* 执行命令时产生的回复, 在 beforeSleep 中写出 */
+	if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+
+	/* 处理查询缓冲区中剩下的命令 */
+	server.current_client = c;
+	processInputBuffer(c);
+	server.current_client = NULL;
+}
+
+/*
+ * 信箱的读事件处理器, 取出信箱中所有的客户端.
+ * 属于本 reactor 的客户端是执行完命令被还回来的, 其他的客户端是来执行命令的.
+ */
+static void reactorMailboxHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+	redisClient *c, *next, *prev = NULL;
+	uint64_t count;
+	REDIS_NOTUSED(el);
+	REDIS_NOTUSED(privdata);
+	REDIS_NOTUSED(mask);
+
+	/* 先清空 eventfd 的计数再取信箱, 这样之后投递的客户端一定会再次唤醒本 reactor */
+	if (read(fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+		mylog("Reading from mailbox: %s", strerror(errno));
+
+	c = __atomic_exchange_n(&server.mailbox, NULL, __ATOMIC_ACQUIRE);
+
+	/* 栈中的顺序和投递的顺序相反, 翻转过来 */
+	while (c) {
+		next = c->mailbox_next;
+		c->mailbox_next = prev;
+		prev = c;
+		c = next;
+	}
+
+	for (c = prev; c; c = next) {
+		next = c->mailbox_next;
+		c->mailbox_next = NULL;
+		if (c->reactor == server.reactor_id)
+			reactorClientReturned(c);
+		else
+			reactorExecuteForwarded(c);
+	}
+}
+
+/*
+ * 把客户端 c 的当前命令转交给 reactor r 执行.
+ *
+ * 在客户端回来之前, 本 reactor 不再监听它的读写事件, 也不会再动它.
+ */
+static void reactorForward(redisClient *c, int r) {
+	c->flags |= REDIS_FORWARDED;
+	aeDeleteFileEvent(server.el, c->fd, AE_READABLE | AE_WRITABLE);
+	if (c->flags & REDIS_PENDING_WRITE) {
+		listNode *ln = listSearchKey(server.clients_pending_write, c);
+		if (ln) listDelNode(server.clients_pending_write, ln);
+		c->flags &= ~REDIS_PENDING_WRITE;
+	}
+	mailboxPush(&servers[r], c);
+}
+
+/*============================== Barrier ===================================*/
+
+/*
+ * 在所有 reactor 都停下来的情况下执行命令, 命令可以访问所有分区
+ */
+static void reactorCallWithBarrier(redisClient *c) {
+	pthread_rwlock_unlock(&reactors_lock);
+	pthread_rwlock_wrlock(&reactors_lock);
+	server.in_barrier = 1;
+	reactorCallLocal(c);
+	server.in_barrier = 0;
+	pthread_rwlock_unlock(&reactors_lock);
+	pthread_rwlock_rdlock(&reactors_lock);
+}
+
+/*
+ * 阻塞等待事件之前让出读锁, 跨分区的命令只在这个时候执行
+ */
+void reactorBeforeSleep(void) {
+	pthread_rwlock_unlock(&reactors_lock);
+}
+
+static void reactorAfterSleep(struct aeEventLoop *eventLoop) {
+	pthread_rwlock_rdlock(&reactors_lock);
+	afterSleep(eventLoop);
+}
+
+/*
+ * 多 reactor 模式下执行命令, 根据命令的键决定在哪里执行
+ */
+void reactorCall(redisClient *c) {
+	int target;
+
+	if (c->cmd->flags & REDIS_CMD_GLOBAL) {
+		reactorCallWithBarrier(c);
+		return;
+	}
+
+	target = commandReactor(c->cmd, c->argv, c->argc);
+	if (target == REACTOR_NONE || target == server.reactor_id)
+		reactorCallLocal(c);
+	else if (target == REACTOR_MANY)
+		reactorCallWithBarrier(c);
+	else
+		reactorForward(c, target);
+}
+
+/*
+ * 传播跨分区执行的命令: 把每个键在命令执行之后的状态写入键所在分区的 AOF
+ */
+void reactorFeedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc) {
+	struct redisServer *cur = server_current;
+	int *keys, numkeys, j;
+
+	keys = commandKeys(cmd, argv, argc, &numkeys);
+	for (j = 0; j < numkeys; j++) {
+		server_current = &servers[keyReactor(argv[keys[j]])];
+		feedAppendOnlyFileKey(dictid, argv[keys[j]]);
+	}
+	server_current = cur;
+	zfree(keys);
+}
+
+/*
+ * 在所有 reactor 都停下来的时候, 把每个分区保存到各自的 RDB 文件中
+ */
+int reactorSave(void) {
+	struct redisServer *cur = server_current;
+	int j, retval = REDIS_OK;
+
+	for (j = 0; j < cur->reactors_num && retval == REDIS_OK; j++) {
+		server_current = &servers[j];
+		retval = rdbSave(server.rdb_filename);
+	}
+	server_current = cur;
+	return retval;
+}
+
+/*=========================== Initialization ================================*/
+
+/*
+ * 返回第 id 个分区使用的文件名, 比如 dump.rdb -> dump-1.rdb
+ */
+static char *reactorFilename(char *filename, int id) {
+	char *dot = strrchr(filename, '.');
+	char *name;
+	sds s;
+
+	if (dot)
+		s = sdscatprintf(sdsempty(), "%.*s-%d%s",
+			(int)(dot - filename), filename, id, dot);
+	else
+		s = sdscatprintf(sdsempty(), "%s-%d", filename, id);
+	name = zstrdup(s);
+	sdsfree(s);
+	return name;
+}
+
+/*
+ * 为 reactor 创建信箱
+ */
+static void reactorCreateMailbox(void) {
+	server.mailbox = NULL;
+	server.mailbox_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (server.mailbox_fd == -1) {
+		mylog("Can't create the mailbox of reactor %d: %s",
+			server.reactor_id, strerror(errno));
+		exit(1);
+	}
+	if (aeCreateFileEvent(server.el, server.mailbox_fd, AE_READABLE,
+		reactorMailboxHandler, NULL) == AE_ERR)
+	{
+		mylog("%s", "createFileEvent error!");
+		exit(1);
+	}
+}
+
+/*
+ * 初始化第 1 到第 N-1 个 reactor, 第 0 个就是已经初始化好的 servers[0]
+ */
+void initReactors(void) {
+	pthread_rwlockattr_t attr;
+	int j;
+
+	server.reactor_id = 0;
+	if (server.reactors_num == 1) return;
+
+	if (server.reactors_num < 1 || server.reactors_num > REDIS_REACTORS_MAX_NUM) {
+		mylog("Fatal: the number of reactors must be between 1 and %d",
+			REDIS_REACTORS_MAX_NUM);
+		exit(1);
+	}
+
+	/* 每个 reactor 自己完成读写 */
+	if (server.io_threads_num > 1) {
+		mylog("%s", "I/O threads are disabled in multi-reactor mode");
+		server.io_threads_num = 1;
+	}
+	zmalloc_enable_thread_safeness();
+
+	/* 否则持续的读锁会让跨分区的命令一直拿不到写锁 */
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr,
+		PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&reactors_lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+
+	/* 命令表被所有 reactor 共享, 查找命令时不能再触发渐进式 rehash */
+	while (dictIsRehashing(server.commands)) dictRehash(server.commands, 100);
+	while (dictIsRehashing(server.orig_commands)) dictRehash(server.orig_commands, 100);
+
+	reactorCreateMailbox();
+
+	for (j = 1; j < servers[0].reactors_num; j++) {
+		/* 配置和第 0 个 reactor 相同, 运行时的状态由 initServer() 重新创建 */
+		memcpy(&servers[j], &servers[0], sizeof(struct redisServer));
+		server_current = &servers[j];
+		server.reactor_id = j;
+		server.ipfd_count = 0;
+		server.current_client = NULL;
+		server.rdb_filename = reactorFilename(servers[0].rdb_filename, j);
+		server.aof_filename = reactorFilename(servers[0].aof_filename, j);
+		server.aof_buf = sdsempty();
+		server.aof_rewrite_buf_blocks = NULL;
+		aofRewriteBufferReset();
+		initServer();
+		reactorCreateMailbox();
+	}
+	server_current = &servers[0];
+}
+
+static void *reactorMain(void *arg) {
+	server_current = arg;
+	pthread_rwlock_rdlock(&reactors_lock);
+	aeMain(server.el);
+	return NULL;
+}
+
+/*
+ * 载入其他分区的数据, 然后启动第 1 到第 N-1 个 reactor 的线程.
+ * 第 0 个 reactor 运行在主线程中, 由调用者进入事件循环.
+ */
+void startReactors(aeBeforeSleepProc *beforesleep) {
+	int j;
+
+	if (server.reactors_num == 1) return;
+
+	/* 分区 0 已经载入了 */
+	for (j = 1; j < servers[0].reactors_num; j++) {
+		server_current = &servers[j];
+		loadDataFromDisk();
+	}
+	server_current = &servers[0];
+
+	for (j = 0; j < server.reactors_num; j++) {
+		aeSetBeforeSleepProc(servers[j].el, beforesleep);
+		aeSetAfterSleepProc(servers[j].el, reactorAfterSleep);
+	}
+
+	pthread_rwlock_rdlock(&reactors_lock);
+	for (j = 1; j < server.reactors_num; j++) {
+		if (pthread_create(&servers[j].reactor_thread, NULL, reactorMain,
+			&servers[j]) != 0)
+		{
+			mylog("%s", "Fatal: Can't start reactor thread.");
+			exit(1);
+		}
+	}
+	mylog("%d reactors started", server.reactors_num);
+}
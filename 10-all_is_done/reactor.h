@@ -0,0 +1,14 @@
+#ifndef __REACTOR_H_
+#define __REACTOR_H_
+
+#include "redis.h"
+
+/* api */
+int keyReactor(robj *key);
+void initReactors(void);
+void startReactors(aeBeforeSleepProc *beforesleep);
+void reactorBeforeSleep(void);
+void reactorCall(redisClient *c);
+void reactorFeedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
+int reactorSave(void);
+#endif
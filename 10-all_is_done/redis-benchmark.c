@@ -0,0 +1,368 @@
+/* Redis benchmark utility, 只保留了 redis-benchmark 中最常用的一部分选项.
+ *
+ * 每个客户端一次发送 -P 条命令, 收到全部回复后再发送下一批,
+ * 用来比较 I/O 线程, 多 reactor 等配置在大量流水线客户端下的吞吐量, 例如:
+ *
+ *   ./redis-benchmark -c 1000 -P 16 -n 2000000 -t set,get
+ */
+#include "fmacros.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "ae.h"
+#include "anet.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+#define REDIS_NOTUSED(V) ((void) V)
+
+static struct config {
+	aeEventLoop *el;
+	const char *hostip;
+	int hostport;
+	const char *hostsocket;
+	int numclients;
+	int liveclients;
+	long long requests;
+	long long requests_issued;
+	long long requests_finished;
+	int pipeline;
+	int datasize;
+	int keyspacelen;    // 大于 0 时键名带上 [0, keyspacelen) 中的随机数
+	long long start;
+	long long totlatency; // 所有批次的往返时间之和(微秒)
+	long long batches;
+	int errors;
+	sds data;
+	char *tests;
+	const char *title;
+	const char *cmdfmt;  // 一条命令的参数, 用空格分隔, __rand_int__ 会被替换
+} config;
+
+typedef struct _client {
+	int fd;
+	sds obuf;        // 这一批要发送的命令
+	size_t written;  // obuf 中已经发送的字节数
+	sds ibuf;        // 还没有解析完的回复
+	int pending;     // 这一批中还没有收到回复的命令数
+	long long start; // 这一批开始发送的时间
+} *client;
+
+static long long ustime(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((long long)tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+/*
+ * 按照 RESP 协议把一条命令追加到 s 的末尾
+ */
+static sds appendCommand(sds s) {
+	char buf[64];
+	int argc, j;
+	sds *argv = sdssplitlen(config.cmdfmt, strlen(config.cmdfmt), " ", 1, &argc);
+
+	s = sdscatprintf(s, "*%d\r\n", argc);
+	for (j = 0; j < argc; j++) {
+		const char *arg = argv[j];
+		size_t len = sdslen(argv[j]);
+
+		if (!strcmp(arg, "__data__")) {
+			arg = config.data;
+			len = sdslen(config.data);
+		}
+		else if (strstr(arg, "__rand_int__") != NULL) {
+			long r = config.keyspacelen > 0 ? random() % config.keyspacelen : 0;
+
+			len = snprintf(buf, sizeof(buf), "%.*s%012ld",
+				(int)(strstr(arg, "__rand_int__") - arg), arg, r);
+			arg = buf;
+		}
+		s = sdscatprintf(s, "$%zu\r\n", len);
+		s = sdscatlen(s, arg, len);
+		s = sdscatlen(s, "\r\n", 2);
+	}
+	sdsfreesplitres(argv, argc);
+	return s;
+}
+
+/*
+ * 解析 p 开头的一个完整回复, 返回它的长度, 回复还不完整时返回 0
+ */
+static size_t parseReply(const char *p, const char *end) {
+	const char *nl = memchr(p, '\n', end - p);
+	size_t len;
+	long n;
+
+	if (nl == NULL) return 0;
+	len = nl - p + 1;
+	switch (*p) {
+	case '-':
+		config.errors++;
+		/* fall through */
+	case '+':
+	case ':':
+		return len;
+	case '$':
+		n = strtol(p + 1, NULL, 10);
+		if (n < 0) return len;
+		if ((size_t)(end - p) < len + n + 2) return 0;
+		return len + n + 2;
+	case '*':
+		n = strtol(p + 1, NULL, 10);
+		while (n-- > 0) {
+			size_t elelen = parseReply(p + len, end);
+
+			if (elelen == 0) return 0;
+			len += elelen;
+		}
+		return len;
+	default:
+		fprintf(stderr, "Unexpected reply: %.*s\n", (int)len, p);
+		exit(1);
+	}
+}
+
+static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+
+static void freeClient(client c) {
+	aeDeleteFileEvent(config.el, c->fd, AE_READABLE | AE_WRITABLE);
+	close(c->fd);
+	sdsfree(c->obuf);
+	sdsfree(c->ibuf);
+	zfree(c);
+	if (--config.liveclients == 0) config.el->stop = 1;
+}
+
+/*
+ * 发送下一批命令, 所有请求都已经发出时关闭客户端
+ */
+static void nextBatch(client c) {
+	int j, n = config.pipeline;
+
+	if (config.requests_issued >= config.requests) {
+		freeClient(c);
+		return;
+	}
+	if (n > config.requests - config.requests_issued)
+		n = config.requests - config.requests_issued;
+	config.requests_issued += n;
+
+	sdsclear(c->obuf);
+	for (j = 0; j < n; j++) c->obuf = appendCommand(c->obuf);
+	c->written = 0;
+	c->pending = n;
+	c->start = ustime();
+	aeCreateFileEvent(config.el, c->fd, AE_WRITABLE, writeHandler, c);
+}
+
+static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+	client c = privdata;
+	ssize_t nwritten;
+
+	REDIS_NOTUSED(mask);
+	nwritten = write(fd, c->obuf + c->written, sdslen(c->obuf) - c->written);
+	if (nwritten == -1) {
+		if (errno == EAGAIN) return;
+		fprintf(stderr, "Error writing to the server: %s\n", strerror(errno));
+		exit(1);
+	}
+	c->written += nwritten;
+	if (c->written == sdslen(c->obuf)) {
+		aeDeleteFileEvent(el, fd, AE_WRITABLE);
+		aeCreateFileEvent(el, fd, AE_READABLE, readHandler, c);
+	}
+}
+
+static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+	client c = privdata;
+	char buf[16 * 1024];
+	ssize_t nread;
+	size_t pos = 0, len;
+
+	REDIS_NOTUSED(el);
+	REDIS_NOTUSED(mask);
+	nread = read(fd, buf, sizeof(buf));
+	if (nread == -1) {
+		if (errno == EAGAIN) return;
+		fprintf(stderr, "Error reading from the server: %s\n", strerror(errno));
+		exit(1);
+	}
+	if (nread == 0) {
+		fprintf(stderr, "Server closed the connection\n");
+		exit(1);
+	}
+	c->ibuf = sdscatlen(c->ibuf, buf, nread);
+	while (c->pending > 0 &&
+		(len = parseReply(c->ibuf + pos, c->ibuf + sdslen(c->ibuf))) != 0)
+	{
+		pos += len;
+		c->pending--;
+		config.requests_finished++;
+	}
+	sdsrange(c->ibuf, pos, -1);
+
+	if (c->pending == 0) {
+		config.totlatency += ustime() - c->start;
+		config.batches++;
+		aeDeleteFileEvent(config.el, fd, AE_READABLE);
+		nextBatch(c);
+	}
+}
+
+static int connectToServer(void) {
+	char err[ANET_ERR_LEN];
+	int fd;
+
+	if (config.hostsocket) {
+		struct sockaddr_un sa;
+
+		fd = socket(AF_LOCAL, SOCK_STREAM, 0);
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_LOCAL;
+		strncpy(sa.sun_path, config.hostsocket, sizeof(sa.sun_path) - 1);
+		if (fd == -1 || connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+			fprintf(stderr, "Could not connect to %s: %s\n", config.hostsocket, strerror(errno));
+			exit(1);
+		}
+	}
+	else {
+		struct sockaddr_in sa;
+
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		memset(&sa, 0, sizeof(sa));
+		sa.sin_family = AF_INET;
+		sa.sin_port = htons(config.hostport);
+		if (inet_pton(AF_INET, config.hostip, &sa.sin_addr) != 1) {
+			fprintf(stderr, "Invalid address: %s\n", config.hostip);
+			exit(1);
+		}
+		if (fd == -1 || connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+			fprintf(stderr, "Could not connect to %s:%d: %s\n", config.hostip, config.hostport, strerror(errno));
+			exit(1);
+		}
+		anetEnableTcpNoDelay(err, fd);
+	}
+	anetNonBlock(err, fd);
+	return fd;
+}
+
+static void benchmark(const char *title, const char *cmdfmt) {
+	int j;
+	double secs;
+
+	config.title = title;
+	config.cmdfmt = cmdfmt;
+	config.requests_issued = 0;
+	config.requests_finished = 0;
+	config.totlatency = 0;
+	config.batches = 0;
+	config.errors = 0;
+	config.liveclients = config.numclients;
+	config.start = ustime();
+
+	for (j = 0; j < config.numclients; j++) {
+		client c = zmalloc(sizeof(*c));
+
+		c->fd = connectToServer();
+		c->obuf = sdsempty();
+		c->ibuf = sdsempty();
+		nextBatch(c);
+	}
+	if (config.liveclients > 0) aeMain(config.el);
+
+	secs = (double)(ustime() - config.start) / 1000000;
+	printf("%s: %.2f requests per second, %.3f ms average batch latency",
+		title, config.requests_finished / secs,
+		config.batches ? (double)config.totlatency / config.batches / 1000 : 0);
+	if (config.errors) printf(", %d errors", config.errors);
+	printf("\n");
+}
+
+static int testEnabled(const char *name) {
+	char buf[64];
+	sds list;
+	int found;
+
+	if (config.tests == NULL) return 1;
+	list = sdscatprintf(sdsempty(), ",%s,", config.tests);
+	snprintf(buf, sizeof(buf), ",%s,", name);
+	found = strstr(list, buf) != NULL;
+	sdsfree(list);
+	return found;
+}
+
+static void usage(void) {
+	printf(
+"Usage: redis-benchmark [-h <host>] [-p <port>] [-s <socket>] [-c <clients>]\n"
+"                       [-n <requests>] [-P <pipeline>] [-d <size>] [-r <keyspacelen>]\n"
+"                       [-t <tests>]\n\n"
+" -h <hostname>      Server hostname (default 127.0.0.1)\n"
+" -p <port>          Server port (default 6379)\n"
+" -s <socket>        Server socket (overrides host and port)\n"
+" -c <clients>       Number of parallel connections (default 50)\n"
+" -n <requests>      Total number of requests (default 100000)\n"
+" -P <numreq>        Pipeline <numreq> requests (default 1)\n"
+" -d <size>          Data size of SET/GET value in bytes (default 3)\n"
+" -r <keyspacelen>   Use random keys in the range [0, keyspacelen)\n"
+" -t <tests>         Comma separated list of tests to run:\n"
+"                    set,get,incr,lpush,rpush,lpop,rpop,sadd,hset\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	int j;
+
+	config.hostip = "127.0.0.1";
+	config.hostport = 6379;
+	config.hostsocket = NULL;
+	config.numclients = 50;
+	config.requests = 100000;
+	config.pipeline = 1;
+	config.datasize = 3;
+	config.keyspacelen = 0;
+	config.tests = NULL;
+
+	for (j = 1; j < argc; j++) {
+		int lastarg = (j == argc - 1);
+
+		if (!strcmp(argv[j], "-h") && !lastarg) config.hostip = argv[++j];
+		else if (!strcmp(argv[j], "-p") && !lastarg) config.hostport = atoi(argv[++j]);
+		else if (!strcmp(argv[j], "-s") && !lastarg) config.hostsocket = argv[++j];
+		else if (!strcmp(argv[j], "-c") && !lastarg) config.numclients = atoi(argv[++j]);
+		else if (!strcmp(argv[j], "-n") && !lastarg) config.requests = atoll(argv[++j]);
+		else if (!strcmp(argv[j], "-P") && !lastarg) config.pipeline = atoi(argv[++j]);
+		else if (!strcmp(argv[j], "-d") && !lastarg) config.datasize = atoi(argv[++j]);
+		else if (!strcmp(argv[j], "-r") && !lastarg) config.keyspacelen = atoi(argv[++j]);
+		else if (!strcmp(argv[j], "-t") && !lastarg) config.tests = argv[++j];
+		else usage();
+	}
+	if (config.numclients < 1 || config.pipeline < 1 || config.datasize < 1 || config.requests < 1)
+		usage();
+
+	config.data = sdsgrowzero(sdsempty(), config.datasize);
+	memset(config.data, 'x', config.datasize);
+	config.el = aeCreateEventLoop(config.numclients + 128, AE_API_EPOLL);
+
+	if (testEnabled("set")) benchmark("SET", "SET key:__rand_int__ __data__");
+	if (testEnabled("get")) benchmark("GET", "GET key:__rand_int__");
+	if (testEnabled("incr")) benchmark("INCR", "INCR counter:__rand_int__");
+	if (testEnabled("lpush")) benchmark("LPUSH", "LPUSH mylist __data__");
+	if (testEnabled("rpush")) benchmark("RPUSH", "RPUSH mylist __data__");
+	if (testEnabled("lpop")) benchmark("LPOP", "LPOP mylist");
+	if (testEnabled("rpop")) benchmark("RPOP", "RPOP mylist");
+	if (testEnabled("sadd")) benchmark("SADD", "SADD myset element:__rand_int__");
+	if (testEnabled("hset")) benchmark("HSET", "HSET myhash element:__rand_int__ __data__");
+
+	aeDeleteEventLoop(config.el);
+	return 0;
+}
@@ -30,6 +30,11 @@
 #include "t_zset.h"
 #include "aof.h"
 #include "multi.h"
+#include "reactor.h"
+#include "latency.h"
+#include "slowlog.h"
+#include "evict.h"
+#include "defrag.h"
 
 struct sharedObjectsStruct shared;
 
@@ -39,7 +44,19 @@ void getCommand(redisClient *c);
 /*================================= Globals ================================= */
 
 /* Global vars */
-struct redisServer server; /* server global state */
+struct redisServer servers[REDIS_REACTORS_MAX_NUM]; /* 每个 reactor 一份服务器状态 */
+__thread struct redisServer *server_current = &servers[0];
+
+/*
+ * 各类客户端输出缓冲区限制的默认值:
+ * 普通客户端在输出缓冲区超过 1gb ,或者持续 60 秒超过 256mb 时被关闭,
+ * 附属节点和订阅客户端的值与 Redis 的默认配置相同.
+ */
+clientBufferLimitsConfig clientBufferLimitsDefaults[REDIS_CLIENT_LIMIT_NUM_CLASSES] = {
+	{1024 * 1024 * 1024, 1024 * 1024 * 256, 60}, /* normal */
+	{1024 * 1024 * 256, 1024 * 1024 * 64, 60}, /* slave */
+	{1024 * 1024 * 32, 1024 * 1024 * 8, 60}  /* pubsub */
+};
 double R_Zero, R_PosInf, R_NegInf, R_Nan;
 
 struct redisCommand redisCommandTable[] = {
@@ -51,6 +68,7 @@ struct redisCommand redisCommandTable[] = {
 	{ "append",appendCommand,3,"wm",0,NULL,1,1,1,0,0 },
 	{ "strlen",strlenCommand,2,"r",0,NULL,1,1,1,0,0 },
 	{ "exists",existsCommand,2,"r",0,NULL,1,1,1,0,0 },
+	{ "del",delCommand,-2,"w",0,NULL,1,-1,1,0,0 },
 	{ "setrange",setrangeCommand,4,"wm",0,NULL,1,1,1,0,0 },
 	{ "getrange",getrangeCommand,4,"r",0,NULL,1,1,1,0,0 },
 	{ "substr",getrangeCommand,4,"r",0,NULL,1,1,1,0,0 }, // 求子串居然是getrange的alias 
@@ -68,6 +86,7 @@ struct redisCommand redisCommandTable[] = {
 	{ "hgetall",hgetallCommand,2,"r",0,NULL,1,1,1,0,0 },
 	{ "hmget",hmgetCommand,-3,"r",0,NULL,1,1,1,0,0 },
 	{ "hmset",hmsetCommand,-4,"wm",0,NULL,1,1,1,0,0 },
+	{ "hdel",hdelCommand,-3,"w",0,NULL,1,1,1,0,0 },
 	{ "hkeys",hkeysCommand,2,"rS",0,NULL,1,1,1,0,0 },
 	{ "hvals",hvalsCommand,2,"rS",0,NULL,1,1,1,0,0 },
 	{ "hlen",hlenCommand,2,"r",0,NULL,1,1,1,0,0 },
@@ -103,15 +122,19 @@ struct redisCommand redisCommandTable[] = {
 	{ "persist", persistCommand,2,"w",0,NULL,1,1,1,0,0 },
 	{ "expire",expireCommand,3,"w",0,NULL,1,1,1,0,0 },
 	{ "pexpire",pexpireCommand,3,"w",0,NULL,1,1,1,0,0 },
-	{ "scan",scanCommand,-2,"rR",0,NULL,0,0,0,0,0 },
-	{ "save",saveCommand,1,"ars",0,NULL,0,0,0,0,0 },
+	{ "scan",scanCommand,-2,"rRg",0,NULL,0,0,0,0,0 },
+	{ "save",saveCommand,1,"arsg",0,NULL,0,0,0,0,0 },
 	{ "select",selectCommand,2,"rl",0,NULL,0,0,0,0,0 },
 	/* 事务功能 */
-	{ "exec",execCommand,1,"sM",0,NULL,0,0,0,0,0 },
+	{ "exec",execCommand,1,"sMg",0,NULL,0,0,0,0,0 },
 	{ "discard",discardCommand,1,"rs",0,NULL,0,0,0,0,0 },
 	{ "watch",watchCommand,-2,"rs",0,NULL,1,-1,1,0,0 },
 	{ "unwatch",unwatchCommand,1,"rs",0,NULL,0,0,0,0,0 },
 	{ "multi",multiCommand,1,"rs",0,NULL,0,0,0,0,0 },
+	/* 服务器信息 */
+	{ "info",infoCommand,-1,"rltg",0,NULL,0,0,0,0,0 },
+	{ "latency",latencyCommand,-2,"asltg",0,NULL,0,0,0,0,0 },
+	{ "slowlog",slowlogCommand,-2,"rg",0,NULL,0,0,0,0,0 },
 };
 
 /*================================ Dict ===================================== */
@@ -224,7 +247,7 @@ int dictEncObjKeyCompare(void *privdata, const void *key1,
 	return cmp;
 }
 
-/* Hash type hash table (note that small hashes are represented with ziplists) */
+/* Hash type hash table (note that small hashes are represented with listpacks) */
 dictType hashDictType = {
 	dictEncObjHash,             /* hash function */
 	NULL,                       /* key dup */
@@ -288,10 +311,39 @@ dictType keylistDictType = {
 * for dict.c to resize the hash tables accordingly to the fact we have o not
 * running childs. */
 void updateDictResizePolicy(void) {
-	if (server.rdb_child_pid == -1 && server.aof_child_pid == -1)
+	if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
 		dictEnableResize();
-	else
+		htEnableResize();
+	}
+	else {
 		dictDisableResize();
+		htDisableResize();
+	}
+}
+
+/*
+ * 字典的使用率低于 REDIS_HT_MINFILL 时返回 1, 表示应该缩小字典
+ */
+int dictNeedsResize(dict *d) {
+	long long size, used;
+
+	size = dictSlots(d);
+	used = dictSize(d);
+	return (size && used && size > DICT_HT_INITIAL_SIZE &&
+		(used * 100 / size < REDIS_HT_MINFILL));
+}
+
+/*
+ * 键空间的哈希表是否应该重建:
+ * 1) 使用率低于 REDIS_HT_MINFILL, 包括键被删光之后的空表
+ * 2) 墓碑比键还多, 墓碑会拉长查找不存在的键时的探测序列
+ */
+int htNeedsResize(hashtab *d) {
+	unsigned long size = htSlots(d), used = htSize(d);
+
+	if (size <= HT_INITIAL_SIZE) return 0;
+	return (used * 100 / size < REDIS_HT_MINFILL) ||
+		d->ht[0].deleted > d->ht[0].used;
 }
 
 /*================================== Commands ================================ */
@@ -330,12 +382,15 @@ void populateCommandTable(void) {
 			case 't': c->flags |= REDIS_CMD_STALE; break;
 			case 'M': c->flags |= REDIS_CMD_SKIP_MONITOR; break;
 			case 'k': c->flags |= REDIS_CMD_ASKING; break;
+			case 'g': c->flags |= REDIS_CMD_GLOBAL; break;
 			default: 
 				break;
 			}
 			f++;
 		}
 
+		c->latency_histogram = histogramCreate();
+
 		// 将命令关联到命令表
 		retval1 = dictAdd(server.commands, sdsnew(c->name), c);
 
@@ -371,15 +426,48 @@ struct redisCommand *lookupCommand(sds name) {
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc,
 	int flags)
 {
-	/* 传播到 AOF */
-	if (server.aof_state != REDIS_AOF_OFF && flags & REDIS_PROPAGATE_AOF)
-		feedAppendOnlyFile(cmd, dbid, argv, argc);
+	/* 传播到 AOF
+	 * 跨分区执行的命令传播的是被修改的键的状态, 见 reactor.c */
+	if (server.aof_state != REDIS_AOF_OFF && flags & REDIS_PROPAGATE_AOF) {
+		if (server.in_barrier)
+			reactorFeedAppendOnlyFile(cmd, dbid, argv, argc);
+		else
+			feedAppendOnlyFile(cmd, dbid, argv, argc);
+	}
 }
 
 void call(redisClient *c, int flags) {
-	long long dirty;
+	long long dirty, start, duration;
 	/* 保留旧 dirty 计数器值 */
 	dirty = server.dirty;
+	start = ustime();
+	c->cmd->proc(c); // 执行实现函数
+	duration = ustime() - start;
+	/* 计算命令对数据库的修改次数 */
+	dirty = server.dirty - dirty;
+
+	/* 记录命令的执行次数和耗时 */
+	if (flags & REDIS_CALL_STATS) {
+		/* 多 reactor 模式下命令表被所有 reactor 共享 */
+		if (server.reactors_num > 1) {
+			__atomic_add_fetch(&c->cmd->microseconds, duration, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&c->cmd->calls, 1, __ATOMIC_RELAXED);
+			histogramRecordAtomic(c->cmd->latency_histogram, duration);
+		}
+		else {
+			c->cmd->microseconds += duration;
+			c->cmd->calls++;
+			histogramRecord(c->cmd->latency_histogram, duration);
+		}
+	}
+	server.stat_numcommands++;
+
+	/* 记录慢查询, EXEC 本身不记录, 事务中的命令会被单独记录 */
+	if ((flags & REDIS_CALL_SLOWLOG) && c->cmd->proc != execCommand) {
+		latencyAddSampleIfNeeded("command", duration / 1000);
+		slowlogPushEntryIfNeeded(c, duration);
+	}
+
 	/* 将命令复制到 AOF */
 	if (flags & REDIS_CALL_PROPAGATE) {
 		int flags = REDIS_PROPAGATE_NONE;
@@ -394,7 +482,6 @@ void call(redisClient *c, int flags) {
 		if (flags != REDIS_PROPAGATE_NONE)
 			propagate(c->cmd, c->db->id, c->argv, c->argc, flags);
 	}
-	c->cmd->proc(c); // 执行实现函数
 }
 
 /*
@@ -431,6 +518,13 @@ int processCommand(redisClient *c) {
 		return REDIS_OK;
 	}
 
+	/* 设置了最大内存时, 先尝试淘汰一些键.
+	 * 多 reactor 模式下命令在键所在的 reactor 中执行, 也在那里淘汰键(见 reactor.c),
+	 * 这里只检查要放进事务队列的命令 */
+	if (server.maxmemory && (server.reactors_num == 1 || (c->flags & REDIS_MULTI)) &&
+		evictBeforeCommand(c) == REDIS_ERR)
+		return REDIS_OK;
+
 	/* 如果服务器正在载入数据到数据库，那么只执行带有 REDIS_CMD_LOADING
 	 * 标识的命令，否则将出错 */
 	if (server.loading && !(c->cmd->flags & REDIS_CMD_LOADING)) {
@@ -446,6 +540,10 @@ int processCommand(redisClient *c) {
 		queueMultiCommand(c);
 		addReply(c, shared.queued);
 	}
+	else if (server.reactors_num > 1) {
+		/* 在键所在的 reactor 中执行命令 */
+		reactorCall(c);
+	}
 	else {
 		call(c, REDIS_CALL_FULL);
 	}
@@ -561,7 +659,7 @@ void createSharedObjects(void) {
 
 	// 常用整数
 	for (j = 0; j < REDIS_SHARED_INTEGERS; j++) {
-		shared.integers[j] = createObject(REDIS_STRING, (void*)(long)j);
+		shared.integers[j] = makeObjectShared(createObject(REDIS_STRING, (void*)(long)j));
 		shared.integers[j]->encoding = REDIS_ENCODING_INT;
 	}
 
@@ -595,15 +693,22 @@ void initServerConfig() {
 	server.port = REDIS_SERVERPORT; // 6379号端口监听
 	server.tcp_backlog = REDIS_TCP_BACKLOG;
 	server.bindaddr_count = 0;
+	server.unixsocket = REDIS_DEFAULT_UNIX_SOCKET;
+	server.unixsocketperm = REDIS_DEFAULT_UNIX_SOCKET_PERM;
+	server.sofd = -1;
 
 	server.maxclients = REDIS_MAX_CLIENTS;
 	server.maxidletime = REDIS_MAXIDLETIME;
-	server.hash_max_ziplist_value = REDIS_HASH_MAX_ZIPLIST_VALUE; // 压缩链表所能容忍的最大值
-	server.list_max_ziplist_value = REDIS_LIST_MAX_ZIPLIST_VALUE;
-	server.list_max_ziplist_entries = REDIS_LIST_MAX_ZIPLIST_ENTRIES;
+	server.next_client_id = 1;
+	for (j = 0; j < REDIS_CLIENT_LIMIT_NUM_CLASSES; j++)
+		server.client_obuf_limits[j] = clientBufferLimitsDefaults[j];
+	server.hash_max_listpack_value = REDIS_HASH_MAX_LISTPACK_VALUE; // listpack 所能容忍的最大值
+	server.hash_max_listpack_entries = REDIS_HASH_MAX_LISTPACK_ENTRIES;
+	server.list_max_listpack_size = REDIS_LIST_MAX_LISTPACK_SIZE;
+	server.list_compress_depth = REDIS_LIST_COMPRESS_DEPTH;
 	server.set_max_intset_entries = REDIS_SET_MAX_INTSET_ENTRIES;
-	server.zset_max_ziplist_value = REDIS_ZSET_MAX_ZIPLIST_VALUE;
-	server.zset_max_ziplist_entries = REDIS_ZSET_MAX_ZIPLIST_ENTRIES;
+	server.zset_max_listpack_value = REDIS_ZSET_MAX_LISTPACK_VALUE;
+	server.zset_max_listpack_entries = REDIS_ZSET_MAX_LISTPACK_ENTRIES;
 	server.ipfd_count = 0;
 	server.dbnum = REDIS_DEFAULT_DBNUM;
 	server.tcpkeepalive = REDIS_DEFAULT_TCP_KEEPALIVE;
@@ -639,6 +744,49 @@ void initServerConfig() {
 	server.aof_delayed_fsync = 0;
 	server.aof_last_fsync = time(NULL);
 	server.aof_rewrite_time_start = -1;
+	server.aof_child_info_pipe[0] = -1;
+	server.aof_child_info_pipe[1] = -1;
+	server.aof_last_cow_size = 0;
+
+	/* 慢查询日志 */
+	server.slowlog_log_slower_than = REDIS_SLOWLOG_LOG_SLOWER_THAN;
+	server.slowlog_max_len = REDIS_SLOWLOG_MAX_LEN;
+	server.slowlog_entry_id = 0;
+
+	/* 延迟监视器 */
+	server.latency_monitor_threshold = REDIS_DEFAULT_LATENCY_MONITOR_THRESHOLD;
+	server.el_wakeup_time = 0;
+
+	/* maxmemory */
+	server.maxmemory = REDIS_DEFAULT_MAXMEMORY;
+	server.maxmemory_policy = REDIS_DEFAULT_MAXMEMORY_POLICY;
+	server.maxmemory_samples = REDIS_DEFAULT_MAXMEMORY_SAMPLES;
+	server.lfu_log_factor = REDIS_DEFAULT_LFU_LOG_FACTOR;
+	server.lfu_decay_time = REDIS_DEFAULT_LFU_DECAY_TIME;
+	server.lruclock = getLRUClock();
+
+	server.activerehashing = REDIS_DEFAULT_ACTIVE_REHASHING;
+
+	/* 内存碎片整理 */
+	server.active_defrag_enabled = REDIS_DEFAULT_ACTIVE_DEFRAG;
+	server.active_defrag_ignore_bytes = REDIS_DEFAULT_ACTIVE_DEFRAG_IGNORE_BYTES;
+	server.active_defrag_threshold_lower = REDIS_DEFAULT_ACTIVE_DEFRAG_THRESHOLD_LOWER;
+	server.active_defrag_threshold_upper = REDIS_DEFAULT_ACTIVE_DEFRAG_THRESHOLD_UPPER;
+	server.active_defrag_cycle_min = REDIS_DEFAULT_ACTIVE_DEFRAG_CYCLE_MIN;
+	server.active_defrag_cycle_max = REDIS_DEFAULT_ACTIVE_DEFRAG_CYCLE_MAX;
+	server.active_defrag_running = 0;
+	server.active_defrag_db = 0;
+	server.active_defrag_cursor = 0;
+	server.active_defrag_backoff_until = 0;
+
+	/* I/O 线程 */
+	server.io_threads_num = REDIS_DEFAULT_IO_THREADS;
+	server.io_threads_do_reads = REDIS_DEFAULT_IO_THREADS_DO_READS;
+	server.io_threads_active = 0;
+	server.el_api = REDIS_DEFAULT_EVENTLOOP_API;
+	/* 多 reactor */
+	server.reactors_num = REDIS_DEFAULT_REACTORS;
+	server.reactor_id = 0;
 	/* 初始化浮点常量 */
 	R_Zero = 0.0;
 	R_PosInf = 1.0 / R_Zero;
@@ -646,24 +794,23 @@ void initServerConfig() {
 	R_Nan = R_Zero / R_Zero;
 	populateCommandTable();  // 安装命令处理函数
 
-	/* 如果AOF持久化功能已经打开,那么打开或创建一个 AOF 文件 */
-	if (server.aof_state == REDIS_AOF_ON) {
-		server.aof_fd = open(server.aof_filename,
-			O_WRONLY | O_APPEND | O_CREAT, 0644);
-		if (server.aof_fd == -1) {
-			mylog("Can't open the append-only file: %s",
-				strerror(errno));
-			exit(1);
-		}
-	}
-
 	/* 一些常用的命令 */
 	server.multiCommand = lookupCommandByCString("multi");
+	server.delCommand = lookupCommandByCString("del");
 
 	/* 初始化 BIO 系统 */
 	bioInit();
 }
 
+/*
+ * 创建 TCP 监听套接字, 多 reactor 模式下每个 reactor 各自监听同一个端口
+ */
+static int listenTcp(int port, char *bindaddr) {
+	if (server.reactors_num > 1)
+		return anetTcpReusePortServer(server.neterr, port, bindaddr, server.tcp_backlog);
+	return anetTcpServer(server.neterr, port, bindaddr, server.tcp_backlog);
+}
+
 /*
  * 在port端口监听
  */
@@ -675,7 +822,7 @@ int listenToPort(int port, int *fds, int *count) {
 	for (j = 0; j < server.bindaddr_count || j == 0; j++) {
 		if (server.bindaddr[j] == NULL) {
 			// 这里做了一些简化工作,那就是仅支持ipv4即可
-			fds[*count] = anetTcpServer(server.neterr, port, NULL, server.tcp_backlog);
+			fds[*count] = listenTcp(port, NULL);
 			if (fds[*count] != ANET_ERR) {
 				anetNonBlock(NULL, fds[*count]); // 设置为非阻塞
 				(*count)++;
@@ -684,8 +831,7 @@ int listenToPort(int port, int *fds, int *count) {
 		}
 		else {
 			// Bind IPv4 address.
-			fds[*count] = anetTcpServer(server.neterr, port, server.bindaddr[j],
-				server.tcp_backlog);
+			fds[*count] = listenTcp(port, server.bindaddr[j]);
 		}
 
 		if (fds[*count] == ANET_ERR) {
@@ -729,6 +875,375 @@ void updateCachedTime(void) {
 	server.mstime = mstime();
 }
 
+/*================================== INFO =================================== */
+
+/*
+ * 把字节数转换成方便阅读的形式, 比如 1024 -> 1.00K
+ */
+static void bytesToHuman(char *s, unsigned long long n) {
+	double d;
+
+	if (n < 1024) {
+		sprintf(s, "%lluB", n);
+	}
+	else if (n < (1024 * 1024)) {
+		d = (double)n / (1024);
+		sprintf(s, "%.2fK", d);
+	}
+	else if (n < (1024LL * 1024 * 1024)) {
+		d = (double)n / (1024 * 1024);
+		sprintf(s, "%.2fM", d);
+	}
+	else {
+		d = (double)n / (1024LL * 1024 * 1024);
+		sprintf(s, "%.2fG", d);
+	}
+}
+
+/*
+ * 返回淘汰策略的名字
+ */
+static char *maxmemoryPolicyName(int policy) {
+	switch (policy) {
+	case REDIS_MAXMEMORY_VOLATILE_LRU: return "volatile-lru";
+	case REDIS_MAXMEMORY_VOLATILE_LFU: return "volatile-lfu";
+	case REDIS_MAXMEMORY_VOLATILE_TTL: return "volatile-ttl";
+	case REDIS_MAXMEMORY_VOLATILE_RANDOM: return "volatile-random";
+	case REDIS_MAXMEMORY_ALLKEYS_LRU: return "allkeys-lru";
+	case REDIS_MAXMEMORY_ALLKEYS_LFU: return "allkeys-lfu";
+	case REDIS_MAXMEMORY_ALLKEYS_RANDOM: return "allkeys-random";
+	case REDIS_MAXMEMORY_NO_EVICTION: return "noeviction";
+	default: return "unknown";
+	}
+}
+
+/*
+ * 生成 INFO 命令的输出, section 为 "all" 时输出所有部分, 为 "default" 时输出默认的部分.
+ *
+ * 多 reactor 模式下输出的是所有 reactor 的总和, INFO 带有 "g" 标志,
+ * 执行时其他 reactor 都停了下来, 可以放心地读取它们的状态.
+ */
+sds genRedisInfoString(char *section) {
+	sds info = sdsempty();
+	time_t uptime = server.unixtime - server.stat_starttime;
+	int allsections = 0, defsections = 0;
+	int sections = 0;
+	int j, r;
+
+	if (section == NULL) section = "default";
+	allsections = strcasecmp(section, "all") == 0;
+	defsections = strcasecmp(section, "default") == 0;
+
+	/* Server */
+	if (allsections || defsections || !strcasecmp(section, "server")) {
+		struct utsname name;
+
+		uname(&name);
+		if (sections++) info = sdscat(info, "\r\n");
+		info = sdscatprintf(info,
+			"# Server\r\n"
+			"os:%s %s %s\r\n"
+			"arch_bits:%d\r\n"
+			"multiplexing_api:%s\r\n"
+			"gcc_version:%d.%d.%d\r\n"
+			"process_id:%ld\r\n"
+			"tcp_port:%d\r\n"
+			"uptime_in_seconds:%jd\r\n"
+			"uptime_in_days:%jd\r\n"
+			"hz:%d\r\n"
+			"reactors:%d\r\n"
+			"io_threads:%d\r\n",
+			name.sysname, name.release, name.machine,
+			(int)sizeof(void*) * 8,
+			aeGetApiName(server.el),
+#ifdef __GNUC__
+			__GNUC__, __GNUC_MINOR__, __GNUC_PATCHLEVEL__,
+#else
+			0, 0, 0,
+#endif
+			(long)getpid(),
+			server.port,
+			(intmax_t)uptime,
+			(intmax_t)(uptime / (3600 * 24)),
+			server.hz,
+			server.reactors_num,
+			server.io_threads_num);
+	}
+
+	/* Clients */
+	if (allsections || defsections || !strcasecmp(section, "clients")) {
+		unsigned long clients = 0, lol = 0, bib = 0;
+
+		for (r = 0; r < server.reactors_num; r++) {
+			listIter li;
+			listNode *ln;
+
+			clients += listLength(servers[r].clients);
+			listRewind(servers[r].clients, &li);
+			while ((ln = listNext(&li)) != NULL) {
+				redisClient *c = listNodeValue(ln);
+
+				if (listLength(c->reply) > lol) lol = listLength(c->reply);
+				if (sdslen(c->querybuf) > bib) bib = sdslen(c->querybuf);
+			}
+		}
+		if (sections++) info = sdscat(info, "\r\n");
+		info = sdscatprintf(info,
+			"# Clients\r\n"
+			"connected_clients:%lu\r\n"
+			"client_longest_output_list:%lu\r\n"
+			"client_biggest_input_buf:%lu\r\n",
+			clients, lol, bib);
+	}
+
+	/* Memory */
+	if (allsections || defsections || !strcasecmp(section, "memory")) {
+		char hmem[64];
+		char peak_hmem[64];
+		char rss_hmem[64];
+		char maxmemory_hmem[64];
+		size_t used = zmalloc_used_memory();
+		size_t peak = 0;
+		size_t rss = servers[0].stat_rss;
+		size_t allocated, active;
+		int defrag_running = 0;
+
+		for (r = 0; r < server.reactors_num; r++) {
+			if (servers[r].stat_peak_memory > peak) peak = servers[r].stat_peak_memory;
+			if (servers[r].active_defrag_running > defrag_running)
+				defrag_running = servers[r].active_defrag_running;
+		}
+		if (used > peak) peak = used;
+		/* 分配器的统计要锁住并遍历它所有的 arena, 只在 INFO 需要的时候才取 */
+		zmalloc_get_allocator_info(&allocated, &active);
+
+		bytesToHuman(hmem, used);
+		bytesToHuman(peak_hmem, peak);
+		bytesToHuman(rss_hmem, rss);
+		bytesToHuman(maxmemory_hmem, server.maxmemory);
+		if (sections++) info = sdscat(info, "\r\n");
+		info = sdscatprintf(info,
+			"# Memory\r\n"
+			"used_memory:%zu\r\n"
+			"used_memory_human:%s\r\n"
+			"used_memory_rss:%zu\r\n"
+			"used_memory_rss_human:%s\r\n"
+			"used_memory_peak:%zu\r\n"
+			"used_memory_peak_human:%s\r\n"
+			"allocator_allocated:%zu\r\n"
+			"allocator_active:%zu\r\n"
+			"allocator_frag_ratio:%.2f\r\n"
+			"allocator_frag_bytes:%zd\r\n"
+			"maxmemory:%llu\r\n"
+			"maxmemory_human:%s\r\n"
+			"maxmemory_policy:%s\r\n"
+			"mem_fragmentation_ratio:%.2f\r\n"
+			"mem_fragmentation_bytes:%zd\r\n"
+			"mem_allocator:%s\r\n"
+			"active_defrag_running:%d\r\n",
+			used,
+			hmem,
+			rss,
+			rss_hmem,
+			peak,
+			peak_hmem,
+			allocated,
+			active,
+			allocated ? (float)active / allocated : 0,
+			(ssize_t)(active - allocated),
+			server.maxmemory,
+			maxmemory_hmem,
+			maxmemoryPolicyName(server.maxmemory_policy),
+			zmalloc_get_fragmentation_ratio(rss),
+			(ssize_t)(rss - used),
+			ZMALLOC_LIB,
+			defrag_running);
+	}
+
+	/* Persistence */
+	if (allsections || defsections || !strcasecmp(section, "persistence")) {
+		long long dirty = 0;
+		unsigned long long aof_size = 0, aof_base_size = 0, aof_buf_len = 0;
+		unsigned long aof_delayed_fsync = 0;
+		int rdb_in_progress = 0, aof_in_progress = 0, aof_scheduled = 0;
+		int aof_write_ok = 1;
+		size_t aof_cow_size = 0;
+
+		for (r = 0; r < server.reactors_num; r++) {
+			struct redisServer *s = &servers[r];
+
+			dirty += s->dirty;
+			if (s->rdb_child_pid != -1) rdb_in_progress = 1;
+			if (s->aof_child_pid != -1) aof_in_progress = 1;
+			if (s->aof_rewrite_scheduled) aof_scheduled = 1;
+			if (s->aof_last_write_status != REDIS_OK) aof_write_ok = 0;
+			aof_size += s->aof_current_size;
+			aof_base_size += s->aof_rewrite_base_size;
+			aof_buf_len += sdslen(s->aof_buf);
+			aof_delayed_fsync += s->aof_delayed_fsync;
+			aof_cow_size += s->aof_last_cow_size;
+		}
+		if (sections++) info = sdscat(info, "\r\n");
+		info = sdscatprintf(info,
+			"# Persistence\r\n"
+			"loading:%d\r\n"
+			"rdb_changes_since_last_save:%lld\r\n"
+			"rdb_bgsave_in_progress:%d\r\n"
+			"aof_enabled:%d\r\n"
+			"aof_rewrite_in_progress:%d\r\n"
+			"aof_rewrite_scheduled:%d\r\n"
+			"aof_last_write_status:%s\r\n"
+			"aof_last_cow_size:%zu\r\n",
+			server.loading,
+			dirty,
+			rdb_in_progress,
+			server.aof_state != REDIS_AOF_OFF,
+			aof_in_progress,
+			aof_scheduled,
+			aof_write_ok ? "ok" : "err",
+			aof_cow_size);
+
+		if (server.aof_state != REDIS_AOF_OFF) {
+			info = sdscatprintf(info,
+				"aof_current_size:%llu\r\n"
+				"aof_base_size:%llu\r\n"
+				"aof_buffer_length:%llu\r\n"
+				"aof_delayed_fsync:%lu\r\n",
+				aof_size,
+				aof_base_size,
+				aof_buf_len,
+				aof_delayed_fsync);
+		}
+	}
+
+	/* Stats */
+	if (allsections || defsections || !strcasecmp(section, "stats")) {
+		long long numconnections = 0, numcommands = 0, expiredkeys = 0;
+		long long hits = 0, misses = 0, evictedkeys = 0;
+		long long defrag_hits = 0, defrag_misses = 0;
+		long long defrag_key_hits = 0, defrag_key_misses = 0;
+		long long obuf_disconnections[REDIS_CLIENT_LIMIT_NUM_CLASSES] = { 0 };
+
+		for (r = 0; r < server.reactors_num; r++) {
+			struct redisServer *s = &servers[r];
+
+			numconnections += s->stat_numconnections;
+			numcommands += s->stat_numcommands;
+			expiredkeys += s->stat_expiredkeys;
+			hits += s->stat_keyspace_hits;
+			misses += s->stat_keyspace_misses;
+			evictedkeys += s->stat_evictedkeys;
+			defrag_hits += s->stat_active_defrag_hits;
+			defrag_misses += s->stat_active_defrag_misses;
+			defrag_key_hits += s->stat_active_defrag_key_hits;
+			defrag_key_misses += s->stat_active_defrag_key_misses;
+			for (j = 0; j < REDIS_CLIENT_LIMIT_NUM_CLASSES; j++)
+				obuf_disconnections[j] += s->stat_client_obuf_limit_disconnections[j];
+		}
+		if (sections++) info = sdscat(info, "\r\n");
+		info = sdscatprintf(info,
+			"# Stats\r\n"
+			"total_connections_received:%lld\r\n"
+			"total_commands_processed:%lld\r\n"
+			"expired_keys:%lld\r\n"
+			"evicted_keys:%lld\r\n"
+			"keyspace_hits:%lld\r\n"
+			"keyspace_misses:%lld\r\n"
+			"active_defrag_hits:%lld\r\n"
+			"active_defrag_misses:%lld\r\n"
+			"active_defrag_key_hits:%lld\r\n"
+			"active_defrag_key_misses:%lld\r\n"
+			"client_obuf_limit_disconnections_normal:%lld\r\n"
+			"client_obuf_limit_disconnections_slave:%lld\r\n"
+			"client_obuf_limit_disconnections_pubsub:%lld\r\n",
+			numconnections,
+			numcommands,
+			expiredkeys,
+			evictedkeys,
+			hits,
+			misses,
+			defrag_hits,
+			defrag_misses,
+			defrag_key_hits,
+			defrag_key_misses,
+			obuf_disconnections[REDIS_CLIENT_LIMIT_CLASS_NORMAL],
+			obuf_disconnections[REDIS_CLIENT_LIMIT_CLASS_SLAVE],
+			obuf_disconnections[REDIS_CLIENT_LIMIT_CLASS_PUBSUB]);
+	}
+
+	/* Command statistics */
+	if (allsections || !strcasecmp(section, "commandstats")) {
+		int numcommands = sizeof(redisCommandTable) / sizeof(struct redisCommand);
+
+		if (sections++) info = sdscat(info, "\r\n");
+		info = sdscat(info, "# Commandstats\r\n");
+		for (j = 0; j < numcommands; j++) {
+			struct redisCommand *c = redisCommandTable + j;
+
+			if (!c->calls) continue;
+			info = sdscatprintf(info,
+				"cmdstat_%s:calls=%lld,usec=%lld,usec_per_call=%.2f\r\n",
+				c->name, c->calls, c->microseconds,
+				(c->calls == 0) ? 0 : ((float)c->microseconds / c->calls));
+		}
+	}
+
+	/* 命令耗时的百分位数 */
+	if (allsections || defsections || !strcasecmp(section, "latencystats")) {
+		int numcommands = sizeof(redisCommandTable) / sizeof(struct redisCommand);
+
+		if (sections++) info = sdscat(info, "\r\n");
+		info = sdscat(info, "# Latencystats\r\n");
+		for (j = 0; j < numcommands; j++) {
+			struct redisCommand *c = redisCommandTable + j;
+			histogram *h = c->latency_histogram;
+
+			if (!h->count) continue;
+			info = sdscatprintf(info,
+				"latency_percentiles_usec_%s:p50=%llu,p99=%llu,p99.9=%llu\r\n",
+				c->name,
+				(unsigned long long)histogramValueAtPercentile(h, 50),
+				(unsigned long long)histogramValueAtPercentile(h, 99),
+				(unsigned long long)histogramValueAtPercentile(h, 99.9));
+		}
+	}
+
+	/* Key space */
+	if (allsections || defsections || !strcasecmp(section, "keyspace")) {
+		if (sections++) info = sdscat(info, "\r\n");
+		info = sdscat(info, "# Keyspace\r\n");
+		for (j = 0; j < server.dbnum; j++) {
+			long long keys = 0, vkeys = 0;
+
+			for (r = 0; r < server.reactors_num; r++) {
+				keys += htSize(servers[r].db[j].dict);
+				vkeys += htSize(servers[r].db[j].expires);
+			}
+			if (keys || vkeys) {
+				info = sdscatprintf(info, "db%d:keys=%lld,expires=%lld\r\n",
+					j, keys, vkeys);
+			}
+		}
+	}
+	return info;
+}
+
+/*
+ * INFO [section]
+ */
+void infoCommand(redisClient *c) {
+	char *section = c->argc == 2 ? c->argv[1]->ptr : "default";
+	sds info;
+
+	if (c->argc > 2) {
+		addReply(c, shared.syntaxerr);
+		return;
+	}
+	info = genRedisInfoString(section);
+	addReplyBulkCBuffer(c, info, sdslen(info));
+	sdsfree(info);
+}
+
 /*================================== Shutdown =============================== */
 
 /* 
@@ -738,6 +1253,11 @@ void updateCachedTime(void) {
 void closeListeningSockets(int unlink_unix_socket) {
 	int j;
 	for (j = 0; j < server.ipfd_count; j++) close(server.ipfd[j]);
+	if (server.sofd != -1) close(server.sofd);
+	if (unlink_unix_socket && server.unixsocket) {
+		mylog("%s", "Removing the unix socket file.");
+		unlink(server.unixsocket);
+	}
 }
 
 int prepareForShutdown(int flags) {
@@ -767,6 +1287,8 @@ void freeClient(redisClient *c) {
 	}
 
 	listRelease(c->reply); // 清空回复缓冲区
+	c->bufpos = 0;
+	clientReleaseReplyBuffer(c);
 	freeClientArgv(c); // 清空命令参数
 
 	// 从服务器的客户端链表中删除自身
@@ -776,6 +1298,24 @@ void freeClient(redisClient *c) {
 		listDelNode(server.clients, ln);
 	}
 
+	// 从等待 I/O 的链表以及异步关闭链表中删除自身
+	if (c->flags & REDIS_PENDING_READ) {
+		ln = listSearchKey(server.clients_pending_read, c);
+		if (ln) listDelNode(server.clients_pending_read, ln);
+	}
+	if (c->flags & REDIS_PENDING_WRITE) {
+		ln = listSearchKey(server.clients_pending_write, c);
+		if (ln) listDelNode(server.clients_pending_write, ln);
+	}
+	if (c->flags & REDIS_PENDING_INPUT) {
+		ln = listSearchKey(server.clients_pending_input, c);
+		if (ln) listDelNode(server.clients_pending_input, ln);
+	}
+	if (c->flags & REDIS_CLOSE_ASAP) {
+		ln = listSearchKey(server.clients_to_close, c);
+		if (ln) listDelNode(server.clients_to_close, ln);
+	}
+
 	if (c->name) decrRefCount(c->name);
 	zfree(c->argv);
 	freeClientMultiState(c); // 清除事务状态信息
@@ -791,7 +1331,7 @@ void freeClient(redisClient *c) {
  *
  * 参数 now 是毫秒格式的当前时间
  */
-int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
+int activeExpireCycleTryExpire(redisDb *db, htEntry *de, long long now) {
 	/* 获取键的过期时间 */
 	long long t = dictGetSignedIntegerVal(de);
 	if (now > t) {
@@ -802,6 +1342,7 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
 		/* 从数据库中删除该键 */
 		dbDelete(db, keyobj);
 		decrRefCount(keyobj);
+		server.stat_expiredkeys++;
 		return 1;
 	}
 	else {
@@ -836,16 +1377,17 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
  */
 
 void activeExpireCycle(int type) {
-	/* 静态变量，用来累积函数连续执行时的数据 */
-	static unsigned int current_db = 0; /* Last DB tested. */
-	static int timelimit_exit = 0;      /* Time limit hit in previous call? */
-	static long long last_fast_cycle = 0; /* When last fast cycle ran. */
+	/* 静态变量，用来累积函数连续执行时的数据
+	 * 多 reactor 模式下每个 reactor 各自过期自己的分区，所以是线程局部的 */
+	static __thread unsigned int current_db = 0; /* Last DB tested. */
+	static __thread int timelimit_exit = 0;      /* Time limit hit in previous call? */
+	static __thread long long last_fast_cycle = 0; /* When last fast cycle ran. */
 
 	unsigned int j, iteration = 0;
 	/* 默认每次处理的数据库数量 */
 	unsigned int dbs_per_call = REDIS_DBCRON_DBS_PER_CALL;
 	/* 函数开始的时间 */
-	long long start = ustime(), timelimit;
+	long long start = ustime(), timelimit, elapsed;
 
 	if (type == ACTIVE_EXPIRE_CYCLE_FAST) { /* 快速模式 */
 		/* 如果上次函数没有触发 timelimit_exit ，那么不执行处理 */
@@ -880,7 +1422,7 @@ void activeExpireCycle(int type) {
 	if (type == ACTIVE_EXPIRE_CYCLE_FAST)
 		timelimit = ACTIVE_EXPIRE_CYCLE_FAST_DURATION; /* in microseconds. */
 
-	for (j = 0; j < dbs_per_call; j++) {
+	for (j = 0; j < dbs_per_call && timelimit_exit == 0; j++) {
 		int expired;
 		/* 指向要处理的数据库 */
 		redisDb *db = server.db + (current_db % server.dbnum);
@@ -896,17 +1438,17 @@ void activeExpireCycle(int type) {
 
 			/* 获取数据库中带过期时间的键的数量
 			 * 如果该数量为 0 ，直接跳过这个数据库 */
-			if ((num = dictSize(db->expires)) == 0) {
+			if ((num = htSize(db->expires)) == 0) {
 				break;
 			}
 			/* 获取数据库中键值对的数量 */
-			slots = dictSlots(db->expires);
+			slots = htSlots(db->expires);
 			/* 当前时间 */
 			now = mstime();
 
 			/* 这个数据库的使用率低于 1% ，扫描起来太费力了（大部分都会 MISS）
 			 * 跳过，等待字典收缩程序运行 */
-			if (num && slots > DICT_HT_INITIAL_SIZE &&
+			if (num && slots > HT_INITIAL_SIZE &&
 				(num * 100 / slots < 1)) break;		
 
 			/* 每次最多只能检查 LOOKUPS_PER_LOOP 个键 */
@@ -914,11 +1456,11 @@ void activeExpireCycle(int type) {
 				num = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP;
 
 			while (num--) {
-				dictEntry *de;
+				htEntry *de;
 				long long ttl;
 
 				/* 从 expires 中随机取出一个带过期时间的键 */
-				if ((de = dictGetRandomKey(db->expires)) == NULL) break;
+				if ((de = htGetRandomKey(db->expires)) == NULL) break;
 				/* 计算 TTL */
 				ttl = dictGetSignedIntegerVal(de) - now;
 				/* 如果键已经过期，那么删除它，并将 expired 计数器增一 */
@@ -942,19 +1484,84 @@ void activeExpireCycle(int type) {
 				timelimit_exit = 1;
 			}
 
-			/* 已经超时了，返回 */
-			if (timelimit_exit) return;
+			/* 已经超时了，不再处理 */
+			if (timelimit_exit) break;
 
 			/* 如果已删除的过期键占当前总数据库带过期时间的键数量的 25 %
 			 * 那么不再遍历 */
 		} while (expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP / 4);
 	}
+
+	elapsed = ustime() - start;
+	latencyAddSampleIfNeeded("expire-cycle", elapsed / 1000);
+}
+
+/*
+ * 如果键空间或过期字典的使用率太低, 就缩小它们,
+ * 大量删除键之后多出来的槽要等 rehash 完成才会被释放
+ */
+void tryResizeHashTables(int dbid) {
+	if (htNeedsResize(server.db[dbid].dict))
+		htResize(server.db[dbid].dict);
+	if (htNeedsResize(server.db[dbid].expires))
+		htResize(server.db[dbid].expires);
+}
+
+/*
+ * 渐进式 rehash 只在访问哈希表时执行, 服务器空闲时,
+ * 新旧两个表会同时占用内存很长时间.
+ * 所以每次调用时花 1 毫秒的 CPU 时间主动执行 rehash,
+ * 依次处理键空间, 过期字典和值正在 rehash 的哈希, 集合和有序集合.
+ *
+ * 执行了 rehash 时返回 1, 否则返回 0.
+ */
+int incrementallyRehash(int dbid) {
+	redisDb *db = server.db + dbid;
+
+	if (htIsRehashing(db->dict)) {
+		htRehashMilliseconds(db->dict, 1);
+		return 1;
+	}
+	if (htIsRehashing(db->expires)) {
+		htRehashMilliseconds(db->expires, 1);
+		return 1;
+	}
+	return dbRehashValues(db, 1);
 }
 
 /* 对数据库执行删除过期键，调整大小，以及主动和渐进式 rehash */
 void databasesCron(void) {
 	/* 函数先从数据库中删除过期键，然后再对数据库的大小进行修改 */
 	activeExpireCycle(ACTIVE_EXPIRE_CYCLE_SLOW);
+
+	/* 有子进程时不调整大小, 也不主动 rehash, 避免大量的写时复制 */
+	if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+		/* 多 reactor 模式下每个 reactor 处理自己的分区，所以是线程局部的 */
+		static __thread unsigned int resize_db = 0;
+		static __thread unsigned int rehash_db = 0;
+		unsigned int dbs_per_call = REDIS_DBCRON_DBS_PER_CALL;
+		unsigned int j;
+
+		if (dbs_per_call > server.dbnum) dbs_per_call = server.dbnum;
+
+		/* 缩小使用率太低的哈希表 */
+		for (j = 0; j < dbs_per_call; j++) {
+			tryResizeHashTables(resize_db % server.dbnum);
+			resize_db++;
+		}
+
+		/* 主动 rehash, 每次最多处理一个需要 rehash 的数据库 */
+		if (server.activerehashing) {
+			for (j = 0; j < dbs_per_call; j++) {
+				int work_done = incrementallyRehash(rehash_db % server.dbnum);
+				rehash_db++;
+				if (work_done) break;
+			}
+		}
+	}
+
+	/* 逐步整理键和值的内存碎片 */
+	if (server.active_defrag_enabled) activeDefragCycle();
 }
 
 
@@ -963,7 +1570,8 @@ void databasesCron(void) {
  */
 int clientsCronHandleTimeout(redisClient *c) {
 	time_t now = server.unixtime; // 获取当前的时间
-	if (now - c->lastinteraction > server.maxidletime) {
+	// maxidletime 为 0 表示永不超时
+	if (server.maxidletime && now - c->lastinteraction > server.maxidletime) {
 		// 客户端最后一个与服务器通讯的时间已经超过了maxidletime
 		mylog("%s", "Closing idle client");
 		freeClient(c); // 关闭超时客户端 
@@ -972,11 +1580,36 @@ int clientsCronHandleTimeout(redisClient *c) {
 	return 0;
 }
 
+/*
+ * 回收空闲客户端的查询缓冲区:
+ * 1) 缓冲区比最近的峰值大出很多(比如读入过一个大参数)
+ * 2) 客户端已经空闲了一段时间
+ * 满足任意一个条件的话,就释放缓冲区中的空闲空间.
+ */
+int clientsCronResizeQueryBuffer(redisClient *c) {
+	size_t querybuf_size = sdsAllocSize(c->querybuf);
+	time_t idletime = server.unixtime - c->lastinteraction;
+
+	if (((querybuf_size > REDIS_MBULK_BIG_ARG) &&
+		 (querybuf_size / (c->querybuf_peak + 1)) > 2) ||
+		(querybuf_size > 1024 && idletime > REDIS_CLIENT_IDLE_RECLAIM_SECS))
+	{
+		if (sdsavail(c->querybuf) > 1024)
+			c->querybuf = sdsRemoveFreeSpace(c->querybuf);
+	}
+	/* 重新开始记录峰值 */
+	c->querybuf_peak = 0;
+	return 0;
+}
+
 void clientsCron(void) {
-	// todo
 	int numclients = listLength(server.clients); // 客户端的数量
 	int iterations = numclients / (server.hz * 10); // 要处理的客户端的数量
 
+	/* 每次至少处理 50 个客户端,不足 50 个时全部处理 */
+	if (iterations < 50)
+		iterations = (numclients < 50) ? numclients : 50;
+
 	while (listLength(server.clients) && iterations--) {
 		redisClient *c;
 		listNode *head;
@@ -985,15 +1618,41 @@ void clientsCron(void) {
 		listRotate(server.clients);
 		head = listFirst(server.clients);
 		c = listNodeValue(head);
+		/* 客户端正在其他 reactor 中执行命令 */
+		if (c->flags & REDIS_FORWARDED) continue;
 		if (clientsCronHandleTimeout(c)) continue;
+		if (clientsCronResizeQueryBuffer(c)) continue;
 	}
 }
 
+/*
+ * 采样进程的 RSS, INFO 使用的是采样的结果
+ */
+static void updateMemoryStats(void) {
+	server.stat_rss = zmalloc_get_rss();
+}
+
 int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 	/* 会以一定的频率来运行这个函数 */
 
 	int j;
+	mstime_t latency;
+
 	updateCachedTime();
+	latencyStartMonitor(latency);
+
+	/* 更新 LRU 时钟, I/O 线程创建对象时也会读取它 */
+	__atomic_store_n(&server.lruclock, getLRUClock(), __ATOMIC_RELAXED);
+
+	/* 记录服务器的内存峰值 */
+	if (zmalloc_used_memory() > server.stat_peak_memory)
+		server.stat_peak_memory = zmalloc_used_memory();
+
+	/* RSS 是整个进程的, 读取 /proc 也不便宜, 只在第 0 个 reactor 中定期采样 */
+	if (server.reactor_id == 0) {
+		run_with_period(100) updateMemoryStats();
+	}
+
 	// 服务器进程收到 SIGTERM 消息,关闭服务器
 	if (server.shutdown_asap) {
 		// 尝试关闭服务器
@@ -1003,6 +1662,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 	}
 	// 检查客户端,关闭超时的客户端,并释放客户端多余的缓冲区
 	clientsCron();
+	run_with_period(REDIS_CLIENT_IDLE_RECLAIM_SECS * 1000) replyBufferPoolTrim();
 	databasesCron(); /* 对数据库执行各种操作 */
 
 	/* 如果 BGSAVE 和 BGREWRITEAOF 都没有在执行
@@ -1016,8 +1676,11 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 	if (server.rdb_child_pid != -1 || server.aof_child_pid != -1) {
 		int statloc;
 		pid_t pid;
-		/* 接收子进程发来的信号，非阻塞 */
-		if ((pid = wait3(&statloc, WNOHANG, NULL)) != 0) {
+		/* 接收子进程发来的信号，非阻塞
+		 * 多 reactor 模式下每个 reactor 都可能有自己的子进程，只等待属于自己的那一个 */
+		pid = waitpid(server.rdb_child_pid != -1 ? server.rdb_child_pid :
+			server.aof_child_pid, &statloc, WNOHANG);
+		if (pid > 0) {
 			int exitcode = WEXITSTATUS(statloc); /* 得到退出码 */
 			int bysignal = 0;
 			if (WIFSIGNALED(statloc)) bysignal = WTERMSIG(statloc);
@@ -1064,27 +1727,69 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 	/* 关闭那些需要异步关闭的客户端 */
 	freeClientsInAsyncFreeQueue();
 	server.cronloops++; /* 增加 loop 计数器 */
+
+	latencyEndMonitor(latency);
+	latencyAddSampleIfNeeded("server-cron", latency);
 	return 1000 / server.hz; /* 这个返回的值决定了下次什么时候再调用这个函数 */
 }
 
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 
 
+/*
+ * 清空统计信息
+ */
+static void resetServerStats(void) {
+	int j;
+
+	server.stat_numcommands = 0;
+	server.stat_numconnections = 0;
+	server.stat_expiredkeys = 0;
+	server.stat_keyspace_hits = 0;
+	server.stat_keyspace_misses = 0;
+	server.stat_evictedkeys = 0;
+	server.stat_active_defrag_hits = 0;
+	server.stat_active_defrag_misses = 0;
+	server.stat_active_defrag_key_hits = 0;
+	server.stat_active_defrag_key_misses = 0;
+	server.stat_peak_memory = 0;
+	for (j = 0; j < REDIS_CLIENT_LIMIT_NUM_CLASSES; j++)
+		server.stat_client_obuf_limit_disconnections[j] = 0;
+}
+
+/*
+ * 多 reactor 模式下每个 reactor 都会调用这个函数创建自己的运行时状态,
+ * 信号处理和共享对象只在第 0 个 reactor 中初始化一次.
+ */
 void initServer() {
 	int j;
-	// 忽略SIGPIPE以及SIGHUP两个消息
-	signal(SIGHUP, SIG_IGN);
-	signal(SIGPIPE, SIG_IGN);
-	setupSignalHandlers();
+	if (server.reactor_id == 0) {
+		// 忽略SIGPIPE以及SIGHUP两个消息
+		signal(SIGHUP, SIG_IGN);
+		signal(SIGPIPE, SIG_IGN);
+		setupSignalHandlers();
+	}
 
 	// 初始化并创建数据结构
 	server.clients = listCreate();
 	server.clients_to_close = listCreate();
+	server.clients_pending_read = listCreate();
+	server.clients_pending_write = listCreate();
+	server.clients_pending_input = listCreate();
+	server.reply_buf_pool = zmalloc(sizeof(char*) * REDIS_REPLY_BUF_POOL_MAX);
+	server.reply_buf_pool_len = 0;
+	server.reply_buf_pool_min = 0;
 
 	// 创建共享对象
-	createSharedObjects();
+	if (server.reactor_id == 0) createSharedObjects();
+	if (server.reactor_id == 0) updateMemoryStats();
 
-	server.el = aeCreateEventLoop(server.maxclients + REDIS_EVENTLOOP_FDSET_INCR);
+	server.el = aeCreateEventLoop(server.maxclients + REDIS_EVENTLOOP_FDSET_INCR, server.el_api);
+	if (server.el == NULL) {
+		mylog("Failed creating the event loop. Error message: '%s'", strerror(errno));
+		exit(1);
+	}
+	mylog("Event loop uses %s", aeGetApiName(server.el));
 	server.db = zmalloc(sizeof(redisDb) * server.dbnum); // 创建数据库
 
 	// 打开 TCP 监听端口,用于等待客户端的命令请求
@@ -1092,15 +1797,44 @@ void initServer() {
 		listenToPort(server.port, server.ipfd, &server.ipfd_count) == REDIS_ERR) {
 		exit(1);
 	}
+
+	/* 打开本地套接字, 多 reactor 模式下只打开一次, 其他 reactor 监听同一个描述符 */
+	if (server.unixsocket != NULL && server.reactor_id == 0) {
+		unlink(server.unixsocket); /* 有可能是上次没有删除的套接字文件 */
+		server.sofd = anetUnixServer(server.neterr, server.unixsocket,
+			server.unixsocketperm, server.tcp_backlog);
+		if (server.sofd == ANET_ERR) {
+			mylog("Opening socket: %s", server.neterr);
+			exit(1);
+		}
+		anetNonBlock(NULL, server.sofd);
+	}
 	
 	for (j = 0; j < server.dbnum; j++) {
-		server.db[j].dict = dictCreate(&dbDictType, NULL);
-		server.db[j].expires = dictCreate(&keyptrDictType, NULL);
+		server.db[j].dict = htCreate(&dbDictType, NULL);
+		server.db[j].expires = htCreate(&keyptrDictType, NULL);
 		server.db[j].watched_keys = dictCreate(&keylistDictType, NULL);
+		server.db[j].rehashing_values = dictCreate(&setDictType, NULL);
 		server.db[j].id = j;
 	}
 
+	/* 如果AOF持久化功能已经打开,那么打开或创建一个 AOF 文件 */
+	if (server.aof_state == REDIS_AOF_ON) {
+		server.aof_fd = open(server.aof_filename,
+			O_WRONLY | O_APPEND | O_CREAT, 0644);
+		if (server.aof_fd == -1) {
+			mylog("Can't open the append-only file: %s",
+				strerror(errno));
+			exit(1);
+		}
+	}
+
 	server.rdb_child_pid = -1;
+	slowlogInit();
+	latencyMonitorInit();
+	evictionPoolAlloc();
+	resetServerStats();
+	server.stat_starttime = time(NULL);
 	/* 为serverCron() 创建时间事件 */
 	if (aeCreateTimeEvent(server.el, 1, serverCron, NULL, NULL) == AE_ERR) {
 		exit(1);
@@ -1114,6 +1848,11 @@ void initServer() {
 			exit(-1);
 		}
 	}
+	if (server.sofd != -1 && aeCreateFileEvent(server.el, server.sofd, AE_READABLE,
+		acceptUnixHandler, NULL) == AE_ERR) {
+		mylog("%s", "Unrecoverable error creating server.sofd file event.");
+		exit(-1);
+	}
 }
 
 /* Function called at startup to load RDB or AOF file in memory. */
@@ -1144,8 +1883,24 @@ void loadDataFromDisk(void) {
 * main loop of the event driven library, that is, before to sleep
 * for ready file descriptors. */
 void beforeSleep(struct aeEventLoop *eventLoop) {
+	mstime_t latency;
+
 	REDIS_NOTUSED(eventLoop);
 
+	/* 从醒来到现在, 也就是处理文件事件和时间事件花的时间 */
+	if (server.el_wakeup_time) {
+		latency = server.el_wakeup_time;
+		latencyEndMonitor(latency);
+		latencyAddSampleIfNeeded("eventloop-handlers", latency);
+	}
+	latencyStartMonitor(latency);
+
+	/* 执行 I/O 线程读取并解析好的命令 */
+	handleClientsWithPendingReadsUsingThreads();
+
+	/* 轮流执行用完了命令配额的客户端剩下的命令 */
+	handleClientsWithPendingInput();
+
 	/* Run a fast expire cycle (the called function will return
 	* ASAP if a fast cycle is not needed). */
 	
@@ -1153,15 +1908,47 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
 
 	/* 将 AOF 缓冲区的内容写入到 AOF 文件 */
 	flushAppendOnlyFile(0);
+
+	/* 写出等待发送的回复,必须在 AOF 写入之后进行 */
+	handleClientsWithPendingWritesUsingThreads();
+
+	/* 关闭那些需要异步关闭的客户端 */
+	freeClientsInAsyncFreeQueue();
+
+	latencyEndMonitor(latency);
+	latencyAddSampleIfNeeded("before-sleep", latency);
+
+	/* 阻塞等待事件之前让出分区锁 */
+	if (server.reactors_num > 1) reactorBeforeSleep();
+}
+
+/*
+ * 事件循环从等待中醒来之后调用, 记下醒来的时间
+ */
+void afterSleep(struct aeEventLoop *eventLoop) {
+	REDIS_NOTUSED(eventLoop);
+	latencyStartMonitor(server.el_wakeup_time);
 }
 
 int main(int argc, char **argv) {
+#ifdef REDIS_TEST
+	// 用 -DREDIS_TEST 编译时, redis test <name> 运行对应模块的测试
+	if (argc >= 3 && !strcasecmp(argv[1], "test")) {
+		if (!strcasecmp(argv[2], "networking")) return networkingTest(argc, argv);
+		fprintf(stderr, "Unknown test: %s\n", argv[2]);
+		return 1;
+	}
+#endif
 	initServerConfig();
 	initServer();
+	initReactors();
+	initThreadedIO();
 	/* 从 AOF 文件或者 RDB 文件中载入数据 */
 	loadDataFromDisk();
 	/* 运行事件处理器,一直到服务器关闭为止 */
+	startReactors(beforeSleep);
 	aeSetBeforeSleepProc(server.el, beforeSleep);
+	if (server.reactors_num == 1) aeSetAfterSleepProc(server.el, afterSleep);
 	aeMain(server.el);
 	/* 服务器关闭，停止事件循环 */
 	aeDeleteEventLoop(server.el);
@@ -3,6 +3,7 @@
 
 #include "fmacros.h"
 #include "dict.h"
+#include "hashtab.h"
 #include "adlist.h"
 #include "bio.h"
 #include "rdb.h"
@@ -23,6 +24,8 @@
 #include "ae.h"
 #include "sds.h"
 #include "zmalloc.h"
+#include "histogram.h"
+#include "quicklist.h"
 
 /* Error codes */
 #define REDIS_OK				0
@@ -44,6 +47,17 @@
 /* Protocol and I/O related defines */
 #define REDIS_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
 #define REDIS_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
+#define REDIS_MAX_WRITEV_BYTES  (1024*1024) /* 一次 writev 最多写出的字节数 */
+#define REDIS_REPLY_REF_MIN_BYTES (1024*4) /* 不小于这个长度的值对象以引用的方式放入回复链表 */
+/* 客户端的分类,用于输出缓冲区限制 */
+#define REDIS_CLIENT_LIMIT_CLASS_NORMAL 0
+#define REDIS_CLIENT_LIMIT_CLASS_SLAVE 1
+#define REDIS_CLIENT_LIMIT_CLASS_PUBSUB 2
+#define REDIS_CLIENT_LIMIT_NUM_CLASSES 3
+
+#define REDIS_REPLY_BUF_POOL_MAX 1024 /* 每个事件循环最多缓存的空闲回复缓冲区数量 */
+#define REDIS_CLIENT_IDLE_RECLAIM_SECS 2 /* 客户端空闲这么多秒之后回收它的查询缓冲区 */
+#define REDIS_MAX_COMMANDS_PER_EVENT 1000 /* 一个客户端每轮事件循环最多执行的命令数 */
 #define REDIS_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define REDIS_MBULK_BIG_ARG     (1024*32)
 #define REDIS_MIN_RESERVED_FDS 32
@@ -55,6 +69,8 @@
 #define REDIS_DEFAULT_HZ        10 
 #define REDIS_SERVERPORT		6379 /* TCP port */
 #define REDIS_TCP_BACKLOG       511     /* TCP listen backlog */
+#define REDIS_DEFAULT_UNIX_SOCKET NULL  /* 本地套接字的路径, NULL 表示不监听 */
+#define REDIS_DEFAULT_UNIX_SOCKET_PERM 0 /* 本地套接字文件的权限, 0 表示不修改 */
 #define REDIS_BINDADDR_MAX		16
 #define REDIS_IP_STR_LEN INET6_ADDRSTRLEN
 #define REDIS_DEFAULT_DBNUM     16
@@ -62,6 +78,7 @@
 #define REDIS_SHARED_SELECT_CMDS 10
 #define REDIS_SHARED_INTEGERS 10000
 #define REDIS_SHARED_BULKHDR_LEN 32
+#define REDIS_SHARED_REFCOUNT INT_MAX   /* 全局共享的对象的引用计数, 这样的对象不增减引用计数, 也不会被修改 */
 #define REDIS_MAXIDLETIME       0			 /* default client timeout: infinite */
 #define REDIS_DEFAULT_RDB_COMPRESSION 1
 #define REDIS_DEFAULT_RDB_CHECKSUM 1
@@ -72,6 +89,27 @@
 #define REDIS_DEFAULT_AOF_FILENAME "appendonly.aof"
 #define REDIS_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
 #define REDIS_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
+#define REDIS_DEFAULT_IO_THREADS 1      /* 1 表示不开启 I/O 线程,所有读写都在主线程完成 */
+#define REDIS_DEFAULT_IO_THREADS_DO_READS 1
+#define REDIS_DEFAULT_EVENTLOOP_API AE_API_EPOLL /* 改为 AE_API_IOURING 启用 io_uring, 不可用时回退到 epoll */
+#define REDIS_IO_THREADS_MAX_NUM 128
+#define REDIS_DEFAULT_REACTORS 1        /* 1 表示只有一个事件循环,键空间不分区 */
+#define REDIS_REACTORS_MAX_NUM 64
+#define REDIS_SLOWLOG_LOG_SLOWER_THAN 10000 /* 执行时间超过这个值(微秒)的命令会被记录到慢查询日志, 负数表示不记录 */
+#define REDIS_SLOWLOG_MAX_LEN 128       /* 慢查询日志最多保存的条目数 */
+#define REDIS_DEFAULT_LATENCY_MONITOR_THRESHOLD 10 /* 耗时超过这个值(毫秒)的操作会被延迟监视器记录, 0 表示关闭 */
+#define REDIS_DEFAULT_MAXMEMORY 0       /* 最多使用的内存(字节), 0 表示没有限制 */
+#define REDIS_DEFAULT_MAXMEMORY_POLICY REDIS_MAXMEMORY_NO_EVICTION
+#define REDIS_DEFAULT_MAXMEMORY_SAMPLES 5 /* 每次淘汰时每个数据库抽样的键数 */
+#define REDIS_DEFAULT_LFU_LOG_FACTOR 10 /* LFU 计数器的对数因子, 越大计数器增长越慢 */
+#define REDIS_DEFAULT_LFU_DECAY_TIME 1  /* LFU 计数器每隔多少分钟减一 */
+#define REDIS_DEFAULT_ACTIVE_REHASHING 1 /* 是否在 databasesCron 中主动完成哈希表的 rehash */
+#define REDIS_DEFAULT_ACTIVE_DEFRAG 0   /* 是否在后台整理内存碎片, 默认关闭, 需要时改为 1 */
+#define REDIS_DEFAULT_ACTIVE_DEFRAG_IGNORE_BYTES (100*1024*1024) /* 碎片少于这么多字节时不整理 */
+#define REDIS_DEFAULT_ACTIVE_DEFRAG_THRESHOLD_LOWER 10 /* 碎片率(百分比)超过这个值时开始整理 */
+#define REDIS_DEFAULT_ACTIVE_DEFRAG_THRESHOLD_UPPER 100 /* 碎片率超过这个值时以最大力度整理 */
+#define REDIS_DEFAULT_ACTIVE_DEFRAG_CYCLE_MIN 1 /* 整理时最少占用的 CPU 百分比 */
+#define REDIS_DEFAULT_ACTIVE_DEFRAG_CYCLE_MAX 25 /* 整理时最多占用的 CPU 百分比 */
 
 /* client flags */
 #define REDIS_SLAVE (1<<0)   /* This client is a slave server */
@@ -93,6 +131,11 @@ server.unblocked_clients */
 #define REDIS_FORCE_REPL (1<<15)  /* Force replication of current cmd. */
 #define REDIS_PRE_PSYNC (1<<16)   /* Instance don't understand PSYNC. */
 #define REDIS_READONLY (1<<17)    /* Cluster client is in read-only state. */
+#define REDIS_PENDING_READ (1<<18)    /* 客户端的读取与解析被交给了 I/O 线程 */
+#define REDIS_PENDING_COMMAND (1<<19) /* I/O 线程已解析出一条命令,等待主线程执行 */
+#define REDIS_PENDING_WRITE (1<<20)   /* 客户端在 clients_pending_write 链表中 */
+#define REDIS_FORWARDED (1<<21)       /* 命令被转交给键所在分区的 reactor 执行 */
+#define REDIS_PENDING_INPUT (1<<22)   /* 用完了命令配额,剩下的命令在 clients_pending_input 中排队 */
 
 /* 指示 AOF 程序每累积这个量的写入数据
  * 就执行一次显式的 fsync */
@@ -113,10 +156,12 @@ server.unblocked_clients */
 #define REDIS_ENCODING_HT 2      /* Encoded as hash table */
 #define REDIS_ENCODING_ZIPMAP 3  /* Encoded as zipmap */
 #define REDIS_ENCODING_LINKEDLIST 4 /* Encoded as regular linked list */
-#define REDIS_ENCODING_ZIPLIST 5 /* Encoded as ziplist */
+#define REDIS_ENCODING_ZIPLIST 5 /* No longer used, 旧 RDB 中的 ziplist 载入时转换成 listpack */
 #define REDIS_ENCODING_INTSET 6
 #define REDIS_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
 #define REDIS_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
+#define REDIS_ENCODING_QUICKLIST 9 /* Encoded as linked list of listpacks */
+#define REDIS_ENCODING_LISTPACK 10 /* Encoded as listpack */
 
 /* List related stuff */
 #define REDIS_HEAD 0
@@ -136,15 +181,16 @@ server.unblocked_clients */
 #define REDIS_CMD_STALE 1024                /* "t" flag */
 #define REDIS_CMD_SKIP_MONITOR 2048         /* "M" flag */
 #define REDIS_CMD_ASKING 4096               /* "k" flag */
+#define REDIS_CMD_GLOBAL 8192               /* "g" flag, 多 reactor 模式下需要访问所有分区 */
 
 /* Zip structure related defaults */
-#define REDIS_HASH_MAX_ZIPLIST_VALUE 64
-#define REDIS_HASH_MAX_ZIPLIST_ENTRIES 512  // 压缩链表最多能有512项
-#define REDIS_LIST_MAX_ZIPLIST_VALUE 64
-#define REDIS_LIST_MAX_ZIPLIST_ENTRIES 512
+#define REDIS_HASH_MAX_LISTPACK_VALUE 64
+#define REDIS_HASH_MAX_LISTPACK_ENTRIES 512  // listpack 最多能有512项
+#define REDIS_LIST_MAX_LISTPACK_SIZE -2   // 列表的每个 listpack 节点最多 8KB
+#define REDIS_LIST_COMPRESS_DEPTH 0      // 列表两端各有多少个节点不压缩, 0 表示不压缩
 #define REDIS_SET_MAX_INTSET_ENTRIES 512
-#define REDIS_ZSET_MAX_ZIPLIST_ENTRIES 128
-#define REDIS_ZSET_MAX_ZIPLIST_VALUE 64
+#define REDIS_ZSET_MAX_LISTPACK_ENTRIES 128
+#define REDIS_ZSET_MAX_LISTPACK_VALUE 64
 
 /* Command call flags, see call() function */
 #define REDIS_CALL_NONE 0
@@ -170,6 +216,7 @@ server.unblocked_clients */
 #define REDIS_NOTUSED(V) ((void) V)
 
 #define REDIS_DBCRON_DBS_PER_CALL 16
+#define REDIS_HT_MINFILL 10 /* 哈希表的使用率低于这个百分比时缩小 */
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
@@ -188,6 +235,22 @@ server.unblocked_clients */
 #define AOF_FSYNC_EVERYSEC 2
 #define REDIS_DEFAULT_AOF_FSYNC AOF_FSYNC_EVERYSEC
 
+/* maxmemory 淘汰策略 */
+#define REDIS_MAXMEMORY_FLAG_LRU (1<<0)
+#define REDIS_MAXMEMORY_FLAG_LFU (1<<1)
+#define REDIS_MAXMEMORY_FLAG_ALLKEYS (1<<2)
+#define REDIS_MAXMEMORY_FLAG_NO_SHARED_INTEGERS \
+	(REDIS_MAXMEMORY_FLAG_LRU | REDIS_MAXMEMORY_FLAG_LFU)
+
+#define REDIS_MAXMEMORY_VOLATILE_LRU ((0<<8) | REDIS_MAXMEMORY_FLAG_LRU)
+#define REDIS_MAXMEMORY_VOLATILE_LFU ((1<<8) | REDIS_MAXMEMORY_FLAG_LFU)
+#define REDIS_MAXMEMORY_VOLATILE_TTL (2<<8)
+#define REDIS_MAXMEMORY_VOLATILE_RANDOM (3<<8)
+#define REDIS_MAXMEMORY_ALLKEYS_LRU ((4<<8) | REDIS_MAXMEMORY_FLAG_LRU | REDIS_MAXMEMORY_FLAG_ALLKEYS)
+#define REDIS_MAXMEMORY_ALLKEYS_LFU ((5<<8) | REDIS_MAXMEMORY_FLAG_LFU | REDIS_MAXMEMORY_FLAG_ALLKEYS)
+#define REDIS_MAXMEMORY_ALLKEYS_RANDOM ((6<<8) | REDIS_MAXMEMORY_FLAG_ALLKEYS)
+#define REDIS_MAXMEMORY_NO_EVICTION (7<<8)
+
 /* Command propagation flags, see propagate() function */
 #define REDIS_PROPAGATE_NONE 0
 #define REDIS_PROPAGATE_AOF 1
@@ -207,6 +270,13 @@ typedef long long mstime_t;
 * Redis 对象
 */
 #define REDIS_LRU_BITS 24
+#define REDIS_LRU_CLOCK_MAX ((1<<REDIS_LRU_BITS)-1) /* obj->lru 的最大值 */
+#define REDIS_LRU_CLOCK_RESOLUTION 1000 /* LRU 时钟的精度, 单位为毫秒 */
+#define LFU_INIT_VAL 5 /* 新对象的 LFU 计数器, 避免刚创建就被淘汰 */
+
+/* serverCron 的频率足够高时使用缓存的 LRU 时钟, 否则直接计算 */
+#define LRU_CLOCK() ((1000/server.hz <= REDIS_LRU_CLOCK_RESOLUTION) ? \
+	__atomic_load_n(&server.lruclock, __ATOMIC_RELAXED) : getLRUClock())
 
 //
 // redisObject Redis对象
@@ -217,16 +287,42 @@ typedef struct redisObject {
 
 	unsigned encoding : 4; // 编码
 
+	unsigned lru : REDIS_LRU_BITS; // 最近一次访问的 LRU 时钟, LFU 策略下是访问时间和访问频率, 见 evict.c
+
 	int refcount; // 引用计数
 
 	void *ptr; // 指向实际值的指针
 } robj;
 
+/* Macro used to initialize a Redis object allocated on the stack.
+* Note that this macro is taken near the structure definition to make sure
+* we'll update it when the structure is changed, to avoid bugs like
+* bug #85 introduced exactly in this way. */
+#define initStaticStringObject(_var,_ptr) do { \
+    _var.refcount = 1; \
+    _var.type = REDIS_STRING; \
+    _var.encoding = REDIS_ENCODING_RAW; \
+    _var.lru = 0; \
+    _var.ptr = _ptr; \
+} while(0);
+
+
+/*
+ * 客户端输出缓冲区的限制
+ */
+typedef struct clientBufferLimitsConfig {
+	unsigned long long hard_limit_bytes;  // 硬性限制,超过之后立即关闭客户端
+	unsigned long long soft_limit_bytes;  // 软性限制
+	time_t soft_limit_seconds;            // 持续超过软性限制这么多秒之后关闭客户端
+} clientBufferLimitsConfig;
+
+extern clientBufferLimitsConfig clientBufferLimitsDefaults[REDIS_CLIENT_LIMIT_NUM_CLASSES];
 
 typedef struct redisDb {
-	dict *dict;                 // 数据库键空间，保存着数据库中的所有键值对
-	dict *expires;				// 键的过期时间,字典的键为键,字典的值为过期事件 UNIX 时间戳
+	hashtab *dict;              // 数据库键空间，保存着数据库中的所有键值对
+	hashtab *expires;			// 键的过期时间,字典的键为键,字典的值为过期事件 UNIX 时间戳
 	dict *watched_keys;			// 正在被watch命令监视的键
+	dict *rehashing_values;		// 值是正在 rehash 的字典的键, 由 databasesCron 完成 rehash
 	int id;                     // 数据库号码
 } redisDb;
 
@@ -270,6 +366,10 @@ typedef struct redisClient {
 
 	sds querybuf; // 查询缓冲区
 
+	size_t querybuf_peak; // 最近一段时间内查询缓冲区的最大长度,由 clientsCron 重置
+
+	size_t qb_pos; // 查询缓冲区中已经解析到的位置,之前的内容在 processInputBuffer 返回前才被删除
+
 	int argc; // 参数数量
 
 	robj **argv; // 参数对象数组
@@ -290,15 +390,23 @@ typedef struct redisClient {
 
 	int bufpos; // 回复偏移量
 
-	char buf[REDIS_REPLY_CHUNK_BYTES];
+	char *buf; // 回复缓冲区,大小为 REDIS_REPLY_CHUNK_BYTES,第一次用到时才从缓冲区池中取出
 
 	time_t lastinteraction; // 客户端最后一次和服务器互动的时间
+
+	time_t obuf_soft_limit_reached_time; // 输出缓冲区开始超过软性限制的时间,未超过时为 0
 	/* 客户端状态标志 */
 	int flags;              /* REDIS_SLAVE | REDIS_MONITOR | REDIS_MULTI ... */
 
 	multiState mstate;      /* MULTI/EXEC state */
 
 	list *watched_keys;	    /* 正在被WATCH命令监视的键 */
+
+	uint64_t id;            /* 客户端的唯一 id, 在所有 reactor 之间唯一 */
+
+	int reactor;            /* 客户端连接所属的 reactor */
+
+	struct redisClient *mailbox_next; /* 投递到其他 reactor 的信箱时使用的链接 */
 } redisClient;
 
 
@@ -327,10 +435,18 @@ struct redisServer {
 	int ipfd[REDIS_BINDADDR_MAX];  // TCP 描述符
 	int ipfd_count;				   // 已经使用了的描述符的数目
 
+	char *unixsocket;			// 本地套接字的路径
+	mode_t unixsocketperm;		// 本地套接字文件的权限
+	int sofd;					// 本地套接字描述符, 多 reactor 模式下由所有 reactor 共享
+
 	list *clients;	// 一个链表,保存了所有的客户端状态结构
 
 	list *clients_to_close; // 链表,保存了所有待关闭的客户端
 
+	char **reply_buf_pool;   // 空闲的回复缓冲区,客户端需要时从这里取出
+	int reply_buf_pool_len;  // 池中缓冲区的数量
+	int reply_buf_pool_min;  // 上次整理以来池中缓冲区数量的最小值,这么多缓冲区一直没有被取出过
+
 	redisClient *current_client; // 服务器当前服务的客户端,仅用于崩溃报告
 	
 	char neterr[ANET_ERR_LEN]; // 用于记录网络错误 
@@ -341,16 +457,76 @@ struct redisServer {
 	/* Limits */
 	int maxclients;   // Max number of simultaneous clients
 	int maxidletime; // 客户端的最大空转时间
+	clientBufferLimitsConfig client_obuf_limits[REDIS_CLIENT_LIMIT_NUM_CLASSES]; // 各类客户端的输出缓冲区限制
+	long long stat_client_obuf_limit_disconnections[REDIS_CLIENT_LIMIT_NUM_CLASSES]; // 因为超过输出缓冲区限制而被关闭的客户端数量
 
 	time_t unixtime; // 记录时间
 	long long mstime; // 这个精度要高一些
-	size_t hash_max_ziplist_value;
-	size_t hash_max_ziplist_entries;
-	size_t list_max_ziplist_value;
-	size_t list_max_ziplist_entries;
+
+	/* 统计信息 */
+	time_t stat_starttime;          /* 服务器启动的时间 */
+	long long stat_numcommands;     /* 已经执行的命令数量 */
+	long long stat_numconnections;  /* 已经接受的连接数量 */
+	long long stat_expiredkeys;     /* 因为过期而被删除的键的数量 */
+	long long stat_keyspace_hits;   /* 查找键时命中的次数 */
+	long long stat_keyspace_misses; /* 查找键时没有命中的次数 */
+	size_t stat_peak_memory;        /* 用过的内存的峰值 */
+	size_t stat_rss;                /* 进程的 RSS, 由第 0 个 reactor 的 serverCron 定期采样 */
+
+	/* 慢查询日志 */
+	struct slowlogEntry *slowlog;       /* 环形缓冲区, 长度为 slowlog_max_len */
+	unsigned long slowlog_len;          /* 缓冲区中的日志条数 */
+	unsigned long slowlog_head;         /* 下一条日志写入的位置 */
+	long long slowlog_entry_id;         /* 下一条日志的 id, 只使用 servers[0] 的 */
+	long long slowlog_log_slower_than;  /* 执行时间超过这个值(微秒)的命令才会被记录 */
+	unsigned long slowlog_max_len;      /* 慢查询日志最多保存的条目数 */
+	uint64_t next_client_id;            /* 下一个客户端的 id, 只使用 servers[0] 的 */
+
+	/* 延迟监视器 */
+	dict *latency_events;               /* 事件名 -> 样本序列 */
+	long long latency_monitor_threshold; /* 耗时超过这个值(毫秒)的操作才会被记录 */
+	mstime_t el_wakeup_time;            /* 事件循环最近一次从等待中醒来的时间 */
+
+	/* maxmemory */
+	unsigned long long maxmemory;       /* 最多使用的内存(字节), 0 表示没有限制 */
+	int maxmemory_policy;               /* 超过 maxmemory 之后淘汰键的策略 */
+	int maxmemory_samples;              /* 每次淘汰时抽样的键数 */
+	int lfu_log_factor;                 /* LFU 计数器的对数因子 */
+	int lfu_decay_time;                 /* LFU 计数器的衰减周期, 单位为分钟 */
+	unsigned int lruclock;              /* LRU 时钟, 由 serverCron 更新 */
+	struct evictionPoolEntry *eviction_pool; /* 淘汰池, 见 evict.c */
+	long long stat_evictedkeys;         /* 因为 maxmemory 而被淘汰的键的数量 */
+
+	int activerehashing;                /* 是否在 databasesCron 中主动 rehash */
+
+	/* 内存碎片整理, 见 defrag.c */
+	int active_defrag_enabled;
+	unsigned long long active_defrag_ignore_bytes; /* 碎片少于这么多字节时不整理 */
+	int active_defrag_threshold_lower;  /* 碎片率(百分比)超过这个值时开始整理 */
+	int active_defrag_threshold_upper;  /* 碎片率超过这个值时以最大力度整理 */
+	int active_defrag_cycle_min;        /* 整理时最少占用的 CPU 百分比 */
+	int active_defrag_cycle_max;        /* 整理时最多占用的 CPU 百分比 */
+	int active_defrag_running;          /* 正在整理时是本轮占用的 CPU 百分比, 否则为 0 */
+	int active_defrag_db;               /* 正在整理的数据库 */
+	unsigned long active_defrag_cursor; /* 正在整理的数据库的 dictScan 游标 */
+	long long active_defrag_pass_hits;  /* 本轮开始时的 stat_active_defrag_hits */
+	long long active_defrag_pass_misses; /* 本轮开始时的 stat_active_defrag_misses */
+	size_t active_defrag_pass_frag;     /* 本轮开始时 slab 中的碎片字节数 */
+	mstime_t active_defrag_backoff_until; /* 上一轮没能减少碎片, 在这之前不再开始新的一轮, 0 表示没有退避 */
+	size_t active_defrag_backoff_frag;  /* 开始退避时 slab 中的碎片字节数 */
+	size_t active_defrag_backoff_used;  /* 开始退避时使用的内存 */
+	long long stat_active_defrag_hits;  /* 被搬动的内存块数 */
+	long long stat_active_defrag_misses; /* 检查过但不需要搬动的内存块数 */
+	long long stat_active_defrag_key_hits; /* 有内存块被搬动的键数 */
+	long long stat_active_defrag_key_misses; /* 没有内存块被搬动的键数 */
+
+	size_t hash_max_listpack_value;
+	size_t hash_max_listpack_entries;
+	int list_max_listpack_size;
+	int list_compress_depth;
 	size_t set_max_intset_entries;
-	size_t zset_max_ziplist_entries;
-	size_t zset_max_ziplist_value;
+	size_t zset_max_listpack_entries;
+	size_t zset_max_listpack_value;
 
 	/* 有关于数据库存储的一些量 */
 	pid_t rdb_child_pid;   /* PID of RDB saving child */
@@ -393,11 +569,43 @@ struct redisServer {
 	unsigned long aof_delayed_fsync; /* 记录 AOF 的 write 操作被推迟了多少次 */
 	time_t aof_last_fsync;           /* 最后一直执行 fsync 的时间 */
 	time_t aof_rewrite_time_start;	 /* AOF 重写的开始时间 */
+	int aof_child_info_pipe[2];      /* 重写子进程通过这个管道告诉父进程写时复制的内存量 */
+	size_t aof_last_cow_size;        /* 上一次 AOF 重写时子进程写时复制的字节数 */
 
 	/* 常用命令的快捷连接 */
-	struct redisCommand *multiCommand;
+	struct redisCommand *multiCommand, *delCommand;
+
+	/* Threaded I/O */
+	int io_threads_num;         /* I/O 线程的数目(包括主线程),为 1 时不启用 */
+	int io_threads_do_reads;    /* 是否也将读取和解析交给 I/O 线程 */
+	int io_threads_active;      /* I/O 线程当前是否处于工作状态 */
+	int el_api;                 /* 事件循环优先使用的多路复用库, AE_API_* */
+	list *clients_pending_read; /* 等待 I/O 线程读取并解析查询的客户端 */
+	list *clients_pending_write; /* 有回复等待写出,但还没有安装写处理器的客户端 */
+	list *clients_pending_input; /* 查询缓冲区中还有命令没执行完,等待下一轮轮流执行的客户端 */
+
+	/* 多 reactor */
+	int reactors_num;           /* reactor(事件循环线程)的数目,每个 reactor 拥有键空间的一个分区 */
+	int reactor_id;             /* 当前这个 server 实例是第几个 reactor */
+	pthread_t reactor_thread;   /* 运行这个 reactor 的线程 */
+	int mailbox_fd;             /* eventfd,其他 reactor 投递客户端之后用它唤醒本 reactor */
+	redisClient *mailbox;       /* 其他 reactor 投递过来的客户端,一个无锁的栈 */
+	int in_barrier;             /* 正在其他 reactor 都停下来的情况下执行跨分区的命令 */
 };
 
+/*
+ * 每个 reactor 都有自己的 redisServer,
+ * server 总是指向当前线程所服务的那一个, 非 reactor 线程(I/O 线程, BIO)看到的是第 0 个.
+ * 只有一个 reactor 时 server 就是 servers[0], 不必每次访问都经过线程局部的指针.
+ */
+extern struct redisServer servers[REDIS_REACTORS_MAX_NUM];
+extern __thread struct redisServer *server_current;
+#if REDIS_DEFAULT_REACTORS > 1
+#define server (*server_current)
+#else
+#define server (servers[0])
+#endif
+
 
 typedef void redisCommandProc(redisClient *c);
 typedef int *redisGetKeysProc(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
@@ -438,6 +646,9 @@ struct redisCommand {
 	// microseconds 记录了命令执行耗费的总毫微秒数
 	// calls 是命令被执行的总次数
 	long long microseconds, calls;
+
+	// 命令执行耗时(微秒)的分布
+	histogram *latency_histogram;
 };
 
 
@@ -485,10 +696,8 @@ typedef struct {
 	unsigned char encoding;
 	/* 迭代的方向 */
 	unsigned char direction;
-	/* ziplist索引,迭代ziplist编码的列表时使用 */
-	unsigned char *zi;
-	/* 链表节点的指针,迭代双端链表编码的列表时使用 */
-	listNode *ln;
+	/* quicklist 迭代器 */
+	quicklistIter *iter;
 } listTypeIterator;
 
 /* 
@@ -500,11 +709,8 @@ typedef struct {
 	/* 列表迭代器 */
 	listTypeIterator *li;
 
-	/* ziplist 节点索引 */
-	unsigned char *zi;  
-
-	/* 双端链表节点指针 */
-	listNode *ln; 
+	/* quicklist 中的元素 */
+	quicklistEntry entry;
 } listTypeEntry;
 
 /*
@@ -610,6 +816,8 @@ long long mstime(void);
 long long ustime(void);
 void exitFromChild(int retcode);
 void updateDictResizePolicy(void);
+int dictNeedsResize(dict *d);
+int htNeedsResize(hashtab *d);
 void freeClientMultiState(redisClient *c);
 void closeListeningSockets(int unlink_unix_socket);
 struct redisCommand *lookupCommand(sds name);
@@ -618,4 +826,10 @@ void saveCommand(redisClient *c);
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc,
 	int flags);
 void call(redisClient *c, int flags);
+void infoCommand(redisClient *c);
+void initServerConfig(void);
+void initServer(void);
+void loadDataFromDisk(void);
+void afterSleep(struct aeEventLoop *eventLoop);
+unsigned int getLRUClock(void);
 #endif
\ No newline at end of file
@@ -28,6 +28,60 @@
 #include "crc64.h"
 
 
+/*
+ * 将长度为 len 的内容 buf 追加到内存缓存 r 中。
+ *
+ * 成功返回 1 。
+ */
+static size_t rioBufferWrite(rio *r, const void *buf, size_t len) {
+	r->io.buffer.ptr = sdscatlen(r->io.buffer.ptr, (char*)buf, len);
+	r->io.buffer.pos += len;
+	return 1;
+}
+
+/*
+ * 从内存缓存 r 中读取 len 字节到 buf 中。
+ *
+ * 成功返回 1 ，剩余内容不足 len 字节时返回 0 。
+ */
+static size_t rioBufferRead(rio *r, void *buf, size_t len) {
+	if (sdslen(r->io.buffer.ptr) - r->io.buffer.pos < len)
+		return 0; /* not enough buffer to return len bytes. */
+	memcpy(buf, r->io.buffer.ptr + r->io.buffer.pos, len);
+	r->io.buffer.pos += len;
+	return 1;
+}
+
+/*
+ * 返回内存缓存的当前偏移量
+ */
+static off_t rioBufferTell(rio *r) {
+	return r->io.buffer.pos;
+}
+
+/*
+ * 流为内存时所使用的结构
+ */
+static const rio rioBufferIO = {
+	rioBufferRead,
+	rioBufferWrite,
+	rioBufferTell,
+	NULL,           /* update_checksum */
+	0,              /* current checksum */
+	0,              /* bytes read or written */
+	0,              /* read/write chunk size */
+	{ { NULL, 0 } } /* union for io-specific vars */
+};
+
+/*
+ * 初始化内存流
+ */
+void rioInitWithBuffer(rio *r, sds s) {
+	*r = rioBufferIO;
+	r->io.buffer.ptr = s;
+	r->io.buffer.pos = 0;
+}
+
 /*
  * 从文件 r 中读取 len 字节到 buf 中。
  *
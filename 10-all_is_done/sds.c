@@ -5,9 +5,48 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <limits.h>
 #include "sds.h"
 #include "zmalloc.h"
 
+/*
+ * 返回 type 类型的头部的字节数
+ */
+int sdsHdrSize(char type) {
+	switch (type & SDS_TYPE_MASK) {
+	case SDS_TYPE_5:
+		return sizeof(struct sdshdr5);
+	case SDS_TYPE_8:
+		return sizeof(struct sdshdr8);
+	case SDS_TYPE_16:
+		return sizeof(struct sdshdr16);
+	case SDS_TYPE_32:
+		return sizeof(struct sdshdr32);
+	case SDS_TYPE_64:
+		return sizeof(struct sdshdr64);
+	}
+	return 0;
+}
+
+/*
+ * 返回能记录长度 string_size 的最小的头部类型
+ */
+static char sdsReqType(size_t string_size) {
+	if (string_size < 1 << 5)
+		return SDS_TYPE_5;
+	if (string_size < 1 << 8)
+		return SDS_TYPE_8;
+	if (string_size < 1 << 16)
+		return SDS_TYPE_16;
+#if (LONG_MAX == LLONG_MAX)
+	if (string_size < 1ll << 32)
+		return SDS_TYPE_32;
+	return SDS_TYPE_64;
+#else
+	return SDS_TYPE_32;
+#endif
+}
+
 /*
  * 根据给定的初始化字符串 init 和字符串长度 initlen
  * 创建一个新的 sds
@@ -25,35 +64,48 @@
  */
 sds sdsnewlen(const void *init, size_t initlen) {
 
-	struct sdshdr *sh;
+	void *sh;
+	sds s;
+	char type = sdsReqType(initlen);
+	int hdrlen;
+	unsigned char *fp;
+
+	// 空字符串通常是为了在后面追加内容而创建的,
+	// sdshdr5 不能记录空余空间, 所以改用 sdshdr8
+	if (type == SDS_TYPE_5 && initlen == 0) type = SDS_TYPE_8;
+	hdrlen = sdsHdrSize(type);
 
 	// 根据是否有初始化内容，选择适当的内存分配方式
 	// T = O(N)
 	if (init) {
 		// zmalloc 不初始化所分配的内存
-		sh = zmalloc(sizeof(struct sdshdr) + initlen + 1);
+		sh = zmalloc(hdrlen + initlen + 1);
 	}
 	else {
 		// zcalloc 将分配的内存全部初始化为 0
-		sh = zcalloc(sizeof(struct sdshdr) + initlen + 1);
+		sh = zcalloc(hdrlen + initlen + 1);
 	}
 
 	// 内存分配失败，返回
 	if (sh == NULL) return NULL;
 
-	// 设置初始化长度
-	sh->len = initlen;
-	// 新 sds 不预留任何空间
-	sh->free = 0;
-	// 如果有指定初始化内容，将它们复制到 sdshdr 的 buf 中
+	s = (char*)sh + hdrlen;
+	fp = ((unsigned char*)s) - 1;
+
+	// 设置类型和初始化长度, 新 sds 不预留任何空间
+	*fp = type;
+	sdssetlen(s, initlen);
+	sdssetalloc(s, initlen);
+
+	// 如果有指定初始化内容，将它们复制到 buf 中
 	// T = O(N)
 	if (initlen && init)
-		memcpy(sh->buf, init, initlen);
+		memcpy(s, init, initlen);
 	// 以 \0 结尾
-	sh->buf[initlen] = '\0';
+	s[initlen] = '\0';
 
 	// 返回 buf 部分，而不是整个 sdshdr
-	return (char*)sh->buf;
+	return s;
 }
 
 /*
@@ -111,7 +163,7 @@ sds sdsdup(const sds s) {
  */
 void sdsfree(sds s) {
 	if (s == NULL) return;
-	zfree(s - sizeof(struct sdshdr));
+	zfree((char*)s - sdsHdrSize(s[-1]));
 }
 
 
@@ -125,15 +177,11 @@ void sdsfree(sds s) {
  */
 void sdsclear(sds s) {
 
-	// 取出 sdshdr
-	struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-
-	// 重新计算属性
-	sh->free += sh->len;
-	sh->len = 0;
+	// 长度清零, 空间全部变成空余空间
+	sdssetlen(s, 0);
 
 	// 将结束符放到最前面（相当于惰性地删除 buf 中的内容）
-	sh->buf[0] = '\0';
+	s[0] = '\0';
 }
 
 
@@ -151,19 +199,21 @@ void sdsclear(sds s) {
  */
 sds sdsMakeRoomFor(sds s, size_t addlen) {
 
-	struct sdshdr *sh, *newsh;
+	void *sh, *newsh;
 
 	// 获取 s 目前的空余空间长度
-	size_t free = sdsavail(s);
+	size_t avail = sdsavail(s);
 
 	size_t len, newlen;
+	char type, oldtype = s[-1] & SDS_TYPE_MASK;
+	int hdrlen;
 
 	// s 目前的空余空间已经足够，无须再进行扩展，直接返回
-	if (free >= addlen) return s;
+	if (avail >= addlen) return s;
 
 	// 获取 s 目前已占用空间的长度
 	len = sdslen(s);
-	sh = (void*)(s - (sizeof(struct sdshdr)));
+	sh = (char*)s - sdsHdrSize(oldtype);
 
 	// s 最少需要的长度
 	newlen = (len + addlen);
@@ -176,23 +226,45 @@ sds sdsMakeRoomFor(sds s, size_t addlen) {
 	else
 		// 否则，分配长度为目前长度加上 SDS_MAX_PREALLOC
 		newlen += SDS_MAX_PREALLOC;
-	// T = O(N)
-	newsh = zrealloc(sh, sizeof(struct sdshdr) + newlen + 1);
 
-	// 内存不足，分配失败，返回
-	if (newsh == NULL) return NULL;
+	// 新的容量可能需要更宽的头部,
+	// 要追加内容的 sds 不使用记录不了空余空间的 sdshdr5
+	type = sdsReqType(newlen);
+	if (type == SDS_TYPE_5) type = SDS_TYPE_8;
+	hdrlen = sdsHdrSize(type);
+
+	if (oldtype == type) {
+		// T = O(N)
+		newsh = zrealloc(sh, hdrlen + newlen + 1);
+
+		// 内存不足，分配失败，返回
+		if (newsh == NULL) return NULL;
+		s = (char*)newsh + hdrlen;
+	}
+	else {
+		// 头部的大小变了, 字符串要整体后移, 不能直接 realloc
+		newsh = zmalloc(hdrlen + newlen + 1);
+		if (newsh == NULL) return NULL;
+		memcpy((char*)newsh + hdrlen, s, len + 1);
+		zfree(sh);
+		s = (char*)newsh + hdrlen;
+		s[-1] = type;
+		sdssetlen(s, len);
+	}
 
-	// 更新 sds 的空余长度
-	newsh->free = newlen - len;
+	// 更新 sds 的容量
+	sdssetalloc(s, newlen);
 
 	// 返回 sds
-	return newsh->buf;
+	return s;
 }
 
 /*
  * 回收 sds 中的空闲空间，
  * 回收不会对 sds 中保存的字符串内容做任何修改。
  *
+ * 如果去掉空余空间之后可以换用更窄的头部, 那么同时缩小头部.
+ *
  * 返回值
  *  sds ：内存调整后的 sds
  *
@@ -200,18 +272,38 @@ sds sdsMakeRoomFor(sds s, size_t addlen) {
  *  T = O(N)
  */
 sds sdsRemoveFreeSpace(sds s) {
-	struct sdshdr *sh;
+	void *sh, *newsh;
+	char type, oldtype = s[-1] & SDS_TYPE_MASK;
+	int hdrlen, oldhdrlen = sdsHdrSize(oldtype);
+	size_t len = sdslen(s);
+
+	sh = (char*)s - oldhdrlen;
 
-	sh = (void*)(s - (sizeof(struct sdshdr)));
+	type = sdsReqType(len);
+	hdrlen = sdsHdrSize(type);
 
-	// 进行内存重分配，让 buf 的长度仅仅足够保存字符串内容
+	// 类型不变, 或者字符串足够长以至于头部省下的几个字节不值得搬动时,
+	// 直接进行内存重分配，让 buf 的长度仅仅足够保存字符串内容
 	// T = O(N)
-	sh = zrealloc(sh, sizeof(struct sdshdr) + sh->len + 1);
+	if (oldtype == type || type > SDS_TYPE_8) {
+		newsh = zrealloc(sh, oldhdrlen + len + 1);
+		if (newsh == NULL) return NULL;
+		s = (char*)newsh + oldhdrlen;
+	}
+	else {
+		newsh = zmalloc(hdrlen + len + 1);
+		if (newsh == NULL) return NULL;
+		memcpy((char*)newsh + hdrlen, s, len + 1);
+		zfree(sh);
+		s = (char*)newsh + hdrlen;
+		s[-1] = type;
+		sdssetlen(s, len);
+	}
 
 	// 空余空间为 0
-	sh->free = 0;
+	sdssetalloc(s, len);
 
-	return sh->buf;
+	return s;
 }
 
 /*
@@ -221,9 +313,14 @@ sds sdsRemoveFreeSpace(sds s) {
  *  T = O(1)
  */
 size_t sdsAllocSize(sds s) {
-	struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
+	return sdsHdrSize(s[-1]) + sdsalloc(s) + 1;
+}
 
-	return sizeof(*sh) + sh->len + sh->free + 1;
+/*
+ * 返回 sds 所在内存块的起始地址, 也就是头部的地址
+ */
+void *sdsAllocPtr(const sds s) {
+	return (void*)(s - sdsHdrSize(s[-1]));
 }
 
 /*
@@ -253,22 +350,18 @@ size_t sdsAllocSize(sds s) {
  * 复杂度
  *  T = O(1)
  */
-void sdsIncrLen(sds s, int incr) {
-	struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
+void sdsIncrLen(sds s, ssize_t incr) {
+	size_t len = sdslen(s);
 
-	// 确保 sds 空间足够
-	assert(sh->free >= incr);
+	// 确保 sds 空间足够, 或者截断的长度不超过字符串的长度
+	assert(incr >= 0 ? sdsavail(s) >= (size_t)incr : len >= (size_t)(-incr));
 
 	// 更新属性
-	sh->len += incr;
-	sh->free -= incr;
-
-	// 这个 assert 其实可以忽略
-	// 因为前一个 assert 已经确保 sh->free - incr >= 0 了
-	assert(sh->free >= 0);
+	len += incr;
+	sdssetlen(s, len);
 
 	// 放置新的结尾符号
-	s[sh->len] = '\0';
+	s[len] = '\0';
 }
 
 /*
@@ -281,8 +374,7 @@ void sdsIncrLen(sds s, int incr) {
  *  T = O(N)
  */
 sds sdsgrowzero(sds s, size_t len) {
-	struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-	size_t totlen, curlen = sh->len;
+	size_t curlen = sdslen(s);
 
 	// 如果 len 比字符串的现有长度小，
 	// 那么直接返回，不做动作
@@ -296,13 +388,10 @@ sds sdsgrowzero(sds s, size_t len) {
 
 	// 将新分配的空间用 0 填充，防止出现垃圾内容
 	// T = O(N)
-	sh = (void*)(s - (sizeof(struct sdshdr)));
 	memset(s + curlen, 0, (len - curlen + 1)); // also set trailing \0 byte
 
 	// 更新属性
-	totlen = sh->len + sh->free;
-	sh->len = len;
-	sh->free = totlen - sh->len;
+	sdssetlen(s, len);
 
 	// 返回新的 sds
 	return s;
@@ -319,8 +408,6 @@ sds sdsgrowzero(sds s, size_t len) {
  */
 sds sdscatlen(sds s, const void *t, size_t len) {
 
-	struct sdshdr *sh;
-
 	// 原有字符串长度
 	size_t curlen = sdslen(s);
 
@@ -333,12 +420,10 @@ sds sdscatlen(sds s, const void *t, size_t len) {
 
 	// 复制 t 中的内容到字符串后部
 	// T = O(N)
-	sh = (void*)(s - (sizeof(struct sdshdr)));
 	memcpy(s + curlen, t, len);
 
 	// 更新属性
-	sh->len = curlen + len;
-	sh->free = sh->free - len;
+	sdssetlen(s, curlen + len);
 
 	// 添加新结尾符号
 	s[curlen + len] = '\0';
@@ -389,18 +474,11 @@ sds sdscatsds(sds s, const sds t) {
 
 sds sdscpylen(sds s, const char *t, size_t len) {
 
-	struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-
-	// sds 现有 buf 的长度
-	size_t totlen = sh->free + sh->len;
-
 	// 如果 s 的 buf 长度不满足 len ，那么扩展它
-	if (totlen < len) {
+	if (sdsalloc(s) < len) {
 		// T = O(N)
-		s = sdsMakeRoomFor(s, len - sh->len);
+		s = sdsMakeRoomFor(s, len - sdslen(s));
 		if (s == NULL) return NULL;
-		sh = (void*)(s - (sizeof(struct sdshdr)));
-		totlen = sh->free + sh->len;
 	}
 
 	// 复制内容
@@ -411,8 +489,7 @@ sds sdscpylen(sds s, const char *t, size_t len) {
 	s[len] = '\0';
 
 	// 更新属性
-	sh->len = len;
-	sh->free = totlen - len;
+	sdssetlen(s, len);
 
 	// 返回新的 sds
 	return s;
@@ -608,7 +685,6 @@ sds sdscatprintf(sds s, const char *fmt, ...) {
 * %% - Verbatim "%" character.
 */
 sds sdscatfmt(sds s, char const *fmt, ...) {
-	struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
 	size_t initlen = sdslen(s);
 	const char *f = fmt;
 	int i;
@@ -624,9 +700,8 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
 		unsigned long long unum;
 
 		/* Make sure there is always space for at least 1 char. */
-		if (sh->free == 0) {
+		if (sdsavail(s) == 0) {
 			s = sdsMakeRoomFor(s, 1);
-			sh = (void*)(s - (sizeof(struct sdshdr)));
 		}
 
 		switch (*f) {
@@ -638,13 +713,11 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
 			case 'S':
 				str = va_arg(ap, char*);
 				l = (next == 's') ? strlen(str) : sdslen(str);
-				if (sh->free < l) {
+				if (sdsavail(s) < l) {
 					s = sdsMakeRoomFor(s, l);
-					sh = (void*)(s - (sizeof(struct sdshdr)));
 				}
 				memcpy(s + i, str, l);
-				sh->len += l;
-				sh->free -= l;
+				sdssetlen(s, sdslen(s) + l);
 				i += l;
 				break;
 			case 'i':
@@ -656,13 +729,11 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
 				{
 					char buf[SDS_LLSTR_SIZE];
 					l = sdsll2str(buf, num);
-					if (sh->free < l) {
+					if (sdsavail(s) < l) {
 						s = sdsMakeRoomFor(s, l);
-						sh = (void*)(s - (sizeof(struct sdshdr)));
 					}
 					memcpy(s + i, buf, l);
-					sh->len += l;
-					sh->free -= l;
+					sdssetlen(s, sdslen(s) + l);
 					i += l;
 				}
 				break;
@@ -675,27 +746,23 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
 				{
 					char buf[SDS_LLSTR_SIZE];
 					l = sdsull2str(buf, unum);
-					if (sh->free < l) {
+					if (sdsavail(s) < l) {
 						s = sdsMakeRoomFor(s, l);
-						sh = (void*)(s - (sizeof(struct sdshdr)));
 					}
 					memcpy(s + i, buf, l);
-					sh->len += l;
-					sh->free -= l;
+					sdssetlen(s, sdslen(s) + l);
 					i += l;
 				}
 				break;
 			default: /* Handle %% and generally %<unknown>. */
 				s[i++] = next;
-				sh->len += 1;
-				sh->free -= 1;
+				sdssetlen(s, sdslen(s) + 1);
 				break;
 			}
 			break;
 		default:
 			s[i++] = *f;
-			sh->len += 1;
-			sh->free -= 1;
+			sdssetlen(s, sdslen(s) + 1);
 			break;
 		}
 		f++;
@@ -730,7 +797,6 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
 * Output will be just "Hello World".
 */
 sds sdstrim(sds s, const char *cset) {
-	struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
 	char *start, *end, *sp, *ep;
 	size_t len;
 
@@ -747,14 +813,13 @@ sds sdstrim(sds s, const char *cset) {
 
 	// 如果有需要，前移字符串内容
 	// T = O(N)
-	if (sh->buf != sp) memmove(sh->buf, sp, len);
+	if (s != sp) memmove(s, sp, len);
 
 	// 添加终结符
-	sh->buf[len] = '\0';
+	s[len] = '\0';
 
 	// 更新属性
-	sh->free = sh->free + (sh->len - len);
-	sh->len = len;
+	sdssetlen(s, len);
 
 	// 返回修剪后的 sds
 	return s;
@@ -786,8 +851,7 @@ sds sdstrim(sds s, const char *cset) {
 * s = sdsnew("Hello World");
 * sdsrange(s,1,-1); => "ello World"
 */
-void sdsrange(sds s, int start, int end) {
-	struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
+void sdsrange(sds s, ssize_t start, ssize_t end) {
 	size_t newlen, len = sdslen(s);
 
 	if (len == 0) return;
@@ -801,10 +865,10 @@ void sdsrange(sds s, int start, int end) {
 	}
 	newlen = (start > end) ? 0 : (end - start) + 1;
 	if (newlen != 0) {
-		if (start >= (signed)len) {
+		if (start >= (ssize_t)len) {
 			newlen = 0;
 		}
-		else if (end >= (signed)len) {
+		else if (end >= (ssize_t)len) {
 			end = len - 1;
 			newlen = (start > end) ? 0 : (end - start) + 1;
 		}
@@ -815,14 +879,13 @@ void sdsrange(sds s, int start, int end) {
 
 	// 如果有需要，对字符串进行移动
 	// T = O(N)
-	if (start && newlen) memmove(sh->buf, sh->buf + start, newlen);
+	if (start && newlen) memmove(s, s + start, newlen);
 
 	// 添加终结符
-	sh->buf[newlen] = 0;
+	s[newlen] = 0;
 
 	// 更新属性
-	sh->free = sh->free + (sh->len - newlen);
-	sh->len = newlen;
+	sdssetlen(s, newlen);
 }
 
 /*
@@ -6,34 +6,105 @@
 
 #include <sys/types.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include "zmalloc.h"
 
 /* 类型别名，用于指向 sdshdr 的 buf 属性 */
 typedef char *sds;
 
+/*
+ * sds 的头部按照字符串的长度选用不同宽度的结构,
+ * 短字符串的头部只有 1 到 3 个字节.
+ *
+ * buf 前面的一个字节总是 flags, 它的低 3 位记录头部的类型,
+ * 所以从 sds 指针往前读一个字节就能找到整个头部.
+ */
+
+//
+// sdshdr5 长度小于 32 的字符串, 长度保存在 flags 的高 5 位, 没有空余空间
+//
+struct __attribute__((__packed__)) sdshdr5 {
+
+	// 低 3 位是类型, 高 5 位是长度
+	unsigned char flags;
+
+	// 数据空间
+	char buf[];
+};
+
 //
-// sdshdr 保存字符串对象的结构
+// sdshdr8 / 16 / 32 / 64 分别用 1 / 2 / 4 / 8 字节记录长度和容量
 //
-struct sdshdr {
+struct __attribute__((__packed__)) sdshdr8 {
 
 	// buf 中已占用空间的长度
-	int len;
+	uint8_t len;
 
-	// buf 中剩余可用空间的长度
-	int free;
+	// buf 的容量, 不包括头部和结尾的 \0
+	uint8_t alloc;
+
+	// 低 3 位是类型, 高 5 位不使用
+	unsigned char flags;
 
 	// 数据空间
 	char buf[];
 };
 
+struct __attribute__((__packed__)) sdshdr16 {
+	uint16_t len;
+	uint16_t alloc;
+	unsigned char flags;
+	char buf[];
+};
+
+struct __attribute__((__packed__)) sdshdr32 {
+	uint32_t len;
+	uint32_t alloc;
+	unsigned char flags;
+	char buf[];
+};
+
+struct __attribute__((__packed__)) sdshdr64 {
+	uint64_t len;
+	uint64_t alloc;
+	unsigned char flags;
+	char buf[];
+};
+
+/* 头部的类型 */
+#define SDS_TYPE_5  0
+#define SDS_TYPE_8  1
+#define SDS_TYPE_16 2
+#define SDS_TYPE_32 3
+#define SDS_TYPE_64 4
+#define SDS_TYPE_MASK 7
+#define SDS_TYPE_BITS 3
+
+/* 取出 sds 的头部 */
+#define SDS_HDR_VAR(T,s) struct sdshdr##T *sh = (void*)((s) - (sizeof(struct sdshdr##T)));
+#define SDS_HDR(T,s) ((struct sdshdr##T *)((s) - (sizeof(struct sdshdr##T))))
+#define SDS_TYPE_5_LEN(f) ((f) >> SDS_TYPE_BITS)
+
 /*
  * 返回 sds 实际保存的字符串的长度
  *
  * T = O(1)
  */
 static inline size_t sdslen(const sds s) {
-	struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-	return sh->len;
+	unsigned char flags = s[-1];
+	switch (flags & SDS_TYPE_MASK) {
+	case SDS_TYPE_5:
+		return SDS_TYPE_5_LEN(flags);
+	case SDS_TYPE_8:
+		return SDS_HDR(8, s)->len;
+	case SDS_TYPE_16:
+		return SDS_HDR(16, s)->len;
+	case SDS_TYPE_32:
+		return SDS_HDR(32, s)->len;
+	case SDS_TYPE_64:
+		return SDS_HDR(64, s)->len;
+	}
+	return 0;
 }
 
 /*
@@ -42,18 +113,105 @@ static inline size_t sdslen(const sds s) {
  * T = O(1)
  */
 static inline size_t sdsavail(const sds s) {
-	struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-	return sh->free;
+	unsigned char flags = s[-1];
+	switch (flags & SDS_TYPE_MASK) {
+	case SDS_TYPE_5:
+		return 0;
+	case SDS_TYPE_8: {
+		SDS_HDR_VAR(8, s);
+		return sh->alloc - sh->len;
+	}
+	case SDS_TYPE_16: {
+		SDS_HDR_VAR(16, s);
+		return sh->alloc - sh->len;
+	}
+	case SDS_TYPE_32: {
+		SDS_HDR_VAR(32, s);
+		return sh->alloc - sh->len;
+	}
+	case SDS_TYPE_64: {
+		SDS_HDR_VAR(64, s);
+		return sh->alloc - sh->len;
+	}
+	}
+	return 0;
+}
+
+/*
+ * 设置 sds 的长度, 调用者要保证容量足够
+ */
+static inline void sdssetlen(sds s, size_t newlen) {
+	unsigned char flags = s[-1];
+	switch (flags & SDS_TYPE_MASK) {
+	case SDS_TYPE_5: {
+		unsigned char *fp = ((unsigned char*)s) - 1;
+		*fp = SDS_TYPE_5 | (newlen << SDS_TYPE_BITS);
+		break;
+	}
+	case SDS_TYPE_8:
+		SDS_HDR(8, s)->len = newlen;
+		break;
+	case SDS_TYPE_16:
+		SDS_HDR(16, s)->len = newlen;
+		break;
+	case SDS_TYPE_32:
+		SDS_HDR(32, s)->len = newlen;
+		break;
+	case SDS_TYPE_64:
+		SDS_HDR(64, s)->len = newlen;
+		break;
+	}
+}
+
+/*
+ * 返回 buf 的容量 (sdsavail() + sdslen())
+ */
+static inline size_t sdsalloc(const sds s) {
+	unsigned char flags = s[-1];
+	switch (flags & SDS_TYPE_MASK) {
+	case SDS_TYPE_5:
+		return SDS_TYPE_5_LEN(flags);
+	case SDS_TYPE_8:
+		return SDS_HDR(8, s)->alloc;
+	case SDS_TYPE_16:
+		return SDS_HDR(16, s)->alloc;
+	case SDS_TYPE_32:
+		return SDS_HDR(32, s)->alloc;
+	case SDS_TYPE_64:
+		return SDS_HDR(64, s)->alloc;
+	}
+	return 0;
+}
+
+/*
+ * 设置 buf 的容量, sdshdr5 没有容量字段, 什么也不做
+ */
+static inline void sdssetalloc(sds s, size_t newlen) {
+	unsigned char flags = s[-1];
+	switch (flags & SDS_TYPE_MASK) {
+	case SDS_TYPE_5:
+		break;
+	case SDS_TYPE_8:
+		SDS_HDR(8, s)->alloc = newlen;
+		break;
+	case SDS_TYPE_16:
+		SDS_HDR(16, s)->alloc = newlen;
+		break;
+	case SDS_TYPE_32:
+		SDS_HDR(32, s)->alloc = newlen;
+		break;
+	case SDS_TYPE_64:
+		SDS_HDR(64, s)->alloc = newlen;
+		break;
+	}
 }
 
 /* api */
 sds sdsnewlen(const void *init, size_t initlen);
 sds sdsnew(const char *init);
 sds sdsempty(void);
-size_t sdslen(const sds s);
 sds sdsdup(const sds s);
 void sdsfree(sds s);
-size_t sdsavail(const sds s);
 sds sdsgrowzero(sds s, size_t len);
 sds sdscatlen(sds s, const void *t, size_t len);
 sds sdscat(sds s, const char *t);
@@ -69,7 +227,7 @@ __attribute__((format(printf, 2, 3)));
 
 sds sdscatfmt(sds s, char const *fmt, ...);
 sds sdstrim(sds s, const char *cset);
-void sdsrange(sds s, int start, int end);
+void sdsrange(sds s, ssize_t start, ssize_t end);
 void sdsclear(sds s);
 int sdscmp(const sds s1, const sds s2);
 sds *sdssplitlen(const char *s, int len, const char *sep, int seplen, int *count);
@@ -84,8 +242,10 @@ sds sdsjoin(char **argv, int argc, char *sep);
 
 /* Low level functions exposed to the user API */
 sds sdsMakeRoomFor(sds s, size_t addlen);
-void sdsIncrLen(sds s, int incr);
+void sdsIncrLen(sds s, ssize_t incr);
 sds sdsRemoveFreeSpace(sds s);
 size_t sdsAllocSize(sds s);
+void *sdsAllocPtr(const sds s);
+int sdsHdrSize(char type);
 
 #endif
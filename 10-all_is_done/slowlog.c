@@ -0,0 +1,176 @@
+/*
+ * 慢查询日志: 执行时间超过 server.slowlog_log_slower_than 微秒的命令
+ * 会被记录到一个长度固定为 server.slowlog_max_len 的环形缓冲区中,
+ * 日志满了之后新的日志会覆盖最旧的日志.
+ *
+ * 多 reactor 模式下每个 reactor 有自己的缓冲区, 日志的 id 在所有 reactor 间唯一,
+ * SLOWLOG 命令在其他 reactor 停下来之后把它们合并起来.
+ */
+#include "redis.h"
+#include "slowlog.h"
+#include "networking.h"
+#include "util.h"
+#include "object.h"
+
+extern struct sharedObjectsStruct shared;
+
+/*
+ * 初始化当前 reactor 的慢查询日志
+ */
+void slowlogInit(void) {
+	server.slowlog = NULL;
+	if (server.slowlog_max_len > 0)
+		server.slowlog = zcalloc(sizeof(slowlogEntry) * server.slowlog_max_len);
+	server.slowlog_len = 0;
+	server.slowlog_head = 0;
+}
+
+/*
+ * 把 o 复制到 s 中, 超过 SLOWLOG_ENTRY_MAX_STRING 的部分会被截掉,
+ * s 原来的空间足够时不会重新分配内存.
+ */
+static sds slowlogCopyArg(sds s, robj *o) {
+	char buf[64];
+	size_t len;
+	char *p;
+
+	if (s == NULL) s = sdsMakeRoomFor(sdsempty(), SLOWLOG_ENTRY_MAX_STRING + sizeof(buf));
+	if (sdsEncodedObject(o)) {
+		p = o->ptr;
+		len = sdslen(o->ptr);
+	}
+	else {
+		len = ll2string(buf, sizeof(buf), (long)o->ptr);
+		p = buf;
+	}
+
+	if (len <= SLOWLOG_ENTRY_MAX_STRING) return sdscpylen(s, p, len);
+
+	s = sdscpylen(s, p, SLOWLOG_ENTRY_MAX_STRING);
+	len = snprintf(buf, sizeof(buf), "... (%lu more bytes)",
+		(unsigned long)(len - SLOWLOG_ENTRY_MAX_STRING));
+	return sdscatlen(s, buf, len);
+}
+
+/*
+ * 如果命令的执行时间达到了 server.slowlog_log_slower_than, 就把它记到慢查询日志中.
+ * 由 call() 在命令执行之后调用.
+ */
+void slowlogPushEntryIfNeeded(redisClient *c, long long duration) {
+	slowlogEntry *se;
+	int j, argc;
+
+	if (server.slowlog_log_slower_than < 0 || server.slowlog == NULL) return;
+	if (duration < server.slowlog_log_slower_than) return;
+
+	// 取出最旧的条目来用
+	se = server.slowlog + server.slowlog_head;
+	server.slowlog_head = (server.slowlog_head + 1) % server.slowlog_max_len;
+	if (server.slowlog_len < server.slowlog_max_len) server.slowlog_len++;
+
+	if (se->argv == NULL) se->argv = zcalloc(sizeof(sds) * SLOWLOG_ENTRY_MAX_ARGC);
+
+	// 参数太多时, 最后一个位置用来记录省略了多少个参数
+	argc = c->argc > SLOWLOG_ENTRY_MAX_ARGC ? SLOWLOG_ENTRY_MAX_ARGC - 1 : c->argc;
+	for (j = 0; j < argc; j++)
+		se->argv[j] = slowlogCopyArg(se->argv[j], c->argv[j]);
+	if (argc < c->argc) {
+		char buf[64];
+		size_t len = snprintf(buf, sizeof(buf), "... (%d more arguments)", c->argc - argc);
+
+		if (se->argv[argc] == NULL) se->argv[argc] = sdsempty();
+		se->argv[argc] = sdscpylen(se->argv[argc], buf, len);
+		argc++;
+	}
+	se->argc = argc;
+
+	se->id = __atomic_fetch_add(&servers[0].slowlog_entry_id, 1, __ATOMIC_RELAXED);
+	se->duration = duration;
+	se->time = server.unixtime;
+	se->client_id = c->id;
+}
+
+/*
+ * 按 id 从新到旧排序
+ */
+static int slowlogCompareEntries(const void *a, const void *b) {
+	const slowlogEntry *ea = *(const slowlogEntry **)a;
+	const slowlogEntry *eb = *(const slowlogEntry **)b;
+
+	if (ea->id == eb->id) return 0;
+	return ea->id > eb->id ? -1 : 1;
+}
+
+/*
+ * SLOWLOG GET [count]
+ */
+static void slowlogGetCommand(redisClient *c) {
+	slowlogEntry **entries;
+	long long count = 10;
+	long total = 0, i;
+	int r, j;
+
+	if (c->argc == 3 &&
+		getLongFromObjectOrReply(c, c->argv[2], &count, NULL) != REDIS_OK)
+		return;
+	if (count < 0) count = 0;
+
+	for (r = 0; r < server.reactors_num; r++)
+		total += servers[r].slowlog_len;
+
+	// 收集所有 reactor 的日志, 然后从新到旧输出
+	entries = zmalloc(sizeof(slowlogEntry *) * (total ? total : 1));
+	total = 0;
+	for (r = 0; r < server.reactors_num; r++) {
+		for (i = 0; i < (long)servers[r].slowlog_len; i++)
+			entries[total++] = servers[r].slowlog + i;
+	}
+	qsort(entries, total, sizeof(slowlogEntry *), slowlogCompareEntries);
+	if (count > total) count = total;
+
+	addReplyMultiBulkLen(c, count);
+	for (i = 0; i < count; i++) {
+		slowlogEntry *se = entries[i];
+
+		addReplyMultiBulkLen(c, 5);
+		addReplyLongLong(c, se->id);
+		addReplyLongLong(c, se->time);
+		addReplyLongLong(c, se->duration);
+		addReplyMultiBulkLen(c, se->argc);
+		for (j = 0; j < se->argc; j++)
+			addReplyBulkCBuffer(c, se->argv[j], sdslen(se->argv[j]));
+		addReplyLongLong(c, se->client_id);
+	}
+	zfree(entries);
+}
+
+/*
+ * SLOWLOG GET [count] | LEN | RESET
+ */
+void slowlogCommand(redisClient *c) {
+	int r;
+
+	if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr, "reset")) {
+		// 只是把日志标记为空, 条目留给之后的日志使用
+		for (r = 0; r < server.reactors_num; r++) {
+			servers[r].slowlog_len = 0;
+			servers[r].slowlog_head = 0;
+		}
+		addReply(c, shared.ok);
+	}
+	else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr, "len")) {
+		long long len = 0;
+
+		for (r = 0; r < server.reactors_num; r++)
+			len += servers[r].slowlog_len;
+		addReplyLongLong(c, len);
+	}
+	else if ((c->argc == 2 || c->argc == 3) &&
+		!strcasecmp(c->argv[1]->ptr, "get")) {
+		slowlogGetCommand(c);
+	}
+	else {
+		addReplyError(c,
+			"Unknown SLOWLOG subcommand or wrong # of args. Try GET, RESET, LEN.");
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef __SLOWLOG_H
+#define __SLOWLOG_H
+
+#include "redis.h"
+
+#define SLOWLOG_ENTRY_MAX_ARGC 32   /* 每条日志最多记录的参数个数 */
+#define SLOWLOG_ENTRY_MAX_STRING 128 /* 每个参数最多记录的字节数 */
+
+/*
+ * 慢查询日志的一个条目.
+ *
+ * 条目保存在 server.slowlog 这个环形缓冲区中, 被覆盖时不会释放,
+ * argv 数组和其中的 sds 都会被下一条日志重复使用.
+ */
+typedef struct slowlogEntry {
+
+	sds *argv; // 命令参数, 长度为 SLOWLOG_ENTRY_MAX_ARGC, 第一次使用时才分配
+
+	int argc; // 记录下来的参数个数
+
+	long long id; // 日志的唯一 id
+
+	long long duration; // 命令的执行时间,单位为微秒
+
+	time_t time; // 命令执行完的时间
+
+	uint64_t client_id; // 执行命令的客户端的 id
+
+} slowlogEntry;
+
+void slowlogInit(void);
+void slowlogPushEntryIfNeeded(redisClient *c, long long duration);
+void slowlogCommand(redisClient *c);
+
+#endif /* __SLOWLOG_H */
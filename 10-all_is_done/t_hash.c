@@ -1,7 +1,7 @@
 #include "t_hash.h"
 #include "dict.h"
 #include "db.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "t_string.h"
 #include "networking.h"
 #include "object.h"
@@ -10,7 +10,6 @@
 
 /*============================ Variable and Function Declaration ======================== */
 extern struct sharedObjectsStruct shared;
-extern struct redisServer server;
 extern struct dictType hashDictType;
 robj *getDecodedObject(robj *o);
 
@@ -21,12 +20,37 @@ robj *getDecodedObject(robj *o);
  */
 int hashTypeDelete(robj *o, robj *field) {
 	int deleted = 0;
-	// 从ziplist中删除
-	if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+	// 从listpack中删除
+	if (o->encoding == REDIS_ENCODING_LISTPACK) {
 		unsigned char *zl, *fptr;
 		field = getDecodedObject(field);
-		// todo
+
+		zl = o->ptr;
+		fptr = lpFirst(zl);
+		if (fptr != NULL) {
+			// 定位包含域的节点
+			fptr = lpFind(fptr, field->ptr, sdslen(field->ptr), 1);
+			if (fptr != NULL) {
+				zl = lpDelete(zl, &fptr); /* 删除域 */
+				zl = lpDelete(zl, &fptr); /* 删除值 */
+				o->ptr = zl;
+				deleted = 1;
+			}
+		}
+		decrRefCount(field);
 	}
+	// 从字典中删除
+	else if (o->encoding == REDIS_ENCODING_HT) {
+		if (dictDelete((dict*)o->ptr, field) == DICT_OK) {
+			deleted = 1;
+			/* 删除之后检查是否需要缩小字典 */
+			if (dictNeedsResize(o->ptr)) dictResize(o->ptr);
+		}
+	}
+	else {
+		assert(0);
+	}
+	return deleted;
 }
 
 /*
@@ -34,9 +58,9 @@ int hashTypeDelete(robj *o, robj *field) {
  */
 unsigned long hashTypeLength(robj *o) {
 	unsigned long length = ULONG_MAX;
-	if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-		// ziplist中,每个field-value对都需要使用两个节点来保存
-		length = ziplistLen(o->ptr) / 2;
+	if (o->encoding == REDIS_ENCODING_LISTPACK) {
+		// listpack中,每个field-value对都需要使用两个节点来保存
+		length = lpLength(o->ptr) / 2;
 	}
 	else if (o->encoding == REDIS_ENCODING_HT) {
 		length = dictSize((dict *)o->ptr);
@@ -70,11 +94,16 @@ void hdelCommand(redisClient *c) {
 			}
 		}
 	}
+	if (deleted) {
+		if (!keyremoved) dbTrackRehashing(c->db, c->argv[1], o);
+		signalModifiedKey(c->db, c->argv[1]);
+		server.dirty += deleted;
+	}
 	addReplyLongLong(c, deleted);
 }
 
 
-/* 从 ziplist 编码的 hash 中取出和 field 相对应的值。
+/* 从 listpack 编码的 hash 中取出和 field 相对应的值。
  *
  * 参数：
  *  field   域
@@ -85,7 +114,7 @@ void hdelCommand(redisClient *c) {
  * 查找失败时，函数返回 - 1 。
  * 查找成功时，返回 0 。
  */
-int hashTypeGetFromZiplist(robj *o, robj *field,
+int hashTypeGetFromListpack(robj *o, robj *field,
 	unsigned char **vstr,
 	unsigned int *vlen,
 	long long *vll)
@@ -93,24 +122,24 @@ int hashTypeGetFromZiplist(robj *o, robj *field,
 	unsigned char *zl, *fptr = NULL, *vptr = NULL;
 	int ret;
 
-	assert(o->encoding == REDIS_ENCODING_ZIPLIST);
+	assert(o->encoding == REDIS_ENCODING_LISTPACK);
 
 	field = getDecodedObject(field);
-	// 遍历ziplist,查找域的位置
+	// 遍历listpack,查找域的位置
 	zl = o->ptr;
-	fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+	fptr = lpFirst(zl);
 	if (fptr != NULL) {
 		// 定位包含域的节点
-		fptr = ziplistFind(fptr, field->ptr, sdslen(field->ptr), 1);
+		fptr = lpFind(fptr, field->ptr, sdslen(field->ptr), 1);
 		if (fptr != NULL) {
-			vptr = ziplistNext(zl, fptr);
+			vptr = lpNext(zl, fptr);
 			assert(vptr != NULL);
 		}
 	}
 	decrRefCount(field);
-	// 从ziplist节点中取出值
+	// 从listpack节点中取出值
 	if (vptr != NULL) {
-		ret = ziplistGet(vptr, vstr, vlen, vll);
+		ret = lpGet(vptr, vstr, vlen, vll);
 		assert(ret);
 		return 0;
 	}
@@ -137,12 +166,12 @@ int hashTypeGetFromHashTable(robj *o, robj *field, robj **value) {
  * 存在返回1,不存在返回0.
  */
 int hashTypeExists(robj *o, robj *field) {
-	// 检查ziplist
-	if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+	// 检查listpack
+	if (o->encoding == REDIS_ENCODING_LISTPACK) {
 		unsigned char *vstr = NULL;
 		unsigned int vlen = UINT_MAX;
 		long long vll = LLONG_MAX;
-		if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0) return 1;
+		if (hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll) == 0) return 1;
 	}
 	else if (o->encoding == REDIS_ENCODING_HT) {
 		robj *aux;
@@ -197,8 +226,8 @@ hashTypeIterator *hashTypeInitIterator(robj *subject) {
 	hi->subject = subject;
 	// 记录编码
 	hi->encoding = subject->encoding;
-	// 以ziplist的方式初始化迭代器
-	if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+	// 以listpack的方式初始化迭代器
+	if (hi->encoding == REDIS_ENCODING_LISTPACK) {
 		hi->fptr = NULL;
 		hi->vptr = NULL;
 	}
@@ -207,26 +236,27 @@ hashTypeIterator *hashTypeInitIterator(robj *subject) {
 	}
 	else
 		assert(0);
+	return hi;
 }
 
 /*
- * 从 ziplist 编码的哈希中，取出迭代器指针当前指向节点的域或值。
+ * 从 listpack 编码的哈希中，取出迭代器指针当前指向节点的域或值。
  */
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
 	unsigned char **vstr,
 	unsigned int *vlen,
 	long long *vll)
 {
 	int ret;
-	assert(hi->encoding == REDIS_ENCODING_ZIPLIST);
+	assert(hi->encoding == REDIS_ENCODING_LISTPACK);
 	
 	// 取出键
 	if (what & REDIS_HASH_KEY) {
-		ret = ziplistGet(hi->fptr, vstr, vlen, vll);
+		ret = lpGet(hi->fptr, vstr, vlen, vll);
 		assert(ret);
 	}
 	else { // 取出值
-		ret = ziplistGet(hi->vptr, vstr, vlen, vll);
+		ret = lpGet(hi->vptr, vstr, vlen, vll);
 		assert(ret);
 	}
 }
@@ -250,13 +280,13 @@ void hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what, robj **dst) {
  */
 robj *hashTypeCurrentObject(hashTypeIterator *hi, int what) {
 	robj *dst;
-	if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+	if (hi->encoding == REDIS_ENCODING_LISTPACK) {
 		unsigned char *vstr = NULL;
 		unsigned int vlen = UINT_MAX;
 		long long vll = LLONG_MAX;
 
 		// 取出键或值
-		hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+		hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
 		// 创建键或值的对象
 		if (vstr) {
 			dst = createStringObject((char*)vstr, vlen);
@@ -284,7 +314,7 @@ robj *hashTypeCurrentObject(hashTypeIterator *hi, int what) {
  * 如果已经没有元素可获取（为空，或者迭代完毕），那么返回 REDIS_ERR 。
  */
 int hashTypeNext(hashTypeIterator *hi) {
-	if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+	if (hi->encoding == REDIS_ENCODING_LISTPACK) {
 		unsigned char* zl;
 		unsigned char *fptr, *vptr;
 		zl = hi->subject->ptr;
@@ -293,16 +323,16 @@ int hashTypeNext(hashTypeIterator *hi) {
 		// 第一次执行时,初始化指针
 		if (fptr == NULL) {
 			assert(vptr == NULL);
-			fptr = ziplistIndex(zl, 0);
+			fptr = lpFirst(zl);
 		}
 		else { // 获取下一个迭代节点
 			assert(vptr != NULL);
-			fptr = ziplistNext(zl, vptr);
+			fptr = lpNext(zl, vptr);
 		}
-		// 迭代完毕,或者ziplist为空
+		// 迭代完毕,或者listpack为空
 		if (fptr == NULL) return REDIS_ERR;
 		/* 记录值的指针 */
-		vptr = ziplistNext(zl, fptr);
+		vptr = lpNext(zl, fptr);
 		assert(vptr != NULL);
 		hi->fptr = fptr;
 		hi->vptr = vptr;
@@ -324,18 +354,18 @@ void hashTypeReleaseIterator(hashTypeIterator *hi) {
 	if (hi->encoding == REDIS_ENCODING_HT) {
 		dictReleaseIterator(hi->di);
 	}
-	// 释放ziplist迭代器
+	// 释放listpack迭代器
 	zfree(hi);
 }
 
 /*
- * 将一个ziplist编码的哈希对象o转换成其他编码
+ * 将一个listpack编码的哈希对象o转换成其他编码
  */
-void hashTypeConvertZiplist(robj *o, int enc) {
-	assert(o->encoding == REDIS_ENCODING_ZIPLIST);
+void hashTypeConvertListpack(robj *o, int enc) {
+	assert(o->encoding == REDIS_ENCODING_LISTPACK);
 
-	// 如果输入是ZIPLIST,那么不做动作
-	if (enc == REDIS_ENCODING_ZIPLIST) {
+	// 如果输入是LISTPACK,那么不做动作
+	if (enc == REDIS_ENCODING_LISTPACK) {
 
 	}
 	else if (enc == REDIS_ENCODING_HT) {
@@ -347,13 +377,13 @@ void hashTypeConvertZiplist(robj *o, int enc) {
 		hi = hashTypeInitIterator(o);
 		// 创建空白的新字典
 		dict = dictCreate(&hashDictType, NULL);
-		// 遍历整个ziplist
+		// 遍历整个listpack
 		while (hashTypeNext(hi) != REDIS_ERR) {
 			robj *field, *value;
-			// 取出ziplist里的键
+			// 取出listpack里的键
 			field = hashTypeCurrentObject(hi, REDIS_HASH_KEY);
 			field = tryObjectEncoding(field);
-			// 取出ziplist里的值
+			// 取出listpack里的值
 			value = hashTypeCurrentObject(hi, REDIS_HASH_VALUE);
 			value = tryObjectEncoding(value);
 			// 将键值对添加到字典中
@@ -362,9 +392,9 @@ void hashTypeConvertZiplist(robj *o, int enc) {
 				assert(0);
 			}
 		}
-		// 释放ziplist的迭代器
+		// 释放listpack的迭代器
 		hashTypeReleaseIterator(hi);
-		// 释放对象原来的ziplist
+		// 释放对象原来的listpack
 		zfree(o->ptr);
 		// 更新哈希的编码和值对象
 		o->encoding = REDIS_ENCODING_HT;
@@ -376,11 +406,11 @@ void hashTypeConvertZiplist(robj *o, int enc) {
 }
 
 /*
- * 对哈希对象o的编码方式进行转换,目前只支持将ZIPLIST编码转换成HT编码
+ * 对哈希对象o的编码方式进行转换,目前只支持将LISTPACK编码转换成HT编码
  */
 void hashTypeConvert(robj *o, int enc) {
-	if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-		hashTypeConvertZiplist(o, enc);
+	if (o->encoding == REDIS_ENCODING_LISTPACK) {
+		hashTypeConvertListpack(o, enc);
 	}
 	else {
 		assert(0);
@@ -390,18 +420,18 @@ void hashTypeConvert(robj *o, int enc) {
 
 /*
  * 对 argv 数组中的多个对象进行检查，
- * 看是否需要将对象的编码从 REDIS_ENCODING_ZIPLIST 转换成 REDIS_ENCODING_HT
+ * 看是否需要将对象的编码从 REDIS_ENCODING_LISTPACK 转换成 REDIS_ENCODING_HT
  * 注意程序只检查字符串值，因为它们的长度可以在常数时间内取得。
  */
 void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
 	int i;
-	// 如果对象不是ziplist编码,那么直接返回
-	if (o->encoding != REDIS_ENCODING_ZIPLIST) return;
+	// 如果对象不是listpack编码,那么直接返回
+	if (o->encoding != REDIS_ENCODING_LISTPACK) return;
 	// 检查所有输入对象,看它们的字符串值是否超过了指定长度
 	char *str1 = argv[2]->ptr;
 	for (i = start; i <= end; i++) {
 		if (sdsEncodedObject(argv[i]) &&
-			sdslen(argv[i]->ptr) > server.hash_max_ziplist_value) {
+			sdslen(argv[i]->ptr) > server.hash_max_listpack_value) {
 			// 将对象的编码转换为REDIS_ENCODING_HT
 			hashTypeConvert(o, REDIS_ENCODING_HT);
 			break;
@@ -422,41 +452,38 @@ void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
 int hashTypeSet(robj *o, robj *field, robj *value) {
 	int update = 0;
 
-	// 添加到 ziplist
-	if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+	// 添加到 listpack
+	if (o->encoding == REDIS_ENCODING_LISTPACK) {
 		unsigned char *zl, *fptr, *vptr;
 
 		// 解码成字符串或者数字
 		field = getDecodedObject(field);
 		value = getDecodedObject(value);
 
-		// 遍历整个 ziplist, 尝试查找并更新 field （如果它已经存在的话）
+		// 遍历整个 listpack, 尝试查找并更新 field （如果它已经存在的话）
 		zl = o->ptr;
-		fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+		fptr = lpFirst(zl);
 		if (fptr != NULL) {
 			// 定位到域 field
-			fptr = ziplistFind(fptr, field->ptr, sdslen(field->ptr), 1);
+			fptr = lpFind(fptr, field->ptr, sdslen(field->ptr), 1);
 			if (fptr != NULL) {
 				// 定位到域的值
-				vptr = ziplistNext(zl, fptr);
+				vptr = lpNext(zl, fptr);
 				assert(vptr != NULL);
 
 				// 标识这次操作为更新操作
 				update = 1;
 
-				// 删除旧的键值对
-				zl = ziplistDelete(zl, &vptr);
-
-				/* 添加新的键值对 */
-				zl = ziplistInsert(zl, vptr, value->ptr, sdslen(value->ptr));
+				/* 原地替换旧的值 */
+				zl = lpReplace(zl, &vptr, value->ptr, sdslen(value->ptr));
 			}
 		}
 
 		// 如果这不是更新操作，那么这就是一个添加操作
 		if (!update) {
-			// 将新的 field-value 对推入到 ziplist 的末尾
-			zl = ziplistPush(zl, field->ptr, sdslen(field->ptr), ZIPLIST_TAIL);
-			zl = ziplistPush(zl, value->ptr, sdslen(value->ptr), ZIPLIST_TAIL);
+			// 将新的 field-value 对推入到 listpack 的末尾
+			zl = lpPush(zl, field->ptr, sdslen(field->ptr), LP_TAIL);
+			zl = lpPush(zl, value->ptr, sdslen(value->ptr), LP_TAIL);
 		}
 
 		// 更新对象指针
@@ -466,8 +493,8 @@ int hashTypeSet(robj *o, robj *field, robj *value) {
 		decrRefCount(field);
 		decrRefCount(value);
 
-		// 检查在添加操作完成之后，是否需要将 ZIPLIST 编码转换成 HT 编码
-		if (hashTypeLength(o) > server.hash_max_ziplist_entries)
+		// 检查在添加操作完成之后，是否需要将 LISTPACK 编码转换成 HT 编码
+		if (hashTypeLength(o) > server.hash_max_listpack_entries)
 			hashTypeConvert(o, REDIS_ENCODING_HT);
 	}
 	else if (o->encoding == REDIS_ENCODING_HT) {	// 添加到字典
@@ -516,6 +543,7 @@ void hsetCommand(redisClient *c) {
 	update = hashTypeSet(o, c->argv[2], c->argv[3]);
 
 	signalModifiedKey(c->db, c->argv[1]); /* 发送键修改信号 */
+	dbTrackRehashing(c->db, c->argv[1], o);
 
 	server.dirty++; /* 将服务器设为脏 */
 	/* 返回状态,显示field-value对是新添加还是更新 */
@@ -536,13 +564,13 @@ void hsetCommand(redisClient *c) {
 robj *hashTypeGetObject(robj *o, robj *field) {
 	robj *value = NULL;
 
-	// 从 ziplist 中取出值
-	if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+	// 从 listpack 中取出值
+	if (o->encoding == REDIS_ENCODING_LISTPACK) {
 		unsigned char *vstr = NULL;
 		unsigned int vlen = UINT_MAX;
 		long long vll = LLONG_MAX;
 
-		if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0) {
+		if (hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll) == 0) {
 			// 创建值对象
 			if (vstr) {
 				value = createStringObject((char*)vstr, vlen);
@@ -581,13 +609,13 @@ static void addHashFieldToReply(redisClient *c, robj *o, robj *field) {
 		addReply(c, shared.nullbulk);
 		return;
 	}
-	/* ziplist编码 */
-	if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+	/* listpack编码 */
+	if (o->encoding == REDIS_ENCODING_LISTPACK) {
 		unsigned char *vstr = NULL;
 		unsigned int vlen = UINT_MAX;
 		long long vll = LLONG_MAX;
 		/* 取出值 */
-		ret = hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll);
+		ret = hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll);
 		if (ret < 0) {
 			addReply(c, shared.nullbulk);
 		}
@@ -629,12 +657,12 @@ void hgetCommand(redisClient *c) {
  * 从迭代器当前指向的节点取出哈希的field或value
  */
 static void addHashIteratorCursorToReply(redisClient *c, hashTypeIterator *hi, int what) {
-	if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+	if (hi->encoding == REDIS_ENCODING_LISTPACK) {
 		unsigned char *vstr = NULL;
 		unsigned int vlen = UINT_MAX;
 		long long vll = LLONG_MAX;
 
-		hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+		hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
 		if (vstr) {
 			addReplyBulkCBuffer(c, vstr, vlen);
 		}
@@ -737,6 +765,7 @@ void hmsetCommand(redisClient *c) {
 
 	server.dirty++; /* 将服务器设为脏 */ 
 	signalModifiedKey(c->db, c->argv[1]); /* 发送键修改信号 */
+	dbTrackRehashing(c->db, c->argv[1], o);
 }
 
 void hincrbyCommand(redisClient *c) {
@@ -779,6 +808,7 @@ void hincrbyCommand(redisClient *c) {
 	/* 关联键和新的值对象，如果已经有对象存在，那么用新对象替换它 */
 	hashTypeSet(o, c->argv[2], new);
 	decrRefCount(new);
+	dbTrackRehashing(c->db, c->argv[1], o);
 
 	/* 将计算结果用作回复 */
 	addReplyLongLong(c, value);
@@ -16,11 +16,11 @@ void hvalsCommand(redisClient *c);
 void hexistsCommand(redisClient *c);
 
 /* 不向外暴露的函数 */
-int hashTypeGetFromZiplist(robj *o, robj *field, unsigned char **vstr, unsigned int *vlen, long long *vll);
+int hashTypeGetFromListpack(robj *o, robj *field, unsigned char **vstr, unsigned int *vlen, long long *vll);
 robj *hashTypeLookupWriteOrCreate(redisClient *c, robj *key);
 robj *hashTypeCurrentObject(hashTypeIterator *hi, int what);
 robj *hashTypeGetObject(robj *o, robj *field);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what, unsigned char **vstr, unsigned int *vlen, long long *vll);
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what, unsigned char **vstr, unsigned int *vlen, long long *vll);
 void hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what, robj **dst);
 unsigned long hashTypeLength(robj *o);
 hashTypeIterator *hashTypeInitIterator(robj *subject);
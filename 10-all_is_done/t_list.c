@@ -1,9 +1,9 @@
 #include "redis.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "t_list.h"
 #include "dict.h"
 #include "db.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "t_string.h"
 #include "networking.h"
 #include "object.h"
@@ -13,7 +13,6 @@
 
 /*============================ Variable and Function Declaration ======================== */
 extern struct sharedObjectsStruct shared;
-extern struct redisServer server;
 void decrRefCountVoid(void *o);
 robj *getDecodedObject(robj *o);
 
@@ -23,29 +22,16 @@ robj *getDecodedObject(robj *o);
  * 如果entry没有记录任何节点,那么返回NULL
  */
 robj *listTypeGet(listTypeEntry *entry) {
-	listTypeIterator *li = entry->li;
-
 	robj *value = NULL;
-	/* 根据索引,从ZIPLIST中取出节点的值 */
-	if (li->encoding == REDIS_ENCODING_ZIPLIST) {
-		unsigned char *vstr;
-		unsigned int vlen;
-		long long vlong;
-		assert(entry->zi != NULL);
-		if (ziplistGet(entry->zi, &vstr, &vlen, &vlong)) {
-			if (vstr)
-				value = createStringObject((char *)vstr, vlen);
-			else
-				value = createStringObjectFromLongLong(vlong);
-		}
-		else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-			assert(entry->ln != NULL);
-			value = listNodeValue(entry->ln);
-			incrRefCount(value);
-		}
+
+	if (entry->li->encoding == REDIS_ENCODING_QUICKLIST) {
+		if (entry->entry.value)
+			value = createStringObject((char *)entry->entry.value, entry->entry.sz);
 		else
-			assert(0);
+			value = createStringObjectFromLongLong(entry->entry.longval);
 	}
+	else
+		assert(0);
 	return value;
 }
 
@@ -53,10 +39,8 @@ robj *listTypeGet(listTypeEntry *entry) {
  * 返回列表的节点数量
  */
 unsigned long listTypeLength(robj *subject) {
-	if (subject->encoding == REDIS_ENCODING_ZIPLIST)
-		return ziplistLen(subject->ptr);
-	else if (subject->encoding == REDIS_ENCODING_LINKEDLIST)
-		return listLength((list*)subject->ptr);
+	if (subject->encoding == REDIS_ENCODING_QUICKLIST)
+		return quicklistCount(subject->ptr);
 	else
 		assert(0);
 }
@@ -83,11 +67,11 @@ listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char
 	li->encoding = subject->encoding;
 
 	li->direction = direction;
-	if (li->encoding == REDIS_ENCODING_ZIPLIST) { /* ZIPLIST */
-		li->zi = ziplistIndex(subject->ptr, index);
-	}
-	else if (li->encoding == REDIS_ENCODING_LINKEDLIST) { /* 双端链表 */
-		li->ln = listIndex(subject->ptr, index);
+	li->iter = NULL;
+	if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+		/* REDIS_TAIL 表示向表尾迭代, 也就是从表头开始 */
+		int iter_direction = (direction == REDIS_HEAD) ? AL_START_TAIL : AL_START_HEAD;
+		li->iter = quicklistGetIteratorAtIdx(subject->ptr, iter_direction, index);
 	}
 	else
 		assert(0);
@@ -98,6 +82,7 @@ listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char
  * 释放迭代器
  */
 void listTypeReleaseIterator(listTypeIterator *li) {
+	if (li->iter) quicklistReleaseIterator(li->iter);
 	zfree(li);
 }
 
@@ -107,28 +92,10 @@ void listTypeReleaseIterator(listTypeIterator *li) {
 int listTypeNext(listTypeIterator *li, listTypeEntry *entry) {
 	assert(li->subject->encoding == li->encoding);
 	entry->li = li;
-	if (li->encoding == REDIS_ENCODING_ZIPLIST) {
-		/* 记录当前节点到entry */
-		entry->zi = li->zi;
-		if (entry->zi != NULL) {
-			if (li->direction == REDIS_TAIL)
-				li->zi = ziplistNext(li->subject->ptr, li->zi);
-			else
-				li->zi = ziplistPrev(li->subject->ptr, li->zi);
-			return 1;
-		}
-	}
-	else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-		/* 记录当前节点到entry */
-		entry->ln = li->ln;
-		/* 移动迭代器的指针 */
-		if (entry->ln != NULL) {
-			if (li->direction == REDIS_TAIL)
-				li->ln = li->ln->next;
-			else
-				li->ln = li->ln->prev;
-			return 1;
-		}
+	if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+		/* 索引超出范围时没有迭代器 */
+		if (li->iter == NULL) return 0;
+		return quicklistNext(li->iter, &entry->entry);
 	}
 	else
 		assert(0);
@@ -137,48 +104,21 @@ int listTypeNext(listTypeIterator *li, listTypeEntry *entry) {
 }
 
 /*
- * 将类表的底层编码从ziplist转换成双端链表
+ * 将列表的底层编码从listpack转换成quicklist
  */
 void listTypeConvert(robj *subject, int enc) {
-	listTypeIterator *li;
-	listTypeEntry entry;
-	/* 转换成双端链表 */
-	if (enc = REDIS_ENCODING_LINKEDLIST) {
-		list *l = listCreate();
-		listSetFreeMethod(l, decrRefCountVoid);
-
-		/* 遍历ziplist,并将里面的值全部添加到双端链表中 */
-		li = listTypeInitIterator(subject, 0, REDIS_TAIL);
-		while (listTypeNext(li, &entry)) listAddNodeTail(l, listTypeGet(&entry));
-		listTypeReleaseIterator(li);
-		/* 更新编码 */
-		subject->encoding = REDIS_ENCODING_LINKEDLIST;
-		/* 释放原来的ziplist */
-		zfree(subject->ptr);
-		/* 更新对象值指针 */
-		subject->ptr = l;
+	assert(subject->type == REDIS_LIST);
+	assert(subject->encoding == REDIS_ENCODING_LISTPACK);
+
+	if (enc == REDIS_ENCODING_QUICKLIST) {
+		/* listpack 会被释放 */
+		subject->ptr = quicklistCreateFromListpack(server.list_max_listpack_size,
+			server.list_compress_depth, subject->ptr);
+		subject->encoding = REDIS_ENCODING_QUICKLIST;
 	}
 	else
 		assert(0);
 }
-/* 
- * 对输入值 value 进行检查，看是否需要将 subject 从 ziplist 转换为双端链表，
- * 以便保存值 value 。
- *
- * 函数只对 REDIS_ENCODING_RAW 编码的 value 进行检查，
- * 因为整数编码的值不可能超长。
- */
-void listTypeTryConversion(robj *subject, robj *value) {
-
-	/* 确保 subject 为 ZIPLIST 编码 */
-	if (subject->encoding != REDIS_ENCODING_ZIPLIST) return;
-
-	if (sdsEncodedObject(value) &&
-		/* 看字符串是否过长 */
-		sdslen(value->ptr) > server.list_max_ziplist_value)
-		/* 将编码转换为双端链表 */
-		listTypeConvert(subject, REDIS_ENCODING_LINKEDLIST);
-}
 
 /* 
  * 将给定元素添加到列表的表头或表尾。
@@ -192,29 +132,13 @@ void listTypeTryConversion(robj *subject, robj *value) {
  * 调用者无须担心 value 的引用计数，因为这个函数会负责这方面的工作。
  */
 void listTypePush(robj *subject, robj *value, int where) {
-	/* 是否需要转换编码？ */
-	listTypeTryConversion(subject, value);
-
-	if (subject->encoding == REDIS_ENCODING_ZIPLIST &&
-		ziplistLen(subject->ptr) >= server.list_max_ziplist_entries)
-		listTypeConvert(subject, REDIS_ENCODING_LINKEDLIST);
-
-	if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
-		int pos = (where == REDIS_HEAD) ? ZIPLIST_HEAD : ZIPLIST_TAIL;
-		/* 取出对象的值，因为 ZIPLIST 只能保存字符串或整数 */
+	if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+		int pos = (where == REDIS_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+		/* 取出对象的值，因为 listpack 只能保存字符串或整数 */
 		value = getDecodedObject(value);
-		subject->ptr = ziplistPush(subject->ptr, value->ptr, sdslen(value->ptr), pos);
+		quicklistPush(subject->ptr, value->ptr, sdslen(value->ptr), pos);
 		decrRefCount(value);
 	}
-	else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) { /* 双端链表 */
-		if (where == REDIS_HEAD) {
-			listAddNodeHead(subject->ptr, value);
-		}
-		else {
-			listAddNodeTail(subject->ptr, value);
-		}
-		incrRefCount(value);
-	}
 	else 
 		assert(0);
 }
@@ -240,7 +164,9 @@ void pushGenericCommand(redisClient *c, int where) {
 
 		/* 如果列表对象不存在，那么创建一个，并关联到数据库 */
 		if (!lobj) {
-			lobj = createZiplistObject();
+			lobj = createQuicklistObject();
+			quicklistSetOptions(lobj->ptr, server.list_max_listpack_size,
+				server.list_compress_depth);
 			dbAdd(c->db, c->argv[1], lobj);
 		}
 
@@ -268,6 +194,13 @@ void rpushCommand(redisClient *c) {
 	pushGenericCommand(c, REDIS_TAIL);
 }
 
+/*
+ * 弹出字符串元素时用来复制元素的值
+ */
+static void *listPopSaver(unsigned char *data, unsigned int sz) {
+	return createStringObject((char*)data, sz);
+}
+
 /*
  * 从列表的表头或表尾中弹出一个元素。
  *
@@ -279,42 +212,16 @@ void rpushCommand(redisClient *c) {
  */
 robj *listTypePop(robj *subject, int where) {
 	robj *value = NULL;
+	long long vlong;
 	
-	if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
-		unsigned char *p;
-		unsigned char *vstr;
-		unsigned int vlen;
-		long long vlong;
-
+	if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
 		/* 决定弹出元素的位置 */
-		int pos = (where == REDIS_HEAD) ? 0 : -1;
-		p = ziplistIndex(subject->ptr, pos);
-		if (ziplistGet(p, &vstr, &vlen, &vlong)) {
-			/* 为被弹出的元素创建对象 */
-			if (vstr) {
-				value = createStringObject((char*)vstr, vlen);
-			}
-			else {
+		int pos = (where == REDIS_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+		if (quicklistPopCustom(subject->ptr, pos, (unsigned char **)&value,
+			NULL, &vlong, listPopSaver)) {
+			/* 整数元素没有经过 listPopSaver */
+			if (!value)
 				value = createStringObjectFromLongLong(vlong);
-			}
-			/* 从 ziplist 中删除被弹出元素 */
-			subject->ptr = ziplistDelete(subject->ptr, &p);
-		}
-	}
-	else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-		list *list = subject->ptr;
-		listNode *ln;
-		if (where == REDIS_HEAD) {
-			ln = listFirst(list);
-		}
-		else {
-			ln = listLast(list);
-		}
-		/* 删除被弹出的节点 */
-		if (ln != NULL) {
-			value = listNodeValue(ln);
-			incrRefCount(value);
-			listDelNode(list, ln);
 		}
 	}
 	else
@@ -364,22 +271,18 @@ void lindexCommand(redisClient *c) {
 	if ((getLongFromObjectOrReply(c, c->argv[2], &index, NULL) != REDIS_OK))
 		return;
 
-	/* 根据索引，遍历 ziplist ，直到指定位置 */
-	if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-		unsigned char *p;
-		unsigned char *vstr;
-		unsigned int vlen;
-		long long vlong;
+	/* 先按节点的元素个数跳过整个节点，再在目标节点的 listpack 中查找 */
+	if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+		quicklistEntry entry;
 
-		p = ziplistIndex(o->ptr, index);
-
-		if (ziplistGet(p, &vstr, &vlen, &vlong)) {
-			if (vstr) {
-				value = createStringObject((char*)vstr, vlen);
+		if (quicklistIndex(o->ptr, index, &entry)) {
+			if (entry.value) {
+				value = createStringObject((char*)entry.value, entry.sz);
 			}
 			else {
-				value = createStringObjectFromLongLong(vlong);
+				value = createStringObjectFromLongLong(entry.longval);
 			}
+			quicklistRecompress(o->ptr, entry.node);
 			addReplyBulk(c, value);
 			decrRefCount(value);
 		}
@@ -387,16 +290,6 @@ void lindexCommand(redisClient *c) {
 			addReply(c, shared.nullbulk);
 		}
 	}
-	else if (o->encoding == REDIS_ENCODING_LINKEDLIST) { /* 根据索引，遍历双端链表，直到指定位置 */
-		listNode *ln = listIndex(o->ptr, index);
-		if (ln != NULL) {
-			value = listNodeValue(ln);
-			addReplyBulk(c, value);
-		}
-		else {
-			addReply(c, shared.nullbulk);
-		}
-	}
 	else 
 		assert(0);
 }
@@ -417,41 +310,18 @@ void lsetCommand(redisClient *c) {
 	/* 取出整数值对象index */
 	if ((getLongFromObjectOrReply(c, c->argv[2], &index, NULL) != REDIS_OK))
 		return;
-	/* 查看保存value值是否需要转换列表的底层编码 */
-	listTypeTryConversion(o, value);
-	/* 设置到ziplist */
-	if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-		unsigned char *p, *zl = o->ptr;
-		/* 查找索引 */
-		p = ziplistIndex(zl, index);
-		if (p == NULL)
-			addReply(c, shared.outofrangeerr);
-		else {
-			/* 删除现有的值 */
-			o->ptr = ziplistDelete(o->ptr, &p);
-			/* 插入新值到指定索引 */
-			value = getDecodedObject(value);
-			o->ptr = ziplistInsert(o->ptr, p, value->ptr, sdslen(value->ptr));
-			decrRefCount(value);
-
-			addReply(c, shared.ok);
-			signalModifiedKey(c->db, c->argv[1]);
-			server.dirty++;
-		}
-	}
-	else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-		listNode *ln = listIndex(o->ptr, index);
+	/* 设置到quicklist */
+	if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+		quicklist *ql = o->ptr;
+		int replaced;
 
-		if (ln == NULL) {
+		value = getDecodedObject(value);
+		replaced = quicklistReplaceAtIndex(ql, index, value->ptr, sdslen(value->ptr));
+		decrRefCount(value);
+		if (!replaced) {
 			addReply(c, shared.outofrangeerr);
 		}
 		else {
-			/* 删除旧值对象 */
-			decrRefCount((robj*)listNodeValue(ln));
-			/* 指向新对象 */
-			listNodeValue(ln) = value;
-			incrRefCount(value);
-
 			addReply(c, shared.ok);
 			signalModifiedKey(c->db, c->argv[1]);
 			server.dirty++;
@@ -461,4 +331,4 @@ void lsetCommand(redisClient *c) {
 		mylog("%s", "Unknown list encoding");
 		assert(0);
 	}
-}
\ No newline at end of file
+}
@@ -8,7 +8,6 @@ listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char
 void listTypeReleaseIterator(listTypeIterator *li);
 int listTypeNext(listTypeIterator *li, listTypeEntry *entry);
 void listTypeConvert(robj *subject, int enc);
-void listTypeTryConversion(robj *subject, robj *value);
 void listTypePush(robj *subject, robj *value, int where);
 void pushGenericCommand(redisClient *c, int where);
 void lpushCommand(redisClient *c);
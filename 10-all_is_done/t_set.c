@@ -18,7 +18,6 @@
 
 /*============================ Variable and Function Declaration ======================== */
 extern struct sharedObjectsStruct shared;
-extern struct redisServer server;
 extern struct dictType setDictType;
 
 /*
@@ -173,7 +172,8 @@ int setTypeRemove(robj *setobj, robj *value) {
 	if (setobj->encoding == REDIS_ENCODING_HT) {
 		/* 从字典中删除键 */
 		if (dictDelete(setobj->ptr, value) == DICT_OK) {
-			/* 字典暂时就不用缩减大小了. */
+			/* 删除之后检查是否需要缩小字典 */
+			if (dictNeedsResize(setobj->ptr)) dictResize(setobj->ptr);
 			return 1;
 		}
 	}
@@ -361,6 +361,7 @@ void saddCommand(redisClient *c) {
 	if (added) {
 		/* 发送键修改信号 */
 		signalModifiedKey(c->db, c->argv[1]);
+		dbTrackRehashing(c->db, c->argv[1], set);
 	}
 
 	server.dirty += added; /* 将数据库设为脏 */
@@ -512,6 +513,7 @@ void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
 		/* 如果结果集非空，那么将它关联到数据库中 */
 		if (setTypeSize(dstset) > 0) {
 			dbAdd(c->db, dstkey, dstset);
+			dbTrackRehashing(c->db, dstkey, dstset);
 			addReplyLongLong(c, setTypeSize(dstset));
 		}
 		else {
@@ -581,15 +583,18 @@ void spopCommand(redisClient *c) {
 		incrRefCount(ele);
 		setTypeRemove(set, ele);
 	}
-	decrRefCount(ele);
 
-	/* 返回回复 */
+	/* 返回回复, 元素已经从集合中删除, 回复之后才能释放它 */
 	addReplyBulk(c, ele);
+	decrRefCount(ele);
 
 	/* 如果集合已经为空,那么从数据库中删除它 */
 	if (setTypeSize(set) == 0) {
 		dbDelete(c->db, c->argv[1]);
 	}
+	else {
+		dbTrackRehashing(c->db, c->argv[1], set);
+	}
 	signalModifiedKey(c->db, c->argv[1]);
 	server.dirty++; /* 将数据库设为脏 */
 }
@@ -636,6 +641,9 @@ void smoveCommand(redisClient *c) {
 	if (setTypeSize(srcset) == 0) {
 		dbDelete(c->db, c->argv[1]);
 	}
+	else {
+		dbTrackRehashing(c->db, c->argv[1], srcset);
+	}
 
 	/* 发送键修改信号 */
 	signalModifiedKey(c->db, c->argv[1]);
@@ -656,7 +664,7 @@ void smoveCommand(redisClient *c) {
 	*/
 	if (setTypeAdd(dstset, ele)) {
 		server.dirty++;
-		// todo
+		dbTrackRehashing(c->db, c->argv[2], dstset);
 	}
 	addReply(c, shared.cone);
 
@@ -836,6 +844,7 @@ void sunionDiffGenericCommand(redisClient *c, robj **setkeys, int setnum, robj *
 		/* 如果结果集不为空，将它关联到数据库中 */
 		if (setTypeSize(dstset) > 0) {
 			dbAdd(c->db, dstkey, dstset);
+			dbTrackRehashing(c->db, dstkey, dstset);
 			/* 返回结果集的基数 */
 			addReplyLongLong(c, setTypeSize(dstset));
 		}
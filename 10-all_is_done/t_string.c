@@ -7,7 +7,6 @@
 #include "util.h"
 
 extern struct sharedObjectsStruct shared;
-extern struct redisServer server;
 
 #define REDIS_SET_NO_FLAGS 0
 #define REDIS_SET_NX (1<<0)     // Set if key not exists.
@@ -356,7 +355,7 @@ void mgetCommand(redisClient *c) { // 一次性获取多个值
 				addReply(c, shared.nullbulk);
 			}
 			else {
-				addReply(c, o); // 值存在,并且是字符串
+				addReplyBulk(c, o); // 值存在,并且是字符串
 			}
 		}
 	}
@@ -1,11 +1,11 @@
 #include "redis.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "intset.h"
 #include <math.h>
 #include <assert.h>
 #include "dict.h"
 #include "db.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "t_string.h"
 #include "networking.h"
 #include "object.h"
@@ -15,7 +15,6 @@
 
 /*============================ Variable and Function Declaration ======================== */
 extern struct sharedObjectsStruct shared;
-extern struct redisServer server;
 extern struct dictType zsetDictType;
 
 zskiplist *zslCreate(void);
@@ -42,7 +41,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
 	int minlen, cmp;
 
 	/* 取出节点中的字符串值，以及它的长度 */
-	assert(ziplistGet(eptr, &vstr, &vlen, &vlong));
+	assert(lpGet(eptr, &vstr, &vlen, &vlong));
 	if (vstr == NULL) {
 		/* Store string representation of long long in buf. */
 		vlen = ll2string((char*)vbuf, sizeof(vbuf), vlong);
@@ -159,10 +158,10 @@ void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
 	assert(*eptr != NULL && *sptr != NULL);
 
 	/* 指向下个成员 */
-	next_eptr = ziplistNext(zl, *sptr);
+	next_eptr = lpNext(zl, *sptr);
 	if (next_eptr != NULL) {
 		/* 指向下个分值 */
-		next_sptr = ziplistNext(zl, next_eptr);
+		next_sptr = lpNext(zl, next_eptr);
 		assert(next_sptr != NULL);
 	}
 	else {
@@ -310,7 +309,7 @@ zskiplistNode *zslCreateNode(int level, double score, robj *obj) {
  * 返回跳跃表包含的元素的数量
  */
 unsigned int zzlLength(unsigned char *zl) {
-	return ziplistLen(zl) / 2;
+	return lpLength(zl) / 2;
 }
 
 /*
@@ -324,7 +323,7 @@ void zsetConvert(robj *zobj, int encoding) {
 
 	if (zobj->encoding == encoding) return;
 	
-	if (zobj->encoding == REDIS_ENCODING_ZIPLIST) { /* 从ZIPLIST编码转换为SKIPLIST编码 */
+	if (zobj->encoding == REDIS_ENCODING_LISTPACK) { /* 从LISTPACK编码转换为SKIPLIST编码 */
 		unsigned char *zl = zobj->ptr;
 		unsigned char *eptr, *sptr;
 		unsigned char *vstr;
@@ -338,24 +337,24 @@ void zsetConvert(robj *zobj, int encoding) {
 		zs->dict = dictCreate(&zsetDictType, NULL); /* 字典 */
 		zs->zsl = zslCreate(); /* 跳跃表 */
 
-		// 有序集合在 ziplist 中的排列：
+		// 有序集合在 listpack 中的排列：
 		//
 		// | member-1 | score-1 | member-2 | score-2 | ... |
 		//
 
-		/* 指向ziplist中首个节点(保存该元素) */
-		eptr = ziplistIndex(zl, 0);
+		/* 指向listpack中首个节点(保存该元素) */
+		eptr = lpSeek(zl, 0);
 		assert(eptr != NULL);
-		/* 指向ziplist中的第二个节点(保存该元素的分值) */
-		sptr = ziplistNext(zl, eptr);
+		/* 指向listpack中的第二个节点(保存该元素的分值) */
+		sptr = lpNext(zl, eptr);
 		assert(sptr != NULL);
 
-		/* 遍历所有的ziplist节点,并将元素的成员和分值添加到有序集合中 */
+		/* 遍历所有的listpack节点,并将元素的成员和分值添加到有序集合中 */
 		while (eptr != NULL) {
 			/* 取出分值 */
 			score = zzlGetScore(sptr);
 			/* 取出成员 */
-			ziplistGet(eptr, &vstr, &vlen, &vlong);
+			lpGet(eptr, &vstr, &vlen, &vlong);
 			if (vstr == NULL) /* 存储的是整数值 */
 				ele = createStringObjectFromLongLong(vlong);
 			else /* 存储的是string类型 */
@@ -367,17 +366,17 @@ void zsetConvert(robj *zobj, int encoding) {
 			/* 移动指针,指向下个元素 */
 			zzlNext(zl, &eptr, &sptr);
 		}
-		/* 释放原来的ziplist */
+		/* 释放原来的listpack */
 		zfree(zobj->ptr);
 		/* 更新对象的值,以及编码方式 */
 		zobj->ptr = zs;
 		zobj->encoding = REDIS_ENCODING_SKIPLIST;
 	}
-	else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) { /* 从SKIPLIST转换为ZIPLIST编码 */
-		/* 新的ziplist */
-		unsigned char *zl = ziplistNew();
+	else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) { /* 从SKIPLIST转换为LISTPACK编码 */
+		/* 新的listpack */
+		unsigned char *zl = lpNew();
 
-		if (encoding != REDIS_ENCODING_ZIPLIST) assert(0);
+		if (encoding != REDIS_ENCODING_LISTPACK) assert(0);
 
 		/* 指向跳跃表 */
 		zs = zobj->ptr;
@@ -386,14 +385,15 @@ void zsetConvert(robj *zobj, int encoding) {
 		dictRelease(zs->dict);
 
 		/* 指向跳跃表的首个节点 */
+		node = zs->zsl->header->level[0].forward;
 		zfree(zs->zsl->header);
 		zfree(zs->zsl);
 
-		/* 遍历跳跃表,取出里面的元素,并将他们添加到ziplist */
+		/* 遍历跳跃表,取出里面的元素,并将他们添加到listpack */
 		while (node) {
 			/* 取出编码后的值对象 */
 			ele = getDecodedObject(node->obj);
-			/* 添加元素到ziplist */
+			/* 添加元素到listpack */
 			zl = zzlInsertAt(zl, NULL, ele, node->score);
 			decrRefCount(ele);
 
@@ -406,7 +406,7 @@ void zsetConvert(robj *zobj, int encoding) {
 		zfree(zs);
 		/* 更新对象的值,以及对象的编码方式 */
 		zobj->ptr = zl;
-		zobj->encoding = REDIS_ENCODING_ZIPLIST;
+		zobj->encoding = REDIS_ENCODING_LISTPACK;
 	}
 	else
 		assert(0);
@@ -414,21 +414,21 @@ void zsetConvert(robj *zobj, int encoding) {
 
 
 /*
- * 从 ziplist 中删除 eptr 所指定的有序集合元素（包括成员和分值）
+ * 从 listpack 中删除 eptr 所指定的有序集合元素（包括成员和分值）
  */
 unsigned char *zzlDelete(unsigned char *zl, unsigned char *eptr) {
 	unsigned char *p = eptr;
 
-	zl = ziplistDelete(zl, &p);
-	zl = ziplistDelete(zl, &p);
+	zl = lpDelete(zl, &p);
+	zl = lpDelete(zl, &p);
 	return zl;
 }
 
 /*
  * 将带有给定成员和分值的新节点插入到 eptr 所指向的节点的前面，
- * 如果 eptr 为 NULL ，那么将新节点插入到 ziplist 的末端。
+ * 如果 eptr 为 NULL ，那么将新节点插入到 listpack 的末端。
  *
- * 函数返回插入操作完成之后的 ziplist
+ * 函数返回插入操作完成之后的 listpack
  */
 unsigned char *zzlInsertAt(unsigned char *zl, unsigned char *eptr, robj *ele, double score) {
 	unsigned char *sptr;
@@ -441,14 +441,19 @@ unsigned char *zzlInsertAt(unsigned char *zl, unsigned char *eptr, robj *ele, do
 	if (eptr == NULL) { /* 插入到表尾,或者空表 */
 		// | member-1 | score-1 | member-2 | score-2 | ... | member-N | score-N |
 		/* 先推入元素 */
-		zl = ziplistPush(zl, ele->ptr, sdslen(ele->ptr), ZIPLIST_TAIL);
+		zl = lpPush(zl, ele->ptr, sdslen(ele->ptr), LP_TAIL);
 		/* 然后推入分值 */
-		zl = ziplistPush(zl, (unsigned char*)scorebuf, scorelen, ZIPLIST_TAIL);
+		zl = lpPush(zl, (unsigned char*)scorebuf, scorelen, LP_TAIL);
 	}
 	else { /* 插入到某个节点的前面 */
 		/* 插入成员 */
 		offset = eptr - zl;
-		zl = ziplistInsert(zl, eptr, ele->ptr, sdslen(ele->ptr));
+		zl = lpInsert(zl, eptr, ele->ptr, sdslen(ele->ptr));
+		eptr = zl + offset;
+
+		/* 在成员后面插入分值 */
+		assert((sptr = lpNext(zl, eptr)) != NULL);
+		zl = lpInsert(zl, sptr, (unsigned char*)scorebuf, scorelen);
 	}
 	return zl;
 }
@@ -465,7 +470,7 @@ double zzlGetScore(unsigned char *sptr) {
 
 	assert(sptr != NULL);
 	/* 取出节点值 */
-	assert(ziplistGet(sptr, &vstr, &vlen, &vlong));
+	assert(lpGet(sptr, &vstr, &vlen, &vlong));
 
 	if (vstr) {
 		/* 字符串转double */
@@ -482,29 +487,29 @@ double zzlGetScore(unsigned char *sptr) {
 
 
 /* 
- * 将 ele 成员和它的分值 score 添加到 ziplist 里面
+ * 将 ele 成员和它的分值 score 添加到 listpack 里面
  *
- * ziplist 里的各个节点按 score 值从小到大排列
+ * listpack 里的各个节点按 score 值从小到大排列
  *
  * 这个函数假设 elem 不存在于有序集中
  */
 unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score) {
-	/* 指向 ziplist 第一个节点（也即是有序集的 member 域） */
-	unsigned char *eptr = ziplistIndex(zl, 0), *sptr;
+	/* 指向 listpack 第一个节点（也即是有序集的 member 域） */
+	unsigned char *eptr = lpSeek(zl, 0), *sptr;
 	double s;
 
 	/* 解码值 */
 	ele = getDecodedObject(ele);
-	/* 遍历整个ziplist */
+	/* 遍历整个listpack */
 	while (eptr != NULL) {
 		/* 取出分值 */
-		sptr = ziplistNext(zl, eptr);
+		sptr = lpNext(zl, eptr);
 		assert(sptr != NULL);
 		s = zzlGetScore(sptr);
 		if (s > score) {
 			/* 遇到第一个 score 值比输入 score 大的节点
 			* 将新节点插入在这个节点的前面，
-			* 让节点在 ziplist 里根据 score 从小到大排列 */ 
+			* 让节点在 listpack 里根据 score 从小到大排列 */ 
 			zl = zzlInsertAt(zl, eptr, ele, score);
 			break;
 		}
@@ -518,7 +523,7 @@ unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score) {
 		}
 		/* 输入 score 比节点的 score 值要大
 		 * 移动到下一个节点 */
-		eptr = ziplistNext(zl, sptr);
+		eptr = lpNext(zl, sptr);
 	}
 	/* Push on tail of list when it was not yet inserted. */
 	if (eptr == NULL)
@@ -556,29 +561,29 @@ zskiplist *zslCreate(void) {
 }
 
 /*
- * 从 ziplist 编码的有序集合中查找 ele 成员，并将它的分值保存到 score 。
+ * 从 listpack 编码的有序集合中查找 ele 成员，并将它的分值保存到 score 。
  *
  * 寻找成功返回指向成员 ele 的指针，查找失败返回 NULL 。
  */
 unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score) {
 	/* 定位到首个元素 */
-	unsigned char *eptr = ziplistIndex(zl, 0), *sptr;
+	unsigned char *eptr = lpSeek(zl, 0), *sptr;
 	/* 解码成员 */
 	ele = getDecodedObject(ele);
-	/* 遍历整个ziplist,查找元素 */
+	/* 遍历整个listpack,查找元素 */
 	while (eptr != NULL) {
 		/* 指向分量 */
-		sptr = ziplistNext(zl, eptr);
+		sptr = lpNext(zl, eptr);
 		assert(sptr != NULL);
 		/* 对比成员 */
-		if (ziplistCompare(eptr, ele->ptr, sdslen(ele->ptr))) {
+		if (lpCompare(eptr, ele->ptr, sdslen(ele->ptr))) {
 			/* 成员匹配,取出分值 */
 			if (score != NULL) *score = zzlGetScore(sptr);
 			decrRefCount(ele);
 			return eptr;
 		}
 
-		eptr = ziplistNext(zl, sptr);
+		eptr = lpNext(zl, sptr);
 	}
 	decrRefCount(ele);
 	/* 没有找到 */
@@ -640,13 +645,13 @@ void zaddGenericCommand(redisClient *c, int incr) {
 	zobj = lookupKeyWrite(c->db, key);
 	if (zobj == NULL) {
 		/* 有序集合不存在，创建新有序集合 */
-		if (server.zset_max_ziplist_entries == 0 ||
-			server.zset_max_ziplist_value < sdslen(c->argv[3]->ptr))
+		if (server.zset_max_listpack_entries == 0 ||
+			server.zset_max_listpack_value < sdslen(c->argv[3]->ptr))
 		{
 			zobj = createZsetObject();
 		}
 		else {
-			zobj = createZsetZiplistObject();
+			zobj = createZsetListpackObject();
 		}
 		/* 关联对象到数据库 */
 		dbAdd(c->db, key, zobj);
@@ -663,7 +668,7 @@ void zaddGenericCommand(redisClient *c, int incr) {
 	for (j = 0; j < elements; j++) {
 		score = scores[j];
 
-		if (zobj->encoding == REDIS_ENCODING_ZIPLIST) { /* 有序集合为 ziplist 编码 */
+		if (zobj->encoding == REDIS_ENCODING_LISTPACK) { /* 有序集合为 listpack 编码 */
 			unsigned char *eptr;
 			/* 查找成员 */
 			ele = c->argv[3 + j * 2];
@@ -696,13 +701,13 @@ void zaddGenericCommand(redisClient *c, int incr) {
 				zobj->ptr = zzlInsert(zobj->ptr, ele, score);
 
 				/* 查看元素的数量，
-				 * 看是否需要将 ZIPLIST 编码转换为有序集合 */
-				if (zzlLength(zobj->ptr) > server.zset_max_ziplist_entries)
+				 * 看是否需要将 LISTPACK 编码转换为有序集合 */
+				if (zzlLength(zobj->ptr) > server.zset_max_listpack_entries)
 					zsetConvert(zobj, REDIS_ENCODING_SKIPLIST);
 
 				/* 查看新添加元素的长度
-				 * 看是否需要将 ZIPLIST 编码转换为有序集合 */
-				if (sdslen(ele->ptr) > server.zset_max_ziplist_value)
+				 * 看是否需要将 LISTPACK 编码转换为有序集合 */
+				if (sdslen(ele->ptr) > server.zset_max_listpack_value)
 					zsetConvert(zobj, REDIS_ENCODING_SKIPLIST);
 				server.dirty++;
 				added++;
@@ -773,6 +778,7 @@ cleanup:
 	if (added || updated) {
 		signalModifiedKey(c->db, key);
 	}
+	if (added) dbTrackRehashing(c->db, key, zobj);
 }
 
 
@@ -787,7 +793,7 @@ void zincrbyCommand(redisClient *c) {
 unsigned int zsetLength(robj *zobj) {
 	int length = -1;
 
-	if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+	if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
 		length = zzlLength(zobj->ptr);
 
 	}
@@ -865,7 +871,7 @@ static int zslParseRange(robj *min, robj *max, zrangespec *spec) {
 }
 
 /* 
- * 如果给定的 ziplist 有至少一个节点符合 range 中指定的范围，
+ * 如果给定的 listpack 有至少一个节点符合 range 中指定的范围，
  * 那么函数返回 1 ，否则返回 0 。
  */
 int zzlIsInRange(unsigned char *zl, zrangespec *range) {
@@ -877,21 +883,21 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
 		(range->min == range->max && (range->minex || range->maxex)))
 		return 0;
 
-	/* 取出 ziplist 中的最大分值，并和 range 的最大值对比 */
-	p = ziplistIndex(zl, -1); /* Last score. */
+	/* 取出 listpack 中的最大分值，并和 range 的最大值对比 */
+	p = lpSeek(zl, -1); /* Last score. */
 	if (p == NULL) return 0; /* Empty sorted set */
 	score = zzlGetScore(p);
 	if (!zslValueGteMin(score, range))
 		return 0;
 
-	/* 取出 ziplist 中的最小值，并和 range 的最小值进行对比 */
-	p = ziplistIndex(zl, 1); /* First score. */
+	/* 取出 listpack 中的最小值，并和 range 的最小值进行对比 */
+	p = lpSeek(zl, 1); /* First score. */
 	assert(p != NULL);
 	score = zzlGetScore(p);
 	if (!zslValueLteMax(score, range))
 		return 0;
 
-	/* ziplist 有至少一个节点符合范围 */
+	/* listpack 有至少一个节点符合范围 */
 	return 1;
 }
 
@@ -924,14 +930,14 @@ static int zslValueGteMin(double value, zrangespec *spec) {
  */
 unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
 	/* 从表头开始遍历 */
-	unsigned char *eptr = ziplistIndex(zl, 0), *sptr;
+	unsigned char *eptr = lpSeek(zl, 0), *sptr;
 	double score;
 
 	if (!zzlIsInRange(zl, range)) return NULL;
 
-	/* 分值在 ziplist 中是从小到大排列的, 从表头向表尾遍历 */
+	/* 分值在 listpack 中是从小到大排列的, 从表头向表尾遍历 */
 	while (eptr != NULL) {
-		sptr = ziplistNext(zl, eptr);
+		sptr = lpNext(zl, eptr);
 		assert(sptr != NULL);
 
 		score = zzlGetScore(sptr);
@@ -942,7 +948,7 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
 			return NULL;
 		}
 
-		eptr = ziplistNext(zl, sptr);
+		eptr = lpNext(zl, sptr);
 	}
 
 	return NULL;
@@ -1098,7 +1104,7 @@ void zcountCommand(redisClient *c) {
 	if ((zobj = lookupKeyReadOrReply(c, key, shared.czero)) == NULL ||
 		checkType(c, zobj, REDIS_ZSET)) return;
 
-	if (zobj->encoding == REDIS_ENCODING_ZIPLIST) { /* 如果底层的编码是压缩表的话 */
+	if (zobj->encoding == REDIS_ENCODING_LISTPACK) { /* 如果底层的编码是压缩表的话 */
 		unsigned char *zl = zobj->ptr;
 		unsigned char *eptr, *sptr;
 		double score;
@@ -1114,7 +1120,7 @@ void zcountCommand(redisClient *c) {
 
 		/* First element is in range */
 		/* 取出分值 */
-		sptr = ziplistNext(zl, eptr);
+		sptr = lpNext(zl, eptr);
 		score = zzlGetScore(sptr);
 		assert(zslValueLteMax(score, &range));
 
@@ -1181,19 +1187,19 @@ void zrankGenericCommand(redisClient *c, int reverse) {
 
 	sdsEncodedObject(ele);
 
-	if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+	if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
 		unsigned char *zl = zobj->ptr;
 		unsigned char *eptr, *sptr;
 
-		eptr = ziplistIndex(zl, 0);
+		eptr = lpSeek(zl, 0);
 		assert(eptr != NULL);
-		sptr = ziplistNext(zl, eptr);
+		sptr = lpNext(zl, eptr);
 		assert( sptr != NULL);
 
 		/* 计算排名 */
 		rank = 1;
 		while (eptr != NULL) {
-			if (ziplistCompare(eptr, ele->ptr, sdslen(ele->ptr)))
+			if (lpCompare(eptr, ele->ptr, sdslen(ele->ptr)))
 				break;
 			rank++;
 			zzlNext(zl, &eptr, &sptr);
@@ -1254,7 +1260,7 @@ void zscoreCommand(redisClient *c) {
 	if ((zobj = lookupKeyReadOrReply(c, key, shared.nullbulk)) == NULL ||
 		checkType(c, zobj, REDIS_ZSET)) return;
 
-	if (zobj->encoding == REDIS_ENCODING_ZIPLIST) { /* ziplist */
+	if (zobj->encoding == REDIS_ENCODING_LISTPACK) { /* listpack */
 		/* 取出元素 */
 		if (zzlFind(zobj->ptr, c->argv[2], &score) != NULL)
 			/* 回复分值 */
@@ -1365,9 +1371,9 @@ typedef struct {
 
 		/* 有序集合迭代器. */
 		union _iterzset {
-			/* ziplist 迭代器 */
+			/* listpack 迭代器 */
 			struct {
-				/* 被迭代的 ziplist */
+				/* 被迭代的 listpack */
 				unsigned char *zl;
 				/* 当前成员指针和当前分值指针 */
 				unsigned char *eptr, *sptr;
@@ -1431,7 +1437,7 @@ int zuiLongLongFromValue(zsetopval *val) {
 				assert(NULL);
 			}
 		}
-		else if (val->estr != NULL) { /* 从 ziplist 节点中取值 */
+		else if (val->estr != NULL) { /* 从 listpack 节点中取值 */
 			/* 将节点值（一个字符串）转换为整数 */
 			if (string2ll((char*)val->estr, val->elen, &val->ell))
 				val->flags |= OPVAL_VALID_LL;
@@ -1542,7 +1548,7 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
 		/* 取出对象 */
 		zuiObjectFromValue(val);
 
-		if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+		if (op->encoding == REDIS_ENCODING_LISTPACK) {
 
 			/* 取出成员和分值 */
 			if (zzlFind(op->subject->ptr, val->ele, score) != NULL) {
@@ -1613,12 +1619,12 @@ void zuiInitIterator(zsetopsrc *op) {
 
 		iterzset *it = &op->iter.zset;
 
-		/* 迭代 ziplist */
-		if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+		/* 迭代 listpack */
+		if (op->encoding == REDIS_ENCODING_LISTPACK) {
 			it->zl.zl = op->subject->ptr;
-			it->zl.eptr = ziplistIndex(it->zl.zl, 0);
+			it->zl.eptr = lpSeek(it->zl.zl, 0);
 			if (it->zl.eptr != NULL) {
-				it->zl.sptr = ziplistNext(it->zl.zl, it->zl.eptr);
+				it->zl.sptr = lpNext(it->zl.zl, it->zl.eptr);
 				assert(it->zl.sptr != NULL);
 			}
 		}
@@ -1662,7 +1668,7 @@ void zuiClearIterator(zsetopsrc *op) {
 	}
 	else if (op->type == REDIS_ZSET) {
 		iterzset *it = &op->iter.zset;
-		if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+		if (op->encoding == REDIS_ENCODING_LISTPACK) {
 			REDIS_NOTUSED(it); /* skip */
 		}
 		else if (op->encoding == REDIS_ENCODING_SKIPLIST) {
@@ -1700,7 +1706,7 @@ int zuiLength(zsetopsrc *op) {
 	}
 	else if (op->type == REDIS_ZSET) {
 
-		if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+		if (op->encoding == REDIS_ENCODING_LISTPACK) {
 			return zzlLength(op->subject->ptr);
 		}
 		else if (op->encoding == REDIS_ENCODING_SKIPLIST) {
@@ -1739,7 +1745,7 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
 		iterset *it = &op->iter.set;
 
-		/* ziplist 编码的集合 */
+		/* listpack 编码的集合 */
 		if (op->encoding == REDIS_ENCODING_INTSET) {
 			int64_t ell;
 
@@ -1772,13 +1778,13 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 	}
 	else if (op->type == REDIS_ZSET) {
 		iterzset *it = &op->iter.zset;
-		/* ziplist 编码的有序集合 */
-		if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+		/* listpack 编码的有序集合 */
+		if (op->encoding == REDIS_ENCODING_LISTPACK) {
 			/* 为空？ */
 			if (it->zl.eptr == NULL || it->zl.sptr == NULL)
 				return 0;
 			/* 取出成员 */
-			assert(ziplistGet(it->zl.eptr, &val->estr, &val->elen, &val->ell));
+			assert(lpGet(it->zl.eptr, &val->estr, &val->elen, &val->ell));
 			/* 取出分值 */
 			val->score = zzlGetScore(it->zl.sptr);
 
@@ -2046,12 +2052,13 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
 	/* 如果结果集合的长度不为 0 */
 	if (dstzset->zsl->length) {
 		/* 看是否需要对结果集合进行编码转换 */
-		if (dstzset->zsl->length <= server.zset_max_ziplist_entries &&
-			maxelelen <= server.zset_max_ziplist_value)
-			zsetConvert(dstobj, REDIS_ENCODING_ZIPLIST);
+		if (dstzset->zsl->length <= server.zset_max_listpack_entries &&
+			maxelelen <= server.zset_max_listpack_value)
+			zsetConvert(dstobj, REDIS_ENCODING_LISTPACK);
 
 		/* 将结果集合关联到数据库 */
 		dbAdd(c->db, dstkey, dstobj);
+		dbTrackRehashing(c->db, dstkey, dstobj);
 
 		/* 回复结果集合的长度 */
 		addReplyLongLong(c, zsetLength(dstobj));
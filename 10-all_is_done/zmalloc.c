@@ -12,24 +12,56 @@ void zlibc_free(void *ptr) {
 }
 
 #include <string.h>
-#include <pthread.h>
 #include "zmalloc.h"
 
+/* 有 malloc_usable_size() 的时候直接向分配器询问内存块的大小,
+ * 不需要在每个内存块前面多放一个记录大小的头部了. */
+#ifdef HAVE_MALLOC_SIZE
+#define PREFIX_SIZE (0)
+#else
 #define PREFIX_SIZE (sizeof(size_t))
+#endif
+
+/* Linux 上可以从 /proc 中读到进程真实的内存用量 */
+#ifdef __linux__
+#define HAVE_PROC_STAT 1
+#define HAVE_PROC_SMAPS 1
+#endif
 
 /* Explicitly override malloc/free etc when using tcmalloc. */
 
-#define update_zmalloc_stat_add(__n) do { \
-    pthread_mutex_lock(&used_memory_mutex); \
-    used_memory += (__n); \
-    pthread_mutex_unlock(&used_memory_mutex); \
-} while(0)
+/* 多线程时每个线程在自己的槽位上累加内存用量, 读取时再把各个槽位加起来.
+ * 槽位各占一个 cache line, 线程之间不会互相争抢; 线程数超过槽位数时
+ * 几个线程共用一个槽位, 所以仍然使用 relaxed 原子操作.
+ * 一个线程释放的内存可能是别的线程分配的, 单个槽位的值可能"为负",
+ * 但是无符号数回绕之后的总和仍然是对的. */
+#define ZMALLOC_STAT_SLOTS 32
+#define ZMALLOC_CACHE_LINE 64
 
-#define update_zmalloc_stat_sub(__n) do { \
-    pthread_mutex_lock(&used_memory_mutex); \
-    used_memory -= (__n); \
-    pthread_mutex_unlock(&used_memory_mutex); \
-} while(0)
+typedef struct zmallocStatSlot {
+    size_t used;
+    char pad[ZMALLOC_CACHE_LINE - sizeof(size_t)];
+} zmallocStatSlot;
+
+static zmallocStatSlot used_memory[ZMALLOC_STAT_SLOTS]
+    __attribute__((aligned(ZMALLOC_CACHE_LINE)));
+static int used_memory_slots = 1; // 已经分配出去的槽位数, 单线程时只用第 0 个
+static __thread size_t *used_memory_slot = NULL;
+static int zmalloc_thread_safe = 0; // dirty的代码不外漏是一种美德
+
+static size_t *zmalloc_stat_slot(void) {
+    if (used_memory_slot == NULL) {
+        int j = __atomic_fetch_add(&used_memory_slots, 1, __ATOMIC_RELAXED);
+        used_memory_slot = &used_memory[j % ZMALLOC_STAT_SLOTS].used;
+    }
+    return used_memory_slot;
+}
+
+#define update_zmalloc_stat_add(__n) \
+    __atomic_add_fetch(zmalloc_stat_slot(), (__n), __ATOMIC_RELAXED)
+
+#define update_zmalloc_stat_sub(__n) \
+    __atomic_sub_fetch(zmalloc_stat_slot(), (__n), __ATOMIC_RELAXED)
 
 
 #define update_zmalloc_stat_alloc(__n) do { \
@@ -38,7 +70,7 @@ void zlibc_free(void *ptr) {
     if (zmalloc_thread_safe) { \
         update_zmalloc_stat_add(_n); \
     } else { \
-        used_memory += _n; \
+        used_memory[0].used += _n; \
     } \
 } while(0)
 
@@ -48,13 +80,385 @@ void zlibc_free(void *ptr) {
     if (zmalloc_thread_safe) { \
         update_zmalloc_stat_sub(_n); \
     } else { \
-        used_memory -= _n; \
+        used_memory[0].used -= _n; \
     } \
 } while(0)
 
-static size_t used_memory = 0;
-static int zmalloc_thread_safe = 0; // dirty的代码不外漏是一种美德
-pthread_mutex_t used_memory_mutex = PTHREAD_MUTEX_INITIALIZER; // 居然还要加锁
+/* ----------------------------- 小对象 slab 分配器 ---------------------------
+ *
+ * robj, dictEntry, 跳跃表节点和短的 sds 都只有几十个字节, 数量却非常多,
+ * 每一个都交给 malloc 的话, 头部开销和碎片都很可观.
+ * 不超过 ZSLAB_MAX_SIZE 字节的分配按大小分成若干类, 从 slab 中分配:
+ *
+ * - 启动后第一次分配时预留一大段只占地址空间的虚拟内存, 切成 ZSLAB_SIZE 大小
+ *   并对齐的 slab, 判断一个指针是不是 slab 中的只需要比较地址范围,
+ *   slab 的头部就在 slab 的开头, 把指针的低位清零就能找到.
+ *   预留的地址空间是 PROT_NONE 的, 不计入 overcommit 的承诺内存,
+ *   slab 第一次被使用时才改为可读写, 这时 vm.overcommit_memory=2 下可能失败.
+ * - 每个 slab 只存放一个大小类的对象, 头部记录空闲对象链表和已分配的对象数.
+ * - 每个线程对每个大小类都有一个小缓存, 分配和释放通常只操作这个缓存,
+ *   缓存空了或者满了时才加锁, 一次从大小类中取出或者归还一批对象.
+ *   对象可以在任何线程中释放, 它只会进入释放它的线程的缓存.
+ * - 一个 slab 中的对象全部被归还之后, 它的内存通过 madvise 还给操作系统,
+ *   每个大小类保留一个空的 slab, 避免在边界上反复申请和归还.
+ *
+ * 预留地址空间失败, 或者拿不到新的 slab 时退回到 malloc.
+ */
+#ifdef __linux__
+#define HAVE_ZMALLOC_SLAB 1
+#endif
+
+#ifdef HAVE_ZMALLOC_SLAB
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define ZSLAB_SIZE (64*1024)        /* 每个 slab 的大小, slab 按这个大小对齐 */
+#define ZSLAB_MAX_SIZE 128          /* 超过这个大小的分配仍然交给 malloc */
+#define ZSLAB_CLASSES 11            /* 16 到 64 字节每 8 字节一类, 之后每 16 字节一类 */
+#define ZSLAB_CACHE_MAX 64          /* 每个线程每个大小类最多缓存的对象数 */
+#define ZSLAB_BATCH 32              /* 一次从大小类中取出或者归还的对象数 */
+#define ZSLAB_DEFRAG_SCAN 64        /* 碎片整理时最多比较多少个 slab 来选择目标 */
+#define ZSLAB_REGION_MAX (64ULL*1024*1024*1024) /* 最多预留的地址空间 */
+#define ZSLAB_REGION_MIN (1ULL*1024*1024*1024)  /* 预留不到这么多就不使用 slab */
+
+typedef struct zslab {
+    struct zslab *prev, *next;      /* 大小类中还有空闲对象的 slab 组成的链表 */
+    void *free;                     /* 被释放过的空闲对象组成的链表 */
+    unsigned int bump;              /* 从来没有分配过的区域的起始偏移量 */
+    unsigned int used;              /* 已经分配出去的对象数(包括在线程缓存中的) */
+    unsigned int size;              /* 对象的大小 */
+    int cls;                        /* 所属的大小类 */
+    int listed;                     /* 是否在大小类的链表中 */
+} zslab;
+
+/* 对象从 slab 开头之后的这个位置开始存放, 头部占满一个 cache line */
+#define ZSLAB_HEADER_SIZE ZMALLOC_CACHE_LINE
+
+typedef struct zslabClass {
+    pthread_mutex_t lock;
+    zslab *partial;                 /* 还有空闲对象的 slab */
+    zslab *empty;                   /* 保留的一个完全空闲的 slab */
+    size_t slabs;                   /* 这个大小类占用的 slab 数(包括保留的) */
+    size_t allocated;               /* 从 slab 中分配出去的字节数(包括在线程缓存中的) */
+    zslab *defrag_target;           /* 碎片整理时对象被搬到这个 slab 中 */
+} zslabClass;
+
+typedef struct zslabCache {
+    int count;
+    void *objs[ZSLAB_CACHE_MAX];
+} zslabCache;
+
+static const unsigned int zslab_class_size[ZSLAB_CLASSES] = {
+    16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128
+};
+
+static char *zslab_base = NULL;     /* 预留的地址空间, 为 NULL 时没有使用 slab */
+static char *zslab_end = NULL;
+static char *zslab_top = NULL;      /* 从来没有使用过的 slab 从这里开始 */
+static zslab *zslab_released = NULL; /* 内存已经还给操作系统的 slab, 可以被任何大小类重用 */
+static pthread_mutex_t zslab_region_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t zslab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t zslab_thread_key;
+static zslabClass zslab_classes[ZSLAB_CLASSES];
+static __thread zslabCache zslab_caches[ZSLAB_CLASSES];
+static __thread int zslab_thread_registered = 0;
+
+#define zslabOwns(p) ((char*)(p) >= zslab_base && (char*)(p) < zslab_end)
+#define zslabOf(p) ((zslab*)((uintptr_t)(p) & ~((uintptr_t)ZSLAB_SIZE-1)))
+
+static inline int zslabClassIndex(size_t size) {
+    if (size <= 16) return 0;
+    if (size <= 64) return (int)((size+7)>>3) - 2;
+    return 6 + (int)((size-64+15)>>4);
+}
+
+/* fork 的时候别的线程可能正拿着锁, 子进程中就再也没有线程去释放它了 */
+static void zslabAtforkPrepare(void) {
+    int j;
+
+    for (j = 0; j < ZSLAB_CLASSES; j++) pthread_mutex_lock(&zslab_classes[j].lock);
+    pthread_mutex_lock(&zslab_region_lock);
+}
+
+static void zslabAtforkRelease(void) {
+    int j;
+
+    pthread_mutex_unlock(&zslab_region_lock);
+    for (j = ZSLAB_CLASSES-1; j >= 0; j--) pthread_mutex_unlock(&zslab_classes[j].lock);
+}
+
+static void zslabFlush(int cls, int n);
+
+/* 线程退出时把它缓存的对象都还回去 */
+static void zslabThreadExit(void *arg) {
+    int j;
+
+    ((void) arg);
+    for (j = 0; j < ZSLAB_CLASSES; j++)
+        if (zslab_caches[j].count) zslabFlush(j, zslab_caches[j].count);
+}
+
+/*
+ * 线程第一次往缓存中放对象时调用, 保证线程退出时 zslabThreadExit 会被调用.
+ * 只释放不分配的线程也要登记, 否则它缓存的对象永远回不到 slab 中.
+ */
+static inline void zslabRegisterThread(void) {
+    if (!zslab_thread_registered) {
+        pthread_setspecific(zslab_thread_key, (void*)1);
+        zslab_thread_registered = 1;
+    }
+}
+
+static void zslabInit(void) {
+    size_t len;
+    char *p = MAP_FAILED;
+    int j;
+
+    for (j = 0; j < ZSLAB_CLASSES; j++) {
+        pthread_mutex_init(&zslab_classes[j].lock, NULL);
+        zslab_classes[j].partial = NULL;
+        zslab_classes[j].empty = NULL;
+        zslab_classes[j].slabs = 0;
+        zslab_classes[j].allocated = 0;
+        zslab_classes[j].defrag_target = NULL;
+    }
+    pthread_key_create(&zslab_thread_key, zslabThreadExit);
+    pthread_atfork(zslabAtforkPrepare, zslabAtforkRelease, zslabAtforkRelease);
+
+    /* 只占地址空间, 不能访问, zslabCreate 用到哪个 slab 才把它改为可读写 */
+    for (len = ZSLAB_REGION_MAX; len >= ZSLAB_REGION_MIN; len /= 2) {
+        p = mmap(NULL, len + ZSLAB_SIZE, PROT_NONE,
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if (p != MAP_FAILED) break;
+    }
+    if (p == MAP_FAILED) return;
+
+    /* 多预留了一个 slab, 保证对齐之后还有 len 字节 */
+    zslab_top = (char*)(((uintptr_t)p + ZSLAB_SIZE - 1) & ~((uintptr_t)ZSLAB_SIZE-1));
+    zslab_end = zslab_top + len;
+    zslab_base = zslab_top;
+}
+
+/*
+ * 为大小类 cls 取得一个新的 slab, 调用者持有大小类的锁
+ */
+static zslab *zslabCreate(int cls) {
+    zslabClass *c = &zslab_classes[cls];
+    zslab *slab;
+
+    if (c->empty) {
+        slab = c->empty;
+        c->empty = NULL;
+        return slab;
+    }
+
+    pthread_mutex_lock(&zslab_region_lock);
+    if (zslab_released) {
+        slab = zslab_released;
+        zslab_released = slab->next;
+    } else if (zslab_top + ZSLAB_SIZE <= zslab_end &&
+               mprotect(zslab_top, ZSLAB_SIZE, PROT_READ|PROT_WRITE) == 0)
+    {
+        /* 承诺内存不够时 mprotect 失败, 这次分配交给 malloc */
+        slab = (zslab*)zslab_top;
+        zslab_top += ZSLAB_SIZE;
+    } else {
+        slab = NULL;
+    }
+    pthread_mutex_unlock(&zslab_region_lock);
+    if (slab == NULL) return NULL;
+
+    slab->prev = slab->next = NULL;
+    slab->free = NULL;
+    slab->bump = ZSLAB_HEADER_SIZE;
+    slab->used = 0;
+    slab->size = zslab_class_size[cls];
+    slab->cls = cls;
+    slab->listed = 0;
+    c->slabs++;
+    return slab;
+}
+
+static void zslabLink(zslabClass *c, zslab *slab) {
+    slab->prev = NULL;
+    slab->next = c->partial;
+    if (c->partial) c->partial->prev = slab;
+    c->partial = slab;
+    slab->listed = 1;
+}
+
+static void zslabUnlink(zslabClass *c, zslab *slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else c->partial = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->prev = slab->next = NULL;
+    slab->listed = 0;
+}
+
+/*
+ * 从 slab 中取出一个对象, 调用者持有大小类的锁
+ */
+static void *zslabTake(zslabClass *c, zslab *slab) {
+    void *obj;
+
+    if (slab->free) {
+        obj = slab->free;
+        slab->free = *(void**)obj;
+    } else {
+        obj = (char*)slab + slab->bump;
+        slab->bump += slab->size;
+    }
+    slab->used++;
+    c->allocated += slab->size;
+    /* slab 已经满了 */
+    if (slab->free == NULL && slab->bump + slab->size > ZSLAB_SIZE)
+        zslabUnlink(c, slab);
+    return obj;
+}
+
+/*
+ * 把对象还给它所在的 slab, 调用者持有大小类的锁
+ */
+static void zslabPut(zslabClass *c, zslab *slab, void *obj) {
+    *(void**)obj = slab->free;
+    slab->free = obj;
+    slab->used--;
+    c->allocated -= slab->size;
+    if (slab->used == 0) {
+        /* 整个 slab 都空闲了, 保留一个, 其余的还给操作系统 */
+        if (slab->listed) zslabUnlink(c, slab);
+        if (c->empty == NULL) {
+            c->empty = slab;
+            return;
+        }
+        c->slabs--;
+        madvise(slab, ZSLAB_SIZE, MADV_DONTNEED);
+        pthread_mutex_lock(&zslab_region_lock);
+        slab->next = zslab_released;
+        zslab_released = slab;
+        pthread_mutex_unlock(&zslab_region_lock);
+    } else if (!slab->listed) {
+        zslabLink(c, slab);
+    }
+}
+
+/*
+ * 从大小类 cls 中取出一批对象放进当前线程的缓存, 取不到时返回 0
+ */
+static int zslabRefill(int cls) {
+    zslabClass *c = &zslab_classes[cls];
+    zslabCache *cache = &zslab_caches[cls];
+    zslab *slab;
+
+    pthread_once(&zslab_once, zslabInit);
+    if (zslab_base == NULL) return 0;
+    zslabRegisterThread();
+
+    pthread_mutex_lock(&c->lock);
+    while (cache->count < ZSLAB_BATCH) {
+        if ((slab = c->partial) == NULL) {
+            if ((slab = zslabCreate(cls)) == NULL) break;
+            zslabLink(c, slab);
+        }
+        cache->objs[cache->count++] = zslabTake(c, slab);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return cache->count;
+}
+
+/*
+ * 把当前线程缓存中的 n 个对象还给大小类 cls
+ */
+static void zslabFlush(int cls, int n) {
+    zslabClass *c = &zslab_classes[cls];
+    zslabCache *cache = &zslab_caches[cls];
+
+    pthread_mutex_lock(&c->lock);
+    while (n-- && cache->count) {
+        void *obj = cache->objs[--cache->count];
+
+        zslabPut(c, zslabOf(obj), obj);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ * 在大小类的前 ZSLAB_DEFRAG_SCAN 个部分空闲的 slab 中找出最满的一个,
+ * 碎片整理时把稀疏的 slab 中的对象搬到这里
+ */
+static zslab *zslabDefragTarget(zslabClass *c) {
+    zslab *slab, *best = NULL;
+    int j = 0;
+
+    for (slab = c->partial; slab && j < ZSLAB_DEFRAG_SCAN; slab = slab->next, j++)
+        if (best == NULL || slab->used > best->used) best = slab;
+    return best;
+}
+
+static inline void *zslabAlloc(size_t size) {
+    int cls = zslabClassIndex(size);
+    zslabCache *cache = &zslab_caches[cls];
+
+    if (cache->count == 0 && !zslabRefill(cls)) return NULL;
+    update_zmalloc_stat_alloc(zslab_class_size[cls]);
+    return cache->objs[--cache->count];
+}
+
+static inline void zslabFree(void *ptr) {
+    zslab *slab = zslabOf(ptr);
+    zslabCache *cache = &zslab_caches[slab->cls];
+
+    update_zmalloc_stat_free(slab->size);
+    zslabRegisterThread();
+    if (cache->count == ZSLAB_CACHE_MAX) zslabFlush(slab->cls, ZSLAB_BATCH);
+    cache->objs[cache->count++] = ptr;
+}
+
+/*
+ * slab 占用的内存和其中分配出去的字节数
+ */
+static void zslabGetInfo(size_t *allocated, size_t *active) {
+    int j;
+
+    *allocated = *active = 0;
+    for (j = 0; j < ZSLAB_CLASSES; j++) {
+        *allocated += __atomic_load_n(&zslab_classes[j].allocated, __ATOMIC_RELAXED);
+        *active += __atomic_load_n(&zslab_classes[j].slabs, __ATOMIC_RELAXED) * ZSLAB_SIZE;
+    }
+}
+
+/*
+ * 碎片整理: 如果 ptr 所在的 slab 比同一大小类的平均水平稀疏,
+ * 就把它搬到最满的那个 slab 中, 返回新的地址, 旧的地址不能再使用.
+ * 不需要搬动时返回 NULL.
+ *
+ * 对象直接还给它原来的 slab 而不是线程缓存, 这样稀疏的 slab 才能被清空并还给操作系统.
+ */
+static void *zslabDefrag(void *ptr) {
+    zslab *slab = zslabOf(ptr), *target;
+    zslabClass *c = &zslab_classes[slab->cls];
+    void *newptr = NULL;
+
+    pthread_mutex_lock(&c->lock);
+    /* 保留的空 slab 被重用了, 或者已经满了 */
+    target = c->defrag_target;
+    if (target == NULL || !target->listed || target->cls != slab->cls)
+        target = c->defrag_target = zslabDefragTarget(c);
+
+    /* 已经满了的 slab 不在链表中, 不用整理; 只搬动比平均水平更稀疏的 slab 中的对象 */
+    if (target && target != slab && slab->listed &&
+        slab->used < target->used &&
+        (size_t)slab->used * slab->size * c->slabs < c->allocated)
+    {
+        newptr = zslabTake(c, target);
+        memcpy(newptr, ptr, slab->size);
+        zslabPut(c, slab, ptr);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return newptr;
+}
+#endif /* HAVE_ZMALLOC_SLAB */
 
 static void zmalloc_default_oom(size_t size) { // out of memeory
     fprintf(stderr, "zmalloc: Out of memory trying to allocate %zu bytes\n",
@@ -66,69 +470,146 @@ static void zmalloc_default_oom(size_t size) { // out of memeory
 static void (*zmalloc_oom_handler)(size_t) = zmalloc_default_oom;
 
 void *zmalloc(size_t size) {
-    void *ptr = malloc(size+PREFIX_SIZE);
+    void *ptr;
+
+#ifdef HAVE_ZMALLOC_SLAB
+    if (size <= ZSLAB_MAX_SIZE && (ptr = zslabAlloc(size)) != NULL) return ptr;
+#endif
+    ptr = malloc(size+PREFIX_SIZE);
 
     if (!ptr) zmalloc_oom_handler(size); // 如果分配不成功,那么说明内存用尽
 
+#ifdef HAVE_MALLOC_SIZE
+    update_zmalloc_stat_alloc(malloc_usable_size(ptr));
+    return ptr;
+#else
     *((size_t*)ptr) = size;
     update_zmalloc_stat_alloc(size+PREFIX_SIZE);
     return (char*)ptr+PREFIX_SIZE;
+#endif
 }
 
 void *zcalloc(size_t size) {
-    void *ptr = calloc(1, size+PREFIX_SIZE);
+    void *ptr;
+
+#ifdef HAVE_ZMALLOC_SLAB
+    if (size <= ZSLAB_MAX_SIZE && (ptr = zslabAlloc(size)) != NULL) {
+        memset(ptr, 0, size);
+        return ptr;
+    }
+#endif
+    ptr = calloc(1, size+PREFIX_SIZE);
 
     if (!ptr) zmalloc_oom_handler(size);
 
+#ifdef HAVE_MALLOC_SIZE
+    update_zmalloc_stat_alloc(malloc_usable_size(ptr));
+    return ptr;
+#else
     *((size_t*)ptr) = size; // 居然要记录下内存块的大小
     update_zmalloc_stat_alloc(size+PREFIX_SIZE);
     return (char*)ptr+PREFIX_SIZE;
+#endif
 }
 
 void *zrealloc(void *ptr, size_t size) {
+#ifndef HAVE_MALLOC_SIZE
     void *realptr;
-
+#endif
     size_t oldsize;
     void *newptr;
 
     if (ptr == NULL) return zmalloc(size);
 
+#ifdef HAVE_ZMALLOC_SLAB
+    /* slab 中的对象不能原地扩大, 还在同一个大小类中时什么都不用做 */
+    if (zslabOwns(ptr)) {
+        oldsize = zslabOf(ptr)->size;
+        if (size <= ZSLAB_MAX_SIZE && zslab_class_size[zslabClassIndex(size)] == oldsize)
+            return ptr;
+        newptr = zmalloc(size);
+        memcpy(newptr, ptr, oldsize < size ? oldsize : size);
+        zslabFree(ptr);
+        return newptr;
+    }
+#endif
+
+#ifdef HAVE_MALLOC_SIZE
+    oldsize = malloc_usable_size(ptr);
+    newptr = realloc(ptr,size);
+    if (!newptr) zmalloc_oom_handler(size);
+
+    update_zmalloc_stat_free(oldsize);
+    update_zmalloc_stat_alloc(malloc_usable_size(newptr));
+    return newptr;
+#else
     realptr = (char*)ptr-PREFIX_SIZE;
     oldsize = *((size_t*)realptr);
     newptr = realloc(realptr,size+PREFIX_SIZE);
     if (!newptr) zmalloc_oom_handler(size);
 
     *((size_t*)newptr) = size;
-    update_zmalloc_stat_free(oldsize);
-    update_zmalloc_stat_alloc(size);
+    update_zmalloc_stat_free(oldsize+PREFIX_SIZE);
+    update_zmalloc_stat_alloc(size+PREFIX_SIZE);
     return (char*)newptr+PREFIX_SIZE;
+#endif
 }
 
 /* Provide zmalloc_size() for systems where this function is not provided by
  * malloc itself, given that in that case we store a header with this
  * information as the first bytes of every allocation. */
-
 size_t zmalloc_size(void *ptr) {
+#ifdef HAVE_ZMALLOC_SLAB
+    if (zslabOwns(ptr)) return zslabOf(ptr)->size;
+#endif
+#ifdef HAVE_MALLOC_SIZE
+    return malloc_usable_size(ptr);
+#else
     void *realptr = (char*)ptr-PREFIX_SIZE;
     size_t size = *((size_t*)realptr);
     /* Assume at least that all the allocations are padded at sizeof(long) by
      * the underlying allocator. */
     if (size&(sizeof(long)-1)) size += sizeof(long)-(size&(sizeof(long)-1));
     return size+PREFIX_SIZE;
+#endif
 }
 
+/*
+ * 为碎片整理重新分配 ptr, 分配器认为值得搬动时返回新的地址, ptr 随即失效,
+ * 否则返回 NULL, ptr 保持不变. 目前只有 slab 中的对象能提供这样的提示.
+ */
+void *zmalloc_defrag(void *ptr) {
+#ifdef HAVE_ZMALLOC_SLAB
+    if (zslabOwns(ptr)) return zslabDefrag(ptr);
+#endif
+    ((void) ptr);
+    return NULL;
+}
 
 void zfree(void *ptr) {
+#ifndef HAVE_MALLOC_SIZE
     void *realptr;
     size_t oldsize;
+#endif
 
     if (ptr == NULL) return;
 
+#ifdef HAVE_ZMALLOC_SLAB
+    if (zslabOwns(ptr)) {
+        zslabFree(ptr);
+        return;
+    }
+#endif
+
+#ifdef HAVE_MALLOC_SIZE
+    update_zmalloc_stat_free(malloc_usable_size(ptr));
+    free(ptr);
+#else
     realptr = (char*)ptr-PREFIX_SIZE;
     oldsize = *((size_t*)realptr);
     update_zmalloc_stat_free(oldsize+PREFIX_SIZE);
     free(realptr);
-
+#endif
 }
 
 char *zstrdup(const char *s) {
@@ -140,16 +621,17 @@ char *zstrdup(const char *s) {
 }
 
 size_t zmalloc_used_memory(void) {
-    size_t um;
+    size_t um = 0;
+    int j, slots;
 
     if (zmalloc_thread_safe) {
-        pthread_mutex_lock(&used_memory_mutex);
-        um = used_memory;
-        pthread_mutex_unlock(&used_memory_mutex);
-
+        slots = __atomic_load_n(&used_memory_slots, __ATOMIC_RELAXED);
+        if (slots > ZMALLOC_STAT_SLOTS) slots = ZMALLOC_STAT_SLOTS;
+        for (j = 0; j < slots; j++)
+            um += __atomic_load_n(&used_memory[j].used, __ATOMIC_RELAXED);
     }
     else {
-        um = used_memory;
+        um = used_memory[0].used;
     }
 
     return um;
@@ -174,6 +656,43 @@ void zmalloc_set_oom_handler(void (*oom_handler)(size_t)) {
  * version of the function. */
 
 
+#if defined(HAVE_PROC_STAT)
+#include <unistd.h>
+#include <fcntl.h>
+
+size_t zmalloc_get_rss(void) {
+    int page = sysconf(_SC_PAGESIZE);
+    size_t rss;
+    char buf[4096];
+    int fd, count, nread;
+    char *p, *x;
+
+    if ((fd = open("/proc/self/stat",O_RDONLY)) == -1) return 0;
+    if ((nread = read(fd,buf,sizeof(buf)-1)) <= 0) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    buf[nread] = '\0';
+
+    /* 进程名可能包含空格, 从最后一个 ')' 之后开始数,
+     * RSS 是 /proc/<pid>/stat 的第 24 个字段, 也就是 ')' 之后的第 22 个 */
+    p = strrchr(buf,')');
+    count = 22;
+    while(p && count--) {
+        p = strchr(p,' ');
+        if (p) p++;
+    }
+    if (!p) return 0;
+    x = strchr(p,' ');
+    if (!x) return 0;
+    *x = '\0';
+
+    rss = strtoll(p,NULL,10);
+    rss *= page;
+    return rss;
+}
+#else
 size_t zmalloc_get_rss(void) {
     /* If we can't get the RSS in an OS-specific way for this system just
      * return the memory usage we estimated in zmalloc()..
@@ -182,13 +701,413 @@ size_t zmalloc_get_rss(void) {
      * of course... */
     return zmalloc_used_memory();
 }
+#endif
 
 /* Fragmentation = RSS / allocated-bytes */
 float zmalloc_get_fragmentation_ratio(size_t rss) {
     return (float)rss/zmalloc_used_memory();
 }
 
+/*
+ * 取得 slab 的统计信息, 碎片整理只能整理 slab 中的内存, 根据这两个值决定要不要整理
+ */
+int zmalloc_get_slab_info(size_t *allocated, size_t *active) {
+#ifdef HAVE_ZMALLOC_SLAB
+    zslabGetInfo(allocated, active);
+    return 1;
+#else
+    *allocated = *active = 0;
+    return 0;
+#endif
+}
 
+/*
+ * 取得分配器自己的统计信息:
+ * allocated 是分配出去还没有释放的字节数, active 是分配器从系统拿到的字节数,
+ * 两者的差就是分配器内部的碎片和缓存的空闲内存.
+ * 分配器不提供这些信息时返回 0.
+ *
+ * mallinfo2() 会锁住并遍历所有 arena 的空闲链表, 堆越碎开销越大,
+ * 不要在 serverCron 这样的周期性路径上调用.
+ */
+int zmalloc_get_allocator_info(size_t *allocated, size_t *active) {
+    size_t slab_allocated = 0, slab_active = 0;
+
+#ifdef HAVE_ZMALLOC_SLAB
+    zslabGetInfo(&slab_allocated, &slab_active);
+#endif
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+
+    *allocated = mi.uordblks + mi.hblkhd + slab_allocated;
+    *active = mi.arena + mi.hblkhd + slab_active;
+    return 1;
+#else
+    *allocated = slab_allocated;
+    *active = slab_active;
+    return slab_active != 0;
+#endif
+}
+
+#if defined(HAVE_PROC_SMAPS)
+/*
+ * 把 /proc/self/smaps 中所有名为 field 的字段加起来, 返回字节数.
+ * 需要遍历进程的每一个内存映射, 不能在频繁执行的地方调用.
+ */
+size_t zmalloc_get_smap_bytes_by_field(char *field) {
+    char line[1024];
+    size_t bytes = 0;
+    FILE *fp = fopen("/proc/self/smaps","r");
+    int flen = strlen(field);
+
+    if (!fp) return 0;
+    while(fgets(line,sizeof(line),fp) != NULL) {
+        if (strncmp(line,field,flen) == 0) {
+            char *p = strchr(line,'k');
+            if (p) {
+                *p = '\0';
+                bytes += strtol(line+flen,NULL,10) * 1024;
+            }
+        }
+    }
+    fclose(fp);
+    return bytes;
+}
+#else
+size_t zmalloc_get_smap_bytes_by_field(char *field) {
+    ((void) field);
+    return 0;
+}
+#endif
+
+/*
+ * 进程私有的脏页字节数.
+ * 在 fork 出来的子进程中调用时, 就是写时复制(copy-on-write)复制出来的内存.
+ */
 size_t zmalloc_get_private_dirty(void) {
+    return zmalloc_get_smap_bytes_by_field("Private_Dirty:");
+}
+
+#ifdef ZMALLOC_TEST_MAIN
+/*
+ * 测试: make zmalloc-test && ./zmalloc-test
+ * 多线程下分配和释放的吞吐量, 以及 slab 和 malloc 的内存占用: ./zmalloc-test benchmark
+ * 整个服务器的 SET 吞吐量用 redis-benchmark -t set 测量
+ */
+#include <stdio.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+static int failed = 0;
+
+#define test_assert(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond); \
+        failed++; \
+    } \
+} while (0)
+
+static long long testUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* 单线程: 每次分配和释放都按 zmalloc_size 计入 used_memory */
+static void testAccounting(void) {
+    size_t base = zmalloc_used_memory();
+    void *p[100];
+    size_t total = 0;
+    int j;
+
+    for (j = 0; j < 100; j++) {
+        p[j] = zmalloc(j*37+1);
+        total += zmalloc_size(p[j]);
+    }
+    test_assert(zmalloc_used_memory() == base+total);
+
+    // 扩大和缩小, 包括跨过 slab 和 malloc 的边界
+    for (j = 0; j < 100; j++) {
+        total -= zmalloc_size(p[j]);
+        p[j] = zrealloc(p[j], (j%2) ? j*53+200 : 8);
+        total += zmalloc_size(p[j]);
+    }
+    test_assert(zmalloc_used_memory() == base+total);
+
+    for (j = 0; j < 100; j++) zfree(p[j]);
+    test_assert(zmalloc_used_memory() == base);
+}
+
+#ifdef HAVE_ZMALLOC_SLAB
+/* 每个大小都落在 slab 中, 得到的是不小于它的最小大小类 */
+static void testSlabSizeClasses(void) {
+    size_t size;
+
+    for (size = 1; size <= ZSLAB_MAX_SIZE; size++) {
+        void *p = zmalloc(size);
+        int cls = zslabClassIndex(size);
+
+        test_assert(zslabOwns(p));
+        test_assert(zmalloc_size(p) == zslab_class_size[cls]);
+        test_assert(zslab_class_size[cls] >= size);
+        test_assert(cls == 0 || zslab_class_size[cls-1] < size);
+        test_assert(((uintptr_t)p & 7) == 0);
+        memset(p, 0xff, size);
+        zfree(p);
+    }
+
+    // 再大一点就交给 malloc
+    {
+        void *p = zmalloc(ZSLAB_MAX_SIZE+1);
+
+        test_assert(!zslabOwns(p));
+        test_assert(zmalloc_size(p) > ZSLAB_MAX_SIZE);
+        zfree(p);
+    }
+}
+
+#define SLAB_TEST_OBJECTS 200000
+
+static void *slab_objs[SLAB_TEST_OBJECTS];
+
+/* 分配一批对象然后全部释放, 线程退出时缓存中的对象被还回去 */
+static void *slabAllocFreeThread(void *arg) {
+    int j;
+
+    ((void) arg);
+    for (j = 0; j < SLAB_TEST_OBJECTS; j++) slab_objs[j] = zmalloc(24);
+    for (j = 0; j < SLAB_TEST_OBJECTS; j++) zfree(slab_objs[j]);
+    return NULL;
+}
+
+static void *slabAllocThread(void *arg) {
+    int j;
+
+    ((void) arg);
+    for (j = 0; j < SLAB_TEST_OBJECTS; j++) slab_objs[j] = zmalloc(40);
+    return NULL;
+}
+
+/* 只释放不分配, 退出时缓存中的对象也要还回去 */
+static void *slabFreeThread(void *arg) {
+    int j;
+
+    ((void) arg);
+    for (j = 0; j < SLAB_TEST_OBJECTS; j++) zfree(slab_objs[j]);
+    return NULL;
+}
+
+/*
+ * 完全空闲的 slab 还给操作系统, 线程退出时缓存被清空,
+ * 在别的线程中释放的对象也能回到原来的 slab
+ */
+static void testSlabRelease(void) {
+    size_t base_allocated, base_active, allocated, active, rss;
+    pthread_t tid;
+    int j;
+
+    zmalloc_enable_thread_safeness();
+    zslabThreadExit(NULL);
+    zmalloc_get_slab_info(&base_allocated, &base_active);
+
+    pthread_create(&tid, NULL, slabAllocFreeThread, NULL);
+    pthread_join(tid, NULL);
+    zmalloc_get_slab_info(&allocated, &active);
+    test_assert(allocated == base_allocated);
+    test_assert(active <= base_active+ZSLAB_SIZE);
+
+    // 在主线程中分配, 然后全部释放
+    for (j = 0; j < SLAB_TEST_OBJECTS; j++) {
+        slab_objs[j] = zmalloc(56);
+        memset(slab_objs[j], 0, 56);
+    }
+    zmalloc_get_slab_info(&allocated, &active);
+    test_assert(allocated >= base_allocated+(size_t)SLAB_TEST_OBJECTS*56);
+    rss = zmalloc_get_rss();
+    for (j = 0; j < SLAB_TEST_OBJECTS; j++) zfree(slab_objs[j]);
+    zslabThreadExit(NULL);
+    zmalloc_get_slab_info(&allocated, &active);
+    test_assert(allocated == base_allocated);
+    test_assert(active <= base_active+2*ZSLAB_SIZE);
+    test_assert(zmalloc_get_rss()+(size_t)SLAB_TEST_OBJECTS*56/2 < rss);
+
+    // 在另一个线程中分配, 在主线程中释放
+    pthread_create(&tid, NULL, slabAllocThread, NULL);
+    pthread_join(tid, NULL);
+    for (j = 0; j < SLAB_TEST_OBJECTS; j++) zfree(slab_objs[j]);
+    zslabThreadExit(NULL);
+    zmalloc_get_slab_info(&allocated, &active);
+    test_assert(allocated == base_allocated);
+    test_assert(active <= base_active+3*ZSLAB_SIZE);
+
+    // 在另一个线程中分配, 在第三个只释放的线程中释放
+    pthread_create(&tid, NULL, slabAllocThread, NULL);
+    pthread_join(tid, NULL);
+    pthread_create(&tid, NULL, slabFreeThread, NULL);
+    pthread_join(tid, NULL);
+    zmalloc_get_slab_info(&allocated, &active);
+    test_assert(allocated == base_allocated);
+}
+#endif
+
+#define TEST_THREADS 4
+#define TEST_OBJECTS 100000
+
+static void *handoff[TEST_THREADS][TEST_OBJECTS];
+static volatile int bench_stop = 0;
+
+/* 每个线程分配一批对象, 交给下一个线程释放 */
+static void *allocThread(void *arg) {
+    long id = (long)arg;
+    int j;
+
+    for (j = 0; j < TEST_OBJECTS; j++)
+        handoff[id][j] = zmalloc(16+(j%200));
+    return NULL;
+}
+
+static void *freeThread(void *arg) {
+    long id = (long)arg;
+    int j;
+
+    for (j = 0; j < TEST_OBJECTS; j++)
+        zfree(handoff[(id+1)%TEST_THREADS][j]);
+    return NULL;
+}
+
+/*
+ * 多线程: 线程各自计数, 由别的线程释放的内存使单个槽位回绕, 总和仍然正确
+ */
+static void testThreadedAccounting(void) {
+    pthread_t tids[TEST_THREADS];
+    size_t base;
+    long j;
+
+    zmalloc_enable_thread_safeness();
+    base = zmalloc_used_memory();
+    for (j = 0; j < TEST_THREADS; j++) pthread_create(&tids[j], NULL, allocThread, (void*)j);
+    for (j = 0; j < TEST_THREADS; j++) pthread_join(tids[j], NULL);
+    test_assert(zmalloc_used_memory() > base+(size_t)TEST_THREADS*TEST_OBJECTS*16);
+    for (j = 0; j < TEST_THREADS; j++) pthread_create(&tids[j], NULL, freeThread, (void*)j);
+    for (j = 0; j < TEST_THREADS; j++) pthread_join(tids[j], NULL);
+    test_assert(zmalloc_used_memory() == base);
+}
+
+/* 后台线程不停地分配和释放 64 字节, 模拟 bio 和 I/O 线程 */
+static void *backgroundThread(void *arg) {
+    ((void) arg);
+    while (!bench_stop) zfree(zmalloc(64));
+    return NULL;
+}
+
+/*
+ * 主线程混合分配和释放 16 到 271 字节的内存, 同时有 threads 个后台线程
+ */
+static void benchmarkAllocFree(const char *desc, int threads) {
+    static void *slots[1024];
+    pthread_t tids[8];
+    long long start, elapsed;
+    long ops = 20000000, j;
+
+    bench_stop = 0;
+    for (j = 0; j < threads; j++) pthread_create(&tids[j], NULL, backgroundThread, NULL);
+    start = testUstime();
+    for (j = 0; j < ops; j++) {
+        int k = (j*7)%1024;
+
+        if (slots[k]) {
+            zfree(slots[k]);
+            slots[k] = NULL;
+        } else {
+            slots[k] = zmalloc(16+(j%256));
+        }
+    }
+    elapsed = testUstime()-start;
+    bench_stop = 1;
+    for (j = 0; j < threads; j++) pthread_join(tids[j], NULL);
+    for (j = 0; j < 1024; j++) {
+        zfree(slots[j]);
+        slots[j] = NULL;
+    }
+    printf("%-22s %.1f Mops/s\n", desc, (double)ops/elapsed);
+}
+
+#define MEMORY_OBJECTS 5000000
+
+/*
+ * 在子进程中分配 MEMORY_OBJECTS 个 robj, dictEntry 和短 sds 大小的对象, 再随机释放一半,
+ * 比较 slab 和直接用 malloc 时的耗时和 RSS 增量
+ */
+static void benchmarkMemory(const char *desc, int uselibc) {
+    static const size_t sizes[] = {16, 24, 19, 24, 35};
+    pid_t pid;
+
+    fflush(stdout);
+    if ((pid = fork()) == 0) {
+        void **objs = malloc(sizeof(void*)*MEMORY_OBJECTS);
+        size_t rss0 = zmalloc_get_rss(), rss1, rss2;
+        long long start, alloc_time, free_time;
+        unsigned int seed = 1;
+        long j;
+
+        start = testUstime();
+        for (j = 0; j < MEMORY_OBJECTS; j++) {
+            size_t size = sizes[j%5];
+
+            objs[j] = uselibc ? malloc(size) : zmalloc(size);
+            memset(objs[j], 0, size);
+        }
+        alloc_time = testUstime()-start;
+        rss1 = zmalloc_get_rss();
+
+        start = testUstime();
+        for (j = 0; j < MEMORY_OBJECTS; j++) {
+            if (rand_r(&seed) & 1) continue;
+            if (uselibc) free(objs[j]); else zfree(objs[j]);
+        }
+        free_time = testUstime()-start;
+        rss2 = zmalloc_get_rss();
+
+        printf("%-8s alloc %.1f Mops/s, free %.1f Mops/s, rss %zu MB, %zu MB after freeing half\n",
+            desc, (double)MEMORY_OBJECTS/alloc_time, (double)MEMORY_OBJECTS/2/free_time,
+            (rss1-rss0)/(1024*1024), (rss2-rss0)/(1024*1024));
+        exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && !strcasecmp(argv[1], "benchmark")) {
+        benchmarkAllocFree("single-threaded", 0);
+        zmalloc_enable_thread_safeness();
+        benchmarkAllocFree("safe, 0 threads", 0);
+        benchmarkAllocFree("safe, 1 thread", 1);
+        benchmarkAllocFree("safe, 3 threads", 3);
+        benchmarkMemory("slab", 0);
+        benchmarkMemory("malloc", 1);
+        return 0;
+    }
+
+    testAccounting();
+#ifdef HAVE_ZMALLOC_SLAB
+    /* 预留不到地址空间(比如 ulimit -v)时所有的分配都交给 malloc */
+    if (zslab_base) {
+        testSlabSizeClasses();
+        testSlabRelease();
+    } else {
+        printf("slab region unavailable, skipping slab tests\n");
+    }
+#endif
+    testThreadedAccounting();
+
+    if (failed) {
+        printf("%d assertions failed\n", failed);
+        return 1;
+    }
+    printf("all tests passed\n");
     return 0;
 }
+#endif
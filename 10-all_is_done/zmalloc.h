@@ -7,8 +7,14 @@
 #define __xstr(s) __str(s)
 #define __str(s) #s
 
+#include <stdlib.h> /* size_t, 同时让 __GLIBC__ 有定义 */
+
 #ifndef ZMALLOC_LIB
 #define ZMALLOC_LIB "libc"
+#ifdef __GLIBC__
+#include <malloc.h>
+#define HAVE_MALLOC_SIZE 1
+#endif
 #endif
 
 void *zmalloc(size_t size);
@@ -21,7 +27,11 @@ void zmalloc_enable_thread_safeness(void);
 void zmalloc_set_oom_handler(void (*oom_handler)(size_t));
 float zmalloc_get_fragmentation_ratio(size_t rss);
 size_t zmalloc_get_rss(void);
+size_t zmalloc_get_smap_bytes_by_field(char *field);
 size_t zmalloc_get_private_dirty(void);
+int zmalloc_get_allocator_info(size_t *allocated, size_t *active);
+int zmalloc_get_slab_info(size_t *allocated, size_t *active);
+void *zmalloc_defrag(void *ptr);
 void zlibc_free(void *ptr);
 
 size_t zmalloc_size(void *ptr);